@@ -1,8 +1,10 @@
 #include "mex.hpp"
 #include "mexAdapter.hpp"
 #include "details/blockdata.hpp"
+#include "details/expression.hpp"
+#include "details/fixedblockdata.hpp"
+#include "details/pagemtimes.hpp"
 #include "utilities.hpp"
-#include "blas.h"
 #include <span>
 
 
@@ -75,12 +77,18 @@ struct OutputHelper {
 };
 
 struct ChainRule {
-    std::size_t nInputs{2};
-    std::size_t nOutputs{2};
-    utilities::details::BlockData<2, double> inputs_x;
-    utilities::details::BlockData<3, double> inputs_J;
-    utilities::details::BlockData<2, double> outputs_x;
-    utilities::details::BlockData<3, double> outputs_J;
+    static constexpr std::size_t nInputs{2};
+    static constexpr std::size_t nOutputs{2};
+    // The same shapes are needed on every call, so let the pool recycle them.
+    // The leading extents are fixed, only points and directions vary.
+    using Allocator = utilities::details::pool_allocator<double>;
+    static constexpr std::size_t dynamic = utilities::details::dynamic_extent;
+    template <std::size_t... Extents>
+    using Block = utilities::details::FixedBlockData<double, utilities::details::extents<Extents...>, Allocator>;
+    Block<nInputs, dynamic> inputs_x;
+    Block<nInputs, dynamic, dynamic> inputs_J;
+    Block<nOutputs, dynamic> outputs_x;
+    Block<nOutputs, dynamic, dynamic> outputs_J;
 
     InputHelper inputHelper;
     OutputHelper outputHelper;
@@ -90,10 +98,10 @@ struct ChainRule {
     {
         std::size_t nPoints = inputHelper.getNumberOfPoints();
         std::size_t nDirections = inputHelper.getNumberOfPages();
-        inputs_x.resize(nInputs, nPoints);
-        inputs_J.resize(nInputs, nDirections, nPoints);
-        outputs_x.resize(nOutputs, nPoints);
-        outputs_J.resize(nOutputs, nDirections, nPoints);
+        inputs_x.resize(nPoints);
+        inputs_J.resize(nDirections, nPoints);
+        outputs_x.resize(nPoints);
+        outputs_J.resize(nDirections, nPoints);
     }
 
     void mapSingleInput(matlab::data::Array &&x, std::size_t inputIndex) {
@@ -102,24 +110,16 @@ struct ChainRule {
 
         auto dims = x.getDimensions();
         if (x.getType() == matlab::data::ArrayType::DOUBLE) {
-            matlab::data::TypedArray<double> xref = std::move(x);
-            if (dims[1] == 1) {
-                for (std::size_t iDim = 0; iDim < dims[0]; ++iDim) {
-                    std::fill(inputs_x.row(inputIndex).begin(), inputs_x.row(inputIndex).end(), xref[iDim]);
-                }                
-            } else {
-                utilities::details::BlockData<2, double> input_bd(std::move(x));
-                for (std::size_t iDim = 0; iDim < dims[0]; ++iDim) {
-                    std::copy(input_bd.row(iDim).begin(), input_bd.row(iDim).end(), inputs_x.row(inputIndex+iDim).begin());
-                }
-            }
+            // A single point is expanded to all of them.
+            utilities::details::BlockData<2, double> input_bd(std::move(x));
+            utilities::details::assign(inputs_x.view().subview<0>(inputIndex, dims[0]), input_bd);
         } else if (x.getType() == matlab::data::ArrayType::COMPLEX_DOUBLE) {
             utilities::details::BlockData<3, std::complex<double>> input_bd(std::move(x));
             std::size_t nDir = dims.size() > 2 ? dims[2] : 1;
             for (std::size_t iRow = 0; iRow < dims[0]; ++iRow) {
-                std::transform(input_bd.row(iRow).begin(), input_bd.row(iRow).end(), inputs_x.row(inputIndex + iRow).begin(), [](const std::complex<double>& val) { return val.real(); });
+                utilities::details::assign(inputs_x.row(inputIndex + iRow), real(input_bd.row(iRow)));
                 for (std::size_t iDir = 0; iDir < nDir; ++iDir) {
-                    std::transform(input_bd.page(iDir).row(iRow).begin(), input_bd.page(iDir).row(iRow).end(), inputs_J.tensorial(inputIndex + iRow, iDir).begin(), [](const std::complex<double>& val) { return val.imag() * 1e100; });
+                    utilities::details::assign(inputs_J.tensorial(inputIndex + iRow, iDir), imag(input_bd.page(iDir).row(iRow)) * 1e100);
                 }
             }
         } else {
@@ -141,22 +141,13 @@ struct ChainRule {
     }
 
     void singleModelCallMockup(std::span<double> y, std::span<double> J, std::size_t iPoint) {
-        std::size_t nPoints{ getNumberOfPoints() };
-        std::size_t nPages{ getNumberOfDirections() };
+        std::size_t nDirections{ getNumberOfDirections() };
 
-        const char transa = 'N';
-        const char transb = 'N';
-        ptrdiff_t m = nOutputs;
-        ptrdiff_t k = nPages;
-        ptrdiff_t n = nInputs;
-        ptrdiff_t lda = nOutputs;
-        ptrdiff_t ldb = nInputs;
-        double alpha = 1.0;
-        double beta = 0.0;
-        
-        dgemm(&transa, &transb, &m, &n, &k, &alpha, 
-                J.data(), &lda, inputs_J.page(iPoint).data(), &ldb, &beta,
-                outputs_J.page(iPoint).data(), &lda);
+        // outputs_J(:,:,iPoint) = J * inputs_J(:,:,iPoint)
+        utilities::details::pagemtimes(
+            J.data(), {nOutputs, nInputs, 1}, utilities::details::Transpose::none,
+            inputs_J.page(iPoint).data(), {nInputs, nDirections, 1}, utilities::details::Transpose::none,
+            outputs_J.page(iPoint).data());
 
         std::copy_n(y.begin(), nOutputs, outputs_x.column(iPoint).begin());
         
@@ -167,14 +158,11 @@ struct ChainRule {
 		std::size_t nPoints = getNumberOfPoints();
         std::size_t nDirections = getNumberOfDirections();
         
-        matlab::data::buffer_ptr_t<std::complex<double>> retval = f.createBuffer<std::complex<double>>(getNumberOfPoints() * getNumberOfDirections());
+        utilities::details::BlockData<3, std::complex<double>> retval(f, { 1, nPoints, nDirections });
         for (std::size_t iDirection = 0; iDirection < nDirections; ++iDirection) {
-            std::transform(outputs_x.row(idx).begin(), outputs_x.row(idx).end(), outputs_J.tensorial(idx, iDirection).begin(), retval.get() + iDirection * nPoints, 
-            [](const double& val, const double& j_val) {
-                    return std::complex<double>(val, j_val * 1e-100);
-                });
+            utilities::details::assign(retval.page(iDirection), complex(outputs_x.row(idx), outputs_J.tensorial(idx, iDirection) * 1e-100));
 		}
-		return f.createArrayFromBuffer<std::complex<double>>({ 1, nPoints, nDirections }, std::move(retval));
+		return retval.release();
     }
 
     matlab::data::StructArray getNested() {
@@ -215,13 +203,17 @@ public:
         matlab::data::buffer_ptr_t<double> y_ptr = yref.release();
         matlab::data::buffer_ptr_t<double> J_ptr = J.release();
 
-         for (std::size_t iPoint = 0; iPoint < nPoints; ++iPoint) {
-             // Map the outputs
-             chainRule.singleModelCallMockup(
-                 std::span<double>(y_ptr.get(), 2),
-                 std::span<double>(J_ptr.get(), 4),
-                 iPoint);
-         }
+        // Points are independent; the mockup only touches plain buffers, so it
+        // is safe to run on the pool.
+        utilities::details::parallel_for(0, nPoints, [&](std::size_t first, std::size_t last) {
+            for (std::size_t iPoint = first; iPoint < last; ++iPoint) {
+                // Map the outputs
+                chainRule.singleModelCallMockup(
+                    std::span<double>(y_ptr.get(), 2),
+                    std::span<double>(J_ptr.get(), 4),
+                    iPoint);
+            }
+        });
 
         // chainRule.singleModelCallMockup(
         //      chainRule.inputs_x.column(0),
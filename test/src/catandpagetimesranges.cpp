@@ -60,10 +60,12 @@ struct OutputHelper {
 struct ChainRule {
     std::size_t nInputs{2};
     std::size_t nOutputs{2};
-    utilities::details::BlockDataV<2, double> inputs_x;
-    utilities::details::BlockDataV<3, double> inputs_J;
-    utilities::details::BlockDataV<2, double> outputs_x;
-    utilities::details::BlockDataV<3, double> outputs_J;
+    // The same shapes are needed on every call, so let the pool recycle them.
+    using Allocator = utilities::details::pool_allocator<double>;
+    utilities::details::BlockDataV<2, double, Allocator> inputs_x;
+    utilities::details::BlockDataV<3, double, Allocator> inputs_J;
+    utilities::details::BlockDataV<2, double, Allocator> outputs_x;
+    utilities::details::BlockDataV<3, double, Allocator> outputs_J;
 
     InputHelper inputHelper;
     OutputHelper outputHelper;
@@ -164,21 +166,20 @@ struct ChainRule {
 		std::size_t nPoints = getNumberOfPoints();
         std::size_t nDirections = getNumberOfDirections();
         
-        matlab::data::buffer_ptr_t<std::complex<double>> retval = f.createBuffer<std::complex<double>>(getNumberOfPoints() * getNumberOfDirections());
-        std::span<std::complex<double>> retval_span(retval.get(), nPoints * nDirections);
+        utilities::details::BlockDataV<3, std::complex<double>> retval(f, { 1, nPoints, nDirections });
         auto outputRow = outputs_x.all() | outputs_x.row(idx);
         for (std::size_t iDirection = 0; iDirection < nDirections; ++iDirection) {
             auto outputJac = outputs_J.all() | outputs_J.tensorial(idx, iDirection);
-            auto targetRow = retval_span | std::views::drop(iDirection * nPoints) | std::views::take(nPoints);
+            auto targetPage = retval.all() | retval.page(iDirection);
             std::transform( std::ranges::begin(outputRow), 
                             std::ranges::end(outputRow), 
                             std::ranges::begin(outputJac), 
-                            std::ranges::begin(targetRow), 
+                            std::ranges::begin(targetPage), 
                             [](const double& val, const double& j_val) {
                                 return std::complex<double>(val, j_val * 1e-100);
                             });
 		}
-		return f.createArrayFromBuffer<std::complex<double>>({ 1, nPoints, nDirections }, std::move(retval));
+		return retval.release();
     }
 
     matlab::data::StructArray getNested() {
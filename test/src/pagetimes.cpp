@@ -1,7 +1,7 @@
 #include "mex.hpp"
 #include "mexAdapter.hpp"
 #include "utilities.hpp"
-#include "blas.h"
+#include "details/pagemtimes.hpp"
 
 class MexFunction 
     : public matlab::mex::Function 
@@ -23,61 +23,27 @@ public:
 
         auto Asz = A.getDimensions();
         auto Bsz = B.getDimensions();
-
-        if (Asz[1] != Bsz[0]) {
-            utilities::error("Matrix dimensions must agree.\n");
-        }
-        auto aIsPaged = Asz.size() > 2 && Asz[2] > 1;
-        auto bIsPaged = Bsz.size() > 2 && Bsz[2] > 1;
-        std::size_t nPages{1};
-        
-        if (aIsPaged && bIsPaged) {
-            if (Asz[2] != Bsz[2]) {
-                utilities::error("Number of pages must agree.\n");
-            }
-        }
-        if (aIsPaged) {
-            nPages = Asz[2];
-        } else if (bIsPaged) {
-            nPages = Bsz[2];
+        if (Asz.size() > 3 || Bsz.size() > 3) {
+            utilities::error("Only three dimensional arrays are supported.\n");
         }
-        matlab::data::ArrayFactory factory;
-        matlab::data::buffer_ptr_t<double> C_ptr = factory.createBuffer<double>(Asz[0]*Bsz[1]*nPages);
-        matlab::data::buffer_ptr_t<double> A_ptr = A.release();
-        matlab::data::buffer_ptr_t<double> B_ptr = B.release();
+        std::array<std::size_t, 3> aDims{1, 1, 1};
+        std::array<std::size_t, 3> bDims{1, 1, 1};
+        std::copy(Asz.begin(), Asz.end(), aDims.begin());
+        std::copy(Bsz.begin(), Bsz.end(), bDims.begin());
 
-        const char transa = 'N';
-        const char transb = 'N';
-        ptrdiff_t m = Asz[0];
-        ptrdiff_t k = Asz[1];
-        ptrdiff_t n = Bsz[1];
-        ptrdiff_t lda = Asz[0];
-        ptrdiff_t ldb = Bsz[0];
-        double alpha = 1.0;
-        double beta = 0.0;
-        if (aIsPaged && bIsPaged) {
-            for (std::size_t iPage = 0; iPage < nPages; ++iPage)
-                dgemm(&transa, &transb, &m, &n, &k, &alpha, 
-                      A_ptr.get() + iPage*m*k, &lda, B_ptr.get() + iPage*n*k, &ldb, &beta,
-                      C_ptr.get() + iPage*m*n, &lda);
-        }
-        else if (aIsPaged) {
-            for (std::size_t iPage = 0; iPage < nPages; iPage++) 
-                dgemm(&transa, &transb, &m, &n, &k, &alpha, 
-                      A_ptr.get() + iPage*m*k, &lda, B_ptr.get(), &ldb, &beta,
-                      C_ptr.get() + iPage*m*n, &lda);
-        } else if (bIsPaged) {
-            for (std::size_t iPage = 0; iPage < nPages; iPage++) 
-                dgemm(&transa, &transb, &m, &n, &k, &alpha, 
-                      A_ptr.get(), &lda, B_ptr.get() + iPage*n*k, &ldb, &beta,
-                      C_ptr.get() + iPage*m*n, &lda);
-        } else {
-            
-            dgemm(&transa, &transb, &m, &n, &k, &alpha, 
-                  A_ptr.get(), &lda, B_ptr.get(), &ldb, &beta,
-                  C_ptr.get(), &lda);
+        std::array<std::size_t, 3> cDims{};
+        try {
+            cDims = utilities::details::pagemtimesDims(aDims, utilities::details::Transpose::none, bDims, utilities::details::Transpose::none);
+        } catch (const std::invalid_argument& e) {
+            utilities::error("{}.\n", e.what());
         }
 
-        outputs[0] = factory.createArrayFromBuffer<double>({Asz[0], Bsz[1], nPages}, std::move(C_ptr));
+        utilities::details::BlockData<3, double> A_bd(std::move(A));
+        utilities::details::BlockData<3, double> B_bd(std::move(B));
+        matlab::data::ArrayFactory factory;
+        utilities::details::BlockData<3, double> C_bd(factory, cDims);
+        utilities::details::pagemtimes(A_bd, utilities::details::Transpose::none, B_bd, utilities::details::Transpose::none, C_bd);
+
+        outputs[0] = C_bd.release();
     }
 };
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "mex.hpp"
 #include "mexAdapter.hpp"
 #include "utilities.hpp"
+#include "details/stridedview.hpp"
 #include <numeric>
 #include <ranges>
 #include <array>
@@ -17,25 +18,26 @@ namespace ranges {
 auto row = [](const std::vector<std::size_t>& dims, std::size_t rowIndex) {
     assert(dims.size() >= 2 && "Dimensions must have at least 2 elements for row access");
     assert(rowIndex < dims[0] && "Row index out of bounds");
-    return std::views::drop(rowIndex) | std::views::stride(dims[0]) | std::views::take(dims[1]);
+    return utilities::details::views::strided(rowIndex, dims[0], dims[1]);
 };
 
 auto page = [](const std::vector<std::size_t>& dims, std::size_t pageIndex) {
     assert(dims.size() >= 3 && "Dimensions must have at least 3 elements for page access");
     assert(pageIndex < dims[2] && "Page index out of bounds");
-    return std::views::drop(pageIndex * dims[0] * dims[1]) | std::views::take(dims[0] * dims[1]);
+    return utilities::details::views::slice(pageIndex * dims[0] * dims[1], dims[0] * dims[1]);
 };
 
 auto col = [](const std::vector<std::size_t>& dims, std::size_t colIndex) {
     assert(dims.size() >= 2 && "Dimensions must have at least 2 elements for column access");
     assert(colIndex < dims[1] && "Column index out of bounds");
-    return std::views::drop(colIndex * dims[0]) | std::views::take(dims[0]);
+    return utilities::details::views::slice(colIndex * dims[0], dims[0]);
 };
 
 auto tensorial = [](const std::vector<std::size_t>& dims, std::size_t iRow, std::size_t jCol) {
     assert(dims.size() >= 3 && "Dimensions must have at least 3 elements for tensorial access");
     assert(iRow < dims[0] && "Row index out of bounds");
-    return std::views::drop(iRow) | std::views::stride(dims[0]*dims[1]) | std::views::take(dims[2]);
+    assert(jCol < dims[1] && "Column index out of bounds");
+    return utilities::details::views::strided(iRow + jCol * dims[0], dims[0] * dims[1], dims[2]);
 };
 } // namespace ranges
 
@@ -1,5 +1,10 @@
 #include <gtest/gtest.h>
 #include "details/blockdata.hpp"
+#include "details/fixedblockdata.hpp"
+#include "details/chunkedblockdata.hpp"
+#include "timing.hpp"
+#include <thread>
+#include <memory_resource>
 
 TEST(BlockDataTest, SingleDimension)
 {
@@ -78,7 +83,63 @@ TEST(BlockDataTest, Transpose)
                            { return offset++; });
         }
     }
-    
+
+    bd3.transpose();
+
+    EXPECT_EQ(bd3.nRows(), nCols);
+    EXPECT_EQ(bd3.nCols(), nRows);
+    EXPECT_EQ(bd3.nPages(), nPages);
+    for (std::size_t kPage = 0; kPage < nPages; ++kPage)
+    {
+        for (std::size_t iCol = 0; iCol < nRows; ++iCol)
+        {
+            for (std::size_t iRow = 0; iRow < nCols; ++iRow)
+            {
+                EXPECT_EQ(bd3(iRow, iCol, kPage), iCol + iRow * nRows + kPage * nRows * nCols);
+            }
+        }
+    }
+}
+
+namespace {
+
+// The element by element transpose BlockData used to do, kept as reference.
+template <typename T>
+void naiveTranspose(const T* in, std::size_t nRows, std::size_t nCols, T* out)
+{
+    for (std::size_t jCol = 0; jCol < nCols; ++jCol)
+    {
+        for (std::size_t iRow = 0; iRow < nRows; ++iRow)
+        {
+            out[jCol + iRow * nCols] = in[iRow + jCol * nRows];
+        }
+    }
+}
+
+} // namespace
+
+TEST(BlockDataTest, TransposeTiles)
+{
+    // Shapes around the tile sizes, and degenerate ones.
+    for (auto [nRows, nCols] : std::vector<std::pair<std::size_t, std::size_t>>{{67, 129}, {32, 32}, {8, 40}, {1, 1000}, {1000, 1}, {0, 5}, {33, 7}})
+    {
+        utilities::details::BlockData<2, double> bd(nRows, nCols);
+        std::iota(bd.begin(), bd.end(), 0.);
+        std::vector<double> expected(bd.size());
+        naiveTranspose(bd.data(), nRows, nCols, expected.data());
+        bd.transpose();
+        EXPECT_EQ(bd.nRows(), nCols);
+        EXPECT_EQ(bd.nCols(), nRows);
+        EXPECT_TRUE(std::equal(bd.begin(), bd.end(), expected.begin())) << nRows << " x " << nCols;
+    }
+
+    utilities::details::BlockData<4, float> bd4({9, 13, 3, 2});
+    std::iota(bd4.begin(), bd4.end(), 0.f);
+    auto original = bd4;
+    bd4.transpose();
+    EXPECT_EQ(bd4.view().extent(0), 13);
+    EXPECT_EQ(bd4.view().extent(1), 9);
+    EXPECT_EQ(bd4(12, 8, 2, 1), original(8, 12, 2, 1));
 }
 
 // template<typename T>
@@ -152,4 +213,843 @@ TEST(BlockDataVTest, InitialFillTest) {
         EXPECT_EQ(bd(0, 0, iPage), 3.0);
         EXPECT_EQ(bd(1, 1, iPage), 4.0);
     }
-}
\ No newline at end of file
+}
+
+namespace {
+std::size_t releasedBuffers = 0;
+
+utilities::details::buffer_ptr_t<double> makeBuffer(std::size_t nElements) {
+    return {new double[nElements], [](void *ptr) {
+                ++releasedBuffers;
+                delete[] static_cast<double *>(ptr);
+            }};
+}
+} // namespace
+
+TEST(BlockDataTest, AdoptBuffer)
+{
+    constexpr std::size_t nRows = 3;
+    constexpr std::size_t nCols = 4;
+    constexpr std::size_t nPages = 2;
+    releasedBuffers = 0;
+    {
+        auto buffer = makeBuffer(nRows * nCols * nPages);
+        double *raw = buffer.get();
+        std::iota(raw, raw + nRows * nCols * nPages, 0.);
+
+        utilities::details::BlockData<3, double> bd({nRows, nCols, nPages}, std::move(buffer));
+        EXPECT_TRUE(bd.adopted());
+        EXPECT_EQ(bd.data(), raw);
+        EXPECT_EQ(bd.size(), nRows * nCols * nPages);
+        EXPECT_EQ(bd(1, 2, 1), 1. + 2. * nRows + nRows * nCols);
+
+        std::vector<double> row(bd.page(1).row(2).begin(), bd.page(1).row(2).end());
+        ASSERT_EQ(row.size(), nCols);
+        for (std::size_t jCol = 0; jCol < nCols; ++jCol) {
+            EXPECT_EQ(row[jCol], bd(2, jCol, 1));
+        }
+        std::vector<double> fibre(bd.tensorial(1, 3).begin(), bd.tensorial(1, 3).end());
+        ASSERT_EQ(fibre.size(), nPages);
+        EXPECT_EQ(fibre[1], bd(1, 3, 1));
+
+        utilities::details::BlockData<3, double> copy(bd);
+        EXPECT_FALSE(copy.adopted());
+        EXPECT_NE(copy.data(), raw);
+        EXPECT_EQ(copy(1, 2, 1), bd(1, 2, 1));
+
+        utilities::details::BlockData<3, double> moved(std::move(bd));
+        EXPECT_TRUE(moved.adopted());
+        EXPECT_EQ(moved.data(), raw);
+        EXPECT_EQ(std::distance(moved.page(1).begin(), moved.page(1).end()), static_cast<std::ptrdiff_t>(nRows * nCols));
+        EXPECT_EQ(releasedBuffers, 0);
+    }
+    EXPECT_EQ(releasedBuffers, 1);
+}
+
+TEST(BlockDataTest, AdoptColumnVector)
+{
+    // A MATLAB [n,1] array: its trailing singleton folds into BlockData<1>.
+    constexpr std::size_t n = 5;
+    releasedBuffers = 0;
+    {
+        const std::vector<std::size_t> matlabDims{n, 1};
+        auto buffer = makeBuffer(n);
+        double *raw = buffer.get();
+        std::iota(raw, raw + n, 0.);
+        utilities::details::BlockData<1, double> bd(utilities::details::foldDimensions<1>(matlabDims), std::move(buffer));
+        EXPECT_EQ(bd.dims(), (std::array<std::size_t, 1>{n}));
+        EXPECT_EQ(bd.data(), raw);
+        EXPECT_EQ(bd.size(), n);
+    }
+    EXPECT_EQ(releasedBuffers, 1);
+    EXPECT_EQ(utilities::details::foldDimensions<3>(std::vector<std::size_t>{2, 3}), (std::array<std::size_t, 3>{2, 3, 1}));
+    EXPECT_THROW(utilities::details::foldDimensions<1>(std::vector<std::size_t>{n, 2}), std::invalid_argument);
+}
+
+TEST(BlockDataTest, AdoptedResizeAndRelease)
+{
+    releasedBuffers = 0;
+    utilities::details::BlockData<2, double> bd({2, 3}, makeBuffer(6));
+    std::iota(bd.begin(), bd.end(), 0.);
+
+    bd.resize(2, 3);
+    EXPECT_TRUE(bd.adopted());
+
+    bd.resize(2, 4);
+    EXPECT_FALSE(bd.adopted());
+    EXPECT_EQ(releasedBuffers, 1);
+    EXPECT_EQ(bd(1, 2), 5.);
+
+    utilities::details::BlockDataV<2, double> bdv({2, 3}, makeBuffer(6));
+    EXPECT_TRUE(bdv.adopted());
+    bdv(1, 1) = 4.;
+    EXPECT_EQ(bdv(1, 1), 4.);
+}
+
+TEST(BlockDataTest, BufferOrigin)
+{
+    // Only a MATLAB buffer may go back to MATLAB as it is; the origin moves
+    // with the buffer and is gone once the elements leave it.
+    using utilities::details::BufferOrigin;
+    using utilities::details::Storage;
+    releasedBuffers = 0;
+    Storage<double> external(makeBuffer(4), 4);
+    EXPECT_EQ(external.origin(), BufferOrigin::external);
+    Storage<double> matlab(makeBuffer(4), 4, BufferOrigin::matlab);
+    Storage<double> moved(std::move(matlab));
+    EXPECT_EQ(moved.origin(), BufferOrigin::matlab);
+    EXPECT_EQ(matlab.origin(), BufferOrigin::external);
+    EXPECT_EQ(Storage<double>(moved).origin(), BufferOrigin::external);
+    moved.resize(5);
+    EXPECT_EQ(moved.origin(), BufferOrigin::external);
+
+    // clear() frees without handing anything out.
+    external.clear();
+    EXPECT_TRUE(external.empty());
+    EXPECT_FALSE(external.adopted());
+    EXPECT_EQ(releasedBuffers, 2);
+    moved.clear();
+    EXPECT_EQ(moved.data(), nullptr);
+}
+
+TEST(BlockDataBenchmark, AdoptVersusCopy)
+{
+    constexpr std::size_t nRows = 16;
+    constexpr std::size_t nCols = 16;
+    constexpr std::size_t nPages = 4096;
+    constexpr std::size_t nElements = nRows * nCols * nPages;
+    std::vector<double> source(nElements, 1.);
+
+    double copySeconds = timing::best(5, [&]() {
+        utilities::details::BlockData<3, double> bd(nRows, nCols, nPages);
+        std::copy(source.begin(), source.end(), bd.begin());
+        EXPECT_EQ(bd(0, 0, nPages - 1), 1.);
+    });
+    double adoptSeconds = timing::best(5, [&]() {
+        utilities::details::BlockData<3, double> bd({nRows, nCols, nPages}, makeBuffer(nElements));
+        EXPECT_TRUE(bd.adopted());
+    });
+    timing::report("BlockData copy construction", copySeconds, sizeof(double) * nElements);
+    timing::report("BlockData buffer adoption", adoptSeconds, sizeof(double) * nElements);
+}
+
+TEST(BlockDataTest, ReleaseOutputBuffer)
+{
+    releasedBuffers = 0;
+    auto buffer = makeBuffer(2 * 3 * 4);
+    double *raw = buffer.get();
+    utilities::details::BlockData<3, double> out({2, 3, 4}, std::move(buffer));
+    for (std::size_t kPage = 0; kPage < out.nPages(); ++kPage) {
+        std::fill(out.page(kPage).begin(), out.page(kPage).end(), static_cast<double>(kPage));
+    }
+
+    auto released = out.releaseBuffer();
+    EXPECT_EQ(released.get(), raw);
+    EXPECT_EQ(out.size(), 0);
+    EXPECT_FALSE(out.adopted());
+    EXPECT_EQ(raw[2 * 3 * 3], 3.);
+    EXPECT_EQ(releasedBuffers, 0);
+
+    utilities::details::BlockData<2, double> owned(2, 2);
+    std::fill(owned.begin(), owned.end(), 7.);
+    auto copied = owned.releaseBuffer();
+    EXPECT_EQ(copied[3], 7.);
+    EXPECT_EQ(owned.size(), 0);
+}
+
+TEST(BlockViewTest, SlicesAreIndependentValues)
+{
+    constexpr std::size_t nRows = 3;
+    constexpr std::size_t nCols = 4;
+    constexpr std::size_t nPages = 5;
+    utilities::details::BlockData<3, double> bd(nRows, nCols, nPages);
+    std::iota(bd.begin(), bd.end(), 0.);
+
+    auto page = bd.page(2);
+    auto row0 = page.row(0);
+    auto row2 = page.row(2);
+    auto col1 = page.column(1);
+    EXPECT_EQ(row0.size(), nCols);
+    EXPECT_EQ(col1.size(), nRows);
+    for (std::size_t jCol = 0; jCol < nCols; ++jCol) {
+        EXPECT_EQ(row0[jCol], bd(0, jCol, 2));
+        EXPECT_EQ(row2[jCol], bd(2, jCol, 2));
+    }
+    EXPECT_EQ(col1[2], bd(2, 1, 2));
+    EXPECT_EQ(page(1, 3), bd(1, 3, 2));
+    EXPECT_TRUE(page.is_contiguous());
+    EXPECT_FALSE(row0.is_contiguous());
+
+    auto fibre = bd.tensorial(1, 2);
+    ASSERT_EQ(fibre.size(), nPages);
+    EXPECT_EQ(fibre.stride(0), nRows * nCols);
+    for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+        EXPECT_EQ(fibre[kPage], bd(1, 2, kPage));
+    }
+
+    auto middle = bd.view().subview<2>(1, 3);
+    EXPECT_EQ(middle.extent(2), 3);
+    EXPECT_EQ(middle(0, 0, 0), bd(0, 0, 1));
+    auto rows = bd.view().slice<0>(1);
+    EXPECT_EQ(rows(2, 4), bd(1, 2, 4));
+
+    const auto &cbd = bd;
+    utilities::details::BlockView<1, const double> constRow = cbd.page(2).row(2);
+    EXPECT_EQ(constRow[3], row2[3]);
+
+    EXPECT_THROW(bd.page(nPages), std::out_of_range);
+    EXPECT_THROW(page.row(nRows), std::out_of_range);
+    EXPECT_THROW(bd.tensorial(nRows, 0), std::out_of_range);
+}
+
+TEST(BlockViewTest, RowsFromSeveralThreads)
+{
+    constexpr std::size_t nRows = 8;
+    constexpr std::size_t nCols = 1000;
+    utilities::details::BlockData<2, double> bd(nRows, nCols);
+
+    std::vector<std::thread> workers;
+    for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
+        workers.emplace_back([&bd, iRow]() {
+            auto row = bd.row(iRow);
+            std::fill(row.begin(), row.end(), static_cast<double>(iRow));
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
+        for (std::size_t jCol = 0; jCol < nCols; ++jCol) {
+            ASSERT_EQ(bd(iRow, jCol), static_cast<double>(iRow));
+        }
+    }
+}
+
+TEST(BlockViewTest, IteratorCategories)
+{
+    using utilities::details::BlockData;
+    using ColumnView = decltype(std::declval<BlockData<2, double> &>().column(0));
+    using PageView = decltype(std::declval<BlockData<3, double> &>().page(0));
+    using RowView = decltype(std::declval<BlockData<2, double> &>().row(0));
+    using FibreView = decltype(std::declval<const BlockData<3, double> &>().tensorial(0, 0));
+
+    static_assert(std::contiguous_iterator<BlockData<3, double>::iterator>);
+    static_assert(std::ranges::contiguous_range<ColumnView>);
+    static_assert(std::ranges::contiguous_range<PageView>);
+    static_assert(std::ranges::random_access_range<RowView>);
+    static_assert(std::ranges::sized_range<RowView>);
+    static_assert(std::random_access_iterator<FibreView::iterator>);
+    static_assert(std::ranges::view<FibreView>);
+
+    BlockData<2, double> bd(4, 5);
+    std::iota(bd.begin(), bd.end(), 0.);
+    auto row = bd.row(1);
+    auto it = row.begin();
+    EXPECT_EQ(row.end() - it, 5);
+    EXPECT_EQ(*(it + 2), bd(1, 2));
+    EXPECT_EQ(it[3], bd(1, 3));
+    EXPECT_EQ(*(it++), bd(1, 0));
+    EXPECT_EQ(*it, bd(1, 1));
+    EXPECT_TRUE(it < row.end());
+    EXPECT_EQ(*std::prev(row.end()), bd(1, 4));
+
+    std::vector<double> reversed(row.size());
+    std::reverse_copy(row.begin(), row.end(), reversed.begin());
+    EXPECT_EQ(reversed.front(), bd(1, 4));
+    EXPECT_TRUE(std::is_sorted(row.begin(), row.end()));
+}
+
+TEST(BlockDataBenchmark, SliceCopyAndTransform)
+{
+    using utilities::details::StridedIterator;
+    constexpr std::size_t nRows = 64;
+    constexpr std::size_t nCols = 64;
+    constexpr std::size_t nPages = 64;
+    constexpr double bytes = sizeof(double) * nRows * nCols * nPages;
+    utilities::details::BlockData<3, double> source(nRows, nCols, nPages);
+    utilities::details::BlockData<3, double> target(nRows, nCols, nPages);
+    std::iota(source.begin(), source.end(), 0.);
+    auto scale = [](double val) { return 2. * val; };
+
+    double seconds = timing::best(10, [&]() { std::copy(source.begin(), source.end(), target.begin()); });
+    timing::report("copy whole array", seconds, bytes);
+    seconds = timing::best(10, [&]() { std::transform(source.begin(), source.end(), target.begin(), scale); });
+    timing::report("transform whole array", seconds, bytes);
+
+    seconds = timing::best(10, [&]() {
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            auto in = source.page(kPage);
+            std::copy(in.begin(), in.end(), target.page(kPage).begin());
+        }
+    });
+    timing::report("copy pages", seconds, bytes);
+    seconds = timing::best(10, [&]() {
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            auto in = source.page(kPage);
+            std::transform(in.begin(), in.end(), target.page(kPage).begin(), scale);
+        }
+    });
+    timing::report("transform pages", seconds, bytes);
+
+    seconds = timing::best(10, [&]() {
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            for (std::size_t jCol = 0; jCol < nCols; ++jCol) {
+                auto in = source.page(kPage).column(jCol);
+                std::copy(in.begin(), in.end(), target.page(kPage).column(jCol).begin());
+            }
+        }
+    });
+    timing::report("copy columns", seconds, bytes);
+    seconds = timing::best(10, [&]() {
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            for (std::size_t jCol = 0; jCol < nCols; ++jCol) {
+                auto in = source.page(kPage).column(jCol);
+                StridedIterator<double> first(in.data()), last(in.data(), 1, static_cast<std::ptrdiff_t>(in.size()));
+                std::copy(first, last, StridedIterator<double>(target.page(kPage).column(jCol).data()));
+            }
+        }
+    });
+    timing::report("copy columns (strided iterator)", seconds, bytes);
+    seconds = timing::best(10, [&]() {
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            for (std::size_t jCol = 0; jCol < nCols; ++jCol) {
+                auto in = source.page(kPage).column(jCol);
+                std::transform(in.begin(), in.end(), target.page(kPage).column(jCol).begin(), scale);
+            }
+        }
+    });
+    timing::report("transform columns", seconds, bytes);
+
+    seconds = timing::best(10, [&]() {
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
+                auto in = source.page(kPage).row(iRow);
+                std::copy(in.begin(), in.end(), target.page(kPage).row(iRow).begin());
+            }
+        }
+    });
+    timing::report("copy rows", seconds, bytes);
+    seconds = timing::best(10, [&]() {
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
+                auto in = source.page(kPage).row(iRow);
+                std::transform(in.begin(), in.end(), target.page(kPage).row(iRow).begin(), scale);
+            }
+        }
+    });
+    timing::report("transform rows", seconds, bytes);
+
+    seconds = timing::best(10, [&]() {
+        for (std::size_t jCol = 0; jCol < nCols; ++jCol) {
+            for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
+                auto in = source.tensorial(iRow, jCol);
+                std::copy(in.begin(), in.end(), target.tensorial(iRow, jCol).begin());
+            }
+        }
+    });
+    timing::report("copy tensorial fibres", seconds, bytes);
+    seconds = timing::best(10, [&]() {
+        for (std::size_t jCol = 0; jCol < nCols; ++jCol) {
+            for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
+                auto in = source.tensorial(iRow, jCol);
+                std::transform(in.begin(), in.end(), target.tensorial(iRow, jCol).begin(), scale);
+            }
+        }
+    });
+    timing::report("transform tensorial fibres", seconds, bytes);
+
+    EXPECT_EQ(target(3, 2, 1), scale(source(3, 2, 1)));
+}
+
+TEST(BlockDataTest, AlignedStorage)
+{
+    utilities::details::BlockData<3, double> bd(3, 5, 7);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(bd.data()) % utilities::details::simd_alignment, 0);
+    bd.resize(9, 9, 9);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(bd.data()) % utilities::details::simd_alignment, 0);
+    utilities::details::BlockDataV<2, float> bdv(3, 3);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(&bdv(0, 0)) % utilities::details::simd_alignment, 0);
+}
+
+TEST(BlockDataTest, PooledStorageSteadyState)
+{
+    using Allocator = utilities::details::pool_allocator<double>;
+    utilities::details::BufferPool pool;
+    Allocator allocator(pool);
+
+    auto call = [&allocator](std::size_t nPoints) {
+        utilities::details::BlockData<2, double, Allocator> inputs_x(allocator);
+        utilities::details::BlockData<3, double, Allocator> inputs_J(allocator);
+        utilities::details::BlockData<3, double, Allocator> outputs_J(allocator);
+        inputs_x.resize(2, nPoints);
+        inputs_J.resize(2, 3, nPoints);
+        outputs_J.resize(2, 3, nPoints);
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(outputs_J.data()) % utilities::details::simd_alignment, 0);
+        utilities::details::BlockData<3, double, Allocator> copy(outputs_J);
+        EXPECT_EQ(copy.size(), outputs_J.size());
+    };
+
+    call(1000);
+    std::size_t warmedUp = pool.upstreamAllocations();
+    EXPECT_GT(warmedUp, 0);
+    for (std::size_t iCall = 0; iCall < 10; ++iCall) {
+        call(1000);
+        call(900);
+    }
+    EXPECT_EQ(pool.upstreamAllocations(), warmedUp);
+    EXPECT_GT(pool.cachedBytes(), 0);
+    pool.trim();
+    EXPECT_EQ(pool.cachedBytes(), 0);
+}
+
+TEST(BlockDataTest, PoolLimits)
+{
+    utilities::details::BufferPool pool(1024, 4096);
+    void* large = pool.allocate(1025);
+    EXPECT_EQ(pool.upstreamAllocations(), 1);
+    pool.deallocate(large, 1025);
+    EXPECT_EQ(pool.cachedBytes(), 0);
+
+    std::array<void*, 5> blocks;
+    for (void*& block : blocks) {
+        block = pool.allocate(1000);
+    }
+    for (void* block : blocks) {
+        pool.deallocate(block, 1000);
+    }
+    EXPECT_EQ(pool.cachedBytes(), 4096);
+    pool.trim();
+}
+
+TEST(BlockDataTest, PolymorphicAllocator)
+{
+    std::array<std::byte, 4096> arena;
+    std::pmr::monotonic_buffer_resource resource(arena.data(), arena.size(), std::pmr::null_memory_resource());
+    using Allocator = std::pmr::polymorphic_allocator<double>;
+    utilities::details::BlockData<2, double, Allocator> bd({4, 4}, Allocator(&resource));
+    std::iota(bd.begin(), bd.end(), 0.);
+    EXPECT_GE(reinterpret_cast<std::byte *>(bd.data()), arena.data());
+    EXPECT_LT(reinterpret_cast<std::byte *>(bd.data()), arena.data() + arena.size());
+
+    utilities::details::BlockData<2, double, Allocator> other;
+    other = std::move(bd);
+    EXPECT_EQ(other(3, 3), 15.);
+}
+
+TEST(FixedBlockDataTest, StaticExtentsAreInline)
+{
+    using Jacobian = utilities::details::FixedBlockData<double, utilities::details::extents<2, 2>>;
+    static_assert(Jacobian::is_static);
+    static_assert(sizeof(Jacobian) == 4 * sizeof(double));
+    static_assert(Jacobian::rank() == 2);
+
+    Jacobian J;
+    EXPECT_EQ(J.size(), 4);
+    EXPECT_EQ(J.nRows(), 2);
+    EXPECT_EQ(J.nCols(), 2);
+    for (double val : J) {
+        EXPECT_EQ(val, 0.);
+    }
+    J(0, 0) = 1.;
+    J(1, 0) = 2.;
+    J(0, 1) = 3.;
+    J(1, 1) = 4.;
+    EXPECT_EQ(J.data()[2], 3.);
+    EXPECT_EQ(J.at(1, 1), 4.);
+    EXPECT_THROW(J.at(2, 0), std::out_of_range);
+    EXPECT_EQ(*J.row(1).begin(), 2.);
+    EXPECT_EQ(*(J.column(1).begin() + 1), 4.);
+}
+
+TEST(FixedBlockDataTest, MixedExtents)
+{
+    constexpr auto dynamic = utilities::details::dynamic_extent;
+    using Extents = utilities::details::extents<2, dynamic, dynamic>;
+    static_assert(Extents::rank_dynamic() == 2);
+    static_assert(Extents::static_extent(0) == 2);
+
+    utilities::details::FixedBlockData<double, Extents> bd(3, 5);
+    static_assert(!decltype(bd)::is_static);
+    EXPECT_EQ(bd.size(), 2 * 3 * 5);
+    EXPECT_EQ(bd.nCols(), 3);
+    EXPECT_EQ(bd.nPages(), 5);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(bd.data()) % utilities::details::simd_alignment, 0);
+    std::iota(bd.begin(), bd.end(), 0.);
+    EXPECT_EQ(bd(1, 2, 3), 1 + 2 * 2 + 3 * 6);
+    EXPECT_EQ(bd.page(3).data(), &bd(0, 0, 3));
+
+    auto fibre = bd.tensorial(1, 2);
+    EXPECT_EQ(std::ranges::distance(fibre), 5);
+    EXPECT_EQ(fibre[4], bd(1, 2, 4));
+
+    bd.resize(4, 2);
+    EXPECT_EQ(bd.size(), 2 * 4 * 2);
+    EXPECT_EQ(bd.extent(1), 4);
+    EXPECT_THROW(bd.at(0, 4, 0), std::out_of_range);
+}
+
+TEST(BlockDataTest, HigherRank)
+{
+    utilities::details::BlockData<4, double> bd({2, 3, 4, 5});
+    EXPECT_EQ(bd.size(), 2 * 3 * 4 * 5);
+    std::iota(bd.begin(), bd.end(), 0.);
+    EXPECT_EQ(bd(1, 2, 3, 4), 1 + 2 * 2 + 3 * 6 + 4 * 24);
+    EXPECT_THROW(bd(0, 3, 0, 0), std::out_of_range);
+    EXPECT_EQ(bd.view().slice<3>(4)(1, 2, 3), bd(1, 2, 3, 4));
+
+    bd.resize({5, 4, 3, 2});
+    EXPECT_EQ(bd.view().extent(0), 5);
+    EXPECT_EQ(bd.size(), 120);
+
+    utilities::details::FixedBlockData<double, utilities::details::extents<2, 2, 2, 2, 2>> tensor;
+    tensor(1, 1, 1, 1, 1) = 1.;
+    EXPECT_EQ(tensor.data()[31], 1.);
+}
+
+TEST(BlockDataBenchmark, Transpose)
+{
+    for (auto [nRows, nCols, nPages] : std::vector<std::array<std::size_t, 3>>{{2048, 2048, 1}, {16, 262144, 1}, {262144, 16, 1}, {64, 64, 1024}})
+    {
+        utilities::details::BlockData<3, double> bd(nRows, nCols, nPages);
+        std::iota(bd.begin(), bd.end(), 0.);
+        std::vector<double> out(bd.size());
+        const double bytes = 2. * bd.size() * sizeof(double);
+
+        double naive = timing::best(5, [&]() {
+            for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+                naiveTranspose(bd.data() + kPage * nRows * nCols, nRows, nCols, out.data() + kPage * nRows * nCols);
+            }
+        });
+        double tiled = timing::best(5, [&]() {
+            utilities::details::pageTranspose(bd.data(), nRows, nCols, nPages, out.data());
+        });
+        std::string label = std::to_string(nRows) + "x" + std::to_string(nCols) + "x" + std::to_string(nPages);
+        timing::report("naive transpose " + label, naive, bytes);
+        timing::report("tiled transpose " + label, tiled, bytes);
+    }
+}
+
+TEST(BlockDataTest, Permute)
+{
+    for (auto dims : std::vector<std::array<std::size_t, 4>>{{5, 7, 2, 3}, {3, 1, 4, 5}, {40, 3, 37, 2}})
+    {
+        utilities::details::BlockData<4, double> original(dims);
+        std::iota(original.begin(), original.end(), 0.);
+        std::array<std::size_t, 4> order{0, 1, 2, 3};
+        do
+        {
+            auto bd = original;
+            bd.permute(order);
+            auto view = bd.view();
+            for (std::size_t k = 0; k < 4; ++k)
+            {
+                ASSERT_EQ(view.extent(k), dims[order[k]]);
+            }
+            std::array<std::size_t, 4> index{};
+            for (index[3] = 0; index[3] < dims[3]; ++index[3])
+                for (index[2] = 0; index[2] < dims[2]; ++index[2])
+                    for (index[1] = 0; index[1] < dims[1]; ++index[1])
+                        for (index[0] = 0; index[0] < dims[0]; ++index[0])
+                        {
+                            ASSERT_EQ(view(index[order[0]], index[order[1]], index[order[2]], index[order[3]]),
+                                      original(index[0], index[1], index[2], index[3]));
+                        }
+        } while (std::next_permutation(order.begin(), order.end()));
+    }
+
+    utilities::details::BlockData<3, double> bd(2, 3, 4);
+    std::iota(bd.begin(), bd.end(), 0.);
+    auto fibre = bd.tensorial(1, 2);
+    std::vector<double> expected(fibre.begin(), fibre.end());
+    bd.permute({2, 1, 0});
+    EXPECT_EQ(bd.nRows(), 4);
+    EXPECT_EQ(bd.nPages(), 2);
+    EXPECT_TRUE(std::ranges::equal(bd.page(1).column(2), expected));
+    EXPECT_THROW(bd.permute({0, 0, 1}), std::invalid_argument);
+    EXPECT_THROW(bd.permute({0, 1, 3}), std::invalid_argument);
+
+    utilities::details::BlockDataV<3, double> bdv(2, 3, 4);
+    std::iota(bdv.all().begin(), bdv.all().end(), 0.);
+    bdv.permute({1, 2, 0});
+    EXPECT_EQ(bdv.nRows(), 3);
+    EXPECT_EQ(bdv.nCols(), 4);
+    EXPECT_EQ(bdv.nPages(), 2);
+    EXPECT_EQ(bdv(2, 3, 1), 1 + 2 * 2 + 3 * 6);
+}
+
+TEST(BlockDataBenchmark, PermuteVersusTensorial)
+{
+    // Layout of ChainRule::outputs_J: outputs x directions x points.
+    const std::size_t nOutputs = 2;
+    const std::size_t nDirections = 8;
+    const std::size_t nPoints = 200000;
+    utilities::details::BlockData<3, double> bd(nOutputs, nDirections, nPoints);
+    std::iota(bd.begin(), bd.end(), 0.);
+    std::vector<double> out(nPoints);
+    const double bytes = 2. * bd.size() * sizeof(double);
+
+    double tensorial = timing::best(5, [&]() {
+        for (std::size_t iOutput = 0; iOutput < nOutputs; ++iOutput) {
+            for (std::size_t iDirection = 0; iDirection < nDirections; ++iDirection) {
+                auto fibre = bd.tensorial(iOutput, iDirection);
+                std::transform(fibre.begin(), fibre.end(), out.begin(), [](double val) { return val * 1e-100; });
+            }
+        }
+    });
+    double permuted = timing::best(5, [&]() {
+        auto directionMajor = bd;
+        directionMajor.permute({2, 1, 0});
+        for (std::size_t iOutput = 0; iOutput < nOutputs; ++iOutput) {
+            for (std::size_t iDirection = 0; iDirection < nDirections; ++iDirection) {
+                auto fibre = directionMajor.page(iOutput).column(iDirection);
+                std::transform(fibre.begin(), fibre.end(), out.begin(), [](double val) { return val * 1e-100; });
+            }
+        }
+    });
+    utilities::details::BlockData<3, double> target(nPoints, nDirections, nOutputs);
+    double permuteOnly = timing::best(5, [&]() {
+        utilities::details::permute(bd.data(), std::array<std::size_t, 3>{nOutputs, nDirections, nPoints}, {2, 1, 0}, target.data());
+    });
+    timing::report("tensorial fibres 2x8x200000", tensorial, bytes);
+    timing::report("copy + permute + columns", permuted, bytes);
+    timing::report("permute {2, 1, 0}", permuteOnly, bytes);
+}
+
+TEST(BlockDataTest, Layouts)
+{
+    using namespace utilities::details;
+    BlockData<3, double> reference(37, 45, 3);
+    std::iota(reference.begin(), reference.end(), 0.);
+
+    BlockData<3, double, aligned_allocator<double>, layout_direction_major> directionMajor(reference);
+    BlockData<3, double, aligned_allocator<double>, layout_tiled<8>> tiled(reference);
+    for (std::size_t k = 0; k < 3; ++k) {
+        for (std::size_t j = 0; j < 45; ++j) {
+            for (std::size_t i = 0; i < 37; ++i) {
+                ASSERT_EQ(directionMajor(i, j, k), reference(i, j, k));
+                ASSERT_EQ(tiled(i, j, k), reference(i, j, k));
+            }
+        }
+    }
+    // Tensorial fibres are contiguous in direction major order.
+    EXPECT_EQ(directionMajor.data()[1], reference(0, 0, 1));
+    EXPECT_EQ(directionMajor.tensorial(4, 5).stride(0), 1);
+    EXPECT_TRUE(std::ranges::equal(directionMajor.tensorial(4, 5), reference.tensorial(4, 5)));
+    EXPECT_TRUE(std::ranges::equal(tiled.tensorial(4, 5), reference.tensorial(4, 5)));
+
+    // The view API is the same in every layout.
+    EXPECT_TRUE(std::ranges::equal(directionMajor.column(44), reference.column(44)));
+    EXPECT_TRUE(std::ranges::equal(tiled.column(44), reference.column(44)));
+    EXPECT_TRUE(std::ranges::equal(tiled.row(36), reference.row(36)));
+    EXPECT_EQ(tiled.page(2)(36, 44), reference(36, 44, 2));
+    EXPECT_EQ(directionMajor.page(2)(36, 44), reference(36, 44, 2));
+    EXPECT_EQ(tiled.view().extents(), reference.view().extents());
+
+    // Tiles are packed, the last row and column of them cut to size.
+    auto edge = tiled.tile(4, 5, 1);
+    EXPECT_EQ(edge.extent(0), 5);
+    EXPECT_EQ(edge.extent(1), 5);
+    EXPECT_EQ(edge(4, 4), reference(36, 44, 1));
+    EXPECT_EQ(tiled.tile(1, 2, 2)(3, 7), reference(11, 23, 2));
+    EXPECT_THROW(tiled.tile(5, 0), std::out_of_range);
+    EXPECT_THROW(tiled(37, 0, 0), std::out_of_range);
+
+    // Back to MATLAB's order, from either layout.
+    BlockData<3, double> fromDirectionMajor(directionMajor);
+    BlockData<3, double> fromTiled(tiled);
+    EXPECT_TRUE(std::ranges::equal(fromDirectionMajor, reference));
+    EXPECT_TRUE(std::ranges::equal(fromTiled, reference));
+    BlockData<3, double, aligned_allocator<double>, layout_tiled<8>> tiledAgain(directionMajor);
+    EXPECT_TRUE(std::ranges::equal(tiledAgain, tiled));
+}
+
+TEST(BlockDataTest, LayoutsOfHigherRank)
+{
+    using namespace utilities::details;
+    BlockData<4, double> reference({5, 6, 3, 2});
+    std::iota(reference.begin(), reference.end(), 0.);
+    BlockData<4, double, aligned_allocator<double>, layout_direction_major> directionMajor(reference);
+    BlockData<4, double, aligned_allocator<double>, layout_tiled<4>> tiled(reference);
+    EXPECT_EQ(directionMajor(4, 5, 2, 1), reference(4, 5, 2, 1));
+    EXPECT_EQ(directionMajor(1, 2, 0, 1), reference.data()[1 + 2 * 5 + 1 * 90]);
+    EXPECT_EQ(tiled(4, 5, 2, 1), reference(4, 5, 2, 1));
+    EXPECT_EQ(tiled.tile(1, 1, 5)(0, 1), reference(4, 5, 2, 1));
+    EXPECT_TRUE(std::ranges::equal(BlockData<4, double>(tiled), reference));
+    EXPECT_TRUE(std::ranges::equal(BlockData<4, double>(directionMajor), reference));
+}
+
+TEST(BlockDataBenchmark, Layouts)
+{
+    // Scale every tensorial fibre of outputs x directions x points, the inner
+    // loop of the chain rule, in MATLAB's and in direction major order.
+    using namespace utilities::details;
+    const std::size_t nOutputs = 2;
+    const std::size_t nDirections = 8;
+    const std::size_t nPoints = 200000;
+    BlockData<3, double> columnMajor(nOutputs, nDirections, nPoints);
+    std::iota(columnMajor.begin(), columnMajor.end(), 0.);
+    BlockData<3, double, aligned_allocator<double>, layout_direction_major> directionMajor(columnMajor);
+    const double bytes = 2. * columnMajor.size() * sizeof(double);
+    auto scaleFibres = [&](auto& block) {
+        for (std::size_t iOutput = 0; iOutput < nOutputs; ++iOutput) {
+            for (std::size_t iDirection = 0; iDirection < nDirections; ++iDirection) {
+                auto fibre = block.tensorial(iOutput, iDirection);
+                std::ranges::transform(fibre, fibre.begin(), [](double val) { return val * 0.5; });
+            }
+        }
+    };
+    double columnMajorFibres = timing::best(5, [&]() { scaleFibres(columnMajor); });
+    double directionMajorFibres = timing::best(5, [&]() { scaleFibres(directionMajor); });
+    double conversion = timing::best(5, [&]() { BlockData<3, double> back(directionMajor); });
+    timing::report("tensorial fibres, layout_left", columnMajorFibres, bytes);
+    timing::report("tensorial fibres, direction major", directionMajorFibres, bytes);
+    timing::report("direction major to layout_left", conversion, bytes);
+
+    // Conversion to a tiled layout against a plain copy.
+    BlockData<2, double> matrix(2048, 2048);
+    std::iota(matrix.begin(), matrix.end(), 0.);
+    BlockData<2, double, aligned_allocator<double>, layout_tiled<32>> tiled(matrix);
+    double tileConversion = timing::best(5, [&]() { relayout(matrix.data(), matrix.mapping(), tiled.data(), tiled.mapping()); });
+    double copy = timing::best(5, [&]() { std::copy(matrix.begin(), matrix.end(), tiled.begin()); });
+    timing::report("layout_left to tiled 2048x2048", tileConversion, 2. * matrix.size() * sizeof(double));
+    timing::report("plain copy 2048x2048", copy, 2. * matrix.size() * sizeof(double));
+}
+
+TEST(BlockDataTest, AppendPages)
+{
+    using namespace utilities::details;
+    BlockData<3, double> bd(2, 3, 0);
+    EXPECT_EQ(bd.size(), 0);
+    std::size_t reallocations = 0;
+    const double* data = nullptr;
+    for (std::size_t kPage = 0; kPage < 100; ++kPage) {
+        auto page = bd.append();
+        EXPECT_EQ(page.extents(), (std::array<std::size_t, 3>{2, 3, 1}));
+        std::fill(page.begin(), page.end(), static_cast<double>(kPage));
+        if (bd.data() != data) {
+            ++reallocations;
+            data = bd.data();
+        }
+    }
+    EXPECT_EQ(bd.dims(), (std::array<std::size_t, 3>{2, 3, 100}));
+    EXPECT_LE(reallocations, 8);
+    EXPECT_GE(bd.capacity(), 100);
+    for (std::size_t kPage = 0; kPage < 100; ++kPage) {
+        EXPECT_EQ(bd(1, 2, kPage), static_cast<double>(kPage));
+    }
+
+    auto two = bd.append(2);
+    EXPECT_EQ(two.extent(2), 2);
+    EXPECT_EQ(bd(0, 0, 101), 0.);
+    bd.shrink_to_fit();
+    EXPECT_EQ(bd.capacity(), 102);
+
+    // Adopted buffers move into owned storage on the first append.
+    releasedBuffers = 0;
+    BlockData<2, double> adopted({2, 3}, makeBuffer(6));
+    std::iota(adopted.begin(), adopted.end(), 0.);
+    adopted.reserve(10);
+    EXPECT_FALSE(adopted.adopted());
+    EXPECT_EQ(releasedBuffers, 1);
+    EXPECT_GE(adopted.capacity(), 10);
+    adopted.append()(0, 0) = 6.;
+    EXPECT_EQ(adopted(0, 3), 6.);
+    EXPECT_EQ(adopted(1, 2), 5.);
+
+    BlockData<1, int> values(0);
+    for (int i = 0; i < 10; ++i) {
+        values.append()[0] = i;
+    }
+    EXPECT_EQ(values[9], 9);
+}
+
+TEST(ChunkedBlockDataTest, PagesStayInPlace)
+{
+    using namespace utilities::details;
+    ChunkedBlockData<3, double> chunked({2, 3}, 4);
+    EXPECT_EQ(chunked.pagesPerChunk(), 4);
+    std::vector<const double*> pages;
+    for (std::size_t kPage = 0; kPage < 10; ++kPage) {
+        auto page = chunked.append();
+        std::iota(page.begin(), page.end(), 6. * kPage);
+        pages.push_back(page.data());
+    }
+    EXPECT_EQ(chunked.dims(), (std::array<std::size_t, 3>{2, 3, 10}));
+    for (std::size_t kPage = 0; kPage < 10; ++kPage) {
+        EXPECT_EQ(chunked.page(kPage).data(), pages[kPage]);
+    }
+    EXPECT_EQ(chunked(1, 2, 9), 59.);
+    EXPECT_THROW(chunked.page(10), std::out_of_range);
+    EXPECT_THROW(chunked(2, 0, 0), std::out_of_range);
+
+    auto bd = chunked.toBlockData();
+    EXPECT_EQ(bd.dims(), chunked.dims());
+    std::vector<double> expected(60);
+    std::iota(expected.begin(), expected.end(), 0.);
+    EXPECT_TRUE(std::ranges::equal(bd, expected));
+
+    chunked.clear();
+    EXPECT_EQ(chunked.nPages(), 0);
+    EXPECT_EQ(chunked.toBlockData().size(), 0);
+    EXPECT_EQ((ChunkedBlockData<2, double>({1024}).pagesPerChunk()), (ChunkedBlockData<2, double>::defaultChunkBytes / 8192));
+}
+
+TEST(BlockDataBenchmark, AccumulatePages)
+{
+    // Accumulate an unknown number of 16 x 16 pages and hand them out as one
+    // contiguous block.
+    using namespace utilities::details;
+    const std::size_t nRows = 16;
+    const std::size_t nCols = 16;
+    const std::size_t nPages = 2048;
+    const double bytes = static_cast<double>(nRows * nCols * nPages * sizeof(double));
+    auto fill = [](auto page, std::size_t kPage) { std::fill(page.begin(), page.end(), static_cast<double>(kPage)); };
+
+    double resizeEach = timing::best(3, [&]() {
+        BlockData<3, double> bd(nRows, nCols, 0);
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            // A fresh vector per size, as resize on adopted output buffers does.
+            BlockData<3, double> grown(nRows, nCols, kPage + 1);
+            std::copy(bd.begin(), bd.end(), grown.begin());
+            bd = std::move(grown);
+            fill(bd.page(kPage), kPage);
+        }
+    });
+    double append = timing::best(3, [&]() {
+        BlockData<3, double> bd(nRows, nCols, 0);
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            fill(bd.append(), kPage);
+        }
+    });
+    double chunked = timing::best(3, [&]() {
+        ChunkedBlockData<3, double> cbd({nRows, nCols});
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            fill(cbd.append(), kPage);
+        }
+        auto bd = cbd.toBlockData();
+        EXPECT_EQ(bd(0, 0, nPages - 1), static_cast<double>(nPages - 1));
+    });
+    timing::report("grow by copying every page", resizeEach, bytes);
+    timing::report("BlockData::append", append, bytes);
+    timing::report("ChunkedBlockData, then contiguous", chunked, bytes);
+}
@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#include "details/convert.hpp"
+#include "timing.hpp"
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+using utilities::details::Conversion;
+using utilities::details::Overflow;
+using utilities::details::Rounding;
+using utilities::details::convert;
+
+namespace {
+
+template <typename Target, typename Source>
+std::vector<Target> converted(const std::vector<Source>& in, Conversion conversion = {}) {
+    std::vector<Target> out(in.size());
+    convert(in.data(), in.size(), out.data(), conversion);
+    return out;
+}
+
+} // namespace
+
+TEST(ConvertTest, FloatingToInteger)
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const double inf = std::numeric_limits<double>::infinity();
+    const std::vector<double> x{2.5, -2.5, 2.49, -0.5, 0.4, 300., -300., nan, inf, -inf, 126.7};
+
+    // MATLAB: half away from zero, saturated, NaN is 0.
+    EXPECT_EQ(converted<std::int8_t>(x), (std::vector<std::int8_t>{3, -3, 2, -1, 0, 127, -128, 0, 127, -128, 127}));
+    EXPECT_EQ(converted<std::uint8_t>(x), (std::vector<std::uint8_t>{3, 0, 2, 0, 0, 255, 0, 0, 255, 0, 127}));
+    EXPECT_EQ(converted<std::int8_t>(x, {Rounding::toward_zero}), (std::vector<std::int8_t>{2, -2, 2, 0, 0, 127, -128, 0, 127, -128, 126}));
+
+    EXPECT_EQ(converted<std::int32_t>(std::vector<double>{2147483646.6, 2147483647., 3e9, -2147483648.4, -3e9}),
+              (std::vector<std::int32_t>{2147483647, 2147483647, 2147483647, -2147483647 - 1, -2147483647 - 1}));
+    const auto int64Max = std::numeric_limits<std::int64_t>::max();
+    EXPECT_EQ(converted<std::int64_t>(std::vector<double>{9.3e18, -9.3e18, 4611686018427387904.}),
+              (std::vector<std::int64_t>{int64Max, -int64Max - 1, 4611686018427387904}));
+    EXPECT_EQ(converted<std::uint64_t>(std::vector<float>{1.9e19f, -1.f, 0.5f}),
+              (std::vector<std::uint64_t>{std::numeric_limits<std::uint64_t>::max(), 0, 1}));
+
+    const Conversion checked{Rounding::nearest, Overflow::error};
+    EXPECT_EQ(converted<std::int16_t>(std::vector<double>{-32768., 32767., 1.5}, checked), (std::vector<std::int16_t>{-32768, 32767, 2}));
+    EXPECT_THROW(converted<std::int16_t>(std::vector<double>{32768.}, checked), std::out_of_range);
+    EXPECT_THROW(converted<std::int16_t>(std::vector<double>{nan}, checked), std::out_of_range);
+}
+
+TEST(ConvertTest, IntegerAndLogical)
+{
+    const std::vector<std::int32_t> x{-70000, -1, 0, 1, 70000};
+    EXPECT_EQ(converted<std::int16_t>(x), (std::vector<std::int16_t>{-32768, -1, 0, 1, 32767}));
+    EXPECT_EQ(converted<std::uint16_t>(x), (std::vector<std::uint16_t>{0, 0, 0, 1, 65535}));
+    EXPECT_EQ(converted<std::int64_t>(x), (std::vector<std::int64_t>{-70000, -1, 0, 1, 70000}));
+    EXPECT_EQ(converted<double>(x), (std::vector<double>{-70000., -1., 0., 1., 70000.}));
+    EXPECT_EQ(converted<std::int32_t>(std::vector<std::uint64_t>{std::numeric_limits<std::uint64_t>::max(), 5}),
+              (std::vector<std::int32_t>{std::numeric_limits<std::int32_t>::max(), 5}));
+    EXPECT_THROW(converted<std::uint8_t>(x, {Rounding::nearest, Overflow::error}), std::out_of_range);
+
+    EXPECT_EQ(converted<float>(std::vector<std::uint8_t>{255, 0}), (std::vector<float>{255.f, 0.f}));
+    const bool logical[] = {true, false, true};
+    std::vector<float> out(3);
+    convert(logical, 3, out.data());
+    EXPECT_EQ(out, (std::vector<float>{1.f, 0.f, 1.f}));
+    const double values[] = {0., -2., 0.5, std::nan("")};
+    bool asLogical[4];
+    convert(values, 4, asLogical);
+    EXPECT_FALSE(asLogical[0]);
+    EXPECT_TRUE(asLogical[1] && asLogical[2]);
+    EXPECT_FALSE(asLogical[3]);
+}
+
+TEST(ConvertTest, Complex)
+{
+    EXPECT_EQ(converted<std::complex<double>>(std::vector<float>{1.f, -2.f}),
+              (std::vector<std::complex<double>>{{1., 0.}, {-2., 0.}}));
+    EXPECT_EQ(converted<std::complex<float>>(std::vector<std::complex<double>>{{1., -1.}}),
+              (std::vector<std::complex<float>>{{1.f, -1.f}}));
+    EXPECT_EQ(converted<std::complex<double>>(std::vector<std::int16_t>{-3}), (std::vector<std::complex<double>>{{-3., 0.}}));
+}
+
+TEST(ConvertTest, Parallel)
+{
+    const std::size_t n = utilities::details::convertParallelLimit * 3 + 17;
+    std::vector<double> x(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        x[i] = static_cast<double>(i % 1000) - 499.5;
+    }
+    auto y = converted<std::int16_t>(x);
+    for (std::size_t i = 0; i < n; i += 997) {
+        EXPECT_EQ(y[i], static_cast<std::int16_t>(std::round(x[i])));
+    }
+    x[n - 1] = 1e6;
+    EXPECT_THROW(converted<std::int16_t>(x, {Rounding::nearest, Overflow::error}), std::out_of_range);
+}
+
+TEST(ConvertBenchmark, SinglePassVersusScalar)
+{
+    // 2^24 elements: the MATLAB way is a conversion into a temporary double
+    // array, then a copy into the BlockData.
+    const std::size_t n = std::size_t{1} << 24;
+    std::vector<float> singles(n);
+    std::vector<double> doubles(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        singles[i] = static_cast<float>(i % 4096) * 0.25f - 512.f;
+        doubles[i] = static_cast<double>(singles[i]) * 100.;
+    }
+    std::vector<double> temporary(n);
+    std::vector<double> outDouble(n);
+    std::vector<std::int32_t> outInt(n);
+
+    double twoPass = timing::best(5, [&]() {
+        std::copy(singles.begin(), singles.end(), temporary.begin());
+        std::copy(temporary.begin(), temporary.end(), outDouble.begin());
+    });
+    double onePass = timing::best(5, [&]() { convert(singles.data(), n, outDouble.data()); });
+    double scalarRound = timing::best(5, [&]() {
+        for (std::size_t i = 0; i < n; ++i) {
+            const double x = doubles[i];
+            outInt[i] = std::isnan(x) ? 0 : static_cast<std::int32_t>(std::clamp(std::round(x), -2147483648., 2147483647.));
+        }
+    });
+    double vectorRound = timing::best(5, [&]() { convert(doubles.data(), n, outInt.data()); });
+    timing::report("single -> double, via temporary", twoPass, static_cast<double>(n * (sizeof(float) + sizeof(double))));
+    timing::report("single -> double, one pass", onePass, static_cast<double>(n * (sizeof(float) + sizeof(double))));
+    timing::report("double -> int32, std::round", scalarRound, static_cast<double>(n * (sizeof(double) + sizeof(std::int32_t))));
+    timing::report("double -> int32, convert", vectorRound, static_cast<double>(n * (sizeof(double) + sizeof(std::int32_t))));
+    EXPECT_EQ(outInt[4097], static_cast<std::int32_t>(std::round(doubles[4097])));
+}
@@ -0,0 +1,265 @@
+#include <gtest/gtest.h>
+#include "details/blockdata.hpp"
+#include "details/expression.hpp"
+#include "timing.hpp"
+#include <complex>
+#include <numeric>
+#include <vector>
+
+using utilities::details::BlockData;
+
+TEST(ExpressionTest, ArithmeticIsLazy)
+{
+    BlockData<2, double> a(3, 4);
+    BlockData<2, double> b(3, 4);
+    std::iota(a.begin(), a.end(), 0.);
+    std::iota(b.begin(), b.end(), 100.);
+
+    auto e = a * 2. + b - 1.;
+    EXPECT_EQ(e.size(), 12);
+    a(0, 0) = 10.;
+    EXPECT_EQ(e[0], 10. * 2. + 100. - 1.);
+
+    BlockData<2, double> c(3, 4);
+    utilities::details::assign(c, a * 2. + b - 1.);
+    for (std::size_t i = 1; i < c.size(); ++i) {
+        EXPECT_EQ(c.data()[i], a.data()[i] * 2. + b.data()[i] - 1.);
+    }
+    utilities::details::assign(c, -(a / 2.));
+    EXPECT_EQ(c(2, 3), -11. / 2.);
+    utilities::details::assign(c, 5.);
+    EXPECT_EQ(c(1, 1), 5.);
+
+    BlockData<2, double> wrong(4, 3);
+    EXPECT_THROW(a + wrong.column(0), std::invalid_argument);
+    EXPECT_THROW(utilities::details::assign(c.column(0), a), std::invalid_argument);
+}
+
+TEST(ExpressionTest, ViewsAndComplex)
+{
+    using utilities::details::assign;
+    const std::size_t nRows = 2;
+    const std::size_t nPoints = 5;
+    const std::size_t nDirections = 3;
+    BlockData<3, std::complex<double>> input(nRows, nPoints, nDirections);
+    for (std::size_t i = 0; i < input.size(); ++i) {
+        input.data()[i] = {static_cast<double>(i), -static_cast<double>(i) * 1e-100};
+    }
+
+    // The split of ChainRule::mapSingleInput: real part into a row, scaled
+    // imaginary parts into tensorial fibres.
+    BlockData<2, double> x(nRows, nPoints);
+    BlockData<3, double> J(nRows, nDirections, nPoints);
+    for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
+        assign(x.row(iRow), real(input.row(iRow)));
+        for (std::size_t iDir = 0; iDir < nDirections; ++iDir) {
+            assign(J.tensorial(iRow, iDir), imag(input.page(iDir).row(iRow)) * 1e100);
+        }
+    }
+    EXPECT_EQ(x(1, 4), input(1, 4, 0).real());
+    EXPECT_DOUBLE_EQ(J(1, 2, 4), input(1, 4, 2).imag() * 1e100);
+
+    // And back, as in ChainRule::outputByIndex.
+    BlockData<3, std::complex<double>> out(1, nPoints, nDirections);
+    for (std::size_t iDir = 0; iDir < nDirections; ++iDir) {
+        assign(out.page(iDir), complex(x.row(1), J.tensorial(1, iDir) * 1e-100));
+    }
+    for (std::size_t iDir = 0; iDir < nDirections; ++iDir) {
+        for (std::size_t iPoint = 0; iPoint < nPoints; ++iPoint) {
+            EXPECT_EQ(out(0, iPoint, iDir).real(), input(1, iPoint, 0).real());
+            EXPECT_DOUBLE_EQ(out(0, iPoint, iDir).imag(), input(1, iPoint, iDir).imag());
+        }
+    }
+
+    std::vector<std::complex<double>> values{{1., 2.}, {3., 4.}, {5., 6.}, {7., 8.}};
+    BlockData<1, std::complex<double>> z(4);
+    assign(z, conj(utilities::details::lazy(values)));
+    EXPECT_EQ(z[3], std::complex<double>(7., -8.));
+    BlockData<1, double> magnitude(4);
+    assign(magnitude, abs(z));
+    EXPECT_DOUBLE_EQ(magnitude[0], std::sqrt(5.));
+}
+
+TEST(ExpressionTest, ComparisonsAndSelect)
+{
+    using utilities::details::assign;
+    std::vector<double> values{-2., -1., 0., 1., 2., 3.};
+    auto v = utilities::details::lazy(values);
+    BlockData<1, double> clipped(values.size());
+    assign(clipped, select(v < 0., 0., select(v > 2., 2., v)));
+    EXPECT_TRUE(std::ranges::equal(clipped, std::vector<double>{0., 0., 0., 1., 2., 2.}));
+
+    std::vector<bool> mask(values.size());
+    assign(mask, v >= 1.);
+    EXPECT_EQ(mask, (std::vector<bool>{false, false, false, true, true, true}));
+    std::vector<int> equal(values.size());
+    assign(equal, v == clipped);
+    EXPECT_EQ(equal, (std::vector<int>{0, 0, 1, 1, 1, 0}));
+}
+
+TEST(ExpressionTest, ParallelEvaluation)
+{
+    const std::size_t n = 3 * utilities::details::expressionParallelLimit + 17;
+    BlockData<1, double> a(n);
+    BlockData<1, double> b(n);
+    std::iota(a.begin(), a.end(), 0.);
+    utilities::details::assign(b, a * 0.5 + 1.);
+    for (std::size_t i = 0; i < n; ++i) {
+        ASSERT_EQ(b[i], static_cast<double>(i) * 0.5 + 1.);
+    }
+}
+
+TEST(ExpressionTest, ImplicitExpansion)
+{
+    using utilities::details::assign;
+    BlockData<2, double> column(3, 1);
+    BlockData<2, double> row(1, 4);
+    std::iota(column.begin(), column.end(), 1.);
+    std::iota(row.begin(), row.end(), 10.);
+
+    auto sum = column + row;
+    EXPECT_EQ(sum.size(), 12);
+    BlockData<2, double> outer(3, 4);
+    assign(outer, sum);
+    for (std::size_t jCol = 0; jCol < 4; ++jCol) {
+        for (std::size_t iRow = 0; iRow < 3; ++iRow) {
+            EXPECT_EQ(outer(iRow, jCol), column(iRow, 0) + row(0, jCol));
+        }
+    }
+
+    // Subtract the mean over the pages from every page.
+    BlockData<3, double> pages(2, 3, 4);
+    std::iota(pages.begin(), pages.end(), 0.);
+    BlockData<3, double> mean(2, 3, 1);
+    for (std::size_t kPage = 0; kPage < 4; ++kPage) {
+        assign(mean, mean + pages.page(kPage) / 4.);
+    }
+    BlockData<3, double> centred(2, 3, 4);
+    assign(centred, pages - mean);
+    EXPECT_DOUBLE_EQ(centred(1, 2, 0), -9.);
+    EXPECT_DOUBLE_EQ(centred(1, 2, 3), 9.);
+
+    // The target expands too: a column into every column of a matrix, and
+    // into rows 1 and 2 only, a view that is not a single stride.
+    BlockData<2, double> filled(3, 5);
+    assign(filled, column);
+    EXPECT_EQ(filled(2, 4), 3.);
+    BlockData<2, double> two(2, 1);
+    two(0, 0) = -1.;
+    two(1, 0) = -2.;
+    assign(filled.view().subview<0>(1, 2), two * 10.);
+    EXPECT_EQ(filled(0, 4), 1.);
+    EXPECT_EQ(filled(1, 4), -10.);
+    EXPECT_EQ(filled(2, 0), -20.);
+
+    // A 1 x n row of a matrix is a row vector, a rank one row a column.
+    BlockData<2, double> rows(3, 4);
+    assign(rows, outer.view().subview<0>(2, 1) * 2.);
+    EXPECT_EQ(rows(0, 3), 2. * outer(2, 3));
+    EXPECT_THROW(assign(rows, outer.row(2)), std::invalid_argument);
+    EXPECT_NO_THROW(assign(rows.row(0), outer.view().subview<0>(2, 1)));
+    EXPECT_EQ(rows(0, 1), outer(2, 1));
+
+    BlockData<2, double> wide(3, 5);
+    EXPECT_THROW(assign(wide, column + row), std::invalid_argument);
+    EXPECT_THROW(outer + two, std::invalid_argument);
+
+    utilities::details::BlockDataV<2, double> v(3, 4);
+    assign(v.view(), outer - row);
+    EXPECT_EQ(v.view()(2, 3), column(2, 0));
+}
+
+TEST(ExpressionTest, ParallelExpansion)
+{
+    const std::size_t nRows = 7;
+    const std::size_t nCols = utilities::details::expressionParallelLimit;
+    BlockData<2, double> a(nRows, nCols);
+    BlockData<2, double> column(nRows, 1);
+    BlockData<2, double> row(1, nCols);
+    std::iota(a.begin(), a.end(), 0.);
+    std::iota(column.begin(), column.end(), 0.);
+    std::iota(row.begin(), row.end(), 0.);
+    BlockData<2, double> b(nRows, nCols);
+    utilities::details::assign(b, a - column - row * 7.);
+    EXPECT_TRUE(std::all_of(b.begin(), b.end(), [](double x) { return x == 0.; }));
+}
+
+TEST(ExpressionBenchmark, FusedVersusTransforms)
+{
+    // outputByIndex: y + 1i * J * 1e-100, per direction, from a row and a
+    // tensorial fibre of outputs x directions x points.
+    using utilities::details::assign;
+    const std::size_t nOutputs = 2;
+    const std::size_t nDirections = 8;
+    const std::size_t nPoints = 200000;
+    BlockData<2, double> y(nOutputs, nPoints);
+    BlockData<3, double> J(nOutputs, nDirections, nPoints);
+    std::iota(y.begin(), y.end(), 0.);
+    std::iota(J.begin(), J.end(), 0.);
+    BlockData<3, std::complex<double>> out(1, nPoints, nDirections);
+    const double bytes = static_cast<double>(nDirections * nPoints * (2 + 2) * sizeof(double));
+
+    double transforms = timing::best(5, [&]() {
+        // Two passes: scale the fibre into a temporary, then interleave.
+        std::vector<double> scaled(nPoints);
+        for (std::size_t iDir = 0; iDir < nDirections; ++iDir) {
+            auto fibre = J.tensorial(1, iDir);
+            std::transform(fibre.begin(), fibre.end(), scaled.begin(), [](double j) { return j * 1e-100; });
+            auto row = y.row(1);
+            std::transform(row.begin(), row.end(), scaled.begin(), out.page(iDir).begin(),
+                           [](double val, double j) { return std::complex<double>(val, j); });
+        }
+    });
+    double fused = timing::best(5, [&]() {
+        for (std::size_t iDir = 0; iDir < nDirections; ++iDir) {
+            assign(out.page(iDir), complex(y.row(1), J.tensorial(1, iDir) * 1e-100));
+        }
+    });
+    timing::report("transform, scale then interleave", transforms, bytes);
+    timing::report("fused expression", fused, bytes);
+
+    BlockData<1, double> a(1 << 22);
+    BlockData<1, double> b(1 << 22);
+    BlockData<1, double> c(1 << 22);
+    std::iota(a.begin(), a.end(), 0.);
+    std::iota(b.begin(), b.end(), 1.);
+    double axpyTransforms = timing::best(5, [&]() {
+        std::transform(a.begin(), a.end(), c.begin(), [](double x) { return x * 3.; });
+        std::transform(c.begin(), c.end(), b.begin(), c.begin(), std::plus<>());
+    });
+    double axpyFused = timing::best(5, [&]() { assign(c, a * 3. + b); });
+    timing::report("a * 3 + b, two transforms", axpyTransforms, 3. * a.size() * sizeof(double));
+    timing::report("a * 3 + b, fused", axpyFused, 3. * a.size() * sizeof(double));
+}
+
+TEST(ExpressionBenchmark, ExpansionVersusCopies)
+{
+    // Scale every row of outputs x points by a column and shift by a row, as
+    // a copy of the expanded operands would, and with implicit expansion.
+    using utilities::details::assign;
+    const std::size_t nRows = 16;
+    const std::size_t nCols = 1 << 16;
+    BlockData<2, double> a(nRows, nCols);
+    BlockData<2, double> column(nRows, 1);
+    BlockData<2, double> row(1, nCols);
+    BlockData<2, double> result(nRows, nCols);
+    std::iota(a.begin(), a.end(), 0.);
+    std::iota(column.begin(), column.end(), 1.);
+    std::iota(row.begin(), row.end(), 2.);
+    const double bytes = static_cast<double>(2 * a.size() * sizeof(double));
+
+    double copies = timing::best(5, [&]() {
+        BlockData<2, double> columns(nRows, nCols);
+        BlockData<2, double> rows(nRows, nCols);
+        for (std::size_t jCol = 0; jCol < nCols; ++jCol) {
+            std::copy(column.begin(), column.end(), columns.column(jCol).begin());
+            std::fill(rows.column(jCol).begin(), rows.column(jCol).end(), row(0, jCol));
+        }
+        assign(result, a * columns + rows);
+    });
+    double expanded = timing::best(5, [&]() { assign(result, a * column + row); });
+    timing::report("expanded copies, then fused", copies, bytes);
+    timing::report("implicit expansion", expanded, bytes);
+    double plain = timing::best(5, [&]() { assign(result, a * 2. + 1.); });
+    timing::report("scalars only", plain, bytes);
+}
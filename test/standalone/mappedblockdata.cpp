@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+#include "details/mappedblockdata.hpp"
+#include "details/blockdata.hpp"
+#include "temporaryfile.hpp"
+#include "timing.hpp"
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <vector>
+
+using utilities::details::MappedBlockData;
+
+TEST(MappedBlockDataTest, CreateWriteAndReadBack)
+{
+    TemporaryFile file("mexutilities_mapped_create.bin");
+    {
+        auto bd = MappedBlockData<3, double>::create(file.path, {2, 3, 4});
+        EXPECT_EQ(bd.size(), 24);
+        EXPECT_EQ(std::filesystem::file_size(file.path), 24 * sizeof(double));
+        EXPECT_TRUE(std::all_of(bd.begin(), bd.end(), [](double x) { return x == 0.; }));
+        std::iota(bd.begin(), bd.end(), 0.);
+        bd(1, 2, 3) = -1.;
+        bd.flush();
+    }
+
+    MappedBlockData<3, const double> readOnly(file.path, {2, 3, 4});
+    static_assert(std::is_same_v<decltype(readOnly.data()), const double*>);
+    EXPECT_EQ(readOnly(1, 2, 3), -1.);
+    EXPECT_EQ(readOnly(1, 0, 2), 13.);
+    EXPECT_TRUE(std::ranges::equal(readOnly.page(1).row(1), std::vector<double>{7., 9., 11.}));
+    EXPECT_TRUE(std::ranges::equal(readOnly.tensorial(0, 1), std::vector<double>{2., 8., 14., 20.}));
+
+    // The same file as 6 x 4, and from an offset.
+    MappedBlockData<2, const double> matrix(file.path, {6, 4});
+    EXPECT_EQ(matrix(0, 2), 12.);
+    EXPECT_TRUE(std::ranges::equal(matrix.column(1), std::vector<double>{6., 7., 8., 9., 10., 11.}));
+    EXPECT_TRUE(std::ranges::equal(matrix.row(0), std::vector<double>{0., 6., 12., 18.}));
+    MappedBlockData<2, const double> tail(file.path, {6, 2}, 12 * sizeof(double));
+    EXPECT_EQ(tail(5, 1), -1.);
+
+    using Matrix = MappedBlockData<2, const double>;
+    EXPECT_THROW(Matrix(file.path, {6, 5}), std::invalid_argument);
+    EXPECT_THROW(Matrix(file.path, {2, 2}, 3), std::invalid_argument);
+    EXPECT_THROW(Matrix(file.path.string() + ".missing", {1, 1}), std::system_error);
+}
+
+TEST(MappedBlockDataTest, StreamPages)
+{
+    TemporaryFile file("mexutilities_mapped_stream.bin");
+    const std::size_t nPages = 300;
+    {
+        auto bd = MappedBlockData<3, double>::create(file.path, {4, 5, nPages});
+        bd.forEachPage([](std::size_t kPage, auto page) {
+            std::fill(page.begin(), page.end(), static_cast<double>(kPage));
+        }, 16);
+    }
+    MappedBlockData<3, const double> bd(file.path, {4, 5, nPages});
+    bd.advise(utilities::details::Access::random);
+    EXPECT_EQ(bd(3, 4, 123), 123.);
+    double total = 0.;
+    std::size_t visited = 0;
+    bd.forEachPage([&](std::size_t kPage, auto page) {
+        EXPECT_EQ(page.extents(), (std::array<std::size_t, 2>{4, 5}));
+        EXPECT_EQ(page(3, 4), static_cast<double>(kPage));
+        total += std::accumulate(page.begin(), page.end(), 0.);
+        ++visited;
+    }, 7);
+    EXPECT_EQ(visited, nPages);
+    EXPECT_EQ(total, 20. * nPages * (nPages - 1) / 2.);
+    bd.prefetch(nPages - 1, 10);
+    bd.evict(0, nPages);
+    EXPECT_EQ(bd(0, 0, 0), 0.);
+}
+
+TEST(MappedBlockDataBenchmark, StreamVersusLoad)
+{
+    // Sum the pages of a 64 MiB file: read it whole into a BlockData first, or
+    // stream the pages of the mapping.
+    TemporaryFile file("mexutilities_mapped_bench.bin");
+    const std::size_t nRows = 16;
+    const std::size_t nCols = 16;
+    const std::size_t nPages = 32768;
+    {
+        auto bd = MappedBlockData<3, double>::create(file.path, {nRows, nCols, nPages});
+        std::iota(bd.begin(), bd.end(), 0.);
+    }
+    const double bytes = static_cast<double>(nRows * nCols * nPages * sizeof(double));
+    double total = 0.;
+
+    double load = timing::best(3, [&]() {
+        utilities::details::BlockData<3, double> bd(nRows, nCols, nPages);
+        std::ifstream in(file.path, std::ios::binary);
+        in.read(reinterpret_cast<char*>(bd.data()), static_cast<std::streamsize>(bytes));
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            auto page = bd.page(kPage);
+            total += std::accumulate(page.begin(), page.end(), 0.);
+        }
+    });
+    double stream = timing::best(3, [&]() {
+        MappedBlockData<3, const double> bd(file.path, {nRows, nCols, nPages});
+        bd.forEachPage([&](std::size_t, auto page) { total += std::accumulate(page.begin(), page.end(), 0.); });
+    });
+    timing::report("read whole file, then pages", load, bytes);
+    timing::report("mapped, streamed pages", stream, bytes);
+    EXPECT_GT(total, 0.);
+}
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include "details/matrixbatch.hpp"
+#include "details/pagemtimes.hpp"
+#include "timing.hpp"
+#include <random>
+
+namespace {
+
+utilities::details::BlockData<3, double> randomPages(std::size_t nRows, std::size_t nCols, std::size_t nPages, unsigned seed) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> dist(-1., 1.);
+    utilities::details::BlockData<3, double> pages(nRows, nCols, nPages);
+    std::generate(pages.begin(), pages.end(), [&]() { return dist(gen); });
+    return pages;
+}
+
+} // namespace
+
+TEST(MatrixBatchTest, PackUnpackRoundTrip)
+{
+    // 13 matrices do not fill the last block of 8.
+    auto pages = randomPages(3, 2, 13, 1);
+    utilities::details::MatrixBatch<double> batch(pages);
+    EXPECT_EQ(batch.lanes, 8);
+    EXPECT_EQ(batch.size(), 13);
+    EXPECT_EQ(batch.nBlocks(), 2);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(batch.data()) % utilities::details::simd_alignment, 0);
+    for (std::size_t p = 0; p < 13; ++p) {
+        for (std::size_t j = 0; j < 2; ++j) {
+            for (std::size_t i = 0; i < 3; ++i) {
+                EXPECT_EQ(batch(i, j, p), pages(i, j, p));
+            }
+        }
+    }
+    // Element (1, 1) of matrix 9 is in lane 1 of the second block.
+    EXPECT_EQ(batch.block(1)[(1 * 3 + 1) * 8 + 1], pages(1, 1, 9));
+    EXPECT_EQ(batch.block(1)[5], 0.);
+    EXPECT_THROW(batch(0, 0, 13), std::out_of_range);
+
+    utilities::details::BlockData<3, double> back;
+    batch.unpack(back);
+    EXPECT_EQ(back.nPages(), 13);
+    EXPECT_TRUE(std::equal(back.begin(), back.end(), pages.begin()));
+}
+
+TEST(MatrixBatchTest, MultiplyAddTranspose)
+{
+    using utilities::details::Transpose;
+    const std::size_t nMatrices = 37;
+    auto A = randomPages(2, 3, nMatrices, 2);
+    auto B = randomPages(3, 4, nMatrices, 3);
+    utilities::details::MatrixBatch<double, 4> a(A);
+    utilities::details::MatrixBatch<double, 4> b(B);
+
+    utilities::details::MatrixBatch<double, 4> c;
+    utilities::details::multiply(a, b, c);
+    auto expected = utilities::details::pagemtimes(A, B);
+    utilities::details::BlockData<3, double> C;
+    c.unpack(C);
+    ASSERT_EQ(C.size(), expected.size());
+    for (std::size_t iElement = 0; iElement < C.size(); ++iElement) {
+        EXPECT_NEAR(C.data()[iElement], expected.data()[iElement], 1e-14);
+    }
+
+    utilities::details::MatrixBatch<double, 4> at;
+    utilities::details::transpose(a, at);
+    EXPECT_EQ(at.nRows(), 3);
+    EXPECT_EQ(at.nCols(), 2);
+    for (std::size_t p = 0; p < nMatrices; ++p) {
+        EXPECT_EQ(at(2, 1, p), A(1, 2, p));
+    }
+
+    // A.' + A.' doubles every element.
+    utilities::details::MatrixBatch<double, 4> sum;
+    utilities::details::add(at, at, sum);
+    EXPECT_EQ(sum(2, 0, 5), 2. * A(0, 2, 5));
+
+    EXPECT_THROW(utilities::details::multiply(a, a, c), std::invalid_argument);
+    EXPECT_THROW(utilities::details::add(a, b, c), std::invalid_argument);
+    EXPECT_THROW(utilities::details::multiply(at, a, at), std::invalid_argument);
+}
+
+TEST(MatrixBatchBenchmark, VersusPages)
+{
+    using utilities::details::Transpose;
+    for (std::size_t size : {2, 6}) {
+        const std::size_t nMatrices = 1000000 / (size * size) * 4;
+        auto A = randomPages(size, size, nMatrices, 4);
+        auto B = randomPages(size, size, nMatrices, 5);
+        utilities::details::BlockData<3, double> C(size, size, nMatrices);
+        const double bytes = 3. * A.size() * sizeof(double);
+
+        double paged = timing::best(5, [&]() {
+            utilities::details::pagemtimes(A, Transpose::none, B, Transpose::none, C);
+        });
+
+        utilities::details::MatrixBatch<double> a(A);
+        utilities::details::MatrixBatch<double> b(B);
+        utilities::details::MatrixBatch<double> c(size, size, nMatrices);
+        double batched = timing::best(5, [&]() {
+            utilities::details::multiply(a, b, c);
+        });
+        double packing = timing::best(5, [&]() {
+            a.pack(A.data());
+            c.unpack(C.data());
+        });
+
+        std::string label = std::to_string(size) + "x" + std::to_string(size) + " x " + std::to_string(nMatrices);
+        timing::report("pagemtimes " + label, paged, bytes);
+        timing::report("MatrixBatch multiply " + label, batched, bytes);
+        timing::report("MatrixBatch pack + unpack " + label, packing, 4. * A.size() * sizeof(double));
+    }
+}
@@ -0,0 +1,173 @@
+#include <gtest/gtest.h>
+#include "details/pagemtimes.hpp"
+#include "timing.hpp"
+#include <complex>
+#include <random>
+
+namespace {
+
+using utilities::details::Transpose;
+
+template <typename T>
+T element(const std::vector<T>& X, const std::array<std::size_t, 3>& dims, Transpose op, std::size_t i, std::size_t j, std::size_t iPage) {
+    std::size_t page = dims[2] == 1 ? 0 : iPage;
+    if (op == Transpose::none) {
+        return X[i + j * dims[0] + page * dims[0] * dims[1]];
+    }
+    T val = X[j + i * dims[0] + page * dims[0] * dims[1]];
+    if constexpr (utilities::details::is_complex<T>::value) {
+        if (op == Transpose::ctranspose) {
+            return std::conj(val);
+        }
+    }
+    return val;
+}
+
+template <typename T>
+std::vector<T> reference(const std::vector<T>& A, const std::array<std::size_t, 3>& aDims, Transpose opA,
+                         const std::vector<T>& B, const std::array<std::size_t, 3>& bDims, Transpose opB) {
+    auto cDims = utilities::details::pagemtimesDims(aDims, opA, bDims, opB);
+    std::size_t k = opA == Transpose::none ? aDims[1] : aDims[0];
+    std::vector<T> C(cDims[0] * cDims[1] * cDims[2]);
+    for (std::size_t iPage = 0; iPage < cDims[2]; ++iPage) {
+        for (std::size_t j = 0; j < cDims[1]; ++j) {
+            for (std::size_t i = 0; i < cDims[0]; ++i) {
+                T sum{};
+                for (std::size_t l = 0; l < k; ++l) {
+                    sum += element(A, aDims, opA, i, l, iPage) * element(B, bDims, opB, l, j, iPage);
+                }
+                C[i + j * cDims[0] + iPage * cDims[0] * cDims[1]] = sum;
+            }
+        }
+    }
+    return C;
+}
+
+template <typename T>
+std::vector<T> random(std::size_t n, std::mt19937& gen) {
+    std::uniform_real_distribution<double> dist(-1., 1.);
+    std::vector<T> X(n);
+    for (auto& x : X) {
+        if constexpr (utilities::details::is_complex<T>::value) {
+            x = T(dist(gen), dist(gen));
+        } else {
+            x = static_cast<T>(dist(gen));
+        }
+    }
+    return X;
+}
+
+template <typename T>
+void checkAllOps(std::size_t m, std::size_t n, std::size_t k, std::size_t aPages, std::size_t bPages, double tol) {
+    std::mt19937 gen(42);
+    for (auto opA : {Transpose::none, Transpose::transpose, Transpose::ctranspose}) {
+        for (auto opB : {Transpose::none, Transpose::transpose, Transpose::ctranspose}) {
+            std::array<std::size_t, 3> aDims = opA == Transpose::none ? std::array<std::size_t, 3>{m, k, aPages} : std::array<std::size_t, 3>{k, m, aPages};
+            std::array<std::size_t, 3> bDims = opB == Transpose::none ? std::array<std::size_t, 3>{k, n, bPages} : std::array<std::size_t, 3>{n, k, bPages};
+            auto A = random<T>(aDims[0] * aDims[1] * aDims[2], gen);
+            auto B = random<T>(bDims[0] * bDims[1] * bDims[2], gen);
+            auto expected = reference(A, aDims, opA, B, bDims, opB);
+            std::vector<T> C(expected.size());
+            utilities::details::pagemtimes(A.data(), aDims, opA, B.data(), bDims, opB, C.data());
+            for (std::size_t iElement = 0; iElement < C.size(); ++iElement) {
+                ASSERT_NEAR(std::abs(C[iElement] - expected[iElement]), 0., tol) << "element " << iElement;
+            }
+        }
+    }
+}
+
+} // namespace
+
+TEST(PagemtimesTest, SmallPages)
+{
+    checkAllOps<double>(2, 3, 2, 5, 5, 1e-12);
+    checkAllOps<double>(3, 1, 4, 1, 7, 1e-12);
+    checkAllOps<std::complex<double>>(2, 2, 3, 6, 1, 1e-12);
+    checkAllOps<float>(4, 4, 4, 3, 3, 1e-5);
+}
+
+TEST(PagemtimesTest, BlasPages)
+{
+    checkAllOps<double>(17, 23, 19, 4, 4, 1e-12);
+    checkAllOps<double>(17, 23, 19, 1, 3, 1e-12);
+    checkAllOps<std::complex<double>>(12, 9, 14, 3, 1, 1e-12);
+    checkAllOps<std::complex<float>>(12, 9, 14, 2, 2, 1e-4);
+}
+
+TEST(PagemtimesTest, ParallelPages)
+{
+    // Enough work to cross pagemtimesParallelLimit.
+    checkAllOps<double>(32, 32, 32, 40, 40, 1e-11);
+    checkAllOps<double>(2, 2, 2, 1, 200000, 1e-12);
+}
+
+TEST(PagemtimesTest, Dimensions)
+{
+    using utilities::details::pagemtimesDims;
+    EXPECT_EQ(pagemtimesDims({2, 3, 4}, Transpose::none, {3, 5, 1}, Transpose::none), (std::array<std::size_t, 3>{2, 5, 4}));
+    EXPECT_EQ(pagemtimesDims({3, 2, 1}, Transpose::transpose, {5, 3, 6}, Transpose::transpose), (std::array<std::size_t, 3>{2, 5, 6}));
+    EXPECT_THROW(pagemtimesDims({2, 3, 1}, Transpose::none, {2, 5, 1}, Transpose::none), std::invalid_argument);
+    EXPECT_THROW(pagemtimesDims({2, 3, 2}, Transpose::none, {3, 5, 3}, Transpose::none), std::invalid_argument);
+}
+
+TEST(PagemtimesTest, BlockData)
+{
+    utilities::details::BlockData<2, double> A(2, 2);
+    std::iota(A.begin(), A.end(), 1.);
+    utilities::details::BlockData<3, double> B(2, 3, 4);
+    std::iota(B.begin(), B.end(), 0.);
+
+    auto C = utilities::details::pagemtimes(A, B);
+    EXPECT_EQ(C.nRows(), 2);
+    EXPECT_EQ(C.nCols(), 3);
+    EXPECT_EQ(C.nPages(), 4);
+    for (std::size_t iPage = 0; iPage < 4; ++iPage) {
+        for (std::size_t j = 0; j < 3; ++j) {
+            for (std::size_t i = 0; i < 2; ++i) {
+                EXPECT_EQ(C(i, j, iPage), A(i, 0) * B(0, j, iPage) + A(i, 1) * B(1, j, iPage));
+            }
+        }
+    }
+
+    // An output of the right size keeps its buffer.
+    utilities::details::buffer_ptr_t<double> buffer(new double[24], [](void* ptr) { delete[] static_cast<double*>(ptr); });
+    double* raw = buffer.get();
+    utilities::details::BlockData<3, double> out({24, 1, 1}, std::move(buffer));
+    utilities::details::pagemtimes(A, Transpose::transpose, B, Transpose::none, out);
+    EXPECT_TRUE(out.adopted());
+    EXPECT_EQ(out.data(), raw);
+    EXPECT_EQ(out.nRows(), 2);
+    EXPECT_EQ(out(1, 2, 3), A(0, 1) * B(0, 2, 3) + A(1, 1) * B(1, 2, 3));
+
+    EXPECT_THROW(utilities::details::pagemtimes(B, A), std::invalid_argument);
+}
+
+TEST(PagemtimesBenchmark, VersusPageLoop)
+{
+    std::mt19937 gen(1);
+    for (std::size_t size : {2, 4, 8, 64}) {
+        const std::size_t nPages = std::max<std::size_t>(200000 / (size * size), 16);
+        std::array<std::size_t, 3> dims{size, size, nPages};
+        auto A = random<double>(size * size * nPages, gen);
+        auto B = random<double>(size * size * nPages, gen);
+        std::vector<double> C(A.size());
+        const double bytes = 3. * A.size() * sizeof(double);
+
+        double looped = timing::best(5, [&]() {
+            const char trans = 'N';
+            const int n = static_cast<int>(size);
+            const double alpha = 1.;
+            const double beta = 0.;
+            for (std::size_t iPage = 0; iPage < nPages; ++iPage) {
+                dgemm_(&trans, &trans, &n, &n, &n, &alpha, A.data() + iPage * size * size, &n,
+                       B.data() + iPage * size * size, &n, &beta, C.data() + iPage * size * size, &n);
+            }
+        });
+        double batched = timing::best(5, [&]() {
+            utilities::details::pagemtimes(A.data(), dims, Transpose::none, B.data(), dims, Transpose::none, C.data());
+        });
+        std::string label = std::to_string(size) + "x" + std::to_string(size) + " x " + std::to_string(nPages);
+        timing::report("dgemm loop " + label, looped, bytes);
+        timing::report("pagemtimes " + label, batched, bytes);
+    }
+}
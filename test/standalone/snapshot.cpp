@@ -0,0 +1,241 @@
+#include <gtest/gtest.h>
+#include "details/snapshot.hpp"
+#include "temporaryfile.hpp"
+#include "timing.hpp"
+#include <cmath>
+#include <complex>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <vector>
+
+using namespace utilities::details;
+
+namespace {
+
+// Flips one byte of the file at offset.
+void corrupt(const std::filesystem::path& path, std::size_t offset) {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekg(static_cast<std::streamoff>(offset));
+    char byte = 0;
+    file.read(&byte, 1);
+    byte = static_cast<char>(~byte);
+    file.seekp(static_cast<std::streamoff>(offset));
+    file.write(&byte, 1);
+}
+
+} // namespace
+
+TEST(SnapshotTest, Checksum)
+{
+    std::vector<unsigned char> bytes(1000);
+    std::iota(bytes.begin(), bytes.end(), 0);
+    const auto whole = Checksum().update(bytes.data(), bytes.size()).value();
+    // Pieces of any size give the same checksum.
+    Checksum pieces;
+    pieces.update(bytes.data(), 3).update(bytes.data() + 3, 13).update(bytes.data() + 16, 984);
+    EXPECT_EQ(pieces.value(), whole);
+    EXPECT_NE(Checksum().update(bytes.data(), bytes.size() - 1).value(), whole);
+    bytes[500] ^= 1;
+    EXPECT_NE(Checksum().update(bytes.data(), bytes.size()).value(), whole);
+}
+
+TEST(SnapshotTest, DenseRoundTrip)
+{
+    TemporaryFile file("mexutilities_snapshot_dense.bin");
+    BlockData<3, double> bd(3, 4, 5);
+    std::iota(bd.begin(), bd.end(), 0.);
+    saveSnapshot(file.path, bd);
+    EXPECT_EQ(std::filesystem::file_size(file.path), snapshotDataOffset + bd.size() * sizeof(double));
+
+    auto loaded = loadSnapshot<3, double>(file.path);
+    EXPECT_EQ(loaded.dims(), bd.dims());
+    EXPECT_TRUE(std::ranges::equal(loaded, bd));
+
+    // Trailing singleton dimensions may be added or dropped.
+    auto padded = loadSnapshot<4, double>(file.path);
+    EXPECT_EQ(padded.dims(), (std::array<std::size_t, 4>{3, 4, 5, 1}));
+    EXPECT_THROW((loadSnapshot<2, double>(file.path)), std::invalid_argument);
+
+    EXPECT_THROW((loadSnapshot<3, float>(file.path)), std::invalid_argument);
+    EXPECT_THROW((loadSparseSnapshot<double>(file.path)), std::invalid_argument);
+
+    BlockData<2, std::complex<float>> z(2, 2);
+    z(1, 0) = {1.f, -1.f};
+    saveSnapshot(file.path, z);
+    EXPECT_EQ((loadSnapshot<2, std::complex<float>>(file.path)(1, 0)), std::complex<float>(1.f, -1.f));
+}
+
+TEST(SnapshotTest, Layouts)
+{
+    TemporaryFile file("mexutilities_snapshot_layout.bin");
+    BlockData<3, double> bd(3, 4, 5);
+    std::iota(bd.begin(), bd.end(), 0.);
+    using DirectionMajor = BlockData<3, double, aligned_allocator<double>, layout_direction_major>;
+    using Tiled = BlockData<3, double, aligned_allocator<double>, layout_tiled<2>>;
+
+    // A direction major snapshot loads as either layout.
+    saveSnapshot(file.path, DirectionMajor(bd));
+    EXPECT_TRUE(std::ranges::equal(loadSnapshot<3, double>(file.path), bd));
+    auto directionMajor = loadSnapshot<3, double, aligned_allocator<double>, layout_direction_major>(file.path);
+    EXPECT_EQ(directionMajor(2, 3, 4), bd(2, 3, 4));
+    EXPECT_THROW((mapSnapshot<3, double>(file.path)), std::invalid_argument);
+
+    // Tiled snapshots only load as themselves.
+    saveSnapshot(file.path, Tiled(bd));
+    auto tiled = loadSnapshot<3, double, aligned_allocator<double>, layout_tiled<2>>(file.path);
+    EXPECT_EQ(tiled(1, 3, 2), bd(1, 3, 2));
+    EXPECT_THROW((loadSnapshot<3, double>(file.path)), std::invalid_argument);
+    EXPECT_THROW((loadSnapshot<3, double, aligned_allocator<double>, layout_tiled<4>>(file.path)), std::invalid_argument);
+}
+
+TEST(SnapshotTest, MapWithoutCopying)
+{
+    TemporaryFile file("mexutilities_snapshot_map.bin");
+    BlockData<3, double> bd(4, 5, 6);
+    std::iota(bd.begin(), bd.end(), 0.);
+    saveSnapshot(file.path, bd);
+
+    auto mapped = mapSnapshot<3, double>(file.path, SnapshotCheck::full);
+    static_assert(std::is_same_v<decltype(mapped), MappedBlockData<3, const double>>);
+    EXPECT_EQ(mapped.dims(), bd.dims());
+    EXPECT_TRUE(std::ranges::equal(mapped, bd));
+    EXPECT_TRUE(std::ranges::equal(mapped.page(3).column(2), bd.page(3).column(2)));
+}
+
+TEST(SnapshotTest, SparseRoundTrip)
+{
+    TemporaryFile file("mexutilities_snapshot_sparse.bin");
+    utilities::Sparse<double> A(4, 3, {1, 4, 6, 11}, {1., -2., 3., 4.});
+    saveSnapshot(file.path, A);
+
+    auto B = loadSparseSnapshot<double>(file.path);
+    EXPECT_EQ(B.getNumberOfRows(), 4);
+    EXPECT_EQ(B.getNumberOfColumns(), 3);
+    EXPECT_TRUE(std::ranges::equal(B.linearIndices(), A.linearIndices()));
+    EXPECT_TRUE(std::ranges::equal(B.nonZeroValues(), A.nonZeroValues()));
+
+    // Column bounds, then 32 bit rows.
+    EXPECT_EQ(std::filesystem::file_size(file.path), snapshotDataOffset + 4 * 8 + 4 * (4 + 8));
+    auto B64 = loadSparseSnapshot<double, std::uint64_t>(file.path);
+    EXPECT_TRUE(std::ranges::equal(B64.rowIndices(), A.rowIndices()));
+
+    EXPECT_THROW((loadSparseSnapshot<float>(file.path)), std::invalid_argument);
+    EXPECT_THROW((loadSnapshot<2, double>(file.path)), std::invalid_argument);
+
+    utilities::Sparse<float> empty(5, 5);
+    saveSnapshot(file.path, empty);
+    auto loaded = loadSparseSnapshot<float>(file.path);
+    EXPECT_EQ(loaded.getNumberOfRows(), 5);
+    EXPECT_EQ(loaded.getNumberOfNonZeroElements(), 0);
+}
+
+TEST(SnapshotTest, DetectsCorruption)
+{
+    TemporaryFile file("mexutilities_snapshot_corrupt.bin");
+    BlockData<2, double> bd(16, 16);
+    std::iota(bd.begin(), bd.end(), 0.);
+    auto save = [&]() { saveSnapshot(file.path, bd); };
+
+    save();
+    corrupt(file.path, snapshotDataOffset + 100);
+    EXPECT_THROW((loadSnapshot<2, double>(file.path)), std::runtime_error);
+    EXPECT_THROW((mapSnapshot<2, double>(file.path, SnapshotCheck::full)), std::runtime_error);
+    // Only the header is checked unless asked for.
+    EXPECT_NO_THROW((loadSnapshot<2, double>(file.path, SnapshotCheck::header)));
+    EXPECT_NO_THROW((mapSnapshot<2, double>(file.path)));
+
+    save();
+    corrupt(file.path, 40);
+    EXPECT_THROW((mapSnapshot<2, double>(file.path)), std::runtime_error);
+
+    save();
+    corrupt(file.path, 0);
+    EXPECT_THROW((loadSnapshot<2, double>(file.path)), std::runtime_error);
+
+    save();
+    std::filesystem::resize_file(file.path, snapshotDataOffset + 8);
+    EXPECT_THROW((loadSnapshot<2, double>(file.path)), std::runtime_error);
+    EXPECT_THROW((mapSnapshot<2, double>(file.path)), std::runtime_error);
+    EXPECT_THROW((loadSnapshot<2, double>(file.path.string() + ".missing")), std::runtime_error);
+
+    // A valid header whose payload size does not match its dimensions.
+    save();
+    {
+        auto header = snapshot_detail::makeHeader<double>(SnapshotKind::dense, bd.dims(), bd.size(), 8);
+        std::fstream out(file.path, std::ios::binary | std::ios::in | std::ios::out);
+        snapshot_detail::writeHeader(out, header);
+    }
+    EXPECT_THROW((loadSnapshot<2, double>(file.path, SnapshotCheck::header)), std::runtime_error);
+    EXPECT_THROW((mapSnapshot<2, double>(file.path)), std::runtime_error);
+
+    // Only the current version is read.
+    for (std::uint32_t version : {snapshotVersion - 1, snapshotVersion + 1}) {
+        save();
+        auto header = snapshot_detail::makeHeader<double>(SnapshotKind::dense, bd.dims(), bd.size(), bd.size() * sizeof(double));
+        header.version = version;
+        {
+            std::fstream out(file.path, std::ios::binary | std::ios::in | std::ios::out);
+            snapshot_detail::writeHeader(out, header);
+        }
+        EXPECT_THROW((loadSnapshot<2, double>(file.path, SnapshotCheck::header)), std::runtime_error);
+    }
+}
+
+TEST(SnapshotTest, StreamingWriter)
+{
+    TemporaryFile file("mexutilities_snapshot_stream.bin");
+    const std::size_t nPages = 10;
+    BlockData<2, double> page(3, 4);
+    {
+        SnapshotWriter<double> writer(file.path, std::array<std::size_t, 3>{3, 4, nPages});
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            std::fill(page.begin(), page.end(), static_cast<double>(kPage));
+            writer.write(page);
+        }
+        EXPECT_THROW(writer.write(page), std::out_of_range);
+        writer.finish();
+    }
+    auto bd = loadSnapshot<3, double>(file.path);
+    EXPECT_EQ(bd.dims(), (std::array<std::size_t, 3>{3, 4, nPages}));
+    EXPECT_EQ(bd(2, 3, 7), 7.);
+
+    {
+        SnapshotWriter<double> writer(file.path, std::array<std::size_t, 2>{3, 8});
+        writer.write(page);
+        EXPECT_THROW(writer.finish(), std::invalid_argument);
+    }
+    // Never finished, so never valid.
+    EXPECT_THROW((loadSnapshot<2, double>(file.path)), std::runtime_error);
+}
+
+TEST(SnapshotBenchmark, MapLoadOrRebuild)
+{
+    // 64 MiB of results: recompute them, read a snapshot, or map it and touch
+    // one page.
+    TemporaryFile file("mexutilities_snapshot_bench.bin");
+    const std::size_t nRows = 32;
+    const std::size_t nCols = 32;
+    const std::size_t nPages = 8192;
+    const double bytes = static_cast<double>(nRows * nCols * nPages * sizeof(double));
+    double total = 0.;
+
+    auto rebuild = [&]() {
+        BlockData<3, double> bd(nRows, nCols, nPages);
+        for (std::size_t i = 0; i < bd.size(); ++i) {
+            bd.data()[i] = std::sin(0.001 * static_cast<double>(i));
+        }
+        return bd;
+    };
+    saveSnapshot(file.path, rebuild());
+
+    double rebuilt = timing::best(3, [&]() { total += rebuild()(1, 2, 3); });
+    double loaded = timing::best(3, [&]() { total += loadSnapshot<3, double>(file.path)(1, 2, 3); });
+    double unchecked = timing::best(3, [&]() { total += loadSnapshot<3, double>(file.path, SnapshotCheck::header)(1, 2, 3); });
+    double mapped = timing::best(3, [&]() { total += mapSnapshot<3, double>(file.path)(1, 2, 3); });
+    timing::report("rebuild", rebuilt, bytes);
+    timing::report("load snapshot, checked", loaded, bytes);
+    timing::report("load snapshot, header only", unchecked, bytes);
+    timing::report("map snapshot", mapped, bytes);
+    EXPECT_NE(total, 0.);
+}
@@ -1,5 +1,13 @@
 #include <gtest/gtest.h>
 #include "sparse.hpp"
+#include "timing.hpp"
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
 
 template<typename FloatType, typename MatrixIndexType, typename ReturnIndexType>
 void testSparseCSC(void) {
@@ -155,3 +163,755 @@ TEST(SparseTest, CSR_DoubleTestIntSizeT)
 {
     testSparseCSR<double, int, std::size_t>();
 }
+
+TEST(SparseTest, CompressedColumns)
+{
+    // The matrix of testSparseCSC, from linear indices.
+    utilities::Sparse<double> A(5, 5, {0, 5, 6, 10, 11, 12, 16, 17, 18, 22, 24}, {1, -1, 5, -3, 4, -4, 6, 2, 8, 7, -5});
+    EXPECT_TRUE(std::ranges::equal(A.columnBounds(), std::vector<std::size_t>{0, 1, 3, 6, 9, 11}));
+    EXPECT_TRUE(std::ranges::equal(A.rowIndices(), std::vector<std::uint32_t>{0, 0, 1, 0, 1, 2, 1, 2, 3, 2, 4}));
+    EXPECT_EQ(A.linearIndices(), (std::vector<std::size_t>{0, 5, 6, 10, 11, 12, 16, 17, 18, 22, 24}));
+
+    std::vector<int> jCol(A.getNumberOfNonZeroElements());
+    A.jCol<int>(jCol.data());
+    EXPECT_EQ(jCol, (std::vector<int>{0, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4}));
+
+    // Triplets are sorted into their columns.
+    utilities::Sparse<float, std::size_t> B(3, 4);
+    std::vector<int> iRow{2, 0, 1, 0};
+    std::vector<int> jColB{3, 1, 1, 0};
+    std::vector<float> val{4.f, 2.f, 3.f, 1.f};
+    B.set<int>(iRow, jColB, val);
+    EXPECT_TRUE(std::ranges::equal(B.columnBounds(), std::vector<std::size_t>{0, 1, 3, 3, 4}));
+    EXPECT_TRUE(std::ranges::equal(B.nonZeroValues(), std::vector<float>{1.f, 2.f, 3.f, 4.f}));
+
+    jColB[0] = 4;
+    EXPECT_THROW(B.set<int>(iRow, jColB, val), std::out_of_range);
+    using Small = utilities::Sparse<double, std::uint8_t>;
+    EXPECT_THROW(Small(256, 1), std::out_of_range);
+    EXPECT_THROW((utilities::Sparse<double>(2, 2, {4}, {1.})), std::out_of_range);
+    // Unsorted or duplicate rows within a column need assemble.
+    std::vector<int> iRowUnsorted{0, 1, 0, 2};
+    std::vector<int> jColUnsorted{1, 1, 1, 0};
+    EXPECT_THROW(B.set<int>(iRowUnsorted, jColUnsorted, val), std::invalid_argument);
+    EXPECT_EQ(B.getNumberOfNonZeroElements(), 0);
+    EXPECT_THROW((utilities::Sparse<double>(3, 2, {1, 1}, {1., 2.})), std::invalid_argument);
+    EXPECT_THROW((utilities::Sparse<double>(3, 2, {2, 1}, {1., 2.})), std::invalid_argument);
+
+    // Straight from compressed columns, checked.
+    using Bounds = std::vector<std::size_t>;
+    using Rows = std::vector<std::uint32_t>;
+    utilities::Sparse<double> C(5, 5, Bounds{0, 1, 3, 6, 9, 11}, Rows{0, 0, 1, 0, 1, 2, 1, 2, 3, 2, 4},
+                                std::vector<double>{1, -1, 5, -3, 4, -4, 6, 2, 8, 7, -5});
+    EXPECT_EQ(C.linearIndices(), A.linearIndices());
+    EXPECT_THROW((utilities::Sparse<double>(2, 2, Bounds{0, 1}, Rows{0}, std::vector<double>{1.})), std::invalid_argument);
+    EXPECT_THROW((utilities::Sparse<double>(2, 2, Bounds{0, 2, 1}, Rows{0}, std::vector<double>{1.})), std::invalid_argument);
+    EXPECT_THROW((utilities::Sparse<double>(2, 2, Bounds{0, 2, 2}, Rows{1, 0}, std::vector<double>{1., 2.})), std::invalid_argument);
+    EXPECT_THROW((utilities::Sparse<double>(2, 2, Bounds{0, 1, 1}, Rows{2}, std::vector<double>{1.})), std::out_of_range);
+}
+
+TEST(SparseTest, CsrFollowsPatternChanges)
+{
+    utilities::Sparse<double> A(2, 3);
+    std::vector<std::size_t> iRow{0, 1, 0};
+    std::vector<std::size_t> jCol{0, 1, 2};
+    std::vector<double> val{1., 2., 3.};
+    A.set<std::size_t>(iRow, jCol, val);
+
+    std::vector<std::size_t> rowBnd(3), jColOut(3);
+    std::vector<double> valOut(3);
+    A.getCsr<std::size_t>(rowBnd, jColOut, valOut);
+    EXPECT_EQ(rowBnd, (std::vector<std::size_t>{0, 2, 3}));
+    EXPECT_EQ(jColOut, (std::vector<std::size_t>{0, 2, 1}));
+    EXPECT_EQ(valOut, (std::vector<double>{1., 3., 2.}));
+
+    iRow = {1, 1, 0};
+    A.set<std::size_t>(iRow, jCol, val);
+    A.getCsr<std::size_t>(rowBnd, jColOut, valOut);
+    EXPECT_EQ(rowBnd, (std::vector<std::size_t>{0, 1, 3}));
+    EXPECT_EQ(jColOut, (std::vector<std::size_t>{2, 0, 1}));
+    EXPECT_EQ(valOut, (std::vector<double>{3., 1., 2.}));
+}
+
+TEST(SparseTest, FromDense)
+{
+    // Column major 3 x 4 with a NaN, a tiny value and an empty column.
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const std::vector<double> dense{1., 0., -2., 0., 0., 0., 1e-20, 3., nan, 0.5, 0., -4.};
+    utilities::Sparse<double> A;
+    A.setDense(dense.data(), 3, 4);
+    EXPECT_EQ(A.getNumberOfRows(), 3);
+    EXPECT_EQ(A.getNumberOfColumns(), 4);
+    EXPECT_TRUE(std::ranges::equal(A.columnBounds(), std::vector<std::size_t>{0, 2, 2, 3, 5}));
+    EXPECT_TRUE(std::ranges::equal(A.rowIndices(), std::vector<std::uint32_t>{0, 2, 1, 0, 2}));
+    EXPECT_TRUE(std::ranges::equal(A.nonZeroValues(), std::vector<double>{1., -2., 3., 0.5, -4.}));
+
+    A.setDense(dense.data(), 3, 4, 0.75);
+    EXPECT_TRUE(std::ranges::equal(A.nonZeroValues(), std::vector<double>{1., -2., 3., -4.}));
+    A.setDense(dense.data(), 6, 2, 0.);
+    EXPECT_TRUE(std::ranges::equal(A.linearIndices(), std::vector<std::size_t>{0, 2, 6, 7, 9, 11}));
+
+    // Tall enough for several blocks per column and several pieces on the pool.
+    const std::size_t m = 1000;
+    const std::size_t n = 300;
+    std::vector<float> big(m * n);
+    for (std::size_t k = 0; k < big.size(); k++) {
+        big[k] = k % 7 == 0 ? static_cast<float>(k + 1) : 0.f;
+    }
+    utilities::Sparse<float> B;
+    B.setDense(big.data(), m, n);
+    EXPECT_EQ(B.getNumberOfNonZeroElements(), (m * n + 6) / 7);
+    const auto linear = B.linearIndices();
+    for (std::size_t k = 0; k < linear.size(); k++) {
+        ASSERT_EQ(linear[k], 7 * k);
+        ASSERT_EQ(B.nonZeroValues()[k], static_cast<float>(7 * k + 1));
+    }
+}
+
+TEST(SparseTest, AssembleTriplets)
+{
+    // sparse(i, j, v, 3, 3): unsorted, (1, 0) given three times, (0, 2) summing
+    // to zero and (2, 1) given as zero.
+    const std::vector<int> iRow{2, 1, 0, 1, 0, 2, 1, 0};
+    const std::vector<int> jCol{2, 0, 2, 0, 1, 1, 0, 2};
+    const std::vector<double> val{5., 1., 4., 2., 3., 0., 0.5, -4.};
+    utilities::Sparse<double> A(3, 3);
+    A.assemble(std::span<const int>(iRow), std::span<const int>(jCol), std::span<const double>(val));
+    EXPECT_TRUE(std::ranges::equal(A.columnBounds(), std::vector<std::size_t>{0, 1, 2, 3}));
+    EXPECT_TRUE(std::ranges::equal(A.rowIndices(), std::vector<std::uint32_t>{1, 0, 2}));
+    EXPECT_TRUE(std::ranges::equal(A.nonZeroValues(), std::vector<double>{3.5, 3., 5.}));
+
+    const std::vector<int> outside{3};
+    const std::vector<int> zero{0};
+    const std::vector<double> one{1.};
+    EXPECT_THROW(A.assemble(std::span<const int>(outside), std::span<const int>(zero), std::span<const double>(one)), std::out_of_range);
+    EXPECT_THROW(A.assemble(std::span<const int>(zero), std::span<const int>(iRow), std::span<const double>(one)), std::invalid_argument);
+
+    // Random triplets, many duplicates, against a dense sum; on four threads
+    // there are several pieces to sort.
+    auto& pool = utilities::details::ThreadPool::instance();
+    const std::size_t nThreads = pool.size();
+    pool.resize(4);
+    const std::size_t m = 300;
+    const std::size_t n = 200;
+    const std::size_t nnz = 5 * utilities::Sparse<double>::assembleGrain;
+    std::mt19937 generator(3);
+    std::uniform_int_distribution<std::size_t> row(0, m - 1);
+    std::uniform_int_distribution<std::size_t> col(0, n - 1);
+    std::vector<std::size_t> rows(nnz);
+    std::vector<std::size_t> cols(nnz);
+    std::vector<double> values(nnz);
+    std::vector<double> dense(m * n, 0.);
+    for (std::size_t k = 0; k < nnz; k++) {
+        rows[k] = row(generator);
+        cols[k] = col(generator) / 2;
+        values[k] = static_cast<double>(k % 5) - 1.;
+        dense[rows[k] + cols[k] * m] += values[k];
+    }
+    utilities::Sparse<double> B(m, n);
+    B.assemble(std::span<const std::size_t>(rows), std::span<const std::size_t>(cols), std::span<const double>(values));
+    pool.resize(nThreads);
+    utilities::Sparse<double> C;
+    C.setDense(dense.data(), m, n, 0.);
+    EXPECT_TRUE(std::ranges::equal(B.columnBounds(), C.columnBounds()));
+    EXPECT_TRUE(std::ranges::equal(B.rowIndices(), C.rowIndices()));
+    EXPECT_TRUE(std::ranges::equal(B.nonZeroValues(), C.nonZeroValues()));
+
+    // A tall column: nothing is sized by the number of rows.
+    const std::size_t tall = std::size_t{1} << 30;
+    const std::vector<std::size_t> tallRows{tall - 1, 5, tall - 1, 0};
+    const std::vector<std::size_t> tallCols{0, 0, 0, 0};
+    const std::vector<double> tallValues{1., 2., 3., 4.};
+    utilities::Sparse<double> T(tall, 1);
+    T.assemble(std::span<const std::size_t>(tallRows), std::span<const std::size_t>(tallCols), std::span<const double>(tallValues));
+    EXPECT_TRUE(std::ranges::equal(T.rowIndices(), std::vector<std::uint32_t>{0, 5, static_cast<std::uint32_t>(tall - 1)}));
+    EXPECT_TRUE(std::ranges::equal(T.nonZeroValues(), std::vector<double>{4., 2., 4.}));
+}
+
+TEST(SparseTest, UpdateValues)
+{
+    // 4 x 3 with non-zeros at linear indices 1, 4, 6 and 11.
+    utilities::Sparse<double> A(4, 3, {1, 4, 6, 11}, {1., 2., 3., 4.});
+    auto update = [&](std::vector<std::size_t> linear, std::vector<double> values) {
+        A.updateValues(std::span<const std::size_t>(linear), std::span<const double>(values));
+        return std::vector<double>(A.nonZeroValues().begin(), A.nonZeroValues().end());
+    };
+    EXPECT_EQ(update({1, 4, 6, 11}, {5., 6., 7., 8.}), (std::vector<double>{5., 6., 7., 8.}));
+    // Off the pattern is ignored, missing is zero; twice, the second time
+    // from the cached map.
+    EXPECT_EQ(update({0, 4, 6, 9}, {-1., -2., -3., -4.}), (std::vector<double>{0., -2., -3., 0.}));
+    EXPECT_EQ(update({0, 4, 6, 9}, {1., 2., 3., 4.}), (std::vector<double>{0., 2., 3., 0.}));
+    EXPECT_EQ(update({}, {}), (std::vector<double>{0., 0., 0., 0.}));
+    EXPECT_THROW(update({4, 1}, {1., 2.}), std::invalid_argument);
+    EXPECT_THROW(update({1}, {1., 2.}), std::invalid_argument);
+
+    // A new pattern for A makes the cached map stale.
+    EXPECT_EQ(update({1, 4, 6, 11}, {1., 2., 3., 4.}), (std::vector<double>{1., 2., 3., 4.}));
+    const std::vector<int> iRow{0, 1, 3};
+    const std::vector<int> jCol{1, 1, 2};
+    const std::vector<double> val{1., 1., 1.};
+    A.assemble(std::span<const int>(iRow), std::span<const int>(jCol), std::span<const double>(val));
+    EXPECT_EQ(update({1, 4, 6, 11}, {1., 2., 3., 4.}), (std::vector<double>{2., 0., 4.}));
+
+    // Written in place, the CSR mirror follows.
+    A.nonZeroValues()[1] = 9.;
+    std::vector<double> csr(3);
+    std::vector<std::size_t> rowBnd(5);
+    std::vector<std::size_t> jCols(3);
+    A.getCsr(std::span(rowBnd), std::span(jCols), std::span(csr));
+    EXPECT_EQ(csr, (std::vector<double>{2., 9., 4.}));
+}
+
+TEST(SparseTest, Multiply)
+{
+    // Random 500 x 400 with empty rows and columns, against dense products;
+    // big enough to be cut into several pieces on four threads.
+    const std::size_t m = 500;
+    const std::size_t n = 400;
+    std::mt19937 generator(5);
+    std::uniform_real_distribution<double> uniform(-1., 1.);
+    std::vector<double> dense(m * n, 0.);
+    for (std::size_t j = 0; j < n; j++) {
+        for (std::size_t i = 0; i < m; i++) {
+            const double u = uniform(generator);
+            if (i % 7 != 3 && j % 5 != 1 && std::abs(u) < 0.5) {
+                dense[i + j * m] = u;
+            }
+        }
+    }
+    utilities::Sparse<double> A;
+    A.setDense(dense.data(), m, n, 0.);
+    ASSERT_GT(A.getNumberOfNonZeroElements(), 2 * utilities::Sparse<double>::multiplyGrain);
+
+    std::vector<double> x(n);
+    std::vector<double> xt(m);
+    for (double& v : x) {
+        v = uniform(generator);
+    }
+    for (double& v : xt) {
+        v = uniform(generator);
+    }
+    std::vector<double> yRef(m, 0.);
+    std::vector<double> ytRef(n, 0.);
+    for (std::size_t j = 0; j < n; j++) {
+        for (std::size_t i = 0; i < m; i++) {
+            yRef[i] += dense[i + j * m] * x[j];
+            ytRef[j] += dense[i + j * m] * xt[i];
+        }
+    }
+
+    auto& pool = utilities::details::ThreadPool::instance();
+    const std::size_t nThreads = pool.size();
+    std::vector<double> y(m, -1.);
+    std::vector<double> yt(n, -1.);
+    A.multiply(std::span<const double>(x), std::span(y));
+    A.multiplyTransposed(std::span<const double>(xt), std::span(yt));
+    for (std::size_t i = 0; i < m; i++) {
+        ASSERT_NEAR(y[i], yRef[i], 1e-12);
+    }
+    for (std::size_t j = 0; j < n; j++) {
+        ASSERT_NEAR(yt[j], ytRef[j], 1e-12);
+    }
+
+    // The same bits on any number of threads.
+    pool.resize(4);
+    std::vector<double> y4(m);
+    std::vector<double> yt4(n);
+    A.multiply(std::span<const double>(x), std::span(y4));
+    A.multiplyTransposed(std::span<const double>(xt), std::span(yt4));
+    EXPECT_EQ(y4, y);
+    EXPECT_EQ(yt4, yt);
+
+    // Eleven columns: a block of eight and a block of three.
+    utilities::details::BlockData<2, double> X(n, 11);
+    for (std::size_t k = 0; k < X.size(); k++) {
+        X.data()[k] = uniform(generator);
+    }
+    auto Y = A.multiply(X);
+    pool.resize(nThreads);
+    EXPECT_EQ(Y.dims(), (std::array<std::size_t, 2>{m, 11}));
+    for (std::size_t c = 0; c < 11; c++) {
+        std::vector<double> column(m);
+        A.multiply(std::span<const double>(X.data() + c * n, n), std::span(column));
+        EXPECT_TRUE(std::equal(column.begin(), column.end(), Y.data() + c * m));
+    }
+
+    // A copy builds its own CSR mirror, here from several threads at once.
+    const utilities::Sparse<double> B(A);
+    std::vector<std::vector<double>> yThreads(4, std::vector<double>(m));
+    std::vector<std::thread> threads;
+    for (auto& yThread : yThreads) {
+        threads.emplace_back([&B, &x, &yThread]() { B.multiply(std::span<const double>(x), std::span(yThread)); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (const auto& yThread : yThreads) {
+        EXPECT_EQ(yThread, y);
+    }
+
+    EXPECT_THROW(A.multiply(std::span<const double>(xt), std::span(y)), std::invalid_argument);
+    EXPECT_THROW(A.multiplyTransposed(std::span<const double>(x), std::span(yt)), std::invalid_argument);
+    EXPECT_THROW(A.multiply(utilities::details::BlockData<2, double>(m, 2)), std::invalid_argument);
+}
+
+namespace {
+
+// A random m x n matrix with about density of its elements non-zero, dense
+// column major and sparse.
+std::pair<std::vector<double>, utilities::Sparse<double>> randomSparse(std::size_t m, std::size_t n, double density, std::mt19937& generator) {
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    std::vector<double> dense(m * n, 0.);
+    for (double& x : dense) {
+        if (uniform(generator) < density) {
+            x = uniform(generator) + 0.5;
+        }
+    }
+    utilities::Sparse<double> A;
+    A.setDense(dense.data(), m, n, 0.);
+    return {dense, A};
+}
+
+std::vector<double> toDense(const utilities::Sparse<double>& A) {
+    std::vector<double> dense(A.getNumberOfRows() * A.getNumberOfColumns(), 0.);
+    const auto linear = A.linearIndices();
+    for (std::size_t k = 0; k < linear.size(); k++) {
+        dense[linear[k]] = A.nonZeroValues()[k];
+    }
+    return dense;
+}
+
+} // namespace
+
+TEST(SparseTest, SumPlan)
+{
+    std::mt19937 generator(17);
+    auto [a, A] = randomSparse(60, 50, 0.1, generator);
+    auto [b, B] = randomSparse(60, 50, 0.1, generator);
+    utilities::SparseSumPlan<double> plan(A, B);
+    auto C = plan.compute(A, B, 2., -1.);
+    EXPECT_EQ(C.getNumberOfNonZeroElements(), plan.getNumberOfNonZeroElements());
+    auto c = toDense(C);
+    for (std::size_t k = 0; k < c.size(); k++) {
+        ASSERT_DOUBLE_EQ(c[k], 2. * a[k] - b[k]);
+    }
+
+    // New values on the same patterns.
+    const auto pattern = C.linearIndices();
+    for (double& x : A.nonZeroValues()) {
+        x = -x;
+    }
+    plan.compute(A, B, C, 2., -1.);
+    EXPECT_EQ(C.linearIndices(), pattern);
+    c = toDense(C);
+    for (std::size_t k = 0; k < c.size(); k++) {
+        ASSERT_DOUBLE_EQ(c[k], -2. * a[k] - b[k]);
+    }
+    // Values that cancel stay in the pattern.
+    utilities::SparseSumPlan<double> same(A, A);
+    auto Z = same.compute(A, A, 1., -1.);
+    EXPECT_EQ(Z.linearIndices(), A.linearIndices());
+    EXPECT_TRUE(std::ranges::all_of(Z.nonZeroValues(), [](double x) { return x == 0.; }));
+    EXPECT_THROW(plan.compute(A, A, C), std::invalid_argument);
+
+    // A + sigma*I.
+    std::vector<std::size_t> diagonal;
+    for (std::size_t i = 0; i < 50; i++) {
+        diagonal.push_back(i * 61);
+    }
+    utilities::Sparse<double> I(60, 50, diagonal, std::vector<double>(50, 1.));
+    utilities::SparseSumPlan<double> shift(A, I);
+    auto S = shift.compute(A, I, 1., 3.);
+    auto sDense = toDense(S);
+    for (std::size_t j = 0; j < 50; j++) {
+        for (std::size_t i = 0; i < 60; i++) {
+            ASSERT_DOUBLE_EQ(sDense[i + j * 60], -a[i + j * 60] + (i == j ? 3. : 0.));
+        }
+    }
+    EXPECT_THROW((utilities::SparseSumPlan<double>(A, utilities::Sparse<double>(50, 60))), std::invalid_argument);
+
+    // Same column counts, other rows.
+    utilities::Sparse<double> e0(3, 1, {0}, {1.});
+    utilities::Sparse<double> e1(3, 1, {1}, {2.});
+    utilities::Sparse<double> e2(3, 1, {2}, {5.});
+    utilities::SparseSumPlan<double> unit(e0, e1);
+    utilities::Sparse<double> E;
+    EXPECT_THROW(unit.compute(e2, e1, E), std::invalid_argument);
+    EXPECT_THROW(unit.compute(e0, e2, E), std::invalid_argument);
+}
+
+TEST(SparseTest, ProductPlan)
+{
+    std::mt19937 generator(19);
+    auto [a, A] = randomSparse(300, 200, 0.05, generator);
+    auto [b, B] = randomSparse(200, 250, 0.05, generator);
+    auto& pool = utilities::details::ThreadPool::instance();
+    const std::size_t nThreads = pool.size();
+    pool.resize(4);
+    utilities::SparseProductPlan<double> plan(A, B);
+    auto C = plan.compute(A, B);
+    pool.resize(nThreads);
+    auto c = toDense(C);
+    for (std::size_t j = 0; j < 250; j++) {
+        for (std::size_t i = 0; i < 300; i++) {
+            double sum = 0.;
+            for (std::size_t l = 0; l < 200; l++) {
+                sum += a[i + l * 300] * b[l + j * 200];
+            }
+            ASSERT_NEAR(c[i + j * 300], sum, 1e-12);
+        }
+    }
+    // The same bits on one thread.
+    utilities::Sparse<double> C1;
+    plan.compute(A, B, C1);
+    EXPECT_TRUE(std::ranges::equal(C1.nonZeroValues(), C.nonZeroValues()));
+    EXPECT_TRUE(std::ranges::equal(C1.rowIndices(), C.rowIndices()));
+
+    // J'*J with new values in J.
+    auto Jt = A.transposed();
+    utilities::SparseProductPlan<double> normal(Jt, A);
+    auto N = normal.compute(Jt, A);
+    for (double& x : A.nonZeroValues()) {
+        x *= 2.;
+    }
+    normal.compute(A.transposed(), A, N);
+    auto n = toDense(N);
+    for (std::size_t j = 0; j < 200; j++) {
+        for (std::size_t i = 0; i < 200; i++) {
+            double sum = 0.;
+            for (std::size_t l = 0; l < 300; l++) {
+                sum += 4. * a[l + i * 300] * a[l + j * 300];
+            }
+            ASSERT_NEAR(n[i + j * 200], sum, 1e-12);
+        }
+    }
+    EXPECT_THROW(normal.compute(A, Jt, N), std::invalid_argument);
+    EXPECT_THROW((utilities::SparseProductPlan<double>(A, A)), std::invalid_argument);
+
+    // Same column counts, other rows.
+    utilities::Sparse<double> e0(3, 1, {0}, {1.});
+    utilities::Sparse<double> e2(3, 1, {2}, {1.});
+    utilities::Sparse<double> one(1, 1, {0}, {2.});
+    utilities::SparseProductPlan<double> outer(e0, one);
+    utilities::Sparse<double> E;
+    EXPECT_THROW(outer.compute(e2, one, E), std::invalid_argument);
+    outer.compute(e0, one, E);
+    EXPECT_TRUE(std::ranges::equal(E.linearIndices(), std::vector<std::size_t>{0}));
+}
+
+namespace {
+
+// The previous representation: column major linear offsets, with rows and
+// columns recovered by % m and / m on every export.
+struct LinearOffsets {
+    std::size_t m, n;
+    std::vector<std::size_t> iOffset;
+    std::vector<double> values;
+
+    void getCsc(std::span<std::size_t> columnBounds, std::span<std::size_t> iRow, std::span<double> val) const {
+        std::vector<std::size_t> columnProxy(n, 0);
+        for (std::size_t i = 0; i < iOffset.size(); i++) {
+            std::size_t idx = iOffset[i];
+            columnProxy[idx / m] += 1;
+            iRow[i] = idx % m;
+            val[i] = values[i];
+        }
+        std::fill(columnBounds.begin(), columnBounds.end(), 0);
+        for (std::size_t i = 0; i < n; i++) {
+            columnBounds[i + 1] = columnBounds[i] + columnProxy[i];
+        }
+    }
+
+    void getCsr(std::span<std::size_t> rowBounds, std::span<std::size_t> jCol, std::span<double> val) const {
+        std::vector<std::size_t> rowCount(m, 0);
+        for (std::size_t idx : iOffset) {
+            rowCount[idx % m] += 1;
+        }
+        std::fill(rowBounds.begin(), rowBounds.end(), 0);
+        for (std::size_t iRow = 0; iRow < m; iRow++) {
+            rowBounds[iRow + 1] = rowBounds[iRow] + rowCount[iRow];
+        }
+        std::fill(rowCount.begin(), rowCount.end(), 0);
+        for (std::size_t i = 0; i < iOffset.size(); i++) {
+            std::size_t idx = iOffset[i];
+            std::size_t iRow = idx % m;
+            jCol[rowBounds[iRow] + rowCount[iRow]] = idx / m;
+            val[rowBounds[iRow] + rowCount[iRow]] = values[i];
+            rowCount[iRow] += 1;
+        }
+    }
+};
+
+} // namespace
+
+TEST(SparseBenchmark, CompressedVersusLinearOffsets)
+{
+    // 10^5 x 10^5 with 40 random non-zeros per column, exported repeatedly
+    // as from a mex function called in a loop.
+    const std::size_t m = 100000;
+    const std::size_t n = 100000;
+    const std::size_t perColumn = 40;
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<std::size_t> row(0, m - 1);
+    std::vector<std::size_t> linear;
+    for (std::size_t j = 0; j < n; j++) {
+        std::vector<std::size_t> rows(perColumn);
+        std::generate(rows.begin(), rows.end(), [&]() { return row(generator); });
+        std::sort(rows.begin(), rows.end());
+        rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+        for (std::size_t i : rows) {
+            linear.push_back(i + j * m);
+        }
+    }
+    const std::size_t nnz = linear.size();
+    std::vector<double> values(nnz, 1.);
+    const LinearOffsets before{m, n, linear, values};
+    const utilities::Sparse<double> after(m, n, linear, values);
+
+    std::vector<std::size_t> bounds(std::max(m, n) + 1), indices(nnz);
+    std::vector<double> val(nnz);
+    const double bytes = static_cast<double>(nnz * (sizeof(std::size_t) + sizeof(double)));
+    double cscBefore = timing::best(5, [&]() { before.getCsc(bounds, indices, val); });
+    double cscAfter = timing::best(5, [&]() { after.getCsc<std::size_t>(bounds, indices, val); });
+    double csrBefore = timing::best(5, [&]() { before.getCsr(bounds, indices, val); });
+    double csrAfter = timing::best(5, [&]() { after.getCsr<std::size_t>(bounds, indices, val); });
+    timing::report("getCsc, linear offsets", cscBefore, bytes);
+    timing::report("getCsc, compressed columns", cscAfter, bytes);
+    timing::report("getCsr, linear offsets", csrBefore, bytes);
+    timing::report("getCsr, cached pattern", csrAfter, bytes);
+    EXPECT_EQ(bounds[m], nnz);
+}
+
+TEST(SparseBenchmark, DenseToSparse)
+{
+    // A 4096 x 4096 dense Jacobian with a quarter of its elements non-zero,
+    // converted the way set(TypedArray) used to, element by element with
+    // push_back (minus the proxy indexing, which needs MATLAB), and with
+    // setDense.
+    const std::size_t m = 4096;
+    const std::size_t n = 4096;
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<double> uniform(-1., 1.);
+    std::vector<double> dense(m * n);
+    for (double& x : dense) {
+        const double u = uniform(generator);
+        x = std::abs(u) < 0.75 ? 0. : u;
+    }
+
+    std::size_t nnzBefore = 0;
+    double before = timing::best(3, [&]() {
+        std::vector<std::size_t> colBnd(n + 1, 0);
+        std::vector<std::uint32_t> rows;
+        std::vector<double> values;
+        for (std::size_t j = 0; j < n; j++) {
+            for (std::size_t i = 0; i < m; i++) {
+                if (std::abs(dense[i + j * m]) > std::numeric_limits<double>::epsilon()) {
+                    rows.push_back(static_cast<std::uint32_t>(i));
+                    values.push_back(dense[i + j * m]);
+                }
+            }
+            colBnd[j + 1] = values.size();
+        }
+        nnzBefore = values.size();
+    });
+    utilities::Sparse<double> A;
+    double after = timing::best(3, [&]() { A.setDense(dense.data(), m, n); });
+    const double bytes = static_cast<double>(m * n * sizeof(double));
+    timing::report("dense -> sparse, push_back", before, bytes);
+    timing::report("dense -> sparse, setDense", after, bytes);
+    EXPECT_EQ(A.getNumberOfNonZeroElements(), nnzBefore);
+}
+
+TEST(SparseBenchmark, AssembleTriplets)
+{
+    // 2^21 finite element style triplets, about four per non-zero, assembled
+    // by sorting (column, row) pairs and summing runs, and with assemble.
+    const std::size_t m = 1 << 16;
+    const std::size_t n = 1 << 16;
+    const std::size_t nnz = std::size_t{1} << 21;
+    std::mt19937 generator(11);
+    std::uniform_int_distribution<std::uint32_t> col(0, n - 1);
+    std::uniform_int_distribution<std::uint32_t> offset(0, 3);
+    std::vector<std::uint32_t> rows(nnz);
+    std::vector<std::uint32_t> cols(nnz);
+    std::vector<double> values(nnz);
+    for (std::size_t k = 0; k < nnz; k++) {
+        cols[k] = col(generator);
+        rows[k] = (cols[k] + offset(generator) * 977) % m;
+        values[k] = 1. + static_cast<double>(k % 3);
+    }
+
+    std::size_t nnzBefore = 0;
+    double before = timing::best(3, [&]() {
+        std::vector<std::size_t> order(nnz);
+        std::iota(order.begin(), order.end(), std::size_t{0});
+        std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+            return cols[a] != cols[b] ? cols[a] < cols[b] : rows[a] < rows[b];
+        });
+        std::vector<std::uint32_t> iRows;
+        std::vector<double> sums;
+        std::vector<std::size_t> colBnd(n + 1, 0);
+        for (std::size_t k = 0; k < nnz; k++) {
+            const std::size_t t = order[k];
+            if (k > 0 && cols[t] == cols[order[k - 1]] && rows[t] == rows[order[k - 1]]) {
+                sums.back() += values[t];
+            } else {
+                iRows.push_back(rows[t]);
+                sums.push_back(values[t]);
+                colBnd[cols[t] + 1] += 1;
+            }
+        }
+        std::partial_sum(colBnd.begin(), colBnd.end(), colBnd.begin());
+        nnzBefore = sums.size();
+    });
+    utilities::Sparse<double> A(m, n);
+    double after = timing::best(3, [&]() {
+        A.assemble(std::span<const std::uint32_t>(rows), std::span<const std::uint32_t>(cols), std::span<const double>(values));
+    });
+    const double bytes = static_cast<double>(nnz * (2 * sizeof(std::uint32_t) + sizeof(double)));
+    timing::report("assemble, sort and sum", before, bytes);
+    timing::report("assemble, counting sort", after, bytes);
+    EXPECT_EQ(A.getNumberOfNonZeroElements(), nnzBefore);
+}
+
+TEST(SparseBenchmark, UpdateValues)
+{
+    // A Newton loop's Jacobian, 2^20 non-zeros with the pattern of the
+    // previous iteration: the two pattern merge updateValues did every call,
+    // the cached map, and writing into the values in place.
+    const std::size_t m = 1 << 16;
+    const std::size_t n = 1 << 16;
+    const std::size_t nnz = std::size_t{1} << 20;
+    std::vector<std::size_t> linear(nnz);
+    std::vector<double> nonZeros(nnz);
+    for (std::size_t k = 0; k < nnz; k++) {
+        linear[k] = (k / 16) * m + (k % 16) * 1021;
+        nonZeros[k] = static_cast<double>(k % 11);
+    }
+    utilities::Sparse<double> A(m, n, linear, std::vector<double>(nnz, 1.));
+
+    std::vector<double> merged(nnz);
+    double before = timing::best(5, [&]() {
+        const auto colBnd = A.columnBounds();
+        const auto iRows = A.rowIndices();
+        std::size_t kA = 0;
+        std::size_t jA = 0;
+        auto column = [&]() {
+            while (jA < n && colBnd[jA + 1] <= kA) {
+                jA++;
+            }
+            return jA;
+        };
+        for (std::size_t k = 0; k < nnz; k++) {
+            const std::size_t i = linear[k] % m;
+            const std::size_t j = linear[k] / m;
+            while (kA < nnz && (column() < j || (column() == j && iRows[kA] < i))) {
+                merged[kA++] = 0.;
+            }
+            if (kA < nnz && column() == j && iRows[kA] == i) {
+                merged[kA++] = nonZeros[k];
+            }
+        }
+        std::fill(merged.begin() + static_cast<std::ptrdiff_t>(kA), merged.end(), 0.);
+    });
+    auto update = [&]() { A.updateValues(std::span<const std::size_t>(linear), std::span<const double>(nonZeros)); };
+    update();
+    double cached = timing::best(5, update);
+    double inPlace = timing::best(5, [&]() { std::ranges::copy(nonZeros, A.nonZeroValues().begin()); });
+    const double bytes = static_cast<double>(nnz * (sizeof(std::size_t) + 2 * sizeof(double)));
+    timing::report("updateValues, merge", before, bytes);
+    timing::report("updateValues, cached map", cached, bytes);
+    timing::report("values in place", inPlace, bytes);
+    EXPECT_TRUE(std::ranges::equal(A.nonZeroValues(), merged));
+}
+
+TEST(SparseBenchmark, Multiply)
+{
+    // 2^18 x 2^18 with 16 non-zeros per row, banded with some spread: A*x,
+    // A'*x and A*X for eight columns.  Bytes count the matrix and vectors
+    // once, flops one multiply and add per non-zero and column.
+    const std::size_t m = std::size_t{1} << 18;
+    const std::size_t n = m;
+    const std::size_t perRow = 16;
+    const std::size_t nnz = m * perRow;
+    std::mt19937 generator(13);
+    std::uniform_int_distribution<std::size_t> spread(0, 4095);
+    std::vector<std::uint32_t> rows(nnz);
+    std::vector<std::uint32_t> cols(nnz);
+    std::vector<double> values(nnz);
+    for (std::size_t k = 0; k < nnz; k++) {
+        rows[k] = static_cast<std::uint32_t>(k / perRow);
+        cols[k] = static_cast<std::uint32_t>((k / perRow + spread(generator)) % n);
+        values[k] = 1. / static_cast<double>(1 + k % perRow);
+    }
+    utilities::Sparse<double> A(m, n);
+    A.assemble(std::span<const std::uint32_t>(rows), std::span<const std::uint32_t>(cols), std::span<const double>(values));
+    const std::size_t nonZeros = A.getNumberOfNonZeroElements();
+
+    std::vector<double> x(n, 1.);
+    std::vector<double> y(m);
+    std::vector<double> yt(n);
+    utilities::details::BlockData<2, double> X(n, 8);
+    std::fill(X.begin(), X.end(), 1.);
+    utilities::details::BlockData<2, double> Y(m, 8);
+    A.multiply(std::span<const double>(x), std::span(y));
+
+    const double matrixBytes = static_cast<double>(nonZeros * (sizeof(double) + sizeof(std::uint32_t)));
+    const double vectorBytes = static_cast<double>((m + n) * sizeof(double));
+    double spmv = timing::best(5, [&]() { A.multiply(std::span<const double>(x), std::span(y)); });
+    double spmvt = timing::best(5, [&]() { A.multiplyTransposed(std::span<const double>(x), std::span(yt)); });
+    double spmm = timing::best(5, [&]() { A.multiply(X, Y); });
+    timing::report("A*x", spmv, matrixBytes + vectorBytes, 2. * static_cast<double>(nonZeros));
+    timing::report("A'*x", spmvt, matrixBytes + vectorBytes, 2. * static_cast<double>(nonZeros));
+    timing::report("A*X, 8 columns", spmm, matrixBytes + 8 * vectorBytes, 16. * static_cast<double>(nonZeros));
+    EXPECT_EQ(Y(5, 7), y[5]);
+}
+
+TEST(SparseBenchmark, SymbolicNumericSplit)
+{
+    // J'*J and J'*J + sigma*I for a 2^16 x 2^15 Jacobian with eight non-zeros
+    // per column, formed from scratch every iteration or with the plans made
+    // once.  Bytes count the operands and the result.
+    const std::size_t m = std::size_t{1} << 16;
+    const std::size_t n = std::size_t{1} << 15;
+    const std::size_t perCol = 8;
+    std::mt19937 generator(23);
+    std::uniform_int_distribution<std::size_t> spread(0, 255);
+    std::vector<std::uint32_t> rows(n * perCol);
+    std::vector<std::uint32_t> cols(n * perCol);
+    std::vector<double> values(n * perCol);
+    for (std::size_t k = 0; k < rows.size(); k++) {
+        cols[k] = static_cast<std::uint32_t>(k / perCol);
+        rows[k] = static_cast<std::uint32_t>((2 * cols[k] + spread(generator)) % m);
+        values[k] = 1. + static_cast<double>(k % 7);
+    }
+    utilities::Sparse<double> J(m, n);
+    J.assemble(std::span<const std::uint32_t>(rows), std::span<const std::uint32_t>(cols), std::span<const double>(values));
+    std::vector<std::size_t> diagonal(n);
+    for (std::size_t i = 0; i < n; i++) {
+        diagonal[i] = i * (n + 1);
+    }
+    utilities::Sparse<double> I(n, n, diagonal, std::vector<double>(n, 1.));
+    const auto Jt = J.transposed();
+
+    utilities::Sparse<double> N;
+    utilities::Sparse<double> S;
+    double fromScratch = timing::best(3, [&]() {
+        utilities::SparseProductPlan<double> normal(Jt, J);
+        normal.compute(Jt, J, N);
+        utilities::SparseSumPlan<double> shift(N, I);
+        shift.compute(N, I, S, 1., 1e-3);
+    });
+    utilities::SparseProductPlan<double> normal(Jt, J);
+    normal.compute(Jt, J, N);
+    utilities::SparseSumPlan<double> shift(N, I);
+    double numeric = timing::best(3, [&]() {
+        normal.compute(Jt, J, N);
+        shift.compute(N, I, S, 1., 1e-3);
+    });
+    const double bytes = static_cast<double>((2 * J.getNumberOfNonZeroElements() + N.getNumberOfNonZeroElements() + S.getNumberOfNonZeroElements()) *
+                                             (sizeof(double) + sizeof(std::uint32_t)));
+    timing::report("J'*J + sigma*I, symbolic and numeric", fromScratch, bytes);
+    timing::report("J'*J + sigma*I, numeric only", numeric, bytes);
+    EXPECT_GT(S.getNumberOfNonZeroElements(), n);
+}
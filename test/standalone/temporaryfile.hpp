@@ -0,0 +1,17 @@
+#ifndef TEMPORARYFILE_HPP
+#define TEMPORARYFILE_HPP
+#include <filesystem>
+#include <system_error>
+
+// A file in the temporary directory that is removed again.
+struct TemporaryFile {
+    std::filesystem::path path;
+
+    explicit TemporaryFile(const char* name) : path(std::filesystem::temp_directory_path() / name) {}
+    ~TemporaryFile() {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+};
+
+#endif // TEMPORARYFILE_HPP
@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+#include "details/threadpool.hpp"
+#include "timing.hpp"
+#include <atomic>
+#include <numeric>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+TEST(ThreadPoolTest, EveryIndexOnce)
+{
+    utilities::details::ThreadPool pool(4);
+    EXPECT_EQ(pool.size(), 4);
+    for (std::size_t n : {0, 1, 7, 1000, 100003}) {
+        std::vector<std::atomic<int>> visits(n);
+        pool.parallel_for(0, n, [&](std::size_t first, std::size_t last) {
+            for (std::size_t i = first; i < last; ++i) {
+                visits[i].fetch_add(1);
+            }
+        });
+        for (std::size_t i = 0; i < n; ++i) {
+            ASSERT_EQ(visits[i].load(), 1) << "index " << i << " of " << n;
+        }
+    }
+}
+
+TEST(ThreadPoolTest, GrainIsRespected)
+{
+    utilities::details::ThreadPool pool(3);
+    std::atomic<std::size_t> smallest{1000};
+    std::atomic<std::size_t> nPieces{0};
+    pool.parallel_for(10, 1010, [&](std::size_t first, std::size_t last) {
+        ++nPieces;
+        std::size_t size = last - first;
+        std::size_t current = smallest.load();
+        while (size < current && !smallest.compare_exchange_weak(current, size)) {
+        }
+    }, 50);
+    EXPECT_GE(smallest.load(), 50);
+    EXPECT_LE(nPieces.load(), 1000 / 50);
+}
+
+TEST(ThreadPoolTest, UsesSeveralThreads)
+{
+    utilities::details::ThreadPool pool(4);
+    std::mutex mutex;
+    std::set<std::thread::id> ids;
+    pool.parallel_for(0, 64, [&](std::size_t, std::size_t) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        std::lock_guard<std::mutex> lock(mutex);
+        ids.insert(std::this_thread::get_id());
+    }, 1);
+    EXPECT_GT(ids.size(), 1);
+}
+
+TEST(ThreadPoolTest, Nested)
+{
+    utilities::details::ThreadPool pool(4);
+    std::vector<std::atomic<int>> visits(64 * 64);
+    pool.parallel_for(0, 64, [&](std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last; ++i) {
+            pool.parallel_for(0, 64, [&](std::size_t b, std::size_t e) {
+                for (std::size_t j = b; j < e; ++j) {
+                    visits[i * 64 + j].fetch_add(1);
+                }
+            }, 4);
+        }
+    }, 1);
+    for (auto& visit : visits) {
+        ASSERT_EQ(visit.load(), 1);
+    }
+}
+
+TEST(ThreadPoolTest, SeveralCallers)
+{
+    utilities::details::ThreadPool pool(3);
+    std::vector<std::size_t> sums(4, 0);
+    std::vector<std::thread> callers;
+    for (std::size_t iCaller = 0; iCaller < sums.size(); ++iCaller) {
+        callers.emplace_back([&, iCaller]() {
+            std::atomic<std::size_t> sum{0};
+            pool.parallel_for(0, 10000, [&](std::size_t first, std::size_t last) {
+                std::size_t local = 0;
+                for (std::size_t i = first; i < last; ++i) {
+                    local += i;
+                }
+                sum += local;
+            });
+            sums[iCaller] = sum;
+        });
+    }
+    for (auto& caller : callers) {
+        caller.join();
+    }
+    for (auto sum : sums) {
+        EXPECT_EQ(sum, 10000 * 9999 / 2);
+    }
+}
+
+TEST(ThreadPoolTest, ExceptionsReachTheCaller)
+{
+    utilities::details::ThreadPool pool(4);
+    std::atomic<std::size_t> nDone{0};
+    EXPECT_THROW(pool.parallel_for(0, 1000, [&](std::size_t first, std::size_t last) {
+        if (first <= 500 && 500 < last) {
+            throw std::runtime_error("failed");
+        }
+        nDone += last - first;
+    }, 10), std::runtime_error);
+    EXPECT_LT(nDone.load(), 1000);
+
+    // The pool is still usable afterwards.
+    std::atomic<std::size_t> count{0};
+    pool.parallel_for(0, 100, [&](std::size_t first, std::size_t last) { count += last - first; });
+    EXPECT_EQ(count.load(), 100);
+}
+
+TEST(ThreadPoolTest, Resize)
+{
+    utilities::details::ThreadPool pool(1);
+    EXPECT_EQ(pool.size(), 1);
+    std::thread::id caller = std::this_thread::get_id();
+    pool.parallel_for(0, 100, [&](std::size_t, std::size_t) { EXPECT_EQ(std::this_thread::get_id(), caller); }, 1);
+
+    pool.resize(3);
+    EXPECT_EQ(pool.size(), 3);
+    std::atomic<std::size_t> count{0};
+    pool.parallel_for(0, 100, [&](std::size_t first, std::size_t last) { count += last - first; }, 1);
+    EXPECT_EQ(count.load(), 100);
+
+    EXPECT_GE(utilities::details::ThreadPool::instance().size(), 1);
+}
+
+TEST(ThreadPoolBenchmark, CallOverhead)
+{
+    utilities::details::ThreadPool pool(utilities::details::ThreadPool::defaultThreadCount());
+    std::vector<double> x(1 << 20, 1.);
+    double seconds = timing::best(20, [&]() {
+        pool.parallel_for(0, x.size(), [&](std::size_t first, std::size_t last) {
+            for (std::size_t i = first; i < last; ++i) {
+                x[i] = x[i] * 0.5 + 1.;
+            }
+        });
+    });
+    timing::report("parallel_for axpy 1M, " + std::to_string(pool.size()) + " threads", seconds, 2. * x.size() * sizeof(double));
+    double empty = timing::best(1000, [&]() {
+        pool.parallel_for(0, 64, [](std::size_t, std::size_t) {}, 1);
+    });
+    timing::report("parallel_for empty body", empty, 0.);
+}
@@ -0,0 +1,36 @@
+#ifndef TIMING_HPP
+#define TIMING_HPP
+#include <chrono>
+#include <cstdio>
+#include <string_view>
+
+namespace timing {
+
+// Best of nRepeats wall clock times of fn() in seconds.
+template <typename Fn>
+double best(std::size_t nRepeats, Fn&& fn) {
+    double best = 0.;
+    for (std::size_t iRepeat = 0; iRepeat < nRepeats; ++iRepeat) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (iRepeat == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+    return best;
+}
+
+inline void report(std::string_view name, double seconds, double bytes) {
+    std::printf("[ BENCH    ] %-40.*s %10.3f us %10.2f GB/s\n",
+                static_cast<int>(name.size()), name.data(), seconds * 1e6, bytes / seconds * 1e-9);
+}
+
+// As above, with the rate of flops floating point operations.
+inline void report(std::string_view name, double seconds, double bytes, double flops) {
+    std::printf("[ BENCH    ] %-40.*s %10.3f us %10.2f GB/s %8.2f GFLOP/s\n",
+                static_cast<int>(name.size()), name.data(), seconds * 1e6, bytes / seconds * 1e-9, flops / seconds * 1e-9);
+}
+
+} // namespace timing
+#endif // TIMING_HPP
@@ -1,51 +1,172 @@
+#include <gtest/gtest.h>
+#include "details/blockdata.hpp"
+#include "details/stridedview.hpp"
+#include "timing.hpp"
 #include <vector>
+#include <numeric>
 #include <ranges>
 #include <fmt/ranges.h>
 
+namespace views = utilities::details::views;
 
-void print_range(const std::ranges::range auto& r) {
-    fmt::print("{}\n", r);
+namespace {
+
+// nRows x nCols x nPages with element (i, j, k) = 100 k + 10 j + i.
+std::vector<int> makeBlock(std::size_t nRows, std::size_t nCols, std::size_t nPages) {
+    std::vector<int> v(nRows * nCols * nPages);
+    for (std::size_t iPage = 0; iPage < nPages; ++iPage) {
+        for (std::size_t jCol = 0; jCol < nCols; ++jCol) {
+            for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
+                v[iPage * nRows * nCols + jCol * nRows + iRow] = static_cast<int>(iPage * 100 + jCol * 10 + iRow);
+            }
+        }
+    }
+    return v;
+}
+
+} // namespace
+
+TEST(StridedViewTest, Concepts)
+{
+    std::vector<double> v(24);
+    using Strided = decltype(v | views::strided(1, 3, 8));
+    using Slice = decltype(v | views::slice(12, 12));
+    static_assert(std::ranges::random_access_range<Strided>);
+    static_assert(std::ranges::sized_range<Strided>);
+    static_assert(std::ranges::view<Strided>);
+    static_assert(std::ranges::borrowed_range<Strided>);
+    static_assert(std::ranges::contiguous_range<Slice>);
+    static_assert(std::ranges::sized_range<Slice>);
+    static_assert(std::ranges::contiguous_range<decltype(v | views::slice(12, 12) | views::slice(3, 3))>);
+    // Rows of pages and slices of rows stay single strided views.
+    static_assert(std::is_same_v<decltype(v | views::slice(12, 12) | views::strided(1, 3, 4)), Strided>);
+    static_assert(std::is_same_v<decltype(v | views::strided(1, 3, 8) | views::strided(1, 2, 4)), Strided>);
+    static_assert(std::is_same_v<decltype(v | views::strided(1, 3, 8) | views::slice(1, 4)), Strided>);
+    EXPECT_EQ(std::ranges::data(v | views::slice(12, 12)), v.data() + 12);
 }
 
-void increment_range(std::ranges::range auto&& r) {
-    for (auto& elem : r) {
-        elem += 5;
+TEST(StridedViewTest, Composition)
+{
+    constexpr std::size_t nRows = 3;
+    constexpr std::size_t nCols = 4;
+    constexpr std::size_t nPages = 2;
+    auto v = makeBlock(nRows, nCols, nPages);
+
+    auto page1 = v | views::slice(nRows * nCols, nRows * nCols);
+    EXPECT_EQ(page1.front(), 100);
+    EXPECT_EQ(page1.size(), nRows * nCols);
+
+    auto page1row2 = page1 | views::strided(2, nRows, nCols);
+    EXPECT_EQ(fmt::format("{}", page1row2), "[102, 112, 122, 132]");
+    EXPECT_EQ(page1row2.stride(), nRows);
+    EXPECT_EQ(page1row2[3], 132);
+    EXPECT_EQ(page1row2.end() - page1row2.begin(), 4);
+
+    auto fibre = v | views::strided(1 + 2 * nRows, nRows * nCols, nPages);
+    EXPECT_EQ(fmt::format("{}", fibre), "[21, 121]");
+
+    // Every other element of a row.
+    auto everyOther = page1row2 | views::strided(1, 2, 2);
+    EXPECT_EQ(fmt::format("{}", everyOther), "[112, 132]");
+    EXPECT_EQ(fmt::format("{}", page1row2 | views::slice(1, 2)), "[112, 122]");
+
+    for (auto& elem : v | views::strided(0, nRows, nCols * nPages)) {
+        elem = -1;
     }
+    EXPECT_EQ(v[nRows], -1);
+    EXPECT_EQ(v[nRows + 1], 11);
+
+    EXPECT_THROW(v | views::strided(2, nRows, nCols * nPages + 1), std::out_of_range);
+    EXPECT_THROW(page1 | views::slice(1, nRows * nCols), std::out_of_range);
+    EXPECT_NO_THROW(v | views::strided(v.size(), 1, 0));
 }
 
+TEST(StridedViewTest, BlockDataV)
+{
+    utilities::details::BlockDataV<3, double> bd(3, 4, 2);
+    std::iota(bd.all().begin(), bd.all().end(), 0.);
+    auto page = bd.all() | bd.page(1);
+    static_assert(std::ranges::contiguous_range<decltype(page)>);
+    EXPECT_EQ(std::ranges::data(page), &bd(0, 0, 1));
+    auto row = bd.all() | bd.page(1) | bd.row(2);
+    EXPECT_TRUE(std::ranges::equal(row, std::vector<double>{14., 17., 20., 23.}));
+    auto column = bd.all() | bd.col(3);
+    EXPECT_TRUE(std::ranges::equal(column, std::vector<double>{9., 10., 11.}));
+    auto fibre = bd.all() | bd.tensorial(1, 2);
+    EXPECT_TRUE(std::ranges::equal(fibre, std::vector<double>{7., 19.}));
+}
 
-int main() {
-    // std::vector<int> v {0,1,2,3,4,5,6,7,8};
-    // fmt::print("{}\n", std::views::stride(v,2)); // [0,2,4,6,8]
-    // fmt::print("{}\n", std::views::stride(v,3)); // [0,3,6]
-    // // using pipeline notation:
-    // fmt::print("{}\n", v | std::views::drop(3) | std::views::stride(2)); // [0,2,4,6,8]
-    // // using an explicit view object:
-    // std::ranges::stride_view sv2 {v,2};
-    // fmt::print("{}\n", sv2); // [0,2,4,6,8]
-    // increment_range(v | std::views::drop(3) | std::views::stride(2));
-    // print_range(v | std::views::drop(3) | std::views::stride(2));
-    // print_range(v | std::views::all );
-
-    constexpr auto nRows = 3;
-    constexpr auto nCols = 4;
-    constexpr auto nPages = 2;
-    std::vector<int> v(nRows * nCols * nPages);
+namespace {
 
-    for (std::size_t iPage = 0; iPage < nPages; ++iPage) {
+template <typename Range>
+double sum(Range&& r) {
+    double total = 0.;
+    for (auto value : r) {
+        total += value;
+    }
+    return total;
+}
+
+} // namespace
+
+TEST(StridedViewBenchmark, AgainstPipelines)
+{
+    // Sum every row, column and fibre of outputs x directions x points.
+    const std::size_t nRows = 8;
+    const std::size_t nCols = 64;
+    const std::size_t nPages = 4096;
+    std::vector<double> v(nRows * nCols * nPages);
+    std::iota(v.begin(), v.end(), 0.);
+    const double bytes = static_cast<double>(v.size() * sizeof(double));
+    double total = 0.;
+
+    double columns = timing::best(5, [&]() {
+        for (std::size_t jCol = 0; jCol < nCols * nPages; ++jCol) {
+            total += sum(v | views::slice(jCol * nRows, nRows));
+        }
+    });
+    double columnsPipeline = timing::best(5, [&]() {
+        for (std::size_t jCol = 0; jCol < nCols * nPages; ++jCol) {
+            total += sum(v | std::views::drop(jCol * nRows) | std::views::take(nRows));
+        }
+    });
+    double rows = timing::best(5, [&]() {
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            auto page = v | views::slice(kPage * nRows * nCols, nRows * nCols);
+            for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
+                total += sum(page | views::strided(iRow, nRows, nCols));
+            }
+        }
+    });
+    double fibres = timing::best(5, [&]() {
         for (std::size_t jCol = 0; jCol < nCols; ++jCol) {
             for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
-                v[iPage * nRows * nCols + jCol * nRows + iRow] = iPage * 100 + jCol * 10 + iRow;
+                total += sum(v | views::strided(iRow + jCol * nRows, nRows * nCols, nPages));
             }
         }
-    }
-
-    auto page1 = v | std::views::take(nRows * nCols);
-    auto page2 = v | std::views::drop(nRows * nCols) | std::views::take(nRows * nCols);
-    auto page2row2 = page2 | std::views::drop(1) | std::views::stride(nRows) | std::views::take(nCols);
-    print_range(page1);
-    print_range(page2);
-    print_range(page2row2);
-
-    return 0;
-}
\ No newline at end of file
+    });
+    timing::report("columns, slice", columns, bytes);
+    timing::report("columns, drop | take", columnsPipeline, bytes);
+    timing::report("rows of pages, slice | strided", rows, bytes);
+    timing::report("fibres, strided", fibres, bytes);
+#if defined(__cpp_lib_ranges_stride)
+    double rowsPipeline = timing::best(5, [&]() {
+        for (std::size_t kPage = 0; kPage < nPages; ++kPage) {
+            auto page = v | std::views::drop(kPage * nRows * nCols) | std::views::take(nRows * nCols);
+            for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
+                total += sum(page | std::views::drop(iRow) | std::views::stride(nRows) | std::views::take(nCols));
+            }
+        }
+    });
+    double fibresPipeline = timing::best(5, [&]() {
+        for (std::size_t jCol = 0; jCol < nCols; ++jCol) {
+            for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
+                total += sum(v | std::views::drop(iRow + jCol * nRows) | std::views::stride(nRows * nCols) | std::views::take(nPages));
+            }
+        }
+    });
+    timing::report("rows of pages, drop | stride | take", rowsPipeline, bytes);
+    timing::report("fibres, drop | stride | take", fibresPipeline, bytes);
+#endif // defined(__cpp_lib_ranges_stride)
+    EXPECT_GT(total, 0.);
+}
@@ -0,0 +1,179 @@
+#ifndef ALLOCATOR_HPP
+#define ALLOCATOR_HPP
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace utilities::details {
+
+// Alignment of owned BlockData storage, one cache line / one AVX-512 register.
+inline constexpr std::size_t simd_alignment = 64;
+
+template <typename T, std::size_t Alignment = simd_alignment>
+struct aligned_allocator {
+    static_assert(Alignment >= alignof(T) && std::has_single_bit(Alignment), "Invalid alignment");
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = aligned_allocator<U, Alignment>;
+    };
+
+    aligned_allocator() noexcept = default;
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, Alignment>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{Alignment}));
+    }
+
+    void deallocate(T* ptr, std::size_t) noexcept {
+        ::operator delete(ptr, std::align_val_t{Alignment});
+    }
+
+    template <typename U>
+    bool operator==(const aligned_allocator<U, Alignment>&) const noexcept { return true; }
+};
+
+// Size bucketed cache of aligned blocks.  Freed blocks are kept for reuse so
+// that code which allocates the same shapes on every call (e.g. once per
+// MexFunction::operator()) stops hitting the system allocator after the first
+// call.  instance() lives as long as the loaded mex.
+//
+// Pooled blocks are rounded up to a power of two, so requests larger than
+// maxBlockBytes, where that rounding would waste the most, bypass the pool
+// and are allocated at their own size.  Blocks freed while the cache already
+// holds maxCachedBytes are returned to the system.
+class BufferPool {
+    static constexpr std::size_t nBuckets = std::numeric_limits<std::size_t>::digits;
+    std::array<std::vector<void*>, nBuckets> _free;
+    std::size_t _maxBlockBytes;
+    std::size_t _maxCachedBytes;
+    std::size_t _upstreamAllocations{0};
+    std::size_t _cachedBytes{0};
+    mutable std::mutex _mutex;
+
+    static std::size_t bucket(std::size_t bytes) {
+        return std::bit_width(std::max(bytes, simd_alignment) - 1);
+    }
+
+public:
+    static constexpr std::size_t defaultMaxBlockBytes = std::size_t{1} << 26;
+    static constexpr std::size_t defaultMaxCachedBytes = std::size_t{1} << 28;
+
+    explicit BufferPool(std::size_t maxBlockBytes = defaultMaxBlockBytes, std::size_t maxCachedBytes = defaultMaxCachedBytes)
+        : _maxBlockBytes(maxBlockBytes), _maxCachedBytes(maxCachedBytes) {}
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+    ~BufferPool() {
+        trim();
+    }
+
+    static BufferPool& instance() {
+        static BufferPool pool;
+        return pool;
+    }
+
+    void* allocate(std::size_t bytes) {
+        if (bytes > _maxBlockBytes) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                ++_upstreamAllocations;
+            }
+            return ::operator new(bytes, std::align_val_t{simd_alignment});
+        }
+        std::size_t iBucket = bucket(bytes);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto& list = _free[iBucket];
+            if (!list.empty()) {
+                void* ptr = list.back();
+                list.pop_back();
+                _cachedBytes -= std::size_t{1} << iBucket;
+                return ptr;
+            }
+            ++_upstreamAllocations;
+        }
+        return ::operator new(std::size_t{1} << iBucket, std::align_val_t{simd_alignment});
+    }
+
+    // Never throws: a block that cannot be recorded for reuse is freed.
+    void deallocate(void* ptr, std::size_t bytes) noexcept {
+        if (bytes <= _maxBlockBytes) {
+            std::size_t iBucket = bucket(bytes);
+            std::size_t blockBytes = std::size_t{1} << iBucket;
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_cachedBytes + blockBytes <= _maxCachedBytes) {
+                try {
+                    _free[iBucket].push_back(ptr);
+                    _cachedBytes += blockBytes;
+                    return;
+                } catch (const std::bad_alloc&) {
+                }
+            }
+        }
+        ::operator delete(ptr, std::align_val_t{simd_alignment});
+    }
+
+    // Returns all cached blocks to the system.
+    void trim() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (std::size_t iBucket = 0; iBucket < nBuckets; ++iBucket) {
+            for (void* ptr : _free[iBucket]) {
+                ::operator delete(ptr, std::align_val_t{simd_alignment});
+            }
+            _free[iBucket].clear();
+        }
+        _cachedBytes = 0;
+    }
+
+    // Number of blocks that had to be requested from the system allocator.
+    std::size_t upstreamAllocations() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _upstreamAllocations;
+    }
+
+    std::size_t cachedBytes() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _cachedBytes;
+    }
+};
+
+// Allocator drawing from a BufferPool, by default the process wide one.
+template <typename T>
+struct pool_allocator {
+    static_assert(alignof(T) <= simd_alignment, "Invalid alignment");
+    using value_type = T;
+
+    BufferPool* pool{&BufferPool::instance()};
+
+    pool_allocator() noexcept = default;
+    explicit pool_allocator(BufferPool& pool) noexcept : pool(&pool) {}
+    template <typename U>
+    pool_allocator(const pool_allocator<U>& other) noexcept : pool(other.pool) {}
+
+    T* allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T*>(pool->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t n) noexcept {
+        pool->deallocate(ptr, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const pool_allocator<U>& other) const noexcept { return pool == other.pool; }
+};
+
+} // namespace utilities::details
+#endif // ALLOCATOR_HPP
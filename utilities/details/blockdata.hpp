@@ -10,64 +10,172 @@
 #include <exception>
 #include <ranges>
 #include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include "allocator.hpp"
+#include "convert.hpp"
+#include "storage.hpp"
+#include "blockview.hpp"
+#include "layout.hpp"
+#include "stridedview.hpp"
+#include "transpose.hpp"
 
 namespace utilities::details {
 
-template <std::size_t N, typename T>
+// The first N of dims, padded with ones.  Further dimensions must be
+// singleton, as the trailing 1 of every MATLAB vector is.
+template <std::size_t N, std::ranges::input_range Dims>
+std::array<std::size_t, N> foldDimensions(const Dims& dims) {
+    std::array<std::size_t, N> folded;
+    folded.fill(1);
+    std::size_t r = 0;
+    for (std::size_t d : dims) {
+        if (r < N) {
+            folded[r] = d;
+        } else if (d != 1) {
+            throw std::invalid_argument("Array has more dimensions than supported by BlockData");
+        }
+        ++r;
+    }
+    return folded;
+}
+
+// Allocator is used for owned storage; aligned_allocator gives 64 byte aligned
+// elements, pool_allocator additionally recycles them across calls.
+//
+// Layout is the order of the elements in memory, see layout.hpp: layout_left
+// is MATLAB's, layout_direction_major and layout_tiled<> suit other access
+// patterns.  Indices, views and dimensions mean the same in every layout;
+// conversion to and from MATLAB's order happens when a matlab::data::Array is
+// adopted or released, or explicitly with the converting constructor.
+template <std::size_t N, typename T, typename Allocator = aligned_allocator<T>, typename Layout = layout_left>
 class BlockData {
-    static_assert(N > 0 && N < 4, "Invalid number of dimensions.");
-    std::vector<T> _data;
-    std::array<std::size_t, N> _dims;
+    static_assert(N > 0, "Invalid number of dimensions.");
+    Storage<T, Allocator> _data;
+    std::array<std::size_t, N> _dims{};
+
+    template <std::size_t, typename, typename, typename>
+    friend class BlockData;
+
+    static constexpr bool is_matlab_layout = std::is_same_v<Layout, layout_left>;
+
 public:
     BlockData() = default;
-    BlockData(std::size_t nElements) : _data(nElements), _dims{nElements}, column(_dims, _data.data()), row(_dims, _data.data()), page(_dims, _data.data()), tensorial(_dims, _data.data()) {
+    BlockData(std::size_t nElements) : _data(nElements), _dims{nElements} {
         static_assert(N == 1, "Invalid number of dimensions");
     }
 
-    BlockData(std::size_t nRows, std::size_t nCols) : _data(nRows * nCols), _dims{nRows, nCols}, column(_dims, _data.data()), row(_dims, _data.data()), page(_dims, _data.data()), tensorial(_dims, _data.data()) {
+    BlockData(std::size_t nRows, std::size_t nCols) : _data(nRows * nCols), _dims{nRows, nCols} {
         static_assert(N == 2, "Invalid number of dimensions");
     }
 
-    BlockData(std::size_t nRows, std::size_t nCols, std::size_t nPages) : _data(nRows * nCols * nPages), _dims{nRows, nCols, nPages}, column(_dims, _data.data()), row(_dims, _data.data()), page(_dims, _data.data()), tensorial(_dims, _data.data()) {
+    BlockData(std::size_t nRows, std::size_t nCols, std::size_t nPages) : _data(nRows * nCols * nPages), _dims{nRows, nCols, nPages} {
         static_assert(N == 3, "Invalid number of dimensions");
     }
 
-    BlockData(std::array<std::size_t, N> dims) : _data(std::accumulate(dims.begin(), dims.end(), 1, std::multiplies<std::size_t>())), _dims(dims), column(_dims, _data.data()), row(_dims, _data.data()), page(_dims, _data.data()), tensorial(_dims, _data.data()) {
-        static_assert(N > 0 && N < 4, "Invalid number of dimensions");
-    }
+    BlockData(std::array<std::size_t, N> dims) : _data(std::accumulate(dims.begin(), dims.end(), std::size_t{1}, std::multiplies<std::size_t>())), _dims(dims) {}
+
+    BlockData(std::array<std::size_t, N> dims, const Allocator& allocator)
+        : _data(std::accumulate(dims.begin(), dims.end(), std::size_t{1}, std::multiplies<std::size_t>()), allocator), _dims(dims) {}
+
+    explicit BlockData(const Allocator& allocator) : _data(allocator) {}
+
+    // Adopts an owning buffer of prod(dims) elements without copying it.
+    // release() hands it to MATLAB as it is only if origin is
+    // BufferOrigin::matlab, which the buffer must then be.
+    BlockData(std::array<std::size_t, N> dims, buffer_ptr_t<T>&& buffer, BufferOrigin origin = BufferOrigin::external)
+        : _data(std::move(buffer), std::accumulate(dims.begin(), dims.end(), std::size_t{1}, std::multiplies<std::size_t>()), origin)
+        , _dims(dims) {}
 
     BlockData(const BlockData&) = default;
     BlockData(BlockData&&) = default;
     ~BlockData() = default;
+
+    // Copy of other in this layout.
+    template <typename OtherAllocator, typename OtherLayout>
+    explicit BlockData(const BlockData<N, T, OtherAllocator, OtherLayout>& other, const Allocator& allocator = Allocator())
+        : _data(other.size(), allocator), _dims(other._dims) {
+        relayout(other.data(), other.mapping(), _data.data(), mapping());
+    }
 #if defined(MATLAB_MEX_FILE)
-    BlockData(matlab::data::Array&& A) 
-        : _data(A.getNumberOfElements())
-        , _dims()
-        , column(_dims, _data.data())
-        , row(_dims, _data.data())
-        , page(_dims, _data.data())
-        , tensorial(_dims, _data.data()) {
+    // Takes over the buffer of A; the elements are not copied unless A shares
+    // its data with another array or Layout is not MATLAB's.  An A of another
+    // numeric or logical type is converted to T in a single pass, see
+    // Conversion; complex arrays only convert to complex T.
+    BlockData(matlab::data::Array&& A, Conversion conversion = {})
+        : _data()
+        , _dims() {
+        _dims = foldDimensions<N>(A.getDimensions());
+        std::size_t nElements = A.getNumberOfElements();
+        if (A.getType() != arrayType<T>) {
+            if constexpr (is_matlab_layout) {
+                _data = Storage<T, Allocator>(nElements);
+                convertArray(A, _data.data(), conversion);
+            } else {
+                BlockData<N, T, Allocator, layout_left> converted(std::move(A), conversion);
+                _data = Storage<T, Allocator>(nElements);
+                relayout(converted.data(), converted.mapping(), _data.data(), mapping());
+            }
+            return;
+        }
         matlab::data::TypedArray<T> A_typed(std::move(A));
-        std::copy_n(A_typed.getDimensions().begin(), N, _dims.begin());
-        column.resize(_dims, _data.data());
-        row.resize(_dims, _data.data());
-        page.resize(_dims, _data.data());
-        tensorial.resize(_dims, _data.data());
-        std::copy(A_typed.begin(), A_typed.end(), _data.begin());
+        if constexpr (is_matlab_layout) {
+            _data = Storage<T, Allocator>(A_typed.release(), nElements, BufferOrigin::matlab);
+        } else {
+            auto buffer = A_typed.release();
+            _data = Storage<T, Allocator>(nElements);
+            relayout(buffer.get(), layout_left::mapping<N>(_dims), _data.data(), mapping());
+        }
+    }
+
+    // Output arena: the elements live in a buffer from factory.createBuffer so
+    // that release() can hand them to MATLAB without a copy.
+    BlockData(matlab::data::ArrayFactory& factory, std::array<std::size_t, N> dims)
+        : BlockData(dims, factory.createBuffer<T>(std::accumulate(dims.begin(), dims.end(), std::size_t{1}, std::multiplies<std::size_t>())), BufferOrigin::matlab) {}
+
+    // Moves the elements into a TypedArray and leaves the BlockData empty.
+    // Only copies if the elements are not in a buffer of BufferOrigin::matlab
+    // or Layout is not MATLAB's.
+    matlab::data::TypedArray<T> release() {
+        matlab::data::ArrayFactory factory;
+        matlab::data::ArrayDimensions dims(_dims.begin(), _dims.end());
+        if (is_matlab_layout && _data.origin() == BufferOrigin::matlab) {
+            auto buffer = releaseBuffer();
+            return factory.createArrayFromBuffer<T>(std::move(dims), std::move(buffer));
+        }
+        auto buffer = factory.createBuffer<T>(_data.size());
+        if constexpr (is_matlab_layout) {
+            std::copy(_data.begin(), _data.end(), buffer.get());
+        } else {
+            relayout(_data.data(), mapping(), buffer.get(), layout_left::mapping<N>(_dims));
+        }
+        _data.clear();
+        _dims.fill(0);
+        return factory.createArrayFromBuffer<T>(std::move(dims), std::move(buffer));
     }
 #endif // defined(MATLAB_MEX_FILE)
     
     BlockData& operator=(const BlockData&) = default;
     BlockData& operator=(BlockData&&) = default;
 
+    // True if the elements live in an adopted buffer (see BlockData(dims, buffer)).
+    bool adopted() const {
+        return _data.adopted();
+    }
+
+    // Hands the elements out as an owning buffer and leaves the BlockData empty.
+    buffer_ptr_t<T> releaseBuffer() {
+        auto buffer = _data.release();
+        _dims.fill(0);
+        return buffer;
+    }
+
+    // resize keeps the elements in memory order, so unless only the last
+    // dimension changes they end up at other indices; see append().
     BlockData &resize(std::size_t nElements) {
         static_assert(N == 1, "Invalid number of dimensions");
         _data.resize(nElements);
         _dims.at(0) = nElements;
-        column.resize(_dims, _data.data());
-        row.resize(_dims, _data.data());
-        page.resize(_dims, _data.data());
-        tensorial.resize(_dims, _data.data());
         return *this;
     }
 
@@ -76,10 +184,6 @@ public:
         _data.resize(nRows * nCols);
         _dims.at(0) = nRows;
         _dims.at(1) = nCols;
-        column.resize(_dims, _data.data());
-        row.resize(_dims, _data.data());
-        page.resize(_dims, _data.data());
-        tensorial.resize(_dims, _data.data());
         return *this;
     }
 
@@ -89,17 +193,67 @@ public:
         _dims.at(0) = nRows;
         _dims.at(1) = nCols;
         _dims.at(2) = nPages;
-        column.resize(_dims, _data.data());
-        row.resize(_dims, _data.data());
-        page.resize(_dims, _data.data());
-        tensorial.resize(_dims, _data.data());
         return *this;
     }
 
+    BlockData& resize(std::array<std::size_t, N> dims) {
+        _data.resize(std::accumulate(dims.begin(), dims.end(), std::size_t{1}, std::multiplies<std::size_t>()));
+        _dims = dims;
+        return *this;
+    }
+
+    // Appends count value initialised pages, slices along the last dimension,
+    // and returns a view of them.  Unlike resize() this keeps every element at
+    // its index, and the capacity grows geometrically, so that appending n
+    // pages one at a time copies O(n) pages in total.  Views taken before are
+    // invalidated when the capacity grows.
+    BlockView<N, T, layout_left> append(std::size_t count = 1) {
+        static_assert(is_matlab_layout, "Only column major BlockData can grow");
+        const std::size_t first = _dims[N - 1];
+        const std::size_t nElements = _data.size() + count * pageSize();
+        if (nElements > _data.capacity()) {
+            _data.reserve(std::max(nElements, 2 * _data.capacity()));
+        }
+        _data.resize(nElements);
+        _dims[N - 1] += count;
+        return view().template subview<N - 1>(first, count);
+    }
+
+    // Room for nPages pages in all, see append().
+    BlockData& reserve(std::size_t nPages) {
+        static_assert(is_matlab_layout, "Only column major BlockData can grow");
+        _data.reserve(nPages * pageSize());
+        return *this;
+    }
+
+    // Number of pages that fit without reallocating.
+    std::size_t capacity() const {
+        const std::size_t n = pageSize();
+        return n == 0 ? _dims[N - 1] : _data.capacity() / n;
+    }
+
+    BlockData& shrink_to_fit() {
+        _data.shrink_to_fit();
+        return *this;
+    }
+
+    // Number of elements of a slice along the last dimension.
+    std::size_t pageSize() const {
+        return std::accumulate(_dims.begin(), _dims.end() - 1, std::size_t{1}, std::multiplies<std::size_t>());
+    }
+
     std::size_t size() const {
         return _data.size();
     }
 
+    const std::array<std::size_t, N>& dims() const {
+        return _dims;
+    }
+
+    typename Layout::template mapping<N> mapping() const {
+        return typename Layout::template mapping<N>(_dims);
+    }
+
     std::size_t nRows() const {
         static_assert(N >= 1, "Invalid number of dimensions");
         return _dims.at(0);
@@ -121,317 +275,209 @@ public:
     }
 
     const T &operator[](std::size_t iElement) const {
-        return static_cast<const T&>(const_cast<BlockData<N,T>*>(*this)->operator[](iElement));
+        return static_cast<const T&>(const_cast<BlockData*>(this)->operator[](iElement));
     }
 
     T &operator()(std::size_t iRow, std::size_t jCol) {
         static_assert(N == 2, "Invalid number of dimensions");
-        return _data.at(iRow + jCol * _dims[0]);
+        return _data.at(offset({iRow, jCol}));
     }
 
     const T &operator()(std::size_t iRow, std::size_t jCol) const {
-        return static_cast<const T&>(const_cast<BlockData<N,T>*>(*this)->operator()(iRow, jCol));
+        return static_cast<const T&>(const_cast<BlockData*>(this)->operator()(iRow, jCol));
     }
 
     T &operator()(std::size_t iRow, std::size_t jCol, std::size_t kPage) {
         static_assert(N == 3, "Invalid number of dimensions");
-        return _data.at(iRow + jCol * _dims[0] + kPage * _dims[0] * _dims[1]);
+        return _data.at(offset({iRow, jCol, kPage}));
     }
 
     const T &operator()(std::size_t iRow, std::size_t jCol, std::size_t kPage) const {
-        return static_cast<const T&>(const_cast<BlockData<N,T>*>(*this)->operator()(iRow, jCol, kPage));
-    }
-
-    struct Iterator {
-        using iterator_category = std::bidirectional_iterator_tag;
-        using difference_type = std::ptrdiff_t;
-        using value_type = T;
-        using pointer = T*;
-        using reference = T&;
-
-        Iterator(pointer ptr, std::size_t stride = 1ULL) : _ptr(ptr), _stride(stride) {}
-        reference operator*() const { return *_ptr; }
-        pointer operator->() const { return _ptr; }
-        Iterator& operator++() {
-            _ptr += _stride;
-            return *this;
-        }
-        Iterator operator++(int) {
-            Iterator tmp = *this;
-            for(std::size_t i = 0; i < _stride; ++i) {
-                ++(*this);
-            }
-            return tmp;
-        }
-        Iterator& operator--() {
-            _ptr -= _stride;
-            return *this;
-        }
-        Iterator operator--(int) {
-            Iterator tmp = *this;
-            for(std::size_t i = 0; i < _stride; ++i) {
-                --(*this);
-            }
-            return tmp;
-        }
-        bool operator==(const Iterator& other) const { return _ptr == other._ptr; }
-        bool operator!=(const Iterator& other) const { return _ptr != other._ptr; }
-        private:
-        pointer _ptr;
-        std::size_t _stride;
-    };
-
-    using iterator = Iterator;
-    using const_iterator = Iterator;
-
-    iterator begin() { return Iterator(_data.data()); }
-    iterator end() { return Iterator(_data.data() + _data.size()); }
-
-    const_iterator cbegin() const { return const_cast<BlockData<N,T>*>(this)->begin(); }
-    const_iterator cend() const { return const_cast<BlockData<N,T>*>(this)->end(); }
-
-    class Column {
-        std::size_t currentColumn{};
-        std::size_t offset{0};
-        std::array<std::size_t, N> _dims{{}};
-        T* _data{nullptr};
-        friend class BlockData;
-        friend class Page;
-        Column& resize(std::array<std::size_t, N> newDims, T* newData) {
-            _dims = newDims;
-            _data = newData;
-            return *this;
-        }
-    public:
-        Column() = default;
-        Column(std::array<std::size_t, N> dims, T* data) : currentColumn{0ULL}, offset{0ULL}, _dims(dims), _data(data) {}
-        Column &operator()(std::size_t jCol) {
-            static_assert(N >= 2, "Invalid number of dimensions");
-            if (jCol >= _dims.at(1)) {
-                throw std::out_of_range("Column index out of range");
-            }
-            currentColumn = jCol;
-            return *this;
-        }
-        const Column &operator()(std::size_t jCol) const {
-            return const_cast<Column*>(this)->operator()(jCol);
-        }
-        Iterator begin() { return Iterator(_data + offset + currentColumn*_dims.at(0)); }
-        Iterator end() { return Iterator(_data + offset + (currentColumn + 1) * _dims.at(0)); }
+        return static_cast<const T&>(const_cast<BlockData*>(this)->operator()(iRow, jCol, kPage));
+    }
 
-        const Iterator begin() const { return const_cast<Column*>(this)->begin(); }
-        const Iterator end() const { return const_cast<Column*>(this)->end(); }
+    // Element access for rank four and higher.
+    template <typename... Idx>
+        requires (N > 3) && (sizeof...(Idx) == N) && (std::is_convertible_v<Idx, std::size_t> && ...)
+    T &operator()(Idx... idx) {
+        return _data.at(offset({static_cast<std::size_t>(idx)...}));
+    }
 
-        T* data() {
-            return _data + offset + currentColumn * _dims.at(0);
-        }
-        const T* data() const {
-            return const_cast<Column*>(this)->data();
-        }
+    template <typename... Idx>
+        requires (N > 3) && (sizeof...(Idx) == N) && (std::is_convertible_v<Idx, std::size_t> && ...)
+    const T &operator()(Idx... idx) const {
+        return static_cast<const T&>(const_cast<BlockData*>(this)->operator()(idx...));
+    }
 
-        std::size_t size() const { return _dims.at(0); }
-    } column;
-
-    class Row {
-        std::size_t currentRow {};
-        std::size_t offset{0}; // Offset for multi-dimensional data
-        std::array<std::size_t, N> _dims{{}};
-        T* _data{nullptr};
-        friend class BlockData;
-        friend class Page;
-        Row& resize(std::array<std::size_t, N> newDims, T* newData) {
-            _dims = newDims;
-            _data = newData;
-            return *this;
-        }
-        public:
-        Row() = default;
-        Row(std::array<std::size_t, N> dims, T* data) : currentRow{0ULL}, offset{0ULL}, _dims(dims), _data(data) {}
-        Row &operator()(std::size_t iRow) {
-            if (iRow >= _dims.at(0)) {
-                throw std::out_of_range("Row index out of range");
-            }
-            currentRow = iRow;
-            return *this;
-        }
-        const Row &operator()(std::size_t iRow) const {
-            return const_cast<Row*>(this)->operator()(iRow);
-        }
+    // Iteration runs over the elements in memory order, which is column major
+    // only for layout_left.
+    using iterator = T*;
+    using const_iterator = const T*;
 
-        iterator begin() {
-            if constexpr (N == 1) {
-                return iterator(_data + currentRow);
-            } else if constexpr (N == 2) {
-                return iterator(_data + currentRow, _dims.at(0));
-            } else {
-                // Row on page offset
-                return iterator(_data + currentRow + offset , _dims.at(0));
-            }
-        }
+    iterator begin() { return _data.begin(); }
+    iterator end() { return _data.end(); }
+    const_iterator begin() const { return _data.begin(); }
+    const_iterator end() const { return _data.end(); }
 
-        iterator end() {
-            if constexpr (N == 1) {
-                return iterator(_data + _dims.at(0));
-            } else if constexpr (N == 2) {
-                return iterator(_data + currentRow + _dims.at(0) * _dims.at(1), _dims.at(0));
-            } else {
-                return iterator(_data + currentRow + offset + _dims.at(0) * _dims.at(1), _dims.at(0));
-            }
-        }
+    const_iterator cbegin() const { return _data.begin(); }
+    const_iterator cend() const { return _data.end(); }
 
-        const_iterator cbegin() const {
-            return const_cast<Row*>(this)->begin();
-        }
-        const_iterator cend() const {
-            return const_cast<Row*>(this)->end();
-        }
+    T* data() { return _data.data(); }
+    const T* data() const { return _data.data(); }
 
-        std::size_t size() const {
-            static_assert(N >= 1, "Invalid number of dimensions");
-            return _dims[1];
-        }
-    } row;
-
-    class Page {
-        std::size_t currentPage {};
-        std::array<std::size_t, N> _dims{{}};
-        T* _data{nullptr};
-        friend class BlockData;
-        Page& resize(std::array<std::size_t, N> newDims, T* newData) {
-            _dims = newDims;
-            _data = newData;
-            row.resize(newDims, newData);
-            column.resize(newDims, newData);
-            return *this;
-        }
+    // The views below are values that refer to the elements of this BlockData;
+    // they stay valid until it is resized or destroyed.  They are BlockViews
+    // for strided layouts and MappedViews for tiled ones.
+    auto view() {
+        return makeView(_data.data());
+    }
+    auto view() const {
+        return makeView(_data.data());
+    }
 
-        public:
-        Page() = default;
-        Page(std::array<std::size_t, N> dims, T* data) : currentPage{0ULL}, _dims(dims), _data(data), row(_dims, _data), column(_dims, _data) {}
-        Page &operator()(std::size_t kPage) {
-            static_assert(N > 2, "Invalid number of dimensions");
-            if (kPage >= _dims.at(2)) {
-                throw std::out_of_range("Page index out of range");
-            }
-            currentPage = kPage;
-            row.offset = currentPage * _dims.at(0) * _dims.at(1);
-            column.offset = currentPage * _dims.at(0) * _dims.at(1);
-            return *this;
-        }
-        const Page &operator()(std::size_t kPage) const {
-            return const_cast<Page*>(this)->operator()(kPage);
-        }
+    // For N == 3, row and column refer to the first page.
+    auto column(std::size_t jCol) {
+        static_assert(N >= 2, "Invalid number of dimensions");
+        return page2D().column(jCol);
+    }
+    auto column(std::size_t jCol) const {
+        static_assert(N >= 2, "Invalid number of dimensions");
+        return page2D().column(jCol);
+    }
 
-        iterator begin() {
-            return iterator(_data + currentPage * _dims.at(0) * _dims.at(1));
-        }
-        iterator end() {
-            return iterator(_data + (currentPage + 1) * _dims.at(0) * _dims.at(1));
-        }
+    auto row(std::size_t iRow) {
+        static_assert(N >= 2, "Invalid number of dimensions");
+        return page2D().row(iRow);
+    }
+    auto row(std::size_t iRow) const {
+        static_assert(N >= 2, "Invalid number of dimensions");
+        return page2D().row(iRow);
+    }
 
-        const_iterator cbegin() const {
-            return const_cast<Page*>(this)->begin();
-        }
-        const_iterator cend() const {
-            return const_cast<Page*>(this)->end();
-        }
+    auto page(std::size_t kPage) {
+        static_assert(N == 3, "Invalid number of dimensions");
+        return view().page(kPage);
+    }
+    auto page(std::size_t kPage) const {
+        static_assert(N == 3, "Invalid number of dimensions");
+        return view().page(kPage);
+    }
 
-        T* data() {
-            return _data + currentPage * _dims.at(0) * _dims.at(1);
-        }
-        const T* data() const {
-            return const_cast<Page*>(this)->data();
-        }
-        Row row;
-        Column column;
-        std::size_t size() const {
-            if constexpr (N < 3) {
-                return 1ULL;
-            } else {
-                return _dims.at(0) * _dims.at(1);
+    auto tensorial(std::size_t iRow, std::size_t jCol) {
+        static_assert(N == 3, "Invalid number of dimensions");
+        return view().tensorial(iRow, jCol);
+    }
+    auto tensorial(std::size_t iRow, std::size_t jCol) const {
+        static_assert(N == 3, "Invalid number of dimensions");
+        return view().tensorial(iRow, jCol);
+    }
+
+    // Tile (iTile, jTile) of page kPage of a tiled layout as a packed matrix;
+    // pages are counted over all dimensions after the first two.
+    BlockView<2, T, layout_left> tile(std::size_t iTile, std::size_t jTile, std::size_t kPage = 0) {
+        static_assert(tiled_mapping<typename Layout::template mapping<N>>, "Only tiled layouts have tiles");
+        const auto m = mapping();
+        if (iTile >= m.nTileRows() || jTile >= m.nTileCols() || kPage >= m.nPages()) {
+            throw std::out_of_range("Tile index out of range");
+        }
+        return BlockView<2, T, layout_left>(_data.data() + m.tileOffset(iTile, jTile, kPage), {m.tileRows(iTile), m.tileCols(jTile)});
+    }
+    BlockView<2, const T, layout_left> tile(std::size_t iTile, std::size_t jTile, std::size_t kPage = 0) const {
+        return const_cast<BlockData*>(this)->tile(iTile, jTile, kPage);
+    }
+
+private:
+    // The two and three dimensional column major accessors have always
+    // checked only the linear index, through _data.at(); all others check
+    // every index.
+    std::size_t offset(const std::array<std::size_t, N>& index) const {
+        if constexpr (is_matlab_layout && N <= 3) {
+            std::size_t offset = 0;
+            std::size_t stride = 1;
+            for (std::size_t r = 0; r < N; ++r) {
+                offset += index[r] * stride;
+                stride *= _dims[r];
             }
-        }
-    } page;
-
-    class TensorDirection {
-        std::size_t iRow{}, jCol{};
-        std::array<std::size_t, N> _dims{{}};
-        T* _data{nullptr};
-        friend class BlockData;
-        TensorDirection& resize(std::array<std::size_t, N> newDims, T* newData) {
-            _dims = newDims;
-            _data = newData;
-            return *this;
-        }
-        public:
-        TensorDirection() = default;
-        TensorDirection(std::array<std::size_t, N> dims, T* data) : iRow{0ULL}, jCol{0ULL}, _dims(dims), _data(data) {}
-        TensorDirection &operator()(std::size_t iRow, std::size_t jCol) {
-            static_assert(N >= 2, "Invalid number of dimensions");
-            if (iRow >= _dims.at(0) || jCol >= _dims.at(1)) {
-                throw std::out_of_range("Tensor direction indices out of range");
+            return offset;
+        } else {
+            for (std::size_t r = 0; r < N; ++r) {
+                if (index[r] >= _dims[r]) {
+                    throw std::out_of_range("Index out of range");
+                }
             }
-            this->iRow = iRow;
-            this->jCol = jCol;
-            return *this;
-        }
-        const TensorDirection &operator()(std::size_t iRow, std::size_t jCol) const {
-            return const_cast<TensorDirection*>(this)->operator()(iRow, jCol);
-        }
-        iterator begin() {
-            static_assert(N >= 2, "Invalid number of dimensions");
-            return iterator(_data + iRow + jCol * _dims.at(0), _dims.at(0) * _dims.at(1));
+            return mapping()(index);
         }
-        iterator end() {
-            static_assert(N >= 2, "Invalid number of dimensions");
-            return iterator(_data + iRow + jCol * _dims.at(0) + _dims.at(0) * _dims.at(1) * _dims.at(2), _dims.at(0) * _dims.at(1));
-        }
-        const_iterator cbegin() const {
-            return const_cast<TensorDirection*>(this)->begin();
+    }
+
+    template <typename U>
+    auto makeView(U* data) const {
+        if constexpr (is_matlab_layout) {
+            return BlockView<N, U, layout_left>(data, _dims);
+        } else if constexpr (Layout::template mapping<N>::is_strided) {
+            return BlockView<N, U, layout_stride>(data, _dims, mapping().strides());
+        } else {
+            return MappedView<N, U, typename Layout::template mapping<N>>(data, mapping());
         }
-        const_iterator cend() const {
-            return const_cast<TensorDirection*>(this)->end();
+    }
+
+    // First page as a matrix.
+    template <typename U>
+    auto makePage2D(U* data) const {
+        if constexpr (N == 2) {
+            return makeView(data);
+        } else if constexpr (is_matlab_layout) {
+            return BlockView<2, U, layout_left>(data, {_dims[0], _dims[1]});
+        } else if constexpr (Layout::template mapping<N>::is_strided) {
+            const auto strides = mapping().strides();
+            return BlockView<2, U, layout_stride>(data, {_dims[0], _dims[1]}, {strides[0], strides[1]});
+        } else {
+            return MappedView<2, U, typename Layout::template mapping<N>>(data, mapping(), std::array<std::size_t, N>{}, {0, 1});
         }
-    } tensorial;
+    }
 
+    auto page2D() {
+        return makePage2D(_data.data());
+    }
+    auto page2D() const {
+        return makePage2D(_data.data());
+    }
+
+public:
+
+    // Swaps the first two dimensions.  For N > 2 every page is transposed,
+    // pages in parallel.
     void transpose() {
         static_assert(N > 1, "Transpose is only valid for 2D or higher dimensions");
-        if constexpr (N == 2) {
-            const std::size_t nRows = _dims.at(0);
-            const std::size_t nCols = _dims.at(1);
-            // The previous in-place pairwise swap only works for square
-            // matrices: for a non-square matrix the source/destination linear
-            // indices (column-major) do not pair up once the row stride
-            // changes, so elements were overwritten and the result was wrong.
-            // Transpose out-of-place into a fresh buffer, which is correct for
-            // both square and non-square shapes.  Old element (iRow, jCol) at
-            // iRow + jCol*nRows maps to new element (jCol, iRow) at
-            // jCol + iRow*nCols (nCols is the row stride of the transpose).
-            std::vector<T> transposed(_data.size());
-            for (std::size_t jCol = 0; jCol < nCols; ++jCol) {
-                for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
-                    transposed[jCol + iRow * nCols] = _data[iRow + jCol * nRows];
-                }
-            }
-            _data = std::move(transposed);
-            _dims.at(0) = nCols;
-            _dims.at(1) = nRows;
-            column.resize(_dims, _data.data());
-            row.resize(_dims, _data.data());
-            page.resize(_dims, _data.data());
-            tensorial.resize(_dims, _data.data());
-        }
-        else if constexpr (N == 3) {
-            // Transpose logic for 3D tensors
-        }
+        static_assert(is_matlab_layout, "Transpose is only implemented for layout_left");
+        const std::size_t nRows = _dims[0];
+        const std::size_t nCols = _dims[1];
+        const std::size_t nPages = std::accumulate(_dims.begin() + 2, _dims.end(), std::size_t{1}, std::multiplies<std::size_t>());
+        typename Storage<T, Allocator>::vector_type transposed(_data.size(), _data.get_allocator());
+        pageTranspose(_data.data(), nRows, nCols, nPages, transposed.data());
+        _data = Storage<T, Allocator>(std::move(transposed));
+        std::swap(_dims[0], _dims[1]);
+    }
+
+    // Reorders the dimensions in memory like MATLAB's permute, with zero based
+    // order: dimension k afterwards is dimension order[k] before.  E.g.
+    // permute({2, 1, 0}) makes the tensorial fibres of a BlockData<3>
+    // contiguous columns.
+    BlockData& permute(const std::array<std::size_t, N>& order) {
+        static_assert(is_matlab_layout, "Permute is only implemented for layout_left");
+        auto dims = permutedDims(_dims, order);
+        typename Storage<T, Allocator>::vector_type permuted(_data.size(), _data.get_allocator());
+        details::permute(_data.data(), _dims, order, permuted.data());
+        _data = Storage<T, Allocator>(std::move(permuted));
+        _dims = dims;
+        return *this;
     }
 
 };
 
-template <std::size_t N, typename T>
+template <std::size_t N, typename T, typename Allocator = aligned_allocator<T>>
 class BlockDataV {
-    static_assert(N > 0 && N < 4, "Invalid number of dimensions.");
-    std::vector<T> _data;
+    static_assert(N > 0, "Invalid number of dimensions.");
+    Storage<T, Allocator> _data;
     std::array<std::size_t, N> _dims;
     
     public:
@@ -448,37 +494,62 @@ class BlockDataV {
         static_assert(N == 3, "Invalid number of dimensions");
     }
 
-    BlockDataV(std::array<std::size_t, N> dims) : _data(std::accumulate(dims.begin(), dims.end(), 1, std::multiplies<std::size_t>())), _dims(dims) {
-        static_assert(N > 0 && N < 4, "Invalid number of dimensions");
-    }
+    BlockDataV(std::array<std::size_t, N> dims) : _data(std::accumulate(dims.begin(), dims.end(), std::size_t{1}, std::multiplies<std::size_t>())), _dims(dims) {}
+
+    BlockDataV(std::array<std::size_t, N> dims, const Allocator& allocator)
+        : _data(std::accumulate(dims.begin(), dims.end(), std::size_t{1}, std::multiplies<std::size_t>()), allocator), _dims(dims) {}
+
+    explicit BlockDataV(const Allocator& allocator) : _data(allocator) {}
+
+    // Adopts an owning buffer of prod(dims) elements without copying it.
+    // release() hands it to MATLAB as it is only if origin is
+    // BufferOrigin::matlab, which the buffer must then be.
+    BlockDataV(std::array<std::size_t, N> dims, buffer_ptr_t<T>&& buffer, BufferOrigin origin = BufferOrigin::external)
+        : _data(std::move(buffer), std::accumulate(dims.begin(), dims.end(), std::size_t{1}, std::multiplies<std::size_t>()), origin)
+        , _dims(dims) {}
 
     BlockDataV(const BlockDataV&) = default;
     BlockDataV(BlockDataV&&) = default;
     ~BlockDataV() = default;
 #if defined(MATLAB_MEX_FILE)
-    BlockDataV(matlab::data::Array&& A) 
-        : _data(A.getNumberOfElements())
+    // Takes over the buffer of A or converts it, see BlockData(matlab::data::Array&&, Conversion).
+    BlockDataV(matlab::data::Array&& A, Conversion conversion = {})
+        : _data()
         , _dims() {
+        _dims = foldDimensions<N>(A.getDimensions());
+        std::size_t nElements = A.getNumberOfElements();
+        if (A.getType() != arrayType<T>) {
+            _data = Storage<T, Allocator>(nElements);
+            convertArray(A, _data.data(), conversion);
+            return;
+        }
         matlab::data::TypedArray<T> A_typed(std::move(A));
-        auto n = A_typed.getDimensions().size();
-        if (n > N) {
-            throw std::invalid_argument("Array has more dimensions than supported by BlockDataV");
+        _data = Storage<T, Allocator>(A_typed.release(), nElements, BufferOrigin::matlab);
+    }
+
+    // Output arena, see BlockData(matlab::data::ArrayFactory&, dims).
+    BlockDataV(matlab::data::ArrayFactory& factory, std::array<std::size_t, N> dims)
+        : BlockDataV(dims, factory.createBuffer<T>(std::accumulate(dims.begin(), dims.end(), std::size_t{1}, std::multiplies<std::size_t>())), BufferOrigin::matlab) {}
+
+    matlab::data::TypedArray<T> release() {
+        matlab::data::ArrayFactory factory;
+        matlab::data::ArrayDimensions dims(_dims.begin(), _dims.end());
+        if (_data.origin() == BufferOrigin::matlab) {
+            auto buffer = releaseBuffer();
+            return factory.createArrayFromBuffer<T>(std::move(dims), std::move(buffer));
         }
-        std::fill(_dims.begin(), _dims.end(), 1); // Initialize all dimensions to 1
-        std::copy_n(A_typed.getDimensions().begin(), n, _dims.begin());
-        std::copy(A_typed.begin(), A_typed.end(), _data.begin());
+        auto buffer = factory.createBuffer<T>(_data.size());
+        std::copy(_data.begin(), _data.end(), buffer.get());
+        _data.clear();
+        _dims.fill(0);
+        return factory.createArrayFromBuffer<T>(std::move(dims), std::move(buffer));
     }
 
     BlockDataV(matlab::data::ArrayRef A) 
         : _data(A.getNumberOfElements())
         , _dims() {
         matlab::data::TypedArrayRef<T> A_typed = A;
-        auto n = A_typed.getDimensions().size();
-        if (n > N) {
-            throw std::invalid_argument("Array has more dimensions than supported by BlockDataV");
-        }
-        std::fill(_dims.begin(), _dims.end(), 1); // Initialize all dimensions to 1
-        std::copy_n(A_typed.getDimensions().begin(), n, _dims.begin());
+        _dims = foldDimensions<N>(A_typed.getDimensions());
         std::copy(A_typed.begin(), A_typed.end(), _data.begin());
     }
 #endif // defined(MATLAB_MEX_FILE)
@@ -507,33 +578,73 @@ class BlockDataV {
         return *this;
     }
 
+    BlockDataV& resize(std::array<std::size_t, N> dims) {
+        _data.resize(std::accumulate(dims.begin(), dims.end(), std::size_t{1}, std::multiplies<std::size_t>()));
+        _dims = dims;
+        return *this;
+    }
+
     auto all() {
         return std::views::all(_data);
     }
 
-    
+    const std::array<std::size_t, N>& dims() const {
+        return _dims;
+    }
+
+    // All elements as a column major BlockView, e.g. an operand for
+    // expression.hpp.
+    BlockView<N, T, layout_left> view() {
+        return BlockView<N, T, layout_left>(_data.data(), _dims);
+    }
+    BlockView<N, const T, layout_left> view() const {
+        return BlockView<N, const T, layout_left>(_data.data(), _dims);
+    }
+
+    // See BlockData::permute.
+    BlockDataV& permute(const std::array<std::size_t, N>& order) {
+        auto dims = permutedDims(_dims, order);
+        typename Storage<T, Allocator>::vector_type permuted(_data.size(), _data.get_allocator());
+        details::permute(_data.data(), _dims, order, permuted.data());
+        _data = Storage<T, Allocator>(std::move(permuted));
+        _dims = dims;
+        return *this;
+    }
+
+    bool adopted() const {
+        return _data.adopted();
+    }
+
+    buffer_ptr_t<T> releaseBuffer() {
+        auto buffer = _data.release();
+        _dims.fill(0);
+        return buffer;
+    }
+
+    // Adaptors for all(), see stridedview.hpp: all() | page(k) | row(i) is
+    // row i of page k.  Pages and columns are contiguous.
     auto row(std::size_t rowIndex) {
         static_assert(N >= 2, "Invalid number of dimensions for row access");
         assert(rowIndex < _dims.at(0) && "Row index out of bounds");
-        return std::views::drop(rowIndex) | std::views::stride(_dims.at(0)) | std::views::take(_dims.at(1));
+        return views::strided(rowIndex, _dims.at(0), _dims.at(1));
     };
 
     auto page(std::size_t pageIndex) {
         static_assert(N >= 3, "Invalid number of dimensions for page access");
         assert(pageIndex < _dims[2] && "Page index out of bounds");
-        return std::views::drop(pageIndex * _dims.at(0) * _dims.at(1)) | std::views::take(_dims.at(0) * _dims.at(1));
+        return views::slice(pageIndex * _dims.at(0) * _dims.at(1), _dims.at(0) * _dims.at(1));
     };
 
     auto col(std::size_t colIndex) {
         static_assert(N >= 2, "Invalid number of dimensions for column access");
         assert(colIndex < _dims.at(1) && "Column index out of bounds");
-        return std::views::drop(colIndex * _dims.at(0)) | std::views::take(_dims.at(0));
+        return views::slice(colIndex * _dims.at(0), _dims.at(0));
     };
 
     auto tensorial(std::size_t iRow, std::size_t jCol) {
         static_assert(N >= 3, "Invalid number of dimensions for tensorial access");
         assert(iRow < _dims.at(0) && "Row index out of bounds");
-        return std::views::drop(iRow + jCol*_dims.at(0)) | std::views::stride(_dims.at(0)*_dims.at(1)) | std::views::take(_dims.at(2));
+        return views::strided(iRow + jCol * _dims.at(0), _dims.at(0) * _dims.at(1), _dims.at(2));
     };
 
     T &operator()(std::size_t iElement) {
@@ -552,7 +663,23 @@ class BlockDataV {
     }
 
     const T &operator()(std::size_t iElement) const {
-        return static_cast<const T&>(const_cast<BlockDataV<N,T>*>(this)->operator()(iElement));
+        return static_cast<const T&>(const_cast<BlockDataV*>(this)->operator()(iElement));
+    }
+
+    template <typename... Idx>
+        requires (N > 3) && (sizeof...(Idx) == N) && (std::is_convertible_v<Idx, std::size_t> && ...)
+    T &operator()(Idx... idx) {
+        const std::array<std::size_t, N> index{static_cast<std::size_t>(idx)...};
+        std::size_t offset = 0;
+        std::size_t stride = 1;
+        for (std::size_t r = 0; r < N; ++r) {
+            if (index[r] >= _dims[r]) {
+                throw std::out_of_range("Index out of range");
+            }
+            offset += index[r] * stride;
+            stride *= _dims[r];
+        }
+        return _data.at(offset);
     }
 
     std::size_t size() const {
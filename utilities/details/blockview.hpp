@@ -0,0 +1,339 @@
+#ifndef BLOCKVIEW_HPP
+#define BLOCKVIEW_HPP
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <ranges>
+#include <stdexcept>
+#include <type_traits>
+
+namespace utilities::details {
+
+// Layout tags in the spirit of std::mdspan.  layout_left is packed column
+// major (the MATLAB order), its strides follow from the extents.  layout_stride
+// carries an explicit stride per dimension.
+//
+// As a BlockData layout (see layout.hpp) layout_left provides mapping<N>, the
+// offset of an element of a rank N block from its index.
+struct layout_left {
+    template <std::size_t N>
+    class mapping {
+        std::array<std::size_t, N> _extents{};
+
+    public:
+        static constexpr std::size_t rank = N;
+        static constexpr bool is_strided = true;
+
+        mapping() = default;
+        explicit mapping(const std::array<std::size_t, N>& extents) : _extents(extents) {}
+
+        const std::array<std::size_t, N>& extents() const { return _extents; }
+
+        std::size_t required_span_size() const {
+            std::size_t n = 1;
+            for (auto e : _extents) {
+                n *= e;
+            }
+            return n;
+        }
+
+        std::array<std::size_t, N> strides() const {
+            std::array<std::size_t, N> strides{};
+            std::size_t stride = 1;
+            for (std::size_t r = 0; r < N; ++r) {
+                strides[r] = stride;
+                stride *= _extents[r];
+            }
+            return strides;
+        }
+
+        // Dimensions from the fastest to the slowest running one.
+        static constexpr std::array<std::size_t, N> order() {
+            std::array<std::size_t, N> order{};
+            for (std::size_t r = 0; r < N; ++r) {
+                order[r] = r;
+            }
+            return order;
+        }
+
+        std::size_t operator()(const std::array<std::size_t, N>& index) const {
+            std::size_t offset = 0;
+            std::size_t stride = 1;
+            for (std::size_t r = 0; r < N; ++r) {
+                offset += index[r] * stride;
+                stride *= _extents[r];
+            }
+            return offset;
+        }
+    };
+};
+struct layout_stride {};
+
+// Random access iterator over every stride-th element starting at a base
+// pointer.  It keeps base and index apart so that end() never points past the
+// underlying allocation.
+template <typename T>
+struct StridedIterator {
+    using iterator_concept = std::random_access_iterator_tag;
+    using iterator_category = std::random_access_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = std::remove_cv_t<T>;
+    using pointer = T*;
+    using reference = T&;
+
+    StridedIterator() = default;
+    StridedIterator(pointer ptr, std::size_t stride = 1ULL, difference_type index = 0)
+        : _ptr(ptr), _stride(static_cast<difference_type>(stride)), _index(index) {}
+    template <typename U>
+        requires std::is_convertible_v<U*, T*>
+    StridedIterator(const StridedIterator<U>& other) : _ptr(other._ptr), _stride(other._stride), _index(other._index) {}
+
+    reference operator*() const { return _ptr[_index * _stride]; }
+    pointer operator->() const { return _ptr + _index * _stride; }
+    reference operator[](difference_type n) const { return _ptr[(_index + n) * _stride]; }
+
+    StridedIterator& operator++() {
+        ++_index;
+        return *this;
+    }
+    StridedIterator operator++(int) {
+        StridedIterator tmp = *this;
+        ++_index;
+        return tmp;
+    }
+    StridedIterator& operator--() {
+        --_index;
+        return *this;
+    }
+    StridedIterator operator--(int) {
+        StridedIterator tmp = *this;
+        --_index;
+        return tmp;
+    }
+    StridedIterator& operator+=(difference_type n) {
+        _index += n;
+        return *this;
+    }
+    StridedIterator& operator-=(difference_type n) {
+        _index -= n;
+        return *this;
+    }
+    friend StridedIterator operator+(StridedIterator it, difference_type n) { return it += n; }
+    friend StridedIterator operator+(difference_type n, StridedIterator it) { return it += n; }
+    friend StridedIterator operator-(StridedIterator it, difference_type n) { return it -= n; }
+    friend difference_type operator-(const StridedIterator& lhs, const StridedIterator& rhs) { return lhs._index - rhs._index; }
+
+    // Only iterators over the same slice are comparable.
+    bool operator==(const StridedIterator& other) const { return _index == other._index; }
+    auto operator<=>(const StridedIterator& other) const { return _index <=> other._index; }
+
+    difference_type stride() const { return _stride; }
+
+    private:
+    template <typename>
+    friend struct StridedIterator;
+    pointer _ptr{nullptr};
+    difference_type _stride{1};
+    difference_type _index{0};
+};
+
+// Non-owning view of rank R over elements of type T.  A view is a value:
+// slicing returns a new view and never modifies the one it was taken from,
+// so views of the same data can be handed to different threads.
+template <std::size_t R, typename T, typename Layout = layout_stride>
+class BlockView {
+    static_assert(R > 0, "Invalid number of dimensions.");
+    static_assert(std::is_same_v<Layout, layout_left> || std::is_same_v<Layout, layout_stride>, "Unknown layout.");
+
+    T* _data{nullptr};
+    std::array<std::size_t, R> _extents{};
+    std::array<std::size_t, R> _strides{};
+
+    template <std::size_t, typename, typename>
+    friend class BlockView;
+
+    void checkIndex(std::size_t dim, std::size_t index, const char* message) const {
+        if (index >= _extents[dim]) {
+            throw std::out_of_range(message);
+        }
+    }
+
+    // Fixing dimension Dim of a layout_left view keeps it packed only if Dim is
+    // the slowest running one.
+    template <std::size_t Dim>
+    using slice_layout = std::conditional_t<std::is_same_v<Layout, layout_left> && Dim == R - 1, layout_left, layout_stride>;
+
+public:
+    using element_type = T;
+    using value_type = std::remove_cv_t<T>;
+    using layout_type = Layout;
+    // Packed views iterate with plain pointers, which std algorithms lower to
+    // memmove or vectorised loops.
+    using iterator = std::conditional_t<std::is_same_v<Layout, layout_left>, T*, StridedIterator<T>>;
+    using const_iterator = std::conditional_t<std::is_same_v<Layout, layout_left>, const T*, StridedIterator<const T>>;
+
+    BlockView() = default;
+
+    BlockView(T* data, std::array<std::size_t, R> extents) : _data(data), _extents(extents) {
+        std::size_t stride = 1;
+        for (std::size_t r = 0; r < R; ++r) {
+            _strides[r] = stride;
+            stride *= _extents[r];
+        }
+    }
+
+    BlockView(T* data, std::array<std::size_t, R> extents, std::array<std::size_t, R> strides)
+        : _data(data), _extents(extents), _strides(strides) {
+        static_assert(std::is_same_v<Layout, layout_stride>, "Explicit strides require layout_stride");
+    }
+
+    // Adds const and/or relaxes layout_left to layout_stride.
+    template <typename U, typename OtherLayout>
+        requires std::is_convertible_v<U*, T*> && (std::is_same_v<Layout, layout_stride> || std::is_same_v<OtherLayout, layout_left>)
+    BlockView(const BlockView<R, U, OtherLayout>& other)
+        : _data(other._data), _extents(other._extents), _strides(other._strides) {}
+
+    static constexpr std::size_t rank() { return R; }
+    std::size_t extent(std::size_t dim) const { return _extents[dim]; }
+    std::size_t stride(std::size_t dim) const { return _strides[dim]; }
+    const std::array<std::size_t, R>& extents() const { return _extents; }
+    const std::array<std::size_t, R>& strides() const { return _strides; }
+
+    std::size_t size() const {
+        std::size_t n = 1;
+        for (auto e : _extents) {
+            n *= e;
+        }
+        return n;
+    }
+    bool empty() const { return size() == 0; }
+
+    T* data() const { return _data; }
+
+    // True if the elements can be walked with a single stride, stride(0), in
+    // column major order.
+    bool is_collapsible() const {
+        for (std::size_t r = 1; r < R; ++r) {
+            if (_extents[r] > 1 && _strides[r] != _strides[r - 1] * _extents[r - 1]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool is_contiguous() const {
+        return std::is_same_v<Layout, layout_left> || (_strides[0] == 1 && is_collapsible());
+    }
+
+    template <typename... Idx>
+        requires (sizeof...(Idx) == R) && (std::is_convertible_v<Idx, std::size_t> && ...)
+    T& operator()(Idx... idx) const {
+        std::array<std::size_t, R> index{static_cast<std::size_t>(idx)...};
+        std::size_t offset = 0;
+        for (std::size_t r = 0; r < R; ++r) {
+            offset += index[r] * _strides[r];
+        }
+        return _data[offset];
+    }
+
+    T& operator[](std::size_t iElement) const {
+        static_assert(R == 1, "Invalid number of dimensions");
+        return _data[iElement * _strides[0]];
+    }
+
+    // Fixes dimension Dim at index, like submdspan with an integer slice.
+    template <std::size_t Dim>
+    BlockView<R - 1, T, slice_layout<Dim>> slice(std::size_t index) const {
+        static_assert(R > 1, "Cannot slice a rank one view");
+        static_assert(Dim < R, "Invalid dimension");
+        checkIndex(Dim, index, "Slice index out of range");
+        std::array<std::size_t, R - 1> extents{};
+        std::array<std::size_t, R - 1> strides{};
+        for (std::size_t r = 0, s = 0; r < R; ++r) {
+            if (r != Dim) {
+                extents[s] = _extents[r];
+                strides[s++] = _strides[r];
+            }
+        }
+        if constexpr (std::is_same_v<slice_layout<Dim>, layout_left>) {
+            return BlockView<R - 1, T, layout_left>(_data + index * _strides[Dim], extents);
+        } else {
+            return BlockView<R - 1, T, layout_stride>(_data + index * _strides[Dim], extents, strides);
+        }
+    }
+
+    // Restricts dimension Dim to [first, first + count), like submdspan with a
+    // pair slice.
+    template <std::size_t Dim>
+    BlockView<R, T, slice_layout<Dim>> subview(std::size_t first, std::size_t count) const {
+        static_assert(Dim < R, "Invalid dimension");
+        if (first + count > _extents[Dim]) {
+            throw std::out_of_range("Subview out of range");
+        }
+        std::array<std::size_t, R> extents = _extents;
+        extents[Dim] = count;
+        if constexpr (std::is_same_v<slice_layout<Dim>, layout_left>) {
+            return BlockView<R, T, layout_left>(_data + first * _strides[Dim], extents);
+        } else {
+            return BlockView<R, T, layout_stride>(_data + first * _strides[Dim], extents, _strides);
+        }
+    }
+
+    auto row(std::size_t iRow) const {
+        static_assert(R == 2, "Invalid number of dimensions");
+        checkIndex(0, iRow, "Row index out of range");
+        return slice<0>(iRow);
+    }
+
+    auto column(std::size_t jCol) const {
+        static_assert(R == 2, "Invalid number of dimensions");
+        checkIndex(1, jCol, "Column index out of range");
+        return slice<1>(jCol);
+    }
+
+    auto page(std::size_t kPage) const {
+        static_assert(R == 3, "Invalid number of dimensions");
+        checkIndex(2, kPage, "Page index out of range");
+        return slice<2>(kPage);
+    }
+
+    // Fibre along the pages through element (iRow, jCol).
+    auto tensorial(std::size_t iRow, std::size_t jCol) const {
+        static_assert(R == 3, "Invalid number of dimensions");
+        if (iRow >= _extents[0] || jCol >= _extents[1]) {
+            throw std::out_of_range("Tensor direction indices out of range");
+        }
+        return slice<0>(iRow).template slice<0>(jCol);
+    }
+
+    // Walks all elements in column major order; layout_stride views of rank > 1
+    // have to be collapsible for that.
+    iterator begin() const {
+        if constexpr (std::is_same_v<Layout, layout_left>) {
+            return _data;
+        } else {
+            if (!is_collapsible()) {
+                throw std::logic_error("View cannot be iterated with a single stride");
+            }
+            return iterator(_data, _strides[0]);
+        }
+    }
+    iterator end() const {
+        if constexpr (std::is_same_v<Layout, layout_left>) {
+            return _data + size();
+        } else {
+            return begin() + static_cast<std::ptrdiff_t>(size());
+        }
+    }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+};
+
+} // namespace utilities::details
+
+template <std::size_t R, typename T, typename Layout>
+inline constexpr bool std::ranges::enable_borrowed_range<utilities::details::BlockView<R, T, Layout>> = true;
+template <std::size_t R, typename T, typename Layout>
+inline constexpr bool std::ranges::enable_view<utilities::details::BlockView<R, T, Layout>> = true;
+
+#endif // BLOCKVIEW_HPP
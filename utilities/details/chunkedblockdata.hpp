@@ -0,0 +1,138 @@
+#ifndef CHUNKEDBLOCKDATA_HPP
+#define CHUNKEDBLOCKDATA_HPP
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "allocator.hpp"
+#include "blockview.hpp"
+#include "blockdata.hpp"
+
+namespace utilities::details {
+
+// Column major N-D data that grows along its last dimension, a page at a time,
+// for results accumulated over an unknown number of iterations.  The pages are
+// kept in chunks of pagesPerChunk pages; a full chunk is never touched again,
+// so appending never copies or moves the pages already there and views of
+// them stay valid.  toBlockData() and release() copy everything into
+// contiguous storage once, at the end.  BlockData::append is the alternative
+// when the result has to be contiguous all along.
+template <std::size_t N, typename T, typename Allocator = aligned_allocator<T>>
+class ChunkedBlockData {
+    static_assert(N >= 2, "Invalid number of dimensions.");
+    using chunk_type = std::vector<T, Allocator>;
+
+    std::array<std::size_t, N> _dims{};
+    std::size_t _pageSize{0};
+    std::size_t _pagesPerChunk{1};
+    std::vector<chunk_type> _chunks;
+    Allocator _allocator;
+
+    std::array<std::size_t, N - 1> pageDims() const {
+        std::array<std::size_t, N - 1> dims{};
+        std::copy_n(_dims.begin(), N - 1, dims.begin());
+        return dims;
+    }
+
+public:
+    // Chunks of pagesPerChunk pages; by default as many as fit in defaultChunkBytes.
+    static constexpr std::size_t defaultChunkBytes = std::size_t{1} << 22;
+
+    explicit ChunkedBlockData(const std::array<std::size_t, N - 1>& pageDims, std::size_t pagesPerChunk = 0, const Allocator& allocator = Allocator())
+        : _pageSize(std::accumulate(pageDims.begin(), pageDims.end(), std::size_t{1}, std::multiplies<std::size_t>()))
+        , _allocator(allocator) {
+        std::copy(pageDims.begin(), pageDims.end(), _dims.begin());
+        if (pagesPerChunk == 0) {
+            pagesPerChunk = std::max<std::size_t>(1, defaultChunkBytes / std::max<std::size_t>(1, _pageSize * sizeof(T)));
+        }
+        _pagesPerChunk = pagesPerChunk;
+    }
+
+    const std::array<std::size_t, N>& dims() const { return _dims; }
+    std::size_t size() const { return _pageSize * _dims[N - 1]; }
+    std::size_t nPages() const { return _dims[N - 1]; }
+    std::size_t pageSize() const { return _pageSize; }
+    std::size_t pagesPerChunk() const { return _pagesPerChunk; }
+
+    // Appends a value initialised page and returns a view of it.
+    BlockView<N - 1, T, layout_left> append() {
+        const std::size_t kPage = _dims[N - 1];
+        if (kPage % _pagesPerChunk == 0) {
+            _chunks.emplace_back(_allocator).reserve(_pagesPerChunk * _pageSize);
+        }
+        _chunks.back().resize(_chunks.back().size() + _pageSize);
+        ++_dims[N - 1];
+        return page(kPage);
+    }
+
+    BlockView<N - 1, T, layout_left> page(std::size_t kPage) {
+        if (kPage >= _dims[N - 1]) {
+            throw std::out_of_range("Page index out of range");
+        }
+        T* data = _chunks[kPage / _pagesPerChunk].data() + (kPage % _pagesPerChunk) * _pageSize;
+        return BlockView<N - 1, T, layout_left>(data, pageDims());
+    }
+
+    BlockView<N - 1, const T, layout_left> page(std::size_t kPage) const {
+        return const_cast<ChunkedBlockData*>(this)->page(kPage);
+    }
+
+    template <typename... Idx>
+        requires (sizeof...(Idx) == N) && (std::is_convertible_v<Idx, std::size_t> && ...)
+    T& operator()(Idx... idx) {
+        std::array<std::size_t, N> index{static_cast<std::size_t>(idx)...};
+        std::size_t offset = 0;
+        for (std::size_t r = N - 1; r-- > 0;) {
+            if (index[r] >= _dims[r]) {
+                throw std::out_of_range("Index out of range");
+            }
+            offset = offset * _dims[r] + index[r];
+        }
+        return page(index[N - 1]).data()[offset];
+    }
+
+    template <typename... Idx>
+        requires (sizeof...(Idx) == N) && (std::is_convertible_v<Idx, std::size_t> && ...)
+    const T& operator()(Idx... idx) const {
+        return const_cast<ChunkedBlockData*>(this)->operator()(idx...);
+    }
+
+    // Copies the pages, in order, to size() elements at out.
+    void copyTo(T* out) const {
+        for (const auto& chunk : _chunks) {
+            out = std::copy(chunk.begin(), chunk.end(), out);
+        }
+    }
+
+    template <typename OtherAllocator = Allocator>
+    BlockData<N, T, OtherAllocator> toBlockData(const OtherAllocator& allocator = OtherAllocator()) const {
+        BlockData<N, T, OtherAllocator> retval(_dims, allocator);
+        copyTo(retval.data());
+        return retval;
+    }
+
+    // Drops all pages and keeps the page dimensions.
+    void clear() {
+        _chunks.clear();
+        _dims[N - 1] = 0;
+    }
+
+#if defined(MATLAB_MEX_FILE)
+    // Copies the pages into a MATLAB buffer and leaves this empty.
+    matlab::data::TypedArray<T> release() {
+        matlab::data::ArrayFactory factory;
+        auto buffer = factory.createBuffer<T>(size());
+        copyTo(buffer.get());
+        matlab::data::ArrayDimensions dims(_dims.begin(), _dims.end());
+        clear();
+        return factory.createArrayFromBuffer<T>(std::move(dims), std::move(buffer));
+    }
+#endif // defined(MATLAB_MEX_FILE)
+};
+
+} // namespace utilities::details
+#endif // CHUNKEDBLOCKDATA_HPP
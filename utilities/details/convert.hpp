@@ -0,0 +1,254 @@
+#ifndef CONVERT_HPP
+#define CONVERT_HPP
+#if defined(MATLAB_MEX_FILE)
+#include "MatlabDataArray.hpp"
+#endif // defined(MATLAB_MEX_FILE)
+#include <algorithm>
+#include <atomic>
+#include <complex>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "threadpool.hpp"
+#include "traits.hpp"
+
+namespace utilities::details {
+
+// How values are brought into an integer type.  The defaults are MATLAB's:
+// int32(2.5) is 3, int8(300) is 127 and NaN becomes 0.
+enum class Rounding { nearest, toward_zero };
+enum class Overflow { saturate, error };
+
+struct Conversion {
+    Rounding rounding{Rounding::nearest};
+    Overflow overflow{Overflow::saturate};
+};
+
+// Conversions of at least this many elements run on the thread pool.
+inline constexpr std::size_t convertParallelLimit = std::size_t{1} << 18;
+
+namespace convert_detail {
+
+template <typename T>
+concept integer = std::integral<T> && !std::same_as<T, bool>;
+
+// Floating point to integer, in two steps: clamp to the Source values within
+// Target's range, with NaN as 0, then truncate or round half away from zero
+// as MATLAB does.  Where Source cannot hold Target's maximum (float to int32,
+// double to int64) the clamp stops at the largest value below it, and
+// element() saturates separately.
+template <typename Target, typename Source>
+inline constexpr bool exact = std::numeric_limits<Source>::digits >= std::numeric_limits<Target>::digits;
+
+template <typename Target, typename Source>
+Source clamped(Source x) {
+    // lo is 0 or a power of two, so exact.
+    constexpr Source lo = static_cast<Source>(std::numeric_limits<Target>::min());
+    constexpr Source hi = static_cast<Source>(std::numeric_limits<Target>::max());
+    constexpr Source below = exact<Target, Source> ? hi : hi * (Source{1} - std::numeric_limits<Source>::epsilon() / 2);
+    Source y = x == x ? x : Source{0};
+    y = y < lo ? lo : y;
+    return y > below ? below : y;
+}
+
+template <typename Target, typename Source>
+Target fromClamped(Source y, Rounding rounding) {
+    if (rounding == Rounding::nearest) {
+        // In Source, which keeps the loop in one vector width.
+        const Source truncated = static_cast<Source>(static_cast<Target>(y));
+        const Source fraction = y - truncated;
+        const Source up = fraction >= Source{0.5} ? Source{1} : Source{0};
+        const Source down = fraction <= Source{-0.5} ? Source{1} : Source{0};
+        y = truncated + (up - down);
+    }
+    return static_cast<Target>(y);
+}
+
+// Converts x to Target, saturating.  Written with selects only, so that the
+// loops over it vectorise.
+template <typename Target, typename Source>
+Target element(Source x, Rounding rounding) {
+    if constexpr (is_complex_v<Target>) {
+        using U = typename Target::value_type;
+        if constexpr (is_complex_v<Source>) {
+            return Target(element<U>(x.real(), rounding), element<U>(x.imag(), rounding));
+        } else {
+            return Target(element<U>(x, rounding), U{0});
+        }
+    } else if constexpr (is_complex_v<Source>) {
+        static_assert(sizeof(Source) == 0, "Complex values cannot be converted to a real type");
+    } else if constexpr (std::same_as<Target, bool>) {
+        // NaN != 0, but like every other NaN it becomes 0.
+        return x == x && x != Source{0};
+    } else if constexpr (std::floating_point<Target> || std::same_as<Source, bool>) {
+        return static_cast<Target>(x);
+    } else if constexpr (integer<Source>) {
+        return std::cmp_less(x, std::numeric_limits<Target>::min())      ? std::numeric_limits<Target>::min()
+               : std::cmp_greater(x, std::numeric_limits<Target>::max()) ? std::numeric_limits<Target>::max()
+                                                                         : static_cast<Target>(x);
+    } else {
+        Target t = fromClamped<Target>(clamped<Target>(x), rounding);
+        if constexpr (!exact<Target, Source>) {
+            t = x >= static_cast<Source>(std::numeric_limits<Target>::max()) ? std::numeric_limits<Target>::max() : t;
+        }
+        return t;
+    }
+}
+
+// True if x converts to Target without saturating; NaN never does, except to
+// floating point.
+template <typename Target, typename Source>
+bool representable(Source x) {
+    if constexpr (is_complex_v<Target> && is_complex_v<Source>) {
+        using U = typename Target::value_type;
+        return representable<U>(x.real()) && representable<U>(x.imag());
+    } else if constexpr (is_complex_v<Target>) {
+        return representable<typename Target::value_type>(x);
+    } else if constexpr (std::same_as<Target, bool> || std::same_as<Source, bool>) {
+        return x == x;
+    } else if constexpr (std::floating_point<Target>) {
+        return true;
+    } else if constexpr (integer<Source>) {
+        return std::in_range<Target>(x);
+    } else {
+        constexpr Source lo = static_cast<Source>(std::numeric_limits<Target>::min());
+        constexpr Source hi = static_cast<Source>(std::numeric_limits<Target>::max());
+        return x >= lo && (exact<Target, Source> ? x <= hi : x < hi);
+    }
+}
+
+template <typename Target, typename Source>
+void convertRange(const Source* in, std::size_t n, Target* out, Rounding rounding) {
+    if constexpr (std::floating_point<Source> && integer<Target> && exact<Target, Source>) {
+        // Clamping and rounding together are too many selects for the
+        // vectoriser; split them over a block that stays in L1.
+        constexpr std::size_t block = 256;
+        Source y[block];
+        for (std::size_t first = 0; first < n; first += block) {
+            const std::size_t count = std::min(block, n - first);
+            for (std::size_t i = 0; i < count; ++i) {
+                y[i] = clamped<Target>(in[first + i]);
+            }
+            if (rounding == Rounding::nearest) {
+                for (std::size_t i = 0; i < count; ++i) {
+                    out[first + i] = fromClamped<Target>(y[i], Rounding::nearest);
+                }
+            } else {
+                for (std::size_t i = 0; i < count; ++i) {
+                    out[first + i] = fromClamped<Target>(y[i], Rounding::toward_zero);
+                }
+            }
+        }
+    } else if (rounding == Rounding::nearest) {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = element<Target>(in[i], Rounding::nearest);
+        }
+    } else {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = element<Target>(in[i], Rounding::toward_zero);
+        }
+    }
+}
+
+template <typename Target, typename Source>
+bool allRepresentable(const Source* in, std::size_t n) {
+    return std::all_of(in, in + n, [](Source x) { return representable<Target>(x); });
+}
+
+} // namespace convert_detail
+
+// Converts n elements of in to Target, in parallel for large n.  With
+// Overflow::error, throws std::out_of_range before writing anything if a value
+// (or NaN) does not fit.
+template <typename Target, typename Source>
+void convert(const Source* in, std::size_t n, Target* out, Conversion conversion = {}) {
+    if constexpr (std::same_as<Source, Target>) {
+        std::copy_n(in, n, out);
+    } else if (n < convertParallelLimit) {
+        if (conversion.overflow == Overflow::error && !convert_detail::allRepresentable<Target>(in, n)) {
+            throw std::out_of_range("Value out of range for the target type");
+        }
+        convert_detail::convertRange(in, n, out, conversion.rounding);
+    } else {
+        if (conversion.overflow == Overflow::error) {
+            std::atomic<bool> representable{true};
+            parallel_for(0, n, [&](std::size_t first, std::size_t last) {
+                if (!convert_detail::allRepresentable<Target>(in + first, last - first)) {
+                    representable.store(false, std::memory_order_relaxed);
+                }
+            }, convertParallelLimit / 4);
+            if (!representable.load()) {
+                throw std::out_of_range("Value out of range for the target type");
+            }
+        }
+        parallel_for(0, n, [&](std::size_t first, std::size_t last) {
+            convert_detail::convertRange(in + first, last - first, out + first, conversion.rounding);
+        }, convertParallelLimit / 4);
+    }
+}
+
+#if defined(MATLAB_MEX_FILE)
+template <typename T>
+inline constexpr matlab::data::ArrayType arrayType = matlab::data::ArrayType::UNKNOWN;
+template <> inline constexpr matlab::data::ArrayType arrayType<double> = matlab::data::ArrayType::DOUBLE;
+template <> inline constexpr matlab::data::ArrayType arrayType<float> = matlab::data::ArrayType::SINGLE;
+template <> inline constexpr matlab::data::ArrayType arrayType<bool> = matlab::data::ArrayType::LOGICAL;
+template <> inline constexpr matlab::data::ArrayType arrayType<std::int8_t> = matlab::data::ArrayType::INT8;
+template <> inline constexpr matlab::data::ArrayType arrayType<std::uint8_t> = matlab::data::ArrayType::UINT8;
+template <> inline constexpr matlab::data::ArrayType arrayType<std::int16_t> = matlab::data::ArrayType::INT16;
+template <> inline constexpr matlab::data::ArrayType arrayType<std::uint16_t> = matlab::data::ArrayType::UINT16;
+template <> inline constexpr matlab::data::ArrayType arrayType<std::int32_t> = matlab::data::ArrayType::INT32;
+template <> inline constexpr matlab::data::ArrayType arrayType<std::uint32_t> = matlab::data::ArrayType::UINT32;
+template <> inline constexpr matlab::data::ArrayType arrayType<std::int64_t> = matlab::data::ArrayType::INT64;
+template <> inline constexpr matlab::data::ArrayType arrayType<std::uint64_t> = matlab::data::ArrayType::UINT64;
+template <> inline constexpr matlab::data::ArrayType arrayType<std::complex<double>> = matlab::data::ArrayType::COMPLEX_DOUBLE;
+template <> inline constexpr matlab::data::ArrayType arrayType<std::complex<float>> = matlab::data::ArrayType::COMPLEX_SINGLE;
+
+namespace convert_detail {
+
+// Reads the elements in place: a const TypedArray shares A's data.
+template <typename Source, typename Target>
+void convertTyped(const matlab::data::Array& A, Target* out, Conversion conversion) {
+    if constexpr (is_complex_v<Source> && !is_complex_v<Target>) {
+        throw std::invalid_argument("Complex array cannot be converted to a real type");
+    } else {
+        const matlab::data::TypedArray<Source> typed(A);
+        if (typed.getNumberOfElements() > 0) {
+            convert(&*typed.cbegin(), typed.getNumberOfElements(), out, conversion);
+        }
+    }
+}
+
+} // namespace convert_detail
+
+// Converts the elements of a numeric or logical array of any type, column
+// major, into out.
+template <typename Target>
+void convertArray(const matlab::data::Array& A, Target* out, Conversion conversion = {}) {
+    using convert_detail::convertTyped;
+    switch (A.getType()) {
+    case matlab::data::ArrayType::DOUBLE:         return convertTyped<double>(A, out, conversion);
+    case matlab::data::ArrayType::SINGLE:         return convertTyped<float>(A, out, conversion);
+    case matlab::data::ArrayType::LOGICAL:        return convertTyped<bool>(A, out, conversion);
+    case matlab::data::ArrayType::INT8:           return convertTyped<std::int8_t>(A, out, conversion);
+    case matlab::data::ArrayType::UINT8:          return convertTyped<std::uint8_t>(A, out, conversion);
+    case matlab::data::ArrayType::INT16:          return convertTyped<std::int16_t>(A, out, conversion);
+    case matlab::data::ArrayType::UINT16:         return convertTyped<std::uint16_t>(A, out, conversion);
+    case matlab::data::ArrayType::INT32:          return convertTyped<std::int32_t>(A, out, conversion);
+    case matlab::data::ArrayType::UINT32:         return convertTyped<std::uint32_t>(A, out, conversion);
+    case matlab::data::ArrayType::INT64:          return convertTyped<std::int64_t>(A, out, conversion);
+    case matlab::data::ArrayType::UINT64:         return convertTyped<std::uint64_t>(A, out, conversion);
+    case matlab::data::ArrayType::COMPLEX_DOUBLE: return convertTyped<std::complex<double>>(A, out, conversion);
+    case matlab::data::ArrayType::COMPLEX_SINGLE: return convertTyped<std::complex<float>>(A, out, conversion);
+    default:
+        throw std::invalid_argument("Array type cannot be converted");
+    }
+}
+#endif // defined(MATLAB_MEX_FILE)
+
+} // namespace utilities::details
+#endif // CONVERT_HPP
@@ -0,0 +1,515 @@
+#ifndef EXPRESSION_HPP
+#define EXPRESSION_HPP
+#include <algorithm>
+#include <array>
+#include <complex>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "blockview.hpp"
+#include "blockdata.hpp"
+#include "stridedview.hpp"
+#include "threadpool.hpp"
+#include "traits.hpp"
+
+namespace utilities::details {
+
+// Lazy element-wise expressions over views.  Arithmetic on views, e.g.
+//
+//     assign(inputs_J.tensorial(i, iDir), imag(input.page(iDir).row(i)) * 1e100);
+//
+// builds a small tree of nodes instead of computing anything; assign() then
+// evaluates it in a single loop, element by element, without temporaries.
+// Operands are BlockViews, strided_views, spans, column major BlockData and
+// anything wrapped with lazy(); the leaves keep pointers, so the data has to
+// outlive the expression.
+//
+// Operands follow MATLAB's implicit expansion: BlockData and BlockViews have
+// their dimensions, all other ranges are columns, and a dimension of extent
+// one is expanded to match the other operands, e.g. a 3 x 1 column plus a
+// 1 x 4 row is 3 x 4.  Expanded operands are never copied: their stride along
+// the singleton dimension is zero.  A rank one view such as BlockData::row is
+// a column here; use a 1 x n subview for a MATLAB row vector.
+
+// Expressions with at least this many elements are evaluated on the thread pool.
+inline constexpr std::size_t expressionParallelLimit = std::size_t{1} << 15;
+
+// Base of all expression nodes.  It lives here rather than in
+// expression_detail so that argument dependent lookup finds the operators
+// below for any node.
+struct expression_node {};
+
+namespace expression_detail {
+
+template <typename T>
+concept scalar = std::is_arithmetic_v<T> || is_complex_v<T>;
+
+template <typename T>
+concept expression = std::derived_from<std::remove_cvref_t<T>, expression_node>;
+
+template <typename T>
+inline constexpr bool is_view = false;
+template <std::size_t R, typename T, typename Layout>
+inline constexpr bool is_view<BlockView<R, T, Layout>> = true;
+template <typename T>
+inline constexpr bool is_view<strided_view<T>> = true;
+template <typename T, std::size_t Extent>
+inline constexpr bool is_view<std::span<T, Extent>> = true;
+
+template <typename T>
+inline constexpr bool is_block = false;
+template <std::size_t N, typename T, typename Allocator>
+inline constexpr bool is_block<BlockData<N, T, Allocator, layout_left>> = true;
+
+// Operands with dimensions of their own; other ranges are columns.
+template <typename T>
+inline constexpr bool is_shaped = is_block<T>;
+template <std::size_t R, typename T, typename Layout>
+inline constexpr bool is_shaped<BlockView<R, T, Layout>> = true;
+
+// Views are held by value; blocks own their elements and must be lvalues.
+template <typename T>
+concept range_operand = is_view<std::remove_cvref_t<T>> || (is_block<std::remove_cvref_t<T>> && std::is_lvalue_reference_v<T>);
+
+template <typename T>
+concept operand = expression<T> || range_operand<T>;
+
+template <typename T>
+concept argument = operand<T> || scalar<std::remove_cvref_t<T>>;
+
+template <std::size_t R>
+std::size_t numel(const std::array<std::size_t, R>& shape) {
+    std::size_t n = 1;
+    for (auto e : shape) {
+        n *= e;
+    }
+    return n;
+}
+
+template <std::size_t R>
+std::array<std::ptrdiff_t, R> columnMajor(const std::array<std::size_t, R>& shape) {
+    std::array<std::ptrdiff_t, R> strides{};
+    std::ptrdiff_t stride = 1;
+    for (std::size_t r = 0; r < R; ++r) {
+        strides[r] = stride;
+        stride *= static_cast<std::ptrdiff_t>(shape[r]);
+    }
+    return strides;
+}
+
+// Extent d of shape, one beyond its rank.
+template <std::size_t R>
+std::size_t extent(const std::array<std::size_t, R>& shape, std::size_t d) {
+    return d < R ? shape[d] : 1;
+}
+
+// Expands shape to take operand along, throws if they are incompatible.
+template <std::size_t R, std::size_t S>
+void expand(std::array<std::size_t, R>& shape, const std::array<std::size_t, S>& operand) {
+    static_assert(S <= R);
+    for (std::size_t d = 0; d < S; ++d) {
+        if (operand[d] == 1 || operand[d] == shape[d]) {
+            continue;
+        }
+        if (shape[d] != 1) {
+            throw std::invalid_argument("Expression sizes must agree");
+        }
+        shape[d] = operand[d];
+    }
+}
+
+// True if operand expands to shape, i.e. agrees with it or is one in every dimension.
+template <std::size_t S, std::size_t R>
+bool expandsTo(const std::array<std::size_t, S>& operand, const std::array<std::size_t, R>& shape) {
+    for (std::size_t d = 0; d < std::max(S, R); ++d) {
+        if (extent(operand, d) != 1 && extent(operand, d) != extent(shape, d)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <std::size_t S, std::size_t R>
+bool sameShape(const std::array<std::size_t, S>& a, const std::array<std::size_t, R>& b) {
+    for (std::size_t d = 0; d < std::max(S, R); ++d) {
+        if (extent(a, d) != extent(b, d)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Expanded expressions are evaluated in runs of up to runLength elements along
+// one dimension.  Each leaf provides its run with unit stride, so that the
+// loop over it vectorises: contiguous leaves in place, others broadcast or
+// gathered into a scratch buffer small enough to stay in cache.
+inline constexpr std::size_t runLength = 256;
+
+template <typename Op, typename... Runs>
+struct NodeRun {
+    Op op;
+    std::tuple<Runs...> runs;
+
+    auto operator[](std::size_t i) const {
+        return std::apply([&](const auto&... r) { return op(r[i]...); }, runs);
+    }
+};
+
+// Leaf over a random access iterator, a plain pointer for contiguous storage.
+// first[i] is element i in column major order if linear is set; strides, in
+// steps of the iterator, are zero along singleton dimensions.
+template <typename Iterator, std::size_t R>
+struct Terminal : expression_node {
+    static constexpr std::size_t rank = R;
+    using value_type = std::iter_value_t<Iterator>;
+    using scratch_type = std::array<value_type, runLength>;
+    Iterator first;
+    std::array<std::size_t, R> shape;
+    std::array<std::ptrdiff_t, R> strides;
+    bool linear;
+
+    Terminal(Iterator first, const std::array<std::size_t, R>& shape, std::array<std::ptrdiff_t, R> strides, bool linear = true)
+        : first(first), shape(shape), strides(strides), linear(linear) {
+        for (std::size_t d = 0; d < R; ++d) {
+            if (shape[d] == 1) {
+                this->strides[d] = 0;
+            }
+        }
+    }
+    std::size_t size() const { return numel(shape); }
+    decltype(auto) operator[](std::size_t i) const { return first[static_cast<std::ptrdiff_t>(i)]; }
+
+    template <std::size_t S>
+    std::ptrdiff_t offset(const std::array<std::size_t, S>& index) const {
+        static_assert(S >= R);
+        std::ptrdiff_t offset = 0;
+        for (std::size_t d = 0; d < R; ++d) {
+            offset += static_cast<std::ptrdiff_t>(index[d]) * strides[d];
+        }
+        return offset;
+    }
+
+    // Elements i0, ..., i0 + count - 1 of (index[0], ..., :, ...), the colon
+    // in dimension inner.
+    template <std::size_t S>
+    const value_type* run(const std::array<std::size_t, S>& index, std::size_t inner, std::size_t i0, std::size_t count,
+                          scratch_type& scratch) const {
+        const std::ptrdiff_t stride = inner < R ? strides[inner] : 0;
+        auto it = first + (offset(index) + static_cast<std::ptrdiff_t>(i0) * stride);
+        if constexpr (std::is_pointer_v<Iterator>) {
+            if (stride == 1) {
+                return it;
+            }
+        }
+        if (stride == 0) {
+            std::fill_n(scratch.begin(), count, static_cast<value_type>(*it));
+        } else {
+            for (std::size_t i = 0; i < count; ++i) {
+                scratch[i] = it[static_cast<std::ptrdiff_t>(i) * stride];
+            }
+        }
+        return scratch.data();
+    }
+};
+
+template <typename T>
+struct Scalar : expression_node {
+    static constexpr std::size_t rank = 0;
+    static constexpr bool linear = true;
+    static constexpr std::array<std::size_t, 0> shape{};
+    using scratch_type = std::tuple<>;
+    T value;
+
+    explicit Scalar(T value) : value(value) {}
+    static constexpr std::size_t size() { return 1; }
+    T operator[](std::size_t) const { return value; }
+    template <std::size_t S>
+    Scalar run(const std::array<std::size_t, S>&, std::size_t, std::size_t, std::size_t, scratch_type&) const { return *this; }
+};
+
+template <typename Op, typename... Args>
+struct Node : expression_node {
+    static constexpr std::size_t rank = std::max({Args::rank...});
+    using scratch_type = std::tuple<typename Args::scratch_type...>;
+    Op op;
+    std::tuple<Args...> args;
+    std::array<std::size_t, rank> shape;
+    // Set unless an operand is expanded, so that operator[] can be used.
+    bool linear;
+
+    Node(Op op, Args... a) : op(op), args(std::move(a)...) {
+        shape.fill(1);
+        std::apply([&](const auto&... arg) {
+            (expand(shape, arg.shape), ...);
+            linear = ((arg.linear && (arg.rank == 0 || sameShape(arg.shape, shape))) && ...);
+        }, args);
+    }
+    std::size_t size() const { return numel(shape); }
+    auto operator[](std::size_t i) const {
+        return std::apply([&](const auto&... a) { return op(a[i]...); }, args);
+    }
+    template <std::size_t S>
+    auto run(const std::array<std::size_t, S>& index, std::size_t inner, std::size_t i0, std::size_t count, scratch_type& scratch) const {
+        return [&]<std::size_t... I>(std::index_sequence<I...>) {
+            return NodeRun{op, std::tuple(std::get<I>(args).run(index, inner, i0, count, std::get<I>(scratch))...)};
+        }(std::index_sequence_for<Args...>{});
+    }
+};
+
+template <std::size_t N, typename T, typename Allocator>
+auto terminal(BlockData<N, T, Allocator, layout_left>& b) {
+    return Terminal<T*, N>(b.data(), b.dims(), columnMajor(b.dims()));
+}
+
+template <std::size_t N, typename T, typename Allocator>
+auto terminal(const BlockData<N, T, Allocator, layout_left>& b) {
+    return Terminal<const T*, N>(b.data(), b.dims(), columnMajor(b.dims()));
+}
+
+template <std::size_t R, typename T>
+auto terminal(const BlockView<R, T, layout_left>& v) {
+    return Terminal<T*, R>(v.data(), v.extents(), columnMajor(v.extents()));
+}
+
+// Views that cannot be walked with a single stride are only evaluated by
+// columns.
+template <std::size_t R, typename T>
+auto terminal(const BlockView<R, T, layout_stride>& v) {
+    if (v.is_collapsible()) {
+        return Terminal<StridedIterator<T>, R>(StridedIterator<T>(v.data(), v.stride(0)), v.extents(), columnMajor(v.extents()));
+    }
+    std::array<std::ptrdiff_t, R> strides{};
+    std::copy(v.strides().begin(), v.strides().end(), strides.begin());
+    return Terminal<StridedIterator<T>, R>(StridedIterator<T>(v.data()), v.extents(), strides, false);
+}
+
+template <typename R>
+    requires(!is_shaped<std::remove_cvref_t<R>>)
+auto terminal(R&& r) {
+    std::array<std::size_t, 1> shape{static_cast<std::size_t>(std::ranges::size(r))};
+    if constexpr (std::ranges::contiguous_range<R>) {
+        return Terminal<decltype(std::ranges::data(r)), 1>(std::ranges::data(r), shape, {1});
+    } else {
+        return Terminal<decltype(std::ranges::begin(r)), 1>(std::ranges::begin(r), shape, {1});
+    }
+}
+
+template <typename T>
+auto lift(T&& x) {
+    if constexpr (expression<T>) {
+        return std::remove_cvref_t<T>(std::forward<T>(x));
+    } else if constexpr (scalar<std::remove_cvref_t<T>>) {
+        return Scalar<std::remove_cvref_t<T>>(x);
+    } else {
+        return terminal(x);
+    }
+}
+
+template <typename Op, typename... Args>
+auto make(Op op, Args&&... args) {
+    return Node<Op, decltype(lift(std::forward<Args>(args)))...>(op, lift(std::forward<Args>(args))...);
+}
+
+// destination(index) = expression(index) for every index of shape, one run
+// along the first non-singleton dimension at a time.
+template <typename Destination, typename Expression, std::size_t R>
+void evaluateColumns(const Destination& destination, const Expression& expression, const std::array<std::size_t, R>& shape) {
+    const std::size_t n = numel(shape);
+    if (n == 0) {
+        return;
+    }
+    std::size_t inner = 0;
+    while (inner + 1 < R && shape[inner] == 1) {
+        ++inner;
+    }
+    const std::size_t length = shape[inner];
+    const std::ptrdiff_t stride = destination.strides[inner];
+    auto evaluate = [&](std::size_t first, std::size_t last) {
+        typename Expression::scratch_type scratch;
+        // A copy of the tree, so that its leaves are known not to alias the
+        // destination and every member is defined on entry to the loop.
+        const Expression local = expression;
+        for (std::size_t j = first; j < last; ++j) {
+            std::array<std::size_t, R> index{};
+            for (std::size_t d = inner + 1, rest = j; d < R; ++d) {
+                index[d] = rest % shape[d];
+                rest /= shape[d];
+            }
+            auto out = destination.first + destination.offset(index);
+            for (std::size_t i0 = 0; i0 < length; i0 += runLength) {
+                const std::size_t count = std::min(runLength, length - i0);
+                auto in = local.run(index, inner, i0, count, scratch);
+                if (stride == 1) {
+                    for (std::size_t i = 0; i < count; ++i) {
+                        out[static_cast<std::ptrdiff_t>(i0 + i)] = in[i];
+                    }
+                } else {
+                    for (std::size_t i = 0; i < count; ++i) {
+                        out[static_cast<std::ptrdiff_t>(i0 + i) * stride] = in[i];
+                    }
+                }
+            }
+        }
+    };
+    if (n < expressionParallelLimit) {
+        evaluate(0, n / length);
+    } else {
+        parallel_for(0, n / length, evaluate, std::max<std::size_t>(1, expressionParallelLimit / 4 / length));
+    }
+}
+
+struct Negate {
+    template <typename A>
+    auto operator()(const A& a) const { return -a; }
+};
+struct Real {
+    template <typename A>
+    auto operator()(const A& a) const { return std::real(a); }
+};
+struct Imag {
+    template <typename A>
+    auto operator()(const A& a) const { return std::imag(a); }
+};
+struct Conj {
+    template <typename A>
+    auto operator()(const A& a) const {
+        if constexpr (is_complex_v<A>) {
+            return std::conj(a);
+        } else {
+            return a;
+        }
+    }
+};
+struct Abs {
+    template <typename A>
+    auto operator()(const A& a) const { return std::abs(a); }
+};
+struct MakeComplex {
+    template <typename A, typename B>
+    auto operator()(const A& a, const B& b) const { return std::complex<std::common_type_t<A, B>>(a, b); }
+};
+struct Select {
+    template <typename C, typename A, typename B>
+    auto operator()(const C& c, const A& a, const B& b) const -> std::common_type_t<A, B> { return c ? a : b; }
+};
+
+} // namespace expression_detail
+
+// Wraps any sized random access range, e.g. a std::vector, as an operand.
+template <std::ranges::random_access_range R>
+    requires std::ranges::sized_range<R> && (std::ranges::borrowed_range<R> || std::is_lvalue_reference_v<R>)
+auto lazy(R&& r) {
+    return expression_detail::terminal(r);
+}
+
+#define MEXUTILITIES_EXPRESSION_BINARY(op, fn)                                                             \
+    template <expression_detail::argument L, expression_detail::argument R>                               \
+        requires(expression_detail::operand<L> || expression_detail::operand<R>)                          \
+    auto operator op(L&& l, R&& r) {                                                                      \
+        return expression_detail::make(fn{}, std::forward<L>(l), std::forward<R>(r));                     \
+    }
+
+MEXUTILITIES_EXPRESSION_BINARY(+, std::plus<>)
+MEXUTILITIES_EXPRESSION_BINARY(-, std::minus<>)
+MEXUTILITIES_EXPRESSION_BINARY(*, std::multiplies<>)
+MEXUTILITIES_EXPRESSION_BINARY(/, std::divides<>)
+MEXUTILITIES_EXPRESSION_BINARY(<, std::less<>)
+MEXUTILITIES_EXPRESSION_BINARY(<=, std::less_equal<>)
+MEXUTILITIES_EXPRESSION_BINARY(>, std::greater<>)
+MEXUTILITIES_EXPRESSION_BINARY(>=, std::greater_equal<>)
+MEXUTILITIES_EXPRESSION_BINARY(==, std::equal_to<>)
+MEXUTILITIES_EXPRESSION_BINARY(!=, std::not_equal_to<>)
+
+#undef MEXUTILITIES_EXPRESSION_BINARY
+
+template <expression_detail::operand E>
+auto operator-(E&& e) {
+    return expression_detail::make(expression_detail::Negate{}, std::forward<E>(e));
+}
+
+template <expression_detail::operand E>
+auto real(E&& e) {
+    return expression_detail::make(expression_detail::Real{}, std::forward<E>(e));
+}
+
+template <expression_detail::operand E>
+auto imag(E&& e) {
+    return expression_detail::make(expression_detail::Imag{}, std::forward<E>(e));
+}
+
+template <expression_detail::operand E>
+auto conj(E&& e) {
+    return expression_detail::make(expression_detail::Conj{}, std::forward<E>(e));
+}
+
+template <expression_detail::operand E>
+auto abs(E&& e) {
+    return expression_detail::make(expression_detail::Abs{}, std::forward<E>(e));
+}
+
+// Element-wise std::complex(re, im).
+template <expression_detail::argument Re, expression_detail::argument Im>
+    requires(expression_detail::operand<Re> || expression_detail::operand<Im>)
+auto complex(Re&& re, Im&& im) {
+    return expression_detail::make(expression_detail::MakeComplex{}, std::forward<Re>(re), std::forward<Im>(im));
+}
+
+// Element-wise condition ? a : b; both branches are evaluated.
+template <expression_detail::argument C, expression_detail::argument A, expression_detail::argument B>
+    requires(expression_detail::operand<C> || expression_detail::operand<A> || expression_detail::operand<B>)
+auto select(C&& condition, A&& a, B&& b) {
+    return expression_detail::make(expression_detail::Select{}, std::forward<C>(condition), std::forward<A>(a), std::forward<B>(b));
+}
+
+// target = e element for element, in one pass and, from
+// expressionParallelLimit elements on, on the thread pool.  e may be a scalar
+// or any operand.  It is expanded to the dimensions of target as in MATLAB's
+// target(:, :) = e; failing that, it must have as many elements as target,
+// which are then assigned in column major order.  target must not overlap
+// the operands of e other than element for element.
+template <typename Target, expression_detail::argument E>
+    requires expression_detail::range_operand<Target> || std::ranges::random_access_range<Target>
+void assign(Target&& target, E&& e) {
+    auto expression = expression_detail::lift(std::forward<E>(e));
+    auto destination = expression_detail::terminal(target);
+    const std::size_t n = destination.size();
+    if (destination.linear && expression.linear && (expression.rank == 0 || expression.size() == n)) {
+        auto evaluate = [&](std::size_t first, std::size_t last) {
+            auto out = destination.first;
+            for (std::size_t i = first; i < last; ++i) {
+                out[static_cast<std::ptrdiff_t>(i)] = expression[i];
+            }
+        };
+        if (n < expressionParallelLimit) {
+            evaluate(0, n);
+        } else {
+            parallel_for(0, n, evaluate, expressionParallelLimit / 4);
+        }
+        return;
+    }
+    constexpr std::size_t R = std::max(decltype(destination)::rank, decltype(expression)::rank);
+    std::array<std::size_t, R> shape;
+    shape.fill(1);
+    std::copy(destination.shape.begin(), destination.shape.end(), shape.begin());
+    if (expression_detail::expandsTo(expression.shape, shape)) {
+        expression_detail::evaluateColumns(destination, expression, shape);
+        return;
+    }
+    if (!destination.linear || expression.size() != n) {
+        throw std::invalid_argument("Expression sizes must agree");
+    }
+    shape.fill(1);
+    std::copy(expression.shape.begin(), expression.shape.end(), shape.begin());
+    using Iterator = decltype(destination.first);
+    expression_detail::evaluateColumns(expression_detail::Terminal<Iterator, R>(destination.first, shape, expression_detail::columnMajor(shape)),
+                                       expression, shape);
+}
+
+} // namespace utilities::details
+#endif // EXPRESSION_HPP
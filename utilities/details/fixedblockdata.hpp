@@ -0,0 +1,194 @@
+#ifndef FIXEDBLOCKDATA_HPP
+#define FIXEDBLOCKDATA_HPP
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include "allocator.hpp"
+#include "storage.hpp"
+#include "blockview.hpp"
+
+namespace utilities::details {
+
+inline constexpr std::size_t dynamic_extent = std::numeric_limits<std::size_t>::max();
+
+// Mix of compile time and run time extents, modelled on std::extents.  Only the
+// dynamic ones take up space.
+template <std::size_t... Extents>
+class extents {
+    static constexpr std::array<std::size_t, sizeof...(Extents)> _static{Extents...};
+
+public:
+    static constexpr std::size_t rank() { return sizeof...(Extents); }
+    static constexpr std::size_t rank_dynamic() { return ((Extents == dynamic_extent ? 1 : 0) + ... + 0); }
+    static constexpr std::size_t static_extent(std::size_t r) { return _static[r]; }
+
+    // Index of dimension r amongst the dynamic extents.
+    static constexpr std::size_t dynamic_index(std::size_t r) {
+        std::size_t index = 0;
+        for (std::size_t s = 0; s < r; ++s) {
+            index += _static[s] == dynamic_extent ? 1 : 0;
+        }
+        return index;
+    }
+
+    constexpr extents() = default;
+
+    template <typename... Dynamic>
+        requires (sizeof...(Dynamic) == rank_dynamic()) && (sizeof...(Dynamic) > 0) && (std::is_convertible_v<Dynamic, std::size_t> && ...)
+    constexpr explicit extents(Dynamic... dynamic) : _dynamic{static_cast<std::size_t>(dynamic)...} {}
+
+    constexpr std::size_t extent(std::size_t r) const {
+        if constexpr (rank_dynamic() == 0) {
+            return _static[r];
+        } else {
+            if (_static[r] != dynamic_extent) {
+                return _static[r];
+            }
+            return _dynamic[dynamic_index(r)];
+        }
+    }
+
+    constexpr std::size_t size() const {
+        std::size_t n = 1;
+        for (std::size_t r = 0; r < rank(); ++r) {
+            n *= extent(r);
+        }
+        return n;
+    }
+
+    constexpr std::array<std::size_t, sizeof...(Extents)> to_array() const {
+        std::array<std::size_t, sizeof...(Extents)> dims{};
+        for (std::size_t r = 0; r < rank(); ++r) {
+            dims[r] = extent(r);
+        }
+        return dims;
+    }
+
+private:
+    struct none {};
+    [[no_unique_address]] std::conditional_t<rank_dynamic() == 0, none, std::array<std::size_t, rank_dynamic()>> _dynamic{};
+};
+
+// BlockData whose extents are (partly) known at compile time, e.g.
+// FixedBlockData<double, extents<2, 2, dynamic_extent>> for a stack of 2x2
+// matrices.  Index arithmetic on static extents folds to constants, so loops
+// over them unroll.  If all extents are static the elements are stored inline
+// and never touch the heap.  Element access through operator() is unchecked,
+// use at() for bounds checking.
+template <typename T, typename Extents, typename Allocator = aligned_allocator<T>>
+class FixedBlockData {
+    static constexpr std::size_t R = Extents::rank();
+    static_assert(R > 0, "Invalid number of dimensions.");
+
+public:
+    static constexpr bool is_static = Extents::rank_dynamic() == 0;
+    using extents_type = Extents;
+    using storage_type = std::conditional_t<is_static, std::array<T, Extents().size()>, Storage<T, Allocator>>;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+private:
+    [[no_unique_address]] Extents _extents;
+    storage_type _data;
+
+    template <typename... Idx>
+    constexpr std::size_t offset(Idx... idx) const {
+        const std::array<std::size_t, R> index{static_cast<std::size_t>(idx)...};
+        std::size_t offset = 0;
+        std::size_t stride = 1;
+        for (std::size_t r = 0; r < R; ++r) {
+            assert(index[r] < _extents.extent(r) && "Index out of range");
+            offset += index[r] * stride;
+            stride *= _extents.extent(r);
+        }
+        return offset;
+    }
+
+public:
+    constexpr FixedBlockData() : _extents(), _data() {}
+
+    template <typename... Dynamic>
+        requires (!is_static) && (sizeof...(Dynamic) == Extents::rank_dynamic()) && (std::is_convertible_v<Dynamic, std::size_t> && ...)
+    explicit FixedBlockData(Dynamic... dynamic) : _extents(dynamic...), _data(_extents.size()) {}
+
+    template <typename... Dynamic>
+        requires (!is_static) && (sizeof...(Dynamic) == Extents::rank_dynamic()) && (std::is_convertible_v<Dynamic, std::size_t> && ...)
+    FixedBlockData& resize(Dynamic... dynamic) {
+        _extents = Extents(dynamic...);
+        _data.resize(_extents.size());
+        return *this;
+    }
+
+    static constexpr std::size_t rank() { return R; }
+    constexpr std::size_t extent(std::size_t r) const { return _extents.extent(r); }
+    constexpr const Extents& extents() const { return _extents; }
+    constexpr std::size_t size() const { return _extents.size(); }
+
+    std::size_t nRows() const { return extent(0); }
+    std::size_t nCols() const {
+        static_assert(R >= 2, "Invalid number of dimensions");
+        return extent(1);
+    }
+    std::size_t nPages() const {
+        static_assert(R > 2, "Invalid number of dimensions");
+        return extent(2);
+    }
+
+    template <typename... Idx>
+        requires (sizeof...(Idx) == R) && (std::is_convertible_v<Idx, std::size_t> && ...)
+    constexpr T& operator()(Idx... idx) {
+        return _data[offset(idx...)];
+    }
+
+    template <typename... Idx>
+        requires (sizeof...(Idx) == R) && (std::is_convertible_v<Idx, std::size_t> && ...)
+    constexpr const T& operator()(Idx... idx) const {
+        return _data[offset(idx...)];
+    }
+
+    template <typename... Idx>
+        requires (sizeof...(Idx) == R) && (std::is_convertible_v<Idx, std::size_t> && ...)
+    T& at(Idx... idx) {
+        const std::array<std::size_t, R> index{static_cast<std::size_t>(idx)...};
+        for (std::size_t r = 0; r < R; ++r) {
+            if (index[r] >= extent(r)) {
+                throw std::out_of_range("Index out of range");
+            }
+        }
+        return _data[offset(idx...)];
+    }
+
+    template <typename... Idx>
+        requires (sizeof...(Idx) == R) && (std::is_convertible_v<Idx, std::size_t> && ...)
+    const T& at(Idx... idx) const {
+        return const_cast<FixedBlockData*>(this)->at(idx...);
+    }
+
+    constexpr T* data() { return _data.data(); }
+    constexpr const T* data() const { return _data.data(); }
+
+    constexpr iterator begin() { return data(); }
+    constexpr iterator end() { return data() + size(); }
+    constexpr const_iterator begin() const { return data(); }
+    constexpr const_iterator end() const { return data() + size(); }
+    constexpr const_iterator cbegin() const { return begin(); }
+    constexpr const_iterator cend() const { return end(); }
+
+    BlockView<R, T, layout_left> view() { return BlockView<R, T, layout_left>(data(), _extents.to_array()); }
+    BlockView<R, const T, layout_left> view() const { return BlockView<R, const T, layout_left>(data(), _extents.to_array()); }
+
+    auto row(std::size_t iRow) { return view().row(iRow); }
+    auto row(std::size_t iRow) const { return view().row(iRow); }
+    auto column(std::size_t jCol) { return view().column(jCol); }
+    auto column(std::size_t jCol) const { return view().column(jCol); }
+    auto page(std::size_t kPage) { return view().page(kPage); }
+    auto page(std::size_t kPage) const { return view().page(kPage); }
+    auto tensorial(std::size_t iRow, std::size_t jCol) { return view().tensorial(iRow, jCol); }
+    auto tensorial(std::size_t iRow, std::size_t jCol) const { return view().tensorial(iRow, jCol); }
+};
+
+} // namespace utilities::details
+#endif // FIXEDBLOCKDATA_HPP
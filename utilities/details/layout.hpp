@@ -0,0 +1,466 @@
+#ifndef LAYOUT_HPP
+#define LAYOUT_HPP
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <ranges>
+#include <stdexcept>
+#include <type_traits>
+#include "blockview.hpp"
+#include "threadpool.hpp"
+#include "transpose.hpp"
+
+namespace utilities::details {
+
+// Memory layouts of BlockData besides layout_left, MATLAB's column major order
+// (see blockview.hpp).  A layout provides mapping<N>, which turns the index of
+// an element of a rank N block into its offset in storage.  All layouts are
+// packed, a block takes prod(extents) elements, and all of them describe the
+// same logical array: only the order in memory differs, so a kernel can pick
+// the layout that makes its inner loop stride one and relayout() converts at
+// the mex boundary.
+
+// The last dimension runs fastest, the others follow in column major order.
+// For a BlockData<3> of outputs x directions x points the tensorial fibres are
+// contiguous, so loops over the points are stride one, while a page is a
+// strided view.
+struct layout_direction_major {
+    template <std::size_t N>
+    class mapping {
+        std::array<std::size_t, N> _extents{};
+
+    public:
+        static constexpr std::size_t rank = N;
+        static constexpr bool is_strided = true;
+
+        mapping() = default;
+        explicit mapping(const std::array<std::size_t, N>& extents) : _extents(extents) {}
+
+        const std::array<std::size_t, N>& extents() const { return _extents; }
+
+        std::size_t required_span_size() const {
+            std::size_t n = 1;
+            for (auto e : _extents) {
+                n *= e;
+            }
+            return n;
+        }
+
+        std::array<std::size_t, N> strides() const {
+            std::array<std::size_t, N> strides{};
+            std::size_t stride = 1;
+            for (auto r : order()) {
+                strides[r] = stride;
+                stride *= _extents[r];
+            }
+            return strides;
+        }
+
+        static constexpr std::array<std::size_t, N> order() {
+            std::array<std::size_t, N> order{};
+            order[0] = N - 1;
+            for (std::size_t r = 1; r < N; ++r) {
+                order[r] = r - 1;
+            }
+            return order;
+        }
+
+        std::size_t operator()(const std::array<std::size_t, N>& index) const {
+            std::size_t offset = index[N - 1];
+            std::size_t stride = _extents[N - 1];
+            for (std::size_t r = 0; r + 1 < N; ++r) {
+                offset += index[r] * stride;
+                stride *= _extents[r];
+            }
+            return offset;
+        }
+    };
+};
+
+// Every page, the first two dimensions, is stored as Tile x Tile tiles: column
+// major inside a tile, tiles column major in the page.  The tiles of the last
+// row and column are cut to size rather than padded.  Pages follow each other
+// as in layout_left.  Blocked kernels work on BlockData::tile(), a packed
+// matrix small enough to stay in L1.
+template <std::size_t Tile = 32>
+struct layout_tiled {
+    static_assert(Tile > 0, "Invalid tile size");
+
+    template <std::size_t N>
+    class mapping {
+        static_assert(N >= 2, "Tiled layouts need at least two dimensions");
+        std::array<std::size_t, N> _extents{};
+
+    public:
+        static constexpr std::size_t rank = N;
+        static constexpr bool is_strided = false;
+        static constexpr std::size_t tile_size = Tile;
+
+        mapping() = default;
+        explicit mapping(const std::array<std::size_t, N>& extents) : _extents(extents) {}
+
+        const std::array<std::size_t, N>& extents() const { return _extents; }
+
+        std::size_t required_span_size() const { return pageSize() * nPages(); }
+
+        std::size_t pageSize() const { return _extents[0] * _extents[1]; }
+
+        // Pages counted over all dimensions after the first two.
+        std::size_t nPages() const {
+            std::size_t n = 1;
+            for (std::size_t r = 2; r < N; ++r) {
+                n *= _extents[r];
+            }
+            return n;
+        }
+
+        std::size_t nTileRows() const { return (_extents[0] + Tile - 1) / Tile; }
+        std::size_t nTileCols() const { return (_extents[1] + Tile - 1) / Tile; }
+        std::size_t tileRows(std::size_t iTile) const { return std::min(Tile, _extents[0] - iTile * Tile); }
+        std::size_t tileCols(std::size_t jTile) const { return std::min(Tile, _extents[1] - jTile * Tile); }
+
+        std::size_t tileOffset(std::size_t iTile, std::size_t jTile, std::size_t kPage) const {
+            return kPage * pageSize() + jTile * Tile * _extents[0] + iTile * Tile * tileCols(jTile);
+        }
+
+        std::size_t operator()(const std::array<std::size_t, N>& index) const {
+            const std::size_t iTile = index[0] / Tile;
+            const std::size_t jTile = index[1] / Tile;
+            std::size_t kPage = 0;
+            std::size_t stride = 1;
+            for (std::size_t r = 2; r < N; ++r) {
+                kPage += index[r] * stride;
+                stride *= _extents[r];
+            }
+            return tileOffset(iTile, jTile, kPage) + (index[0] - iTile * Tile) + (index[1] - jTile * Tile) * tileRows(iTile);
+        }
+    };
+};
+
+template <typename Mapping>
+concept tiled_mapping = requires(const Mapping& m) {
+    m.tileOffset(0, 0, 0);
+};
+
+// Random access iterator along one dimension of a MappedView.
+template <typename T, typename Mapping>
+struct MappedIterator {
+    using iterator_concept = std::random_access_iterator_tag;
+    using iterator_category = std::random_access_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = std::remove_cv_t<T>;
+    using pointer = T*;
+    using reference = T&;
+
+    MappedIterator() = default;
+    MappedIterator(T* data, const Mapping& mapping, const std::array<std::size_t, Mapping::rank>& base, std::size_t dim, difference_type index)
+        : _data(data), _mapping(mapping), _base(base), _dim(dim), _index(index) {}
+
+    reference operator*() const { return (*this)[0]; }
+    pointer operator->() const { return &(*this)[0]; }
+    reference operator[](difference_type n) const {
+        auto index = _base;
+        index[_dim] = static_cast<std::size_t>(_index + n);
+        return _data[_mapping(index)];
+    }
+
+    MappedIterator& operator++() {
+        ++_index;
+        return *this;
+    }
+    MappedIterator operator++(int) {
+        MappedIterator tmp = *this;
+        ++_index;
+        return tmp;
+    }
+    MappedIterator& operator--() {
+        --_index;
+        return *this;
+    }
+    MappedIterator operator--(int) {
+        MappedIterator tmp = *this;
+        --_index;
+        return tmp;
+    }
+    MappedIterator& operator+=(difference_type n) {
+        _index += n;
+        return *this;
+    }
+    MappedIterator& operator-=(difference_type n) {
+        _index -= n;
+        return *this;
+    }
+    friend MappedIterator operator+(MappedIterator it, difference_type n) { return it += n; }
+    friend MappedIterator operator+(difference_type n, MappedIterator it) { return it += n; }
+    friend MappedIterator operator-(MappedIterator it, difference_type n) { return it -= n; }
+    friend difference_type operator-(const MappedIterator& lhs, const MappedIterator& rhs) { return lhs._index - rhs._index; }
+
+    // Only iterators along the same line are comparable.
+    bool operator==(const MappedIterator& other) const { return _index == other._index; }
+    auto operator<=>(const MappedIterator& other) const { return _index <=> other._index; }
+
+private:
+    T* _data{nullptr};
+    Mapping _mapping{};
+    std::array<std::size_t, Mapping::rank> _base{};
+    std::size_t _dim{0};
+    difference_type _index{0};
+};
+
+// Rank R view into a block whose layout is not strided, e.g. layout_tiled.
+// It has the interface of BlockView, but every element is located through
+// the mapping of the whole block, which costs a few integer operations per
+// access.  Hot loops should work on whole tiles instead.
+template <std::size_t R, typename T, typename Mapping>
+class MappedView {
+    static constexpr std::size_t M = Mapping::rank;
+    static_assert(R > 0 && R <= M, "Invalid number of dimensions.");
+
+    T* _data{nullptr};
+    Mapping _mapping{};
+    // Index of the first element; the free dimensions run from there.
+    std::array<std::size_t, M> _base{};
+    std::array<std::size_t, R> _free{};
+
+    template <std::size_t, typename, typename>
+    friend class MappedView;
+
+    void checkIndex(std::size_t dim, std::size_t index, const char* message) const {
+        if (index >= extent(dim)) {
+            throw std::out_of_range(message);
+        }
+    }
+
+public:
+    using element_type = T;
+    using value_type = std::remove_cv_t<T>;
+    using mapping_type = Mapping;
+    using iterator = MappedIterator<T, Mapping>;
+    using const_iterator = MappedIterator<const T, Mapping>;
+
+    MappedView() = default;
+
+    MappedView(T* data, const Mapping& mapping) : _data(data), _mapping(mapping) {
+        static_assert(R == M, "A view of the whole block has its rank");
+        for (std::size_t r = 0; r < R; ++r) {
+            _free[r] = r;
+        }
+    }
+
+    MappedView(T* data, const Mapping& mapping, const std::array<std::size_t, M>& base, const std::array<std::size_t, R>& free)
+        : _data(data), _mapping(mapping), _base(base), _free(free) {}
+
+    template <typename U>
+        requires std::is_convertible_v<U*, T*>
+    MappedView(const MappedView<R, U, Mapping>& other)
+        : _data(other._data), _mapping(other._mapping), _base(other._base), _free(other._free) {}
+
+    static constexpr std::size_t rank() { return R; }
+    std::size_t extent(std::size_t dim) const { return _mapping.extents()[_free[dim]]; }
+    std::array<std::size_t, R> extents() const {
+        std::array<std::size_t, R> extents{};
+        for (std::size_t r = 0; r < R; ++r) {
+            extents[r] = extent(r);
+        }
+        return extents;
+    }
+
+    std::size_t size() const {
+        std::size_t n = 1;
+        for (std::size_t r = 0; r < R; ++r) {
+            n *= extent(r);
+        }
+        return n;
+    }
+    bool empty() const { return size() == 0; }
+
+    const Mapping& mapping() const { return _mapping; }
+
+    template <typename... Idx>
+        requires (sizeof...(Idx) == R) && (std::is_convertible_v<Idx, std::size_t> && ...)
+    T& operator()(Idx... idx) const {
+        const std::array<std::size_t, R> free{static_cast<std::size_t>(idx)...};
+        auto index = _base;
+        for (std::size_t r = 0; r < R; ++r) {
+            index[_free[r]] = free[r];
+        }
+        return _data[_mapping(index)];
+    }
+
+    T& operator[](std::size_t iElement) const {
+        static_assert(R == 1, "Invalid number of dimensions");
+        return (*this)(iElement);
+    }
+
+    // Fixes dimension Dim at index, see BlockView::slice.
+    template <std::size_t Dim>
+    MappedView<R - 1, T, Mapping> slice(std::size_t index) const {
+        static_assert(R > 1, "Cannot slice a rank one view");
+        static_assert(Dim < R, "Invalid dimension");
+        checkIndex(Dim, index, "Slice index out of range");
+        auto base = _base;
+        base[_free[Dim]] = index;
+        std::array<std::size_t, R - 1> free{};
+        for (std::size_t r = 0, s = 0; r < R; ++r) {
+            if (r != Dim) {
+                free[s++] = _free[r];
+            }
+        }
+        return MappedView<R - 1, T, Mapping>(_data, _mapping, base, free);
+    }
+
+    auto row(std::size_t iRow) const {
+        static_assert(R == 2, "Invalid number of dimensions");
+        checkIndex(0, iRow, "Row index out of range");
+        return slice<0>(iRow);
+    }
+
+    auto column(std::size_t jCol) const {
+        static_assert(R == 2, "Invalid number of dimensions");
+        checkIndex(1, jCol, "Column index out of range");
+        return slice<1>(jCol);
+    }
+
+    auto page(std::size_t kPage) const {
+        static_assert(R == 3, "Invalid number of dimensions");
+        checkIndex(2, kPage, "Page index out of range");
+        return slice<2>(kPage);
+    }
+
+    auto tensorial(std::size_t iRow, std::size_t jCol) const {
+        static_assert(R == 3, "Invalid number of dimensions");
+        if (iRow >= extent(0) || jCol >= extent(1)) {
+            throw std::out_of_range("Tensor direction indices out of range");
+        }
+        return slice<0>(iRow).template slice<0>(jCol);
+    }
+
+    // Only rank one views are ranges.
+    iterator begin() const {
+        static_assert(R == 1, "Only rank one views can be iterated");
+        return iterator(_data, _mapping, _base, _free[0], 0);
+    }
+    iterator end() const {
+        static_assert(R == 1, "Only rank one views can be iterated");
+        return iterator(_data, _mapping, _base, _free[0], static_cast<std::ptrdiff_t>(extent(0)));
+    }
+    const_iterator cbegin() const { return const_iterator(_data, _mapping, _base, _free[0], 0); }
+    const_iterator cend() const { return const_iterator(_data, _mapping, _base, _free[0], static_cast<std::ptrdiff_t>(extent(0))); }
+};
+
+namespace layout_detail {
+
+// Calls fn(tiled, strided, n, stride) for every column of every tile: n
+// elements at tiled + e in the tiled block are element e of the column,
+// which starts at strided in the strided block and runs with stride.  Strips
+// of tiles run on the thread pool.
+template <typename TiledMapping, typename StridedMapping, typename Fn>
+void forEachTileColumn(const TiledMapping& tiled, const StridedMapping& strided, Fn&& fn) {
+    constexpr std::size_t N = TiledMapping::rank;
+    constexpr std::size_t Tile = TiledMapping::tile_size;
+    const auto& extents = tiled.extents();
+    const auto strides = strided.strides();
+    const std::size_t nTileCols = tiled.nTileCols();
+    const std::size_t grain = std::max<std::size_t>((std::size_t{1} << 16) / std::max<std::size_t>(Tile * extents[0], 1), 1);
+    parallel_for(0, tiled.nPages() * nTileCols, [&](std::size_t first, std::size_t last) {
+        for (std::size_t iStrip = first; iStrip < last; ++iStrip) {
+            const std::size_t jTile = iStrip % nTileCols;
+            std::size_t kPage = iStrip / nTileCols;
+            std::size_t pageOffset = 0;
+            for (std::size_t r = 2; r < N; ++r) {
+                pageOffset += kPage % extents[r] * strides[r];
+                kPage /= extents[r];
+            }
+            const std::size_t nCols = tiled.tileCols(jTile);
+            // Column by column through the strip: the strided side is read or
+            // written in whole columns, the tiled side in Tile long pieces.
+            for (std::size_t jj = 0; jj < nCols; ++jj) {
+                for (std::size_t iTile = 0; iTile < tiled.nTileRows(); ++iTile) {
+                    const std::size_t nRows = tiled.tileRows(iTile);
+                    const std::size_t tile = tiled.tileOffset(iTile, jTile, iStrip / nTileCols);
+                    fn(tile + jj * nRows, pageOffset + iTile * Tile * strides[0] + (jTile * Tile + jj) * strides[1], nRows, strides[0]);
+                }
+            }
+        }
+    }, grain);
+}
+
+} // namespace layout_detail
+
+// out(index) = in(index) for every index of a block, with in stored in the
+// layout described by from and out in the one described by to.  Between
+// strided layouts this is a permute of the storage, between a tiled and a
+// strided one a copy of tile columns; anything else goes element by element.
+template <typename T, typename FromMapping, typename ToMapping>
+void relayout(const T* in, const FromMapping& from, T* out, const ToMapping& to) {
+    static_assert(FromMapping::rank == ToMapping::rank, "Layouts must have the same rank");
+    constexpr std::size_t N = FromMapping::rank;
+    const auto& extents = from.extents();
+    if (extents != to.extents()) {
+        throw std::invalid_argument("Extents of the layouts must agree");
+    }
+    const std::size_t nElements = from.required_span_size();
+    if (nElements == 0) {
+        return;
+    }
+    if constexpr (FromMapping::is_strided && ToMapping::is_strided) {
+        // Storage of from is a column major array of the dimensions in the
+        // order of from; out reorders them to the order of to.
+        const auto fromOrder = from.order();
+        const auto toOrder = to.order();
+        std::array<std::size_t, N> storageDims{};
+        std::array<std::size_t, N> position{};
+        std::array<std::size_t, N> order{};
+        for (std::size_t k = 0; k < N; ++k) {
+            storageDims[k] = extents[fromOrder[k]];
+            position[fromOrder[k]] = k;
+        }
+        for (std::size_t k = 0; k < N; ++k) {
+            order[k] = position[toOrder[k]];
+        }
+        permute(in, storageDims, order, out);
+    } else if constexpr (tiled_mapping<FromMapping> && ToMapping::is_strided) {
+        layout_detail::forEachTileColumn(from, to, [&](std::size_t tiled, std::size_t strided, std::size_t n, std::size_t stride) {
+            if (stride == 1) {
+                std::copy_n(in + tiled, n, out + strided);
+                return;
+            }
+            for (std::size_t e = 0; e < n; ++e) {
+                out[strided + e * stride] = in[tiled + e];
+            }
+        });
+    } else if constexpr (FromMapping::is_strided && tiled_mapping<ToMapping>) {
+        layout_detail::forEachTileColumn(to, from, [&](std::size_t tiled, std::size_t strided, std::size_t n, std::size_t stride) {
+            if (stride == 1) {
+                std::copy_n(in + strided, n, out + tiled);
+                return;
+            }
+            for (std::size_t e = 0; e < n; ++e) {
+                out[tiled + e] = in[strided + e * stride];
+            }
+        });
+    } else {
+        parallel_for(0, nElements, [&](std::size_t first, std::size_t last) {
+            std::array<std::size_t, N> index{};
+            std::size_t remainder = first;
+            for (std::size_t r = 0; r < N; ++r) {
+                index[r] = remainder % extents[r];
+                remainder /= extents[r];
+            }
+            for (std::size_t iElement = first; iElement < last; ++iElement) {
+                out[to(index)] = in[from(index)];
+                for (std::size_t r = 0; r < N && ++index[r] == extents[r]; ++r) {
+                    index[r] = 0;
+                }
+            }
+        }, std::size_t{1} << 14);
+    }
+}
+
+} // namespace utilities::details
+
+template <std::size_t R, typename T, typename Mapping>
+inline constexpr bool std::ranges::enable_borrowed_range<utilities::details::MappedView<R, T, Mapping>> = true;
+
+#endif // LAYOUT_HPP
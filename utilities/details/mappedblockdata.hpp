@@ -0,0 +1,383 @@
+#ifndef MAPPEDBLOCKDATA_HPP
+#define MAPPEDBLOCKDATA_HPP
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include "blockview.hpp"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace utilities::details {
+
+enum class MapMode { read_only, read_write };
+
+// Expected access pattern, passed on to the kernel with madvise.
+enum class Access { normal, sequential, random };
+
+// length bytes of a file from offset on, mapped into memory and shared with
+// the file, so that writes end up in it.  The kernel pages the file in on
+// demand and may drop clean pages again, which makes files larger than the
+// memory usable.  The access hints are madvise calls; on Windows they are
+// ignored.
+class MappedFile {
+    std::byte* _mapping{nullptr};
+    std::size_t _mappedLength{0};
+    std::size_t _offset{0};
+    std::size_t _length{0};
+    MapMode _mode{MapMode::read_only};
+
+#if defined(_WIN32)
+    [[noreturn]] static void fail(const char* what) {
+        throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), what);
+    }
+
+    static std::size_t granularity() {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwAllocationGranularity;
+    }
+#else
+    [[noreturn]] static void fail(const char* what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    static std::size_t granularity() {
+        return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    void advise(std::size_t first, std::size_t count, int advice) const {
+        if (!_mapping || count == 0) {
+            return;
+        }
+        // madvise wants whole pages; widening the range only touches the
+        // mapping's own pages.
+        const std::size_t pageSize = granularity();
+        const std::size_t begin = (_offset + first) / pageSize * pageSize;
+        const std::size_t end = std::min(_mappedLength, _offset + first + count);
+        if (begin < end) {
+            ::madvise(_mapping + begin, end - begin, advice);
+        }
+    }
+#endif
+
+    void unmap() {
+        if (!_mapping) {
+            return;
+        }
+#if defined(_WIN32)
+        UnmapViewOfFile(_mapping);
+#else
+        ::munmap(_mapping, _mappedLength);
+#endif
+        _mapping = nullptr;
+    }
+
+public:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    MappedFile() = default;
+
+    // Maps length bytes from offset on, by default the rest of the file.
+    MappedFile(const std::filesystem::path& path, MapMode mode, std::size_t offset = 0, std::size_t length = npos) : _mode(mode) {
+        const bool writable = mode == MapMode::read_write;
+#if defined(_WIN32)
+        HANDLE file = CreateFileW(path.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                  nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            fail("Cannot open file for mapping");
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            CloseHandle(file);
+            fail("Cannot determine the file size");
+        }
+        const std::size_t fileSize = static_cast<std::size_t>(size.QuadPart);
+#else
+        const int fd = ::open(path.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+        if (fd < 0) {
+            fail("Cannot open file for mapping");
+        }
+        struct stat status;
+        if (::fstat(fd, &status) != 0) {
+            ::close(fd);
+            fail("Cannot determine the file size");
+        }
+        const std::size_t fileSize = static_cast<std::size_t>(status.st_size);
+#endif
+        if (length == npos) {
+            length = offset <= fileSize ? fileSize - offset : 0;
+        }
+        if (offset > fileSize || length > fileSize - offset) {
+#if defined(_WIN32)
+            CloseHandle(file);
+#else
+            ::close(fd);
+#endif
+            throw std::invalid_argument("File is too small for the requested mapping");
+        }
+        // The mapping has to start at a multiple of the page size.
+        const std::size_t start = offset / granularity() * granularity();
+        _offset = offset - start;
+        _length = length;
+        _mappedLength = _offset + length;
+        if (length > 0) {
+#if defined(_WIN32)
+            HANDLE mapping = CreateFileMappingW(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) {
+                const unsigned long long start64 = start;
+                _mapping = static_cast<std::byte*>(MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+                                                                 static_cast<DWORD>(start64 >> 32), static_cast<DWORD>(start64), _mappedLength));
+            }
+            // The view keeps the mapping object alive.
+            const DWORD error = GetLastError();
+            if (mapping) {
+                CloseHandle(mapping);
+            }
+            CloseHandle(file);
+            if (!_mapping) {
+                SetLastError(error);
+                fail("Cannot map file");
+            }
+#else
+            void* mapping = ::mmap(nullptr, _mappedLength, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, static_cast<off_t>(start));
+            const int error = errno;
+            ::close(fd);
+            if (mapping == MAP_FAILED) {
+                errno = error;
+                fail("Cannot map file");
+            }
+            _mapping = static_cast<std::byte*>(mapping);
+#endif
+        } else {
+#if defined(_WIN32)
+            CloseHandle(file);
+#else
+            ::close(fd);
+#endif
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept
+        : _mapping(std::exchange(other._mapping, nullptr))
+        , _mappedLength(std::exchange(other._mappedLength, 0))
+        , _offset(std::exchange(other._offset, 0))
+        , _length(std::exchange(other._length, 0))
+        , _mode(other._mode) {}
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            _mapping = std::exchange(other._mapping, nullptr);
+            _mappedLength = std::exchange(other._mappedLength, 0);
+            _offset = std::exchange(other._offset, 0);
+            _length = std::exchange(other._length, 0);
+            _mode = other._mode;
+        }
+        return *this;
+    }
+    ~MappedFile() { unmap(); }
+
+    // Creates path, or truncates it, with size zero bytes.  The file is
+    // sparse where the file system allows it.
+    static void create(const std::filesystem::path& path, std::size_t size) {
+#if defined(_WIN32)
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            fail("Cannot create file");
+        }
+        LARGE_INTEGER end;
+        end.QuadPart = static_cast<LONGLONG>(size);
+        const bool ok = SetFilePointerEx(file, end, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+        const DWORD error = GetLastError();
+        CloseHandle(file);
+        if (!ok) {
+            SetLastError(error);
+            fail("Cannot resize file");
+        }
+#else
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fail("Cannot create file");
+        }
+        const int result = ::ftruncate(fd, static_cast<off_t>(size));
+        const int error = errno;
+        ::close(fd);
+        if (result != 0) {
+            errno = error;
+            fail("Cannot resize file");
+        }
+#endif
+    }
+
+    std::byte* data() const { return _mapping ? _mapping + _offset : nullptr; }
+    std::size_t size() const { return _length; }
+    MapMode mode() const { return _mode; }
+
+    // Hints for count bytes from first on.
+    void advise(Access access, std::size_t first = 0, std::size_t count = npos) const {
+#if !defined(_WIN32)
+        const int advice = access == Access::sequential ? MADV_SEQUENTIAL : access == Access::random ? MADV_RANDOM : MADV_NORMAL;
+        advise(first, std::min(count, _length - std::min(first, _length)), advice);
+#endif
+    }
+
+    // Starts reading the bytes in, asynchronously.
+    void prefetch(std::size_t first, std::size_t count) const {
+#if !defined(_WIN32)
+        advise(first, std::min(count, _length - std::min(first, _length)), MADV_WILLNEED);
+#endif
+    }
+
+    // Drops the bytes from memory; they are read again from the file, with
+    // any changes, when next accessed.
+    void evict(std::size_t first, std::size_t count) const {
+#if !defined(_WIN32)
+        advise(first, std::min(count, _length - std::min(first, _length)), MADV_DONTNEED);
+#endif
+    }
+
+    // Writes changes back to the file and waits for that.
+    void flush() const {
+        if (!_mapping || _mode != MapMode::read_write) {
+            return;
+        }
+#if defined(_WIN32)
+        if (!FlushViewOfFile(_mapping, _mappedLength)) {
+            fail("Cannot flush mapping");
+        }
+#else
+        if (::msync(_mapping, _mappedLength, MS_SYNC) != 0) {
+            fail("Cannot flush mapping");
+        }
+#endif
+    }
+};
+
+// Column major N-D data in a mapped file, for tensors that do not fit in
+// memory.  MappedBlockData<N, const T> maps the file read only.  Elements,
+// views, rows, columns, pages and tensorial fibres work as for BlockData;
+// prefetch and evict take page (last dimension) ranges, and forEachPage
+// streams through the pages keeping only a window of them in memory.
+template <std::size_t N, typename T>
+class MappedBlockData {
+    static_assert(N > 0, "Invalid number of dimensions.");
+    static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable elements can be mapped");
+
+    MappedFile _file;
+    std::array<std::size_t, N> _dims{};
+    T* _data{nullptr};
+
+    static std::size_t bytes(const std::array<std::size_t, N>& dims) {
+        return std::accumulate(dims.begin(), dims.end(), std::size_t{1}, std::multiplies<std::size_t>()) * sizeof(T);
+    }
+
+    std::size_t pageBytes() const {
+        return std::accumulate(_dims.begin(), _dims.end() - 1, std::size_t{1}, std::multiplies<std::size_t>()) * sizeof(T);
+    }
+
+public:
+    static constexpr MapMode mode = std::is_const_v<T> ? MapMode::read_only : MapMode::read_write;
+    using iterator = T*;
+
+    // Maps an existing file holding the elements from byte offset on.
+    MappedBlockData(const std::filesystem::path& path, const std::array<std::size_t, N>& dims, std::size_t offset = 0)
+        : _file(path, mode, offset, bytes(dims)), _dims(dims), _data(reinterpret_cast<T*>(_file.data())) {
+        if (offset % alignof(T) != 0) {
+            throw std::invalid_argument("Offset is not aligned for the element type");
+        }
+    }
+
+    // Creates path, or truncates it, to hold dims zero elements and maps it.
+    static MappedBlockData create(const std::filesystem::path& path, const std::array<std::size_t, N>& dims) {
+        static_assert(!std::is_const_v<T>, "Cannot create a read only file");
+        MappedFile::create(path, bytes(dims));
+        return MappedBlockData(path, dims);
+    }
+
+    const std::array<std::size_t, N>& dims() const { return _dims; }
+    std::size_t size() const { return _file.size() / sizeof(T); }
+
+    std::size_t nRows() const { return _dims[0]; }
+    std::size_t nCols() const {
+        static_assert(N >= 2, "Invalid number of dimensions");
+        return _dims[1];
+    }
+    std::size_t nPages() const {
+        static_assert(N > 2, "Invalid number of dimensions");
+        return _dims[2];
+    }
+
+    T* data() const { return _data; }
+    iterator begin() const { return _data; }
+    iterator end() const { return _data + size(); }
+
+    BlockView<N, T, layout_left> view() const { return BlockView<N, T, layout_left>(_data, _dims); }
+
+    template <typename... Idx>
+        requires (sizeof...(Idx) == N) && (std::is_convertible_v<Idx, std::size_t> && ...)
+    T& operator()(Idx... idx) const {
+        return view()(idx...);
+    }
+
+    auto row(std::size_t iRow) const { return view().row(iRow); }
+    auto column(std::size_t jCol) const { return view().column(jCol); }
+    auto page(std::size_t kPage) const { return view().page(kPage); }
+    auto tensorial(std::size_t iRow, std::size_t jCol) const { return view().tensorial(iRow, jCol); }
+
+    void advise(Access access) const { _file.advise(access); }
+
+    // Reads count pages from kFirst on in ahead of their use.
+    void prefetch(std::size_t kFirst, std::size_t count) const { _file.prefetch(kFirst * pageBytes(), count * pageBytes()); }
+
+    // Drops count pages from kFirst on from memory.
+    void evict(std::size_t kFirst, std::size_t count) const { _file.evict(kFirst * pageBytes(), count * pageBytes()); }
+
+    void flush() const { _file.flush(); }
+
+    // Calls fn(kPage, view of page kPage) for every slice along the last
+    // dimension in order.  The next window pages are read ahead while the
+    // current ones are processed, and those before are dropped again.
+    template <typename Fn>
+    void forEachPage(Fn&& fn, std::size_t window = 64) const {
+        static_assert(N > 1, "Invalid number of dimensions");
+        window = std::max<std::size_t>(window, 1);
+        const std::size_t n = _dims[N - 1];
+        advise(Access::sequential);
+        prefetch(0, window);
+        for (std::size_t kPage = 0; kPage < n; ++kPage) {
+            if (kPage % window == 0) {
+                prefetch(kPage + window, window);
+                if (kPage >= window) {
+                    evict(kPage - window, window);
+                }
+            }
+            fn(kPage, view().template slice<N - 1>(kPage));
+        }
+        advise(Access::normal);
+    }
+};
+
+} // namespace utilities::details
+#endif // MAPPEDBLOCKDATA_HPP
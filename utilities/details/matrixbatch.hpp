@@ -0,0 +1,220 @@
+#ifndef MATRIXBATCH_HPP
+#define MATRIXBATCH_HPP
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include "allocator.hpp"
+#include "storage.hpp"
+#include "blockdata.hpp"
+#include "threadpool.hpp"
+
+namespace utilities::details {
+
+// Matrices per block: one 64 byte register's worth of elements.
+template <typename T>
+inline constexpr std::size_t batch_lanes = simd_alignment / sizeof(T);
+
+// Many small matrices of equal size, e.g. one Jacobian per point, in array of
+// structures of arrays form.  Matrices are grouped into blocks of Lanes; inside
+// a block element (i, j) of all Lanes matrices is contiguous, so a kernel
+// working on element (i, j) processes Lanes matrices with one vector
+// instruction.  Element (i, j) of matrix p lives at
+//
+//     ((p / Lanes * nCols + j) * nRows + i) * Lanes + p % Lanes
+//
+// The last block is padded with zeros.  pack() and unpack() convert from and
+// to the page major layout of BlockData<3> (matrix p is page p).
+template <typename T, std::size_t Lanes = batch_lanes<T>, typename Allocator = aligned_allocator<T>>
+class MatrixBatch {
+    static_assert(std::is_floating_point_v<T>, "MatrixBatch supports real floating point types");
+    static_assert(Lanes > 0, "Invalid number of lanes");
+
+    Storage<T, Allocator> _data;
+    std::size_t _nRows{0};
+    std::size_t _nCols{0};
+    std::size_t _nMatrices{0};
+
+public:
+    static constexpr std::size_t lanes = Lanes;
+
+    MatrixBatch() = default;
+    MatrixBatch(std::size_t nRows, std::size_t nCols, std::size_t nMatrices, const Allocator& allocator = Allocator())
+        : _data((nMatrices + Lanes - 1) / Lanes * nRows * nCols * Lanes, allocator)
+        , _nRows(nRows)
+        , _nCols(nCols)
+        , _nMatrices(nMatrices) {}
+
+    // Batch of the pages of a BlockData<3>.
+    template <typename OtherAllocator>
+    explicit MatrixBatch(const BlockData<3, T, OtherAllocator>& pages, const Allocator& allocator = Allocator())
+        : MatrixBatch(pages.nRows(), pages.nCols(), pages.nPages(), allocator) {
+        pack(pages.data());
+    }
+
+    MatrixBatch& resize(std::size_t nRows, std::size_t nCols, std::size_t nMatrices) {
+        _data.resize((nMatrices + Lanes - 1) / Lanes * nRows * nCols * Lanes);
+        _nRows = nRows;
+        _nCols = nCols;
+        _nMatrices = nMatrices;
+        return *this;
+    }
+
+    std::size_t nRows() const { return _nRows; }
+    std::size_t nCols() const { return _nCols; }
+    std::size_t size() const { return _nMatrices; }
+    std::size_t nBlocks() const { return (_nMatrices + Lanes - 1) / Lanes; }
+    std::size_t blockSize() const { return _nRows * _nCols * Lanes; }
+
+    T* block(std::size_t iBlock) { return _data.data() + iBlock * blockSize(); }
+    const T* block(std::size_t iBlock) const { return _data.data() + iBlock * blockSize(); }
+    T* data() { return _data.data(); }
+    const T* data() const { return _data.data(); }
+
+    T& operator()(std::size_t iRow, std::size_t jCol, std::size_t iMatrix) {
+        if (iRow >= _nRows || jCol >= _nCols || iMatrix >= _nMatrices) {
+            throw std::out_of_range("Index out of range");
+        }
+        return block(iMatrix / Lanes)[(jCol * _nRows + iRow) * Lanes + iMatrix % Lanes];
+    }
+    const T& operator()(std::size_t iRow, std::size_t jCol, std::size_t iMatrix) const {
+        return const_cast<MatrixBatch*>(this)->operator()(iRow, jCol, iMatrix);
+    }
+
+    // Reads size() column major nRows x nCols pages stored one after another.
+    void pack(const T* pages) {
+        const std::size_t pageSize = _nRows * _nCols;
+        const std::size_t nMatrices = _nMatrices;
+        parallel_for(0, nBlocks(), [&](std::size_t first, std::size_t last) {
+            for (std::size_t iBlock = first; iBlock < last; ++iBlock) {
+                T* dst = block(iBlock);
+                const std::size_t nLanes = std::min(Lanes, nMatrices - iBlock * Lanes);
+                const T* src = pages + iBlock * Lanes * pageSize;
+                for (std::size_t iElement = 0; iElement < pageSize; ++iElement) {
+                    for (std::size_t lane = 0; lane < nLanes; ++lane) {
+                        dst[iElement * Lanes + lane] = src[lane * pageSize + iElement];
+                    }
+                    for (std::size_t lane = nLanes; lane < Lanes; ++lane) {
+                        dst[iElement * Lanes + lane] = T{0};
+                    }
+                }
+            }
+        }, std::max<std::size_t>(4096 / std::max<std::size_t>(blockSize(), 1), 1));
+    }
+
+    // Writes the matrices back as pages, the inverse of pack().
+    void unpack(T* pages) const {
+        const std::size_t pageSize = _nRows * _nCols;
+        const std::size_t nMatrices = _nMatrices;
+        parallel_for(0, nBlocks(), [&](std::size_t first, std::size_t last) {
+            for (std::size_t iBlock = first; iBlock < last; ++iBlock) {
+                const T* src = block(iBlock);
+                const std::size_t nLanes = std::min(Lanes, nMatrices - iBlock * Lanes);
+                T* dst = pages + iBlock * Lanes * pageSize;
+                for (std::size_t lane = 0; lane < nLanes; ++lane) {
+                    for (std::size_t iElement = 0; iElement < pageSize; ++iElement) {
+                        dst[lane * pageSize + iElement] = src[iElement * Lanes + lane];
+                    }
+                }
+            }
+        }, std::max<std::size_t>(4096 / std::max<std::size_t>(blockSize(), 1), 1));
+    }
+
+    template <typename OtherAllocator>
+    void unpack(BlockData<3, T, OtherAllocator>& pages) const {
+        pages.resize(_nRows, _nCols, _nMatrices);
+        unpack(pages.data());
+    }
+};
+
+namespace matrixbatch_detail {
+
+// Blocks per parallel_for piece, aiming at a few thousand flops each.
+inline std::size_t grain(std::size_t flopsPerBlock) {
+    return std::max<std::size_t>(8192 / std::max<std::size_t>(flopsPerBlock, 1), 1);
+}
+
+} // namespace matrixbatch_detail
+
+// C(:,:,p) = A(:,:,p) * B(:,:,p) for every matrix p.
+template <typename T, std::size_t Lanes, typename AllocatorA, typename AllocatorB, typename AllocatorC>
+void multiply(const MatrixBatch<T, Lanes, AllocatorA>& A, const MatrixBatch<T, Lanes, AllocatorB>& B, MatrixBatch<T, Lanes, AllocatorC>& C) {
+    if (A.nCols() != B.nRows()) {
+        throw std::invalid_argument("Inner matrix dimensions must agree");
+    }
+    if (A.size() != B.size()) {
+        throw std::invalid_argument("Number of matrices must agree");
+    }
+    if (static_cast<const void*>(&C) == static_cast<const void*>(&A) || static_cast<const void*>(&C) == static_cast<const void*>(&B)) {
+        throw std::invalid_argument("Batched multiply cannot be done in place");
+    }
+    const std::size_t m = A.nRows();
+    const std::size_t k = A.nCols();
+    const std::size_t n = B.nCols();
+    C.resize(m, n, A.size());
+    parallel_for(0, A.nBlocks(), [&](std::size_t first, std::size_t last) {
+        for (std::size_t iBlock = first; iBlock < last; ++iBlock) {
+            const T* a = A.block(iBlock);
+            const T* b = B.block(iBlock);
+            T* c = C.block(iBlock);
+            for (std::size_t j = 0; j < n; ++j) {
+                for (std::size_t i = 0; i < m; ++i) {
+                    std::array<T, Lanes> acc{};
+                    for (std::size_t l = 0; l < k; ++l) {
+                        const T* x = a + (l * m + i) * Lanes;
+                        const T* y = b + (j * k + l) * Lanes;
+                        for (std::size_t lane = 0; lane < Lanes; ++lane) {
+                            acc[lane] += x[lane] * y[lane];
+                        }
+                    }
+                    std::copy(acc.begin(), acc.end(), c + (j * m + i) * Lanes);
+                }
+            }
+        }
+    }, matrixbatch_detail::grain(2 * m * n * k * Lanes));
+}
+
+// C(:,:,p) = A(:,:,p) + B(:,:,p) for every matrix p.
+template <typename T, std::size_t Lanes, typename AllocatorA, typename AllocatorB, typename AllocatorC>
+void add(const MatrixBatch<T, Lanes, AllocatorA>& A, const MatrixBatch<T, Lanes, AllocatorB>& B, MatrixBatch<T, Lanes, AllocatorC>& C) {
+    if (A.nRows() != B.nRows() || A.nCols() != B.nCols() || A.size() != B.size()) {
+        throw std::invalid_argument("Batch dimensions must agree");
+    }
+    C.resize(A.nRows(), A.nCols(), A.size());
+    const std::size_t blockSize = A.blockSize();
+    parallel_for(0, A.nBlocks(), [&](std::size_t first, std::size_t last) {
+        const T* a = A.block(first);
+        const T* b = B.block(first);
+        T* c = C.block(first);
+        for (std::size_t iElement = 0; iElement < (last - first) * blockSize; ++iElement) {
+            c[iElement] = a[iElement] + b[iElement];
+        }
+    }, matrixbatch_detail::grain(blockSize));
+}
+
+// AT(:,:,p) = A(:,:,p).' for every matrix p.  Within a block this only
+// permutes whole lane vectors.
+template <typename T, std::size_t Lanes, typename AllocatorA, typename AllocatorT>
+void transpose(const MatrixBatch<T, Lanes, AllocatorA>& A, MatrixBatch<T, Lanes, AllocatorT>& AT) {
+    if (static_cast<const void*>(&A) == static_cast<const void*>(&AT)) {
+        throw std::invalid_argument("Batched transpose cannot be done in place");
+    }
+    const std::size_t m = A.nRows();
+    const std::size_t n = A.nCols();
+    AT.resize(n, m, A.size());
+    parallel_for(0, A.nBlocks(), [&](std::size_t first, std::size_t last) {
+        for (std::size_t iBlock = first; iBlock < last; ++iBlock) {
+            const T* a = A.block(iBlock);
+            T* at = AT.block(iBlock);
+            for (std::size_t j = 0; j < n; ++j) {
+                for (std::size_t i = 0; i < m; ++i) {
+                    std::copy_n(a + (j * m + i) * Lanes, Lanes, at + (i * n + j) * Lanes);
+                }
+            }
+        }
+    }, matrixbatch_detail::grain(A.blockSize()));
+}
+
+} // namespace utilities::details
+#endif // MATRIXBATCH_HPP
@@ -0,0 +1,277 @@
+#ifndef PAGEMTIMES_HPP
+#define PAGEMTIMES_HPP
+#include <algorithm>
+#include <array>
+#include <complex>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include "blockdata.hpp"
+#include "threadpool.hpp"
+#include "traits.hpp"
+
+#if defined(MATLAB_MEX_FILE)
+#include "blas.h"
+#else
+// Fortran BLAS with 32 bit integers, as shipped by the reference BLAS and
+// OpenBLAS.  Standalone builds have to link against one of them.
+extern "C" {
+void sgemm_(const char* transa, const char* transb, const int* m, const int* n, const int* k,
+            const float* alpha, const float* A, const int* lda, const float* B, const int* ldb,
+            const float* beta, float* C, const int* ldc);
+void dgemm_(const char* transa, const char* transb, const int* m, const int* n, const int* k,
+            const double* alpha, const double* A, const int* lda, const double* B, const int* ldb,
+            const double* beta, double* C, const int* ldc);
+void cgemm_(const char* transa, const char* transb, const int* m, const int* n, const int* k,
+            const void* alpha, const void* A, const int* lda, const void* B, const int* ldb,
+            const void* beta, void* C, const int* ldc);
+void zgemm_(const char* transa, const char* transb, const int* m, const int* n, const int* k,
+            const void* alpha, const void* A, const int* lda, const void* B, const int* ldb,
+            const void* beta, void* C, const int* ldc);
+}
+#endif // defined(MATLAB_MEX_FILE)
+
+namespace utilities::details {
+
+// Operation applied to a page before multiplying, as the transpX/transpY
+// arguments of MATLAB's pagemtimes.
+enum class Transpose { none, transpose, ctranspose };
+
+namespace blas {
+#if defined(MATLAB_MEX_FILE)
+using int_t = std::ptrdiff_t;
+#else
+using int_t = int;
+#endif
+
+inline char flag(Transpose op) {
+    switch (op) {
+        case Transpose::transpose:
+            return 'T';
+        case Transpose::ctranspose:
+            return 'C';
+        default:
+            return 'N';
+    }
+}
+
+// C = A * B with beta = 0, column major, overloaded on the element type.  The
+// MATLAB headers take non-const pointers, hence the casts.
+inline void gemm(char transa, char transb, int_t m, int_t n, int_t k, float alpha, const float* A, int_t lda, const float* B, int_t ldb, float beta, float* C, int_t ldc) {
+#if defined(MATLAB_MEX_FILE)
+    sgemm(&transa, &transb, &m, &n, &k, &alpha, const_cast<float*>(A), &lda, const_cast<float*>(B), &ldb, &beta, C, &ldc);
+#else
+    sgemm_(&transa, &transb, &m, &n, &k, &alpha, A, &lda, B, &ldb, &beta, C, &ldc);
+#endif
+}
+
+inline void gemm(char transa, char transb, int_t m, int_t n, int_t k, double alpha, const double* A, int_t lda, const double* B, int_t ldb, double beta, double* C, int_t ldc) {
+#if defined(MATLAB_MEX_FILE)
+    dgemm(&transa, &transb, &m, &n, &k, &alpha, const_cast<double*>(A), &lda, const_cast<double*>(B), &ldb, &beta, C, &ldc);
+#else
+    dgemm_(&transa, &transb, &m, &n, &k, &alpha, A, &lda, B, &ldb, &beta, C, &ldc);
+#endif
+}
+
+inline void gemm(char transa, char transb, int_t m, int_t n, int_t k, std::complex<float> alpha, const std::complex<float>* A, int_t lda, const std::complex<float>* B, int_t ldb, std::complex<float> beta, std::complex<float>* C, int_t ldc) {
+#if defined(MATLAB_MEX_FILE)
+    cgemm(&transa, &transb, &m, &n, &k, reinterpret_cast<float*>(&alpha), reinterpret_cast<float*>(const_cast<std::complex<float>*>(A)), &lda,
+          reinterpret_cast<float*>(const_cast<std::complex<float>*>(B)), &ldb, reinterpret_cast<float*>(&beta), reinterpret_cast<float*>(C), &ldc);
+#else
+    cgemm_(&transa, &transb, &m, &n, &k, &alpha, A, &lda, B, &ldb, &beta, C, &ldc);
+#endif
+}
+
+inline void gemm(char transa, char transb, int_t m, int_t n, int_t k, std::complex<double> alpha, const std::complex<double>* A, int_t lda, const std::complex<double>* B, int_t ldb, std::complex<double> beta, std::complex<double>* C, int_t ldc) {
+#if defined(MATLAB_MEX_FILE)
+    zgemm(&transa, &transb, &m, &n, &k, reinterpret_cast<double*>(&alpha), reinterpret_cast<double*>(const_cast<std::complex<double>*>(A)), &lda,
+          reinterpret_cast<double*>(const_cast<std::complex<double>*>(B)), &ldb, reinterpret_cast<double*>(&beta), reinterpret_cast<double*>(C), &ldc);
+#else
+    zgemm_(&transa, &transb, &m, &n, &k, &alpha, A, &lda, B, &ldb, &beta, C, &ldc);
+#endif
+}
+} // namespace blas
+
+// Pages with m * n * k up to this many multiply-adds are done by the inline
+// kernel below; the BLAS call overhead dominates for those.
+inline constexpr std::size_t pagemtimesSmallLimit = 256;
+
+// Total multiply-adds below which pagemtimes stays on the calling thread.
+// Above it, pages are spread over ThreadPool::instance().
+inline constexpr std::size_t pagemtimesParallelLimit = std::size_t{1} << 20;
+
+namespace pagemtimes_detail {
+
+template <bool Conj, typename T>
+inline T conjugateIf(const T& val) {
+    if constexpr (Conj && is_complex_v<T>) {
+        return std::conj(val);
+    } else {
+        return val;
+    }
+}
+
+// C(m x n) = op(A) * op(B) where element (i, l) of op(A) is A[i * rsA + l * csA].
+// K > 0 fixes the inner dimension at compile time so that the sum unrolls.
+template <std::size_t K, bool ConjA, bool ConjB, typename T>
+void smallGemm(std::size_t m, std::size_t n, std::size_t k,
+               const T* A, std::size_t rsA, std::size_t csA,
+               const T* B, std::size_t rsB, std::size_t csB, T* C) {
+    const std::size_t nInner = K > 0 ? K : k;
+    for (std::size_t j = 0; j < n; ++j) {
+        for (std::size_t i = 0; i < m; ++i) {
+            T sum{};
+            for (std::size_t l = 0; l < nInner; ++l) {
+                sum += conjugateIf<ConjA>(A[i * rsA + l * csA]) * conjugateIf<ConjB>(B[l * rsB + j * csB]);
+            }
+            C[i + j * m] = sum;
+        }
+    }
+}
+
+template <bool ConjA, bool ConjB, typename T>
+void smallGemm(std::size_t m, std::size_t n, std::size_t k,
+               const T* A, std::size_t rsA, std::size_t csA,
+               const T* B, std::size_t rsB, std::size_t csB, T* C) {
+    switch (k) {
+        case 1:
+            return smallGemm<1, ConjA, ConjB>(m, n, k, A, rsA, csA, B, rsB, csB, C);
+        case 2:
+            return smallGemm<2, ConjA, ConjB>(m, n, k, A, rsA, csA, B, rsB, csB, C);
+        case 3:
+            return smallGemm<3, ConjA, ConjB>(m, n, k, A, rsA, csA, B, rsB, csB, C);
+        case 4:
+            return smallGemm<4, ConjA, ConjB>(m, n, k, A, rsA, csA, B, rsB, csB, C);
+        default:
+            return smallGemm<0, ConjA, ConjB>(m, n, k, A, rsA, csA, B, rsB, csB, C);
+    }
+}
+
+// Runs fn(first, last) over blocks of [0, nPages), on the thread pool if
+// there is enough work.
+template <typename Fn>
+void forEachPageBlock(std::size_t nPages, std::size_t workPerPage, Fn&& fn) {
+    if (nPages * workPerPage < pagemtimesParallelLimit) {
+        fn(std::size_t{0}, nPages);
+        return;
+    }
+    const std::size_t grain = std::max<std::size_t>(pagemtimesParallelLimit / 16 / std::max<std::size_t>(workPerPage, 1), 1);
+    parallel_for(0, nPages, fn, grain);
+}
+
+} // namespace pagemtimes_detail
+
+// Dimensions of pagemtimes(A, opA, B, opB) for operands of dimensions
+// {rows, columns, pages}.  The page counts have to agree unless one of them is
+// one, in which case that page is used for every page of the other operand.
+inline std::array<std::size_t, 3> pagemtimesDims(const std::array<std::size_t, 3>& aDims, Transpose opA,
+                                                 const std::array<std::size_t, 3>& bDims, Transpose opB) {
+    const std::size_t m = opA == Transpose::none ? aDims[0] : aDims[1];
+    const std::size_t kA = opA == Transpose::none ? aDims[1] : aDims[0];
+    const std::size_t kB = opB == Transpose::none ? bDims[0] : bDims[1];
+    const std::size_t n = opB == Transpose::none ? bDims[1] : bDims[0];
+    if (kA != kB) {
+        throw std::invalid_argument("Inner matrix dimensions must agree");
+    }
+    if (aDims[2] != bDims[2] && aDims[2] != 1 && bDims[2] != 1) {
+        throw std::invalid_argument("Number of pages must agree or be one");
+    }
+    return {m, n, aDims[2] == 1 ? bDims[2] : aDims[2]};
+}
+
+// Page-wise C(:,:,p) = op(A(:,:,p)) * op(B(:,:,p)) on column major buffers, C
+// has to hold prod(pagemtimesDims(...)) elements.  Tiny pages use an inline
+// kernel, larger ones BLAS; pages are spread over threads when there is
+// enough work.
+template <typename T>
+void pagemtimes(const T* A, const std::array<std::size_t, 3>& aDims, Transpose opA,
+                const T* B, const std::array<std::size_t, 3>& bDims, Transpose opB, T* C) {
+    static_assert(std::is_same_v<T, float> || std::is_same_v<T, double> ||
+                  std::is_same_v<T, std::complex<float>> || std::is_same_v<T, std::complex<double>>,
+                  "pagemtimes supports float, double and their complex counterparts");
+    const auto cDims = pagemtimesDims(aDims, opA, bDims, opB);
+    const std::size_t m = cDims[0];
+    const std::size_t n = cDims[1];
+    const std::size_t nPages = cDims[2];
+    const std::size_t k = opA == Transpose::none ? aDims[1] : aDims[0];
+    const std::size_t aPageSize = aDims[2] == 1 ? 0 : aDims[0] * aDims[1];
+    const std::size_t bPageSize = bDims[2] == 1 ? 0 : bDims[0] * bDims[1];
+    const std::size_t cPageSize = m * n;
+    if (nPages == 0 || cPageSize == 0) {
+        return;
+    }
+
+    const std::size_t work = m * n * k;
+    if (work <= pagemtimesSmallLimit) {
+        const bool conjA = opA == Transpose::ctranspose;
+        const bool conjB = opB == Transpose::ctranspose;
+        const std::size_t rsA = opA == Transpose::none ? 1 : aDims[0];
+        const std::size_t csA = opA == Transpose::none ? aDims[0] : 1;
+        const std::size_t rsB = opB == Transpose::none ? 1 : bDims[0];
+        const std::size_t csB = opB == Transpose::none ? bDims[0] : 1;
+        auto kernel = [&](auto conjugateA, auto conjugateB, std::size_t first, std::size_t last) {
+            for (std::size_t iPage = first; iPage < last; ++iPage) {
+                pagemtimes_detail::smallGemm<decltype(conjugateA)::value, decltype(conjugateB)::value>(
+                    m, n, k, A + iPage * aPageSize, rsA, csA, B + iPage * bPageSize, rsB, csB, C + iPage * cPageSize);
+            }
+        };
+        pagemtimes_detail::forEachPageBlock(nPages, work, [&](std::size_t first, std::size_t last) {
+            if (conjA && conjB) {
+                kernel(std::true_type{}, std::true_type{}, first, last);
+            } else if (conjA) {
+                kernel(std::true_type{}, std::false_type{}, first, last);
+            } else if (conjB) {
+                kernel(std::false_type{}, std::true_type{}, first, last);
+            } else {
+                kernel(std::false_type{}, std::false_type{}, first, last);
+            }
+        });
+        return;
+    }
+
+    const char transa = blas::flag(opA);
+    const char transb = blas::flag(opB);
+    const auto lda = static_cast<blas::int_t>(std::max<std::size_t>(aDims[0], 1));
+    const auto ldb = static_cast<blas::int_t>(std::max<std::size_t>(bDims[0], 1));
+    const auto ldc = static_cast<blas::int_t>(std::max<std::size_t>(m, 1));
+    pagemtimes_detail::forEachPageBlock(nPages, work, [&](std::size_t first, std::size_t last) {
+        for (std::size_t iPage = first; iPage < last; ++iPage) {
+            blas::gemm(transa, transb, static_cast<blas::int_t>(m), static_cast<blas::int_t>(n), static_cast<blas::int_t>(k),
+                       T{1}, A + iPage * aPageSize, lda, B + iPage * bPageSize, ldb, T{0}, C + iPage * cPageSize, ldc);
+        }
+    });
+}
+
+template <std::size_t N, typename T, typename Allocator>
+std::array<std::size_t, 3> pageDims(const BlockData<N, T, Allocator>& X) {
+    static_assert(N <= 3, "pagemtimes supports up to three dimensions");
+    std::array<std::size_t, 3> dims{1, 1, 1};
+    std::copy_n(X.view().extents().begin(), N, dims.begin());
+    return dims;
+}
+
+// C = pagemtimes(A, opA, B, opB).  C keeps its buffer if it already has the
+// right number of elements, so it can be an output arena.
+template <std::size_t NA, std::size_t NB, typename T, typename AllocatorA, typename AllocatorB, typename AllocatorC>
+void pagemtimes(const BlockData<NA, T, AllocatorA>& A, Transpose opA, const BlockData<NB, T, AllocatorB>& B, Transpose opB,
+                BlockData<3, T, AllocatorC>& C) {
+    const auto aDims = pageDims(A);
+    const auto bDims = pageDims(B);
+    C.resize(pagemtimesDims(aDims, opA, bDims, opB));
+    pagemtimes(A.data(), aDims, opA, B.data(), bDims, opB, C.data());
+}
+
+template <std::size_t NA, std::size_t NB, typename T, typename AllocatorA, typename AllocatorB>
+BlockData<3, T> pagemtimes(const BlockData<NA, T, AllocatorA>& A, Transpose opA, const BlockData<NB, T, AllocatorB>& B, Transpose opB) {
+    BlockData<3, T> C;
+    pagemtimes(A, opA, B, opB, C);
+    return C;
+}
+
+template <std::size_t NA, std::size_t NB, typename T, typename AllocatorA, typename AllocatorB>
+BlockData<3, T> pagemtimes(const BlockData<NA, T, AllocatorA>& A, const BlockData<NB, T, AllocatorB>& B) {
+    return pagemtimes(A, Transpose::none, B, Transpose::none);
+}
+
+} // namespace utilities::details
+#endif // PAGEMTIMES_HPP
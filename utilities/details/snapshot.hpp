@@ -0,0 +1,482 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <numeric>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "blockdata.hpp"
+#include "layout.hpp"
+#include "mappedblockdata.hpp"
+#include "sparse.hpp"
+
+namespace utilities::details {
+
+// Binary snapshots of BlockData and Sparse, to keep expensive intermediates
+// across sessions.  A file is a snapshotDataOffset byte header, recording
+// what is stored, its dimensions, element type and layout, followed by the
+// elements exactly as they are in memory:
+//
+//     dense     prod(dims) elements in the recorded layout
+//     sparse    the n + 1 column bounds (uint64), the nnz row indices (uint32,
+//               or uint64 if there are more than 2^32 rows), then nnz values
+//
+// The header and the payload carry checksums.  Dense column major snapshots
+// can be mapped rather than read, see mapSnapshot, which makes reloading
+// independent of their size.  Files are only read on machines of the same
+// byte order as the writer.
+
+inline constexpr std::uint32_t snapshotVersion = 1;
+inline constexpr std::size_t snapshotDataOffset = 256;
+inline constexpr std::size_t snapshotMaxRank = 8;
+
+enum class SnapshotKind : std::uint32_t { dense = 1, sparse = 2 };
+
+// How much of a snapshot is verified when it is loaded.  Checking the payload
+// reads all of it, which defeats mapping.
+enum class SnapshotCheck { header, full };
+
+// 64 bit checksum of a byte stream that may be fed in pieces of any size.
+class Checksum {
+    static constexpr std::uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    static constexpr std::uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    std::uint64_t _hash{0x27D4EB2F165667C5ULL};
+    std::uint64_t _pending{0};
+    unsigned _nPending{0};
+    std::uint64_t _length{0};
+
+    static std::uint64_t mix(std::uint64_t hash, std::uint64_t word) {
+        return std::rotl(hash ^ (word * prime2), 31) * prime1;
+    }
+
+public:
+    Checksum& update(const void* data, std::size_t n) {
+        auto bytes = static_cast<const unsigned char*>(data);
+        _length += n;
+        if (_nPending > 0) {
+            for (; n > 0 && _nPending < 8; --n) {
+                _pending |= std::uint64_t{*bytes++} << (8 * _nPending++);
+            }
+            if (_nPending < 8) {
+                return *this;
+            }
+            _hash = mix(_hash, _pending);
+            _pending = 0;
+            _nPending = 0;
+        }
+        for (; n >= 8; n -= 8, bytes += 8) {
+            std::uint64_t word;
+            std::memcpy(&word, bytes, 8);
+            _hash = mix(_hash, word);
+        }
+        for (; n > 0; --n) {
+            _pending |= std::uint64_t{*bytes++} << (8 * _nPending++);
+        }
+        return *this;
+    }
+
+    std::uint64_t value() const {
+        std::uint64_t hash = _nPending > 0 ? mix(_hash, _pending) : _hash;
+        hash = mix(hash, _length);
+        hash ^= hash >> 33;
+        hash *= prime2;
+        hash ^= hash >> 29;
+        return hash;
+    }
+};
+
+namespace snapshot_detail {
+
+inline constexpr std::array<char, 8> magic{'M', 'E', 'X', 'S', 'N', 'A', 'P', '\0'};
+inline constexpr std::uint32_t byteOrderMark = 0x01020304;
+
+struct Header {
+    std::array<char, 8> magic{};
+    std::uint32_t byteOrder{};
+    std::uint32_t version{};
+    std::uint32_t kind{};
+    std::uint32_t elementType{};
+    std::uint32_t elementSize{};
+    std::uint32_t layout{};
+    std::uint32_t layoutParameter{};
+    std::uint32_t rank{};
+    std::array<std::uint64_t, snapshotMaxRank> dims{};
+    std::uint64_t count{};
+    std::uint64_t payloadBytes{};
+    std::uint64_t payloadChecksum{};
+    // Of all of the above.
+    std::uint64_t headerChecksum{};
+
+    std::uint64_t computeChecksum() const {
+        return Checksum().update(this, offsetof(Header, headerChecksum)).value();
+    }
+};
+static_assert(std::is_trivially_copyable_v<Header> && sizeof(Header) <= snapshotDataOffset);
+
+// Element type codes.
+template <typename T>
+constexpr std::uint32_t elementType() {
+    using std::is_same_v;
+    if constexpr (is_same_v<T, double>) return 1;
+    else if constexpr (is_same_v<T, float>) return 2;
+    else if constexpr (is_same_v<T, std::complex<double>>) return 3;
+    else if constexpr (is_same_v<T, std::complex<float>>) return 4;
+    else if constexpr (is_same_v<T, std::int8_t>) return 5;
+    else if constexpr (is_same_v<T, std::uint8_t>) return 6;
+    else if constexpr (is_same_v<T, std::int16_t>) return 7;
+    else if constexpr (is_same_v<T, std::uint16_t>) return 8;
+    else if constexpr (is_same_v<T, std::int32_t>) return 9;
+    else if constexpr (is_same_v<T, std::uint32_t>) return 10;
+    else if constexpr (is_same_v<T, std::int64_t>) return 11;
+    else if constexpr (is_same_v<T, std::uint64_t>) return 12;
+    else if constexpr (is_same_v<T, bool>) return 13;
+    else static_assert(sizeof(T) == 0, "Element type cannot be stored in a snapshot");
+}
+
+// Layout code and parameter.
+template <typename Layout>
+inline constexpr std::array<std::uint32_t, 2> layoutCode{};
+template <>
+inline constexpr std::array<std::uint32_t, 2> layoutCode<layout_left>{0, 0};
+template <>
+inline constexpr std::array<std::uint32_t, 2> layoutCode<layout_direction_major>{1, 0};
+template <std::size_t Tile>
+inline constexpr std::array<std::uint32_t, 2> layoutCode<layout_tiled<Tile>>{2, Tile};
+
+template <typename T, std::size_t N>
+Header makeHeader(SnapshotKind kind, const std::array<std::size_t, N>& dims, std::size_t count, std::size_t payloadBytes,
+                  std::array<std::uint32_t, 2> layout = layoutCode<layout_left>) {
+    static_assert(N <= snapshotMaxRank, "Too many dimensions for a snapshot");
+    Header header;
+    header.magic = magic;
+    header.byteOrder = byteOrderMark;
+    header.version = snapshotVersion;
+    header.kind = static_cast<std::uint32_t>(kind);
+    header.elementType = elementType<T>();
+    header.elementSize = sizeof(T);
+    header.layout = layout[0];
+    header.layoutParameter = layout[1];
+    header.rank = N;
+    std::copy(dims.begin(), dims.end(), header.dims.begin());
+    header.count = count;
+    header.payloadBytes = payloadBytes;
+    return header;
+}
+
+inline void writeHeader(std::ostream& out, Header header) {
+    header.headerChecksum = header.computeChecksum();
+    std::array<char, snapshotDataOffset> bytes{};
+    std::memcpy(bytes.data(), &header, sizeof(Header));
+    out.write(bytes.data(), bytes.size());
+}
+
+inline Header readHeader(std::istream& in) {
+    std::array<char, snapshotDataOffset> bytes{};
+    if (!in.read(bytes.data(), bytes.size())) {
+        throw std::runtime_error("Not a snapshot file");
+    }
+    Header header;
+    std::memcpy(&header, bytes.data(), sizeof(Header));
+    if (header.magic != magic) {
+        throw std::runtime_error("Not a snapshot file");
+    }
+    if (header.byteOrder != byteOrderMark) {
+        throw std::runtime_error("Snapshot was written with another byte order");
+    }
+    if (header.version != snapshotVersion) {
+        throw std::runtime_error("Snapshot version is not supported");
+    }
+    if (header.headerChecksum != header.computeChecksum()) {
+        throw std::runtime_error("Snapshot header is corrupt");
+    }
+    return header;
+}
+
+inline Header readHeader(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open snapshot");
+    }
+    return readHeader(in);
+}
+
+// Checks kind, element type and, for dense data, that the payload holds
+// prod(dims) elements, and returns the dimensions padded to N.
+template <typename T, std::size_t N>
+std::array<std::size_t, N> checkHeader(const Header& header, SnapshotKind kind, const std::filesystem::path& path) {
+    if (header.kind != static_cast<std::uint32_t>(kind)) {
+        throw std::invalid_argument(kind == SnapshotKind::dense ? "Snapshot is not of dense data" : "Snapshot is not of a sparse matrix");
+    }
+    if (header.elementType != elementType<T>() || header.elementSize != sizeof(T)) {
+        throw std::invalid_argument("Snapshot element type does not match");
+    }
+    if (header.rank > snapshotMaxRank) {
+        throw std::runtime_error("Snapshot header is corrupt");
+    }
+    std::array<std::size_t, N> dims;
+    dims.fill(1);
+    for (std::size_t r = 0; r < header.rank; ++r) {
+        if (r < N) {
+            dims[r] = static_cast<std::size_t>(header.dims[r]);
+        } else if (header.dims[r] != 1) {
+            throw std::invalid_argument("Snapshot has more dimensions than requested");
+        }
+    }
+    if (kind == SnapshotKind::dense) {
+        const std::size_t count = std::accumulate(dims.begin(), dims.end(), std::size_t{1}, std::multiplies<std::size_t>());
+        if (header.count != count || header.payloadBytes != count * sizeof(T)) {
+            throw std::runtime_error("Snapshot header is corrupt");
+        }
+    }
+    if (std::filesystem::file_size(path) < snapshotDataOffset + header.payloadBytes) {
+        throw std::runtime_error("Snapshot is truncated");
+    }
+    return dims;
+}
+
+inline void checkPayload(const Header& header, const void* data, std::size_t bytes) {
+    if (Checksum().update(data, bytes).value() != header.payloadChecksum) {
+        throw std::runtime_error("Snapshot checksum does not match");
+    }
+}
+
+// Row indices of a sparse snapshot of m rows are stored as SparseRow<true>
+// when they fit in 32 bit.
+inline bool narrowRows(std::size_t m) {
+    return m <= (std::size_t{1} << 32);
+}
+template <bool Narrow>
+using SparseRow = std::conditional_t<Narrow, std::uint32_t, std::uint64_t>;
+
+// Calls fn with the rows as a span of Row, converted only if Index differs.
+template <typename Row, typename Index, typename Fn>
+void withRows(std::span<const Index> rows, Fn&& fn) {
+    if constexpr (std::is_same_v<Row, Index>) {
+        fn(rows);
+    } else {
+        const std::vector<Row> converted(rows.begin(), rows.end());
+        fn(std::span<const Row>(converted));
+    }
+}
+
+inline std::ofstream openForWriting(const std::filesystem::path& path) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot create snapshot");
+    }
+    return out;
+}
+
+} // namespace snapshot_detail
+
+// Writes column major elements as they are produced, e.g. page by page, so
+// that a snapshot larger than memory never has to be held in full.  The
+// header is completed by finish(); a snapshot that is not finished does not
+// load.
+template <typename T>
+class SnapshotWriter {
+    std::ofstream _out;
+    snapshot_detail::Header _header;
+    Checksum _checksum;
+    std::size_t _written{0};
+
+public:
+    template <std::size_t N>
+    SnapshotWriter(const std::filesystem::path& path, const std::array<std::size_t, N>& dims) : _out(snapshot_detail::openForWriting(path)) {
+        const std::size_t count = std::accumulate(dims.begin(), dims.end(), std::size_t{1}, std::multiplies<std::size_t>());
+        _header = snapshot_detail::makeHeader<T>(SnapshotKind::dense, dims, count, count * sizeof(T));
+        const std::array<char, snapshotDataOffset> placeholder{};
+        _out.write(placeholder.data(), placeholder.size());
+    }
+
+    // Appends the elements of a contiguous range, e.g. a page view.
+    template <std::ranges::contiguous_range R>
+        requires std::is_same_v<std::remove_cv_t<std::ranges::range_value_t<R>>, T>
+    SnapshotWriter& write(R&& elements) {
+        const std::size_t n = static_cast<std::size_t>(std::ranges::size(elements));
+        if (_written + n > _header.count) {
+            throw std::out_of_range("More elements written than the snapshot holds");
+        }
+        const auto bytes = reinterpret_cast<const char*>(std::ranges::data(elements));
+        _checksum.update(bytes, n * sizeof(T));
+        if (!_out.write(bytes, static_cast<std::streamsize>(n * sizeof(T)))) {
+            throw std::runtime_error("Cannot write snapshot");
+        }
+        _written += n;
+        return *this;
+    }
+
+    void finish() {
+        if (_written != _header.count) {
+            throw std::invalid_argument("Snapshot is incomplete");
+        }
+        _header.payloadChecksum = _checksum.value();
+        _out.seekp(0);
+        snapshot_detail::writeHeader(_out, _header);
+        _out.close();
+        if (!_out) {
+            throw std::runtime_error("Cannot write snapshot");
+        }
+    }
+};
+
+template <std::size_t N, typename T, typename Allocator, typename Layout>
+void saveSnapshot(const std::filesystem::path& path, const BlockData<N, T, Allocator, Layout>& bd) {
+    auto out = snapshot_detail::openForWriting(path);
+    auto header = snapshot_detail::makeHeader<T>(SnapshotKind::dense, bd.dims(), bd.size(), bd.size() * sizeof(T),
+                                                 snapshot_detail::layoutCode<Layout>);
+    header.payloadChecksum = Checksum().update(bd.data(), bd.size() * sizeof(T)).value();
+    snapshot_detail::writeHeader(out, header);
+    out.write(reinterpret_cast<const char*>(bd.data()), static_cast<std::streamsize>(bd.size() * sizeof(T)));
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Cannot write snapshot");
+    }
+}
+
+template <typename Number, typename Index>
+void saveSnapshot(const std::filesystem::path& path, const utilities::Sparse<Number, Index>& A) {
+    static_assert(sizeof(std::size_t) == sizeof(std::uint64_t), "Sparse snapshots need 64 bit column bounds");
+    const auto bounds = A.columnBounds();
+    const auto values = A.nonZeroValues();
+    const std::size_t nnz = values.size();
+    const std::size_t boundBytes = bounds.size() * sizeof(std::uint64_t);
+    auto write = [&]<typename Row>(std::span<const Row> rows) {
+        auto out = snapshot_detail::openForWriting(path);
+        auto header = snapshot_detail::makeHeader<Number>(SnapshotKind::sparse, std::array<std::size_t, 2>{A.getNumberOfRows(), A.getNumberOfColumns()},
+                                                          nnz, boundBytes + nnz * (sizeof(Row) + sizeof(Number)));
+        header.payloadChecksum =
+            Checksum().update(bounds.data(), boundBytes).update(rows.data(), nnz * sizeof(Row)).update(values.data(), nnz * sizeof(Number)).value();
+        snapshot_detail::writeHeader(out, header);
+        out.write(reinterpret_cast<const char*>(bounds.data()), static_cast<std::streamsize>(boundBytes));
+        out.write(reinterpret_cast<const char*>(rows.data()), static_cast<std::streamsize>(nnz * sizeof(Row)));
+        out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(nnz * sizeof(Number)));
+        out.close();
+        if (!out) {
+            throw std::runtime_error("Cannot write snapshot");
+        }
+    };
+    if (snapshot_detail::narrowRows(A.getNumberOfRows())) {
+        snapshot_detail::withRows<snapshot_detail::SparseRow<true>>(A.rowIndices(), write);
+    } else {
+        snapshot_detail::withRows<snapshot_detail::SparseRow<false>>(A.rowIndices(), write);
+    }
+}
+
+// Reads a dense snapshot into memory.  Snapshots in another layout are
+// converted if they are column major or direction major.
+template <std::size_t N, typename T, typename Allocator = aligned_allocator<T>, typename Layout = layout_left>
+BlockData<N, T, Allocator, Layout> loadSnapshot(const std::filesystem::path& path, SnapshotCheck check = SnapshotCheck::full) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open snapshot");
+    }
+    const auto header = snapshot_detail::readHeader(in);
+    const auto dims = snapshot_detail::checkHeader<T, N>(header, SnapshotKind::dense, path);
+    auto read = [&](auto&& bd) {
+        in.read(reinterpret_cast<char*>(bd.data()), static_cast<std::streamsize>(bd.size() * sizeof(T)));
+        if (!in) {
+            throw std::runtime_error("Snapshot is truncated");
+        }
+        if (check == SnapshotCheck::full) {
+            snapshot_detail::checkPayload(header, bd.data(), bd.size() * sizeof(T));
+        }
+    };
+    const std::array<std::uint32_t, 2> layout{header.layout, header.layoutParameter};
+    if (layout == snapshot_detail::layoutCode<Layout>) {
+        BlockData<N, T, Allocator, Layout> bd(dims);
+        read(bd);
+        return bd;
+    }
+    if (layout == snapshot_detail::layoutCode<layout_left>) {
+        BlockData<N, T, Allocator, layout_left> bd(dims);
+        read(bd);
+        return BlockData<N, T, Allocator, Layout>(bd);
+    }
+    if (layout == snapshot_detail::layoutCode<layout_direction_major>) {
+        BlockData<N, T, Allocator, layout_direction_major> bd(dims);
+        read(bd);
+        return BlockData<N, T, Allocator, Layout>(bd);
+    }
+    throw std::invalid_argument("Snapshot layout cannot be converted");
+}
+
+// Maps a dense column major snapshot instead of reading it; the elements are
+// paged in when they are used.
+template <std::size_t N, typename T>
+MappedBlockData<N, const T> mapSnapshot(const std::filesystem::path& path, SnapshotCheck check = SnapshotCheck::header) {
+    const auto header = snapshot_detail::readHeader(path);
+    const auto dims = snapshot_detail::checkHeader<T, N>(header, SnapshotKind::dense, path);
+    if (header.layout != snapshot_detail::layoutCode<layout_left>[0]) {
+        throw std::invalid_argument("Only column major snapshots can be mapped");
+    }
+    MappedBlockData<N, const T> bd(path, dims, snapshotDataOffset);
+    if (check == SnapshotCheck::full) {
+        snapshot_detail::checkPayload(header, bd.data(), bd.size() * sizeof(T));
+    }
+    return bd;
+}
+
+namespace snapshot_detail {
+
+// Compressed columns with the rows stored as Row.
+template <typename Number, typename Index, typename Row>
+utilities::Sparse<Number, Index> readCompressedSparse(std::istream& in, const Header& header, const std::array<std::size_t, 2>& dims, SnapshotCheck check) {
+    const std::size_t nnz = static_cast<std::size_t>(header.count);
+    const std::size_t boundBytes = (dims[1] + 1) * sizeof(std::uint64_t);
+    if (header.payloadBytes != boundBytes + nnz * (sizeof(Row) + sizeof(Number))) {
+        throw std::runtime_error("Snapshot header is corrupt");
+    }
+    std::vector<std::size_t> bounds(dims[1] + 1);
+    std::vector<Row> rows(nnz);
+    std::vector<Number> values(nnz);
+    in.read(reinterpret_cast<char*>(bounds.data()), static_cast<std::streamsize>(boundBytes));
+    in.read(reinterpret_cast<char*>(rows.data()), static_cast<std::streamsize>(nnz * sizeof(Row)));
+    in.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(nnz * sizeof(Number)));
+    if (!in) {
+        throw std::runtime_error("Snapshot is truncated");
+    }
+    if (check == SnapshotCheck::full &&
+        Checksum().update(bounds.data(), boundBytes).update(rows.data(), nnz * sizeof(Row)).update(values.data(), nnz * sizeof(Number)).value() !=
+            header.payloadChecksum) {
+        throw std::runtime_error("Snapshot checksum does not match");
+    }
+    if constexpr (std::is_same_v<Row, Index>) {
+        return utilities::Sparse<Number, Index>(dims[0], dims[1], std::move(bounds), std::move(rows), std::move(values));
+    } else {
+        // Rows are below dims[0], which the constructor checks against Index
+        // before the rows.
+        std::vector<Index> converted(rows.begin(), rows.end());
+        return utilities::Sparse<Number, Index>(dims[0], dims[1], std::move(bounds), std::move(converted), std::move(values));
+    }
+}
+
+} // namespace snapshot_detail
+
+template <typename Number, typename Index = typename utilities::Sparse<Number>::index_type>
+utilities::Sparse<Number, Index> loadSparseSnapshot(const std::filesystem::path& path, SnapshotCheck check = SnapshotCheck::full) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open snapshot");
+    }
+    const auto header = snapshot_detail::readHeader(in);
+    const auto dims = snapshot_detail::checkHeader<Number, 2>(header, SnapshotKind::sparse, path);
+    if (snapshot_detail::narrowRows(dims[0])) {
+        return snapshot_detail::readCompressedSparse<Number, Index, snapshot_detail::SparseRow<true>>(in, header, dims, check);
+    }
+    return snapshot_detail::readCompressedSparse<Number, Index, snapshot_detail::SparseRow<false>>(in, header, dims, check);
+}
+
+} // namespace utilities::details
+#endif // SNAPSHOT_HPP
@@ -0,0 +1,190 @@
+#ifndef STORAGE_HPP
+#define STORAGE_HPP
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <stdexcept>
+#include "allocator.hpp"
+
+namespace utilities::details {
+
+// Same type as matlab::data::buffer_ptr_t<T>, spelled out so that the storage
+// can be used (and tested) without the MATLAB headers.
+using buffer_deleter_t = void (*)(void*);
+template <typename T>
+using buffer_ptr_t = std::unique_ptr<T[], buffer_deleter_t>;
+
+// Where an adopted buffer was allocated.  Only a buffer from
+// ArrayFactory::createBuffer or TypedArray::release() may be handed back to
+// MATLAB with createArrayFromBuffer; any other is copied first.
+enum class BufferOrigin { external, matlab };
+
+// Contiguous element storage for BlockData.  Either owns a vector, allocated
+// with Allocator (64 byte aligned by default), or adopts an externally
+// allocated buffer (e.g. from TypedArray::release()), in which case no element
+// is copied and the alignment is whatever the buffer has.
+template <typename T, typename Allocator = aligned_allocator<T>>
+class Storage {
+public:
+    using vector_type = std::vector<T, Allocator>;
+    using allocator_type = Allocator;
+
+private:
+    vector_type _vector;
+    buffer_ptr_t<T> _buffer{nullptr, &Storage::deleteArray};
+    T* _ptr{nullptr};
+    std::size_t _size{0};
+    BufferOrigin _origin{BufferOrigin::external};
+
+    static void deleteArray(void* ptr) {
+        delete[] static_cast<T*>(ptr);
+    }
+
+public:
+    Storage() = default;
+    explicit Storage(const Allocator& allocator) : _vector(allocator) {}
+    explicit Storage(std::size_t nElements, const Allocator& allocator = Allocator()) : _vector(nElements, allocator), _ptr(_vector.data()), _size(nElements) {}
+    explicit Storage(vector_type&& data) : _vector(std::move(data)), _ptr(_vector.data()), _size(_vector.size()) {}
+    Storage(buffer_ptr_t<T>&& buffer, std::size_t nElements, BufferOrigin origin = BufferOrigin::external)
+        : _buffer(std::move(buffer)), _ptr(_buffer.get()), _size(nElements), _origin(origin) {
+        if (!_ptr && nElements > 0) {
+            throw std::invalid_argument("Cannot adopt an empty buffer");
+        }
+    }
+
+    Storage(const Storage& other)
+        : _vector(other.begin(), other.end(), std::allocator_traits<Allocator>::select_on_container_copy_construction(other._vector.get_allocator()))
+        , _ptr(_vector.data())
+        , _size(other._size) {}
+    Storage(Storage&& other) noexcept
+        : _vector(std::move(other._vector))
+        , _buffer(std::move(other._buffer))
+        , _ptr(std::exchange(other._ptr, nullptr))
+        , _size(std::exchange(other._size, 0))
+        , _origin(std::exchange(other._origin, BufferOrigin::external)) {}
+    ~Storage() = default;
+
+    Storage& operator=(const Storage& other) {
+        if (this != &other) {
+            *this = Storage(other);
+        }
+        return *this;
+    }
+
+    Storage& operator=(Storage&& other) noexcept {
+        // With non-propagating allocators (std::pmr) the vector may move element
+        // wise, so take the pointer from where the elements ended up.
+        _vector = std::move(other._vector);
+        _buffer = std::move(other._buffer);
+        _size = std::exchange(other._size, 0);
+        _origin = std::exchange(other._origin, BufferOrigin::external);
+        _ptr = adopted() ? _buffer.get() : _vector.data();
+        other._ptr = nullptr;
+        return *this;
+    }
+
+    allocator_type get_allocator() const { return _vector.get_allocator(); }
+
+    // True if the elements live in an adopted buffer rather than the vector.
+    bool adopted() const { return _buffer != nullptr; }
+    BufferOrigin origin() const { return _origin; }
+
+    void resize(std::size_t nElements) {
+        if (adopted()) {
+            if (nElements == _size) {
+                return;
+            }
+            vector_type data(nElements, _vector.get_allocator());
+            std::copy_n(_ptr, std::min(nElements, _size), data.begin());
+            _buffer.reset();
+            _origin = BufferOrigin::external;
+            _vector = std::move(data);
+        } else {
+            _vector.resize(nElements);
+        }
+        _ptr = _vector.data();
+        _size = nElements;
+    }
+
+    // Number of elements the storage can hold without reallocating.
+    std::size_t capacity() const { return adopted() ? _size : _vector.capacity(); }
+
+    // Makes room for nElements; adopted elements are moved into the vector.
+    void reserve(std::size_t nElements) {
+        if (nElements <= capacity()) {
+            return;
+        }
+        if (adopted()) {
+            vector_type data(_vector.get_allocator());
+            data.reserve(nElements);
+            data.assign(_ptr, _ptr + _size);
+            _buffer.reset();
+            _origin = BufferOrigin::external;
+            _vector = std::move(data);
+        } else {
+            _vector.reserve(nElements);
+        }
+        _ptr = _vector.data();
+    }
+
+    void shrink_to_fit() {
+        if (!adopted()) {
+            _vector.shrink_to_fit();
+            _ptr = _vector.data();
+        }
+    }
+
+    // Hands the elements out as an owning buffer and leaves the storage empty.
+    // Only vector backed storage needs to copy.
+    buffer_ptr_t<T> release() {
+        buffer_ptr_t<T> retval{nullptr, &Storage::deleteArray};
+        if (adopted()) {
+            retval = std::move(_buffer);
+        } else {
+            retval.reset(new T[_size]);
+            std::copy_n(_ptr, _size, retval.get());
+            _vector = vector_type(_vector.get_allocator());
+        }
+        _ptr = nullptr;
+        _size = 0;
+        _origin = BufferOrigin::external;
+        return retval;
+    }
+
+    // Empties the storage without handing the elements out.
+    void clear() {
+        _vector = vector_type(_vector.get_allocator());
+        _buffer.reset();
+        _ptr = nullptr;
+        _size = 0;
+        _origin = BufferOrigin::external;
+    }
+
+    std::size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    T* data() { return _ptr; }
+    const T* data() const { return _ptr; }
+
+    T* begin() { return _ptr; }
+    T* end() { return _ptr + _size; }
+    const T* begin() const { return _ptr; }
+    const T* end() const { return _ptr + _size; }
+
+    T& operator[](std::size_t iElement) { return _ptr[iElement]; }
+    const T& operator[](std::size_t iElement) const { return _ptr[iElement]; }
+
+    T& at(std::size_t iElement) {
+        if (iElement >= _size) {
+            throw std::out_of_range("Storage index out of range");
+        }
+        return _ptr[iElement];
+    }
+    const T& at(std::size_t iElement) const {
+        return const_cast<Storage*>(this)->at(iElement);
+    }
+};
+
+} // namespace utilities::details
+#endif // STORAGE_HPP
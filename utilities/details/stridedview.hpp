@@ -0,0 +1,113 @@
+#ifndef STRIDEDVIEW_HPP
+#define STRIDEDVIEW_HPP
+#include <cstddef>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include "blockview.hpp"
+
+namespace utilities::details {
+
+// size elements of contiguous storage, stride apart, starting at data.  This
+// replaces views::drop | views::stride | views::take pipelines: it is sized
+// and random access, iterating costs an index increment rather than the
+// clamping of stride_view and take_view, and it works with libstdc++ versions
+// that lack views::stride.
+template <typename T>
+class strided_view : public std::ranges::view_interface<strided_view<T>> {
+    T* _data{nullptr};
+    std::size_t _stride{1};
+    std::size_t _size{0};
+
+public:
+    using iterator = StridedIterator<T>;
+
+    strided_view() = default;
+    strided_view(T* data, std::size_t stride, std::size_t size) : _data(data), _stride(stride), _size(size) {}
+
+    iterator begin() const { return iterator(_data, _stride); }
+    iterator end() const { return iterator(_data, _stride, static_cast<std::ptrdiff_t>(_size)); }
+
+    std::size_t size() const { return _size; }
+    std::size_t stride() const { return _stride; }
+    T* base() const { return _data; }
+};
+
+namespace views {
+
+namespace strided_detail {
+
+template <typename R>
+inline constexpr bool is_strided_view = false;
+template <typename T>
+inline constexpr bool is_strided_view<strided_view<T>> = true;
+
+// Ranges a view may be taken of: views into contiguous storage, or
+// contiguous containers that outlive the expression.
+template <typename R>
+concept source = (is_strided_view<std::remove_cvref_t<R>> || std::ranges::contiguous_range<R>) &&
+                 std::ranges::sized_range<R> && (std::ranges::borrowed_range<R> || std::is_lvalue_reference_v<R>);
+
+inline void check(std::size_t size, std::size_t offset, std::size_t stride, std::size_t count) {
+    if (count > 0 && offset + (count - 1) * stride >= size) {
+        throw std::out_of_range("Strided view out of range");
+    }
+}
+
+} // namespace strided_detail
+
+// Adaptors for use as range | adaptor.  They are applied to contiguous ranges
+// or strided_views and compose by combining strides, so that
+//
+//     data | views::slice(kPage * nRows * nCols, nRows * nCols) | views::strided(iRow, nRows, nCols)
+//
+// is row iRow of page kPage as a single strided_view.
+
+// count elements from offset on.  On contiguous storage the result is a
+// std::span, a contiguous_range, so std::ranges::data works on it.
+struct slice {
+    std::size_t offset;
+    std::size_t count;
+
+    slice(std::size_t offset, std::size_t count) : offset(offset), count(count) {}
+
+    template <strided_detail::source R>
+    friend auto operator|(R&& r, const slice& s) {
+        strided_detail::check(std::ranges::size(r), s.offset, 1, s.count);
+        if constexpr (strided_detail::is_strided_view<std::remove_cvref_t<R>>) {
+            return std::remove_cvref_t<R>(r.base() + s.offset * r.stride(), r.stride(), s.count);
+        } else {
+            return std::span(std::ranges::data(r) + s.offset, s.count);
+        }
+    }
+};
+
+// count elements from offset on, stride apart.
+struct strided {
+    std::size_t offset;
+    std::size_t stride;
+    std::size_t count;
+
+    strided(std::size_t offset, std::size_t stride, std::size_t count) : offset(offset), stride(stride), count(count) {}
+
+    template <strided_detail::source R>
+    friend auto operator|(R&& r, const strided& s) {
+        strided_detail::check(std::ranges::size(r), s.offset, s.stride, s.count);
+        if constexpr (strided_detail::is_strided_view<std::remove_cvref_t<R>>) {
+            return std::remove_cvref_t<R>(r.base() + s.offset * r.stride(), s.stride * r.stride(), s.count);
+        } else {
+            using T = std::remove_reference_t<std::ranges::range_reference_t<R>>;
+            return strided_view<T>(std::ranges::data(r) + s.offset, s.stride, s.count);
+        }
+    }
+};
+
+} // namespace views
+
+} // namespace utilities::details
+
+template <typename T>
+inline constexpr bool std::ranges::enable_borrowed_range<utilities::details::strided_view<T>> = true;
+
+#endif // STRIDEDVIEW_HPP
@@ -0,0 +1,284 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace utilities::details {
+
+// Work stealing pool for the kernels in MexUtilities.  instance() lives as long
+// as the loaded mex, so threads are started once rather than on every call.
+//
+// Work submitted to the pool runs on threads that MATLAB knows nothing about:
+// it must not call into the engine (matlabPtr, utilities::printf, error, ...)
+// nor create or destroy matlab::data arrays.  Only touch plain buffers, e.g.
+// the ones behind a BlockData or Sparse.
+class ThreadPool {
+    struct Job {
+        void (*invoke)(void* fn, std::size_t first, std::size_t last);
+        void* fn;
+        std::size_t grain;
+        std::atomic<std::size_t> remaining;
+        std::exception_ptr error;
+        std::mutex errorMutex;
+    };
+
+    struct Task {
+        Job* job;
+        std::size_t first;
+        std::size_t last;
+    };
+
+    // One deque per worker plus a shared one for threads outside the pool.
+    // The owner pops from the back, thieves take from the front.
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::thread> _workers;
+    std::vector<std::unique_ptr<Queue>> _queues;
+    std::atomic<std::size_t> _queued{0};
+    std::atomic<bool> _stop{false};
+    std::mutex _sleepMutex;
+    std::condition_variable _wakeUp;
+
+    struct WorkerId {
+        const ThreadPool* pool{nullptr};
+        std::size_t index{0};
+    };
+    static WorkerId& current() {
+        static thread_local WorkerId id;
+        return id;
+    }
+
+    std::size_t queueIndex() const {
+        const auto& id = current();
+        return id.pool == this ? id.index : _workers.size();
+    }
+
+    void push(std::size_t iQueue, const Task& task) {
+        {
+            std::lock_guard<std::mutex> lock(_queues[iQueue]->mutex);
+            _queues[iQueue]->tasks.push_back(task);
+        }
+        _queued.fetch_add(1, std::memory_order_release);
+        if (!_workers.empty()) {
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+            _wakeUp.notify_one();
+        }
+    }
+
+    bool pop(std::size_t iQueue, Task& task) {
+        auto& queue = *_queues[iQueue];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            return false;
+        }
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+        _queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool steal(std::size_t thief, Task& task) {
+        const std::size_t nQueues = _queues.size();
+        for (std::size_t offset = 1; offset <= nQueues; ++offset) {
+            auto& queue = *_queues[(thief + offset) % nQueues];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+                _queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool localEmpty(std::size_t iQueue) {
+        std::lock_guard<std::mutex> lock(_queues[iQueue]->mutex);
+        return _queues[iQueue]->tasks.empty();
+    }
+
+    // Lazy binary splitting: the upper half of a range is only offered to
+    // thieves while the local deque is empty, otherwise the range is worked
+    // off in grain sized pieces.  Busy pools therefore split little, idle ones
+    // get work handed out quickly.  Ranges shorter than two grains are not
+    // split, so no piece is shorter than a grain.
+    void run(std::size_t iQueue, Task task) {
+        Job& job = *task.job;
+        std::size_t first = task.first;
+        std::size_t last = task.last;
+        const std::size_t nTotal = last - first;
+        try {
+            while (last - first >= 2 * job.grain) {
+                if (localEmpty(iQueue)) {
+                    std::size_t middle = first + (last - first) / 2;
+                    push(iQueue, Task{&job, middle, last});
+                    last = middle;
+                } else {
+                    job.invoke(job.fn, first, first + job.grain);
+                    first += job.grain;
+                }
+            }
+            job.invoke(job.fn, first, last);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(job.errorMutex);
+            if (!job.error) {
+                job.error = std::current_exception();
+            }
+        }
+        // Indices handed to other tasks are accounted for by those.
+        job.remaining.fetch_sub(nTotal - (task.last - last), std::memory_order_acq_rel);
+    }
+
+    bool runOne(std::size_t iQueue) {
+        Task task;
+        if (pop(iQueue, task) || steal(iQueue, task)) {
+            run(iQueue, task);
+            return true;
+        }
+        return false;
+    }
+
+    void workerLoop(std::size_t index) {
+        current() = WorkerId{this, index};
+        while (!_stop.load(std::memory_order_acquire)) {
+            if (runOne(index)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_sleepMutex);
+            _wakeUp.wait(lock, [this] {
+                return _stop.load(std::memory_order_acquire) || _queued.load(std::memory_order_acquire) > 0;
+            });
+        }
+    }
+
+    void start(std::size_t nThreads) {
+        const std::size_t nWorkers = std::max<std::size_t>(nThreads, 1) - 1;
+        _stop = false;
+        _queues.clear();
+        for (std::size_t iQueue = 0; iQueue <= nWorkers; ++iQueue) {
+            _queues.push_back(std::make_unique<Queue>());
+        }
+        _workers.reserve(nWorkers);
+        for (std::size_t iWorker = 0; iWorker < nWorkers; ++iWorker) {
+            _workers.emplace_back(&ThreadPool::workerLoop, this, iWorker);
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+            _stop = true;
+        }
+        _wakeUp.notify_all();
+        for (auto& worker : _workers) {
+            worker.join();
+        }
+        _workers.clear();
+    }
+
+public:
+    // nThreads counts the calling thread, so a pool of size one runs
+    // everything inline.
+    explicit ThreadPool(std::size_t nThreads) {
+        start(nThreads);
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool() {
+        stop();
+    }
+
+    // Sized from the environment variable MEXUTILITIES_NUM_THREADS if set,
+    // otherwise from the number of hardware threads.
+    static std::size_t defaultThreadCount() {
+        if (const char* value = std::getenv("MEXUTILITIES_NUM_THREADS")) {
+            try {
+                return std::max<std::size_t>(std::stoul(value), 1);
+            } catch (const std::exception&) {
+            }
+        }
+        return std::max<unsigned>(std::thread::hardware_concurrency(), 1);
+    }
+
+    // On Windows the workers must not be joined while the mex is being
+    // unloaded; call instance().resize(1) from ~MexFunction there.
+    static ThreadPool& instance() {
+        static ThreadPool pool(defaultThreadCount());
+        return pool;
+    }
+
+    std::size_t size() const {
+        return _workers.size() + 1;
+    }
+
+    // Restarts the pool with nThreads threads.  Must not be called while work
+    // is in flight.
+    void resize(std::size_t nThreads) {
+        if (nThreads == size()) {
+            return;
+        }
+        stop();
+        start(nThreads);
+    }
+
+    // Calls fn(first, last) on disjoint sub-ranges covering [first, last) and
+    // returns once all of them are done.  Pieces are at least grain long
+    // unless the whole range is shorter; grain = 0 picks one from the pool
+    // size.  The calling thread takes part, and the first exception thrown by
+    // fn is rethrown here after the remaining work has finished.
+    template <typename Fn>
+    void parallel_for(std::size_t first, std::size_t last, Fn&& fn, std::size_t grain = 0) {
+        if (first >= last) {
+            return;
+        }
+        const std::size_t n = last - first;
+        if (grain == 0) {
+            grain = std::max<std::size_t>(n / (8 * size()), 1);
+        }
+        if (_workers.empty() || n < 2 * grain) {
+            fn(first, last);
+            return;
+        }
+        using Function = std::remove_reference_t<Fn>;
+        Job job;
+        job.invoke = [](void* f, std::size_t b, std::size_t e) { (*static_cast<Function*>(f))(b, e); };
+        job.fn = const_cast<void*>(static_cast<const void*>(std::addressof(fn)));
+        job.grain = grain;
+        job.remaining.store(n, std::memory_order_relaxed);
+
+        const std::size_t iQueue = queueIndex();
+        run(iQueue, Task{&job, first, last});
+        // Help out, with this job or any other, until all indices are done.
+        while (job.remaining.load(std::memory_order_acquire) > 0) {
+            if (!runOne(iQueue)) {
+                std::this_thread::yield();
+            }
+        }
+        if (job.error) {
+            std::rethrow_exception(job.error);
+        }
+    }
+};
+
+// parallel_for on the process wide pool.
+template <typename Fn>
+void parallel_for(std::size_t first, std::size_t last, Fn&& fn, std::size_t grain = 0) {
+    ThreadPool::instance().parallel_for(first, last, std::forward<Fn>(fn), grain);
+}
+
+} // namespace utilities::details
+#endif // THREADPOOL_HPP
@@ -0,0 +1,17 @@
+#ifndef TRAITS_HPP
+#define TRAITS_HPP
+#include <complex>
+#include <type_traits>
+
+namespace utilities::details {
+
+// True for std::complex of any element type.
+template <typename T>
+struct is_complex : std::false_type {};
+template <typename T>
+struct is_complex<std::complex<T>> : std::true_type {};
+template <typename T>
+inline constexpr bool is_complex_v = is_complex<T>::value;
+
+} // namespace utilities::details
+#endif // TRAITS_HPP
@@ -0,0 +1,268 @@
+#ifndef TRANSPOSE_HPP
+#define TRANSPOSE_HPP
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+#include "threadpool.hpp"
+
+namespace utilities::details {
+
+namespace transpose_detail {
+
+// Side of the register sized micro tile and of the cache tile made up of them.
+// A cache tile of doubles is 8 KiB for source and destination each.
+inline constexpr std::size_t microTile = 8;
+inline constexpr std::size_t cacheTile = 32;
+
+// out(j, i) = in(i, j) for a fixed size Rows x Cols tile.  The compile time
+// bounds let the compiler unroll both loops and use shuffles.
+template <std::size_t Rows, std::size_t Cols, typename T>
+inline void tile(const T* in, std::size_t ldIn, T* out, std::size_t ldOut) {
+    for (std::size_t i = 0; i < Rows; ++i) {
+        for (std::size_t j = 0; j < Cols; ++j) {
+            out[j + i * ldOut] = in[i + j * ldIn];
+        }
+    }
+}
+
+template <typename T>
+inline void edge(const T* in, std::size_t ldIn, T* out, std::size_t ldOut, std::size_t rows, std::size_t cols) {
+    for (std::size_t i = 0; i < rows; ++i) {
+        for (std::size_t j = 0; j < cols; ++j) {
+            out[j + i * ldOut] = in[i + j * ldIn];
+        }
+    }
+}
+
+// out(j, i) = in(i, j) for i < rows and jFirst <= j < jLast, where column j
+// of in starts at in + j * ldIn and column i of out at out + i * ldOut.
+template <typename T>
+void columns(const T* in, std::size_t ldIn, T* out, std::size_t ldOut, std::size_t rows, std::size_t jFirst, std::size_t jLast) {
+    for (std::size_t j0 = jFirst; j0 < jLast; j0 += cacheTile) {
+        const std::size_t jEnd = std::min(j0 + cacheTile, jLast);
+        for (std::size_t i0 = 0; i0 < rows; i0 += cacheTile) {
+            const std::size_t iEnd = std::min(i0 + cacheTile, rows);
+            for (std::size_t j = j0; j < jEnd; j += microTile) {
+                for (std::size_t i = i0; i < iEnd; i += microTile) {
+                    const T* src = in + i + j * ldIn;
+                    T* dst = out + j + i * ldOut;
+                    if (i + microTile <= iEnd && j + microTile <= jEnd) {
+                        tile<microTile, microTile>(src, ldIn, dst, ldOut);
+                    } else {
+                        edge(src, ldIn, dst, ldOut, std::min(microTile, iEnd - i), std::min(microTile, jEnd - j));
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Strips of cache tiles of columns(), on the thread pool.
+template <typename T>
+void parallelColumns(const T* in, std::size_t ldIn, T* out, std::size_t ldOut, std::size_t rows, std::size_t cols) {
+    const std::size_t nStrips = (cols + cacheTile - 1) / cacheTile;
+    const std::size_t grain = std::max<std::size_t>((std::size_t{1} << 16) / std::max<std::size_t>(rows * cacheTile, 1), 1);
+    parallel_for(0, nStrips, [&](std::size_t first, std::size_t last) {
+        columns(in, ldIn, out, ldOut, rows, first * cacheTile, std::min(last * cacheTile, cols));
+    }, grain);
+}
+
+} // namespace transpose_detail
+
+// Out of place transpose of the column major rows x cols matrix in into the
+// cols x rows matrix out.  The matrix is walked in cache tiles made of fixed
+// size micro tiles, so that neither the loads nor the stores stride through
+// memory for more than a tile; strips of cache tiles run on the thread pool.
+template <typename T>
+void transpose(const T* in, std::size_t rows, std::size_t cols, T* out) {
+    transpose_detail::parallelColumns(in, rows, out, cols, rows, cols);
+}
+
+// Transposes each of nPages rows x cols pages of in into out, pages in
+// parallel.
+template <typename T>
+void pageTranspose(const T* in, std::size_t rows, std::size_t cols, std::size_t nPages, T* out) {
+    const std::size_t pageSize = rows * cols;
+    if (nPages == 1) {
+        transpose(in, rows, cols, out);
+        return;
+    }
+    const std::size_t grain = std::max<std::size_t>((std::size_t{1} << 16) / std::max<std::size_t>(pageSize, 1), 1);
+    parallel_for(0, nPages, [&](std::size_t first, std::size_t last) {
+        for (std::size_t kPage = first; kPage < last; ++kPage) {
+            transpose_detail::columns(in + kPage * pageSize, rows, out + kPage * pageSize, cols, rows, 0, cols);
+        }
+    }, grain);
+}
+
+// Input runs up to this many elements are scattered rather than tiled by
+// permute.
+inline constexpr std::size_t scatterRun = 64;
+
+// Dimensions of permute(in, dims, order, out).
+template <std::size_t N>
+std::array<std::size_t, N> permutedDims(const std::array<std::size_t, N>& dims, const std::array<std::size_t, N>& order) {
+    std::array<bool, N> seen{};
+    std::array<std::size_t, N> permuted{};
+    for (std::size_t k = 0; k < N; ++k) {
+        if (order[k] >= N || seen[order[k]]) {
+            throw std::invalid_argument("Order must be a permutation of the dimensions");
+        }
+        seen[order[k]] = true;
+        permuted[k] = dims[order[k]];
+    }
+    return permuted;
+}
+
+// Out of place generalisation of transpose to N dimensions, like MATLAB's
+// permute but with zero based order: dimension k of out is dimension order[k]
+// of in.
+//
+// Dimensions of extent one are dropped and dimensions that stay next to each
+// other are fused first.  What is left is moved in blocks, see below, and the
+// combinations of the remaining outer dimensions run on the thread pool.
+template <typename T, std::size_t N>
+void permute(const T* in, const std::array<std::size_t, N>& dims, const std::array<std::size_t, N>& order, T* out) {
+    permutedDims(dims, order);
+    std::size_t nElements = 1;
+    std::array<std::size_t, N> inStride{};
+    for (std::size_t d = 0; d < N; ++d) {
+        inStride[d] = nElements;
+        nElements *= dims[d];
+    }
+    if (nElements == 0) {
+        return;
+    }
+
+    // Groups of input dimensions in output order: input start dimension,
+    // extent, input and output stride.
+    struct Group {
+        std::size_t first;
+        std::size_t last;
+        std::size_t extent;
+        std::size_t inStride;
+        std::size_t outStride;
+    };
+    std::vector<Group> groups;
+    std::size_t outStride = 1;
+    for (std::size_t k = 0; k < N; ++k) {
+        const std::size_t d = order[k];
+        if (dims[d] == 1) {
+            continue;
+        }
+        if (!groups.empty() && groups.back().last + 1 == d) {
+            groups.back().last = d;
+            groups.back().extent *= dims[d];
+        } else {
+            groups.push_back(Group{d, d, dims[d], inStride[d], outStride});
+        }
+        outStride *= dims[d];
+    }
+    if (groups.size() <= 1) {
+        std::copy_n(in, nElements, out);
+        return;
+    }
+
+    // Group 0 is fastest in out; find the one fastest in in.
+    std::size_t iFastIn = 0;
+    for (std::size_t g = 1; g < groups.size(); ++g) {
+        if (groups[g].first < groups[iFastIn].first) {
+            iFastIn = g;
+        }
+    }
+    const Group fastOut = groups[0];
+    const Group fastIn = groups[iFastIn];
+
+    // Three kinds of blocks, repeated over the outer groups:
+    //  - the fastest dimension stays in front: contiguous runs are copied;
+    //  - short input runs in front of the fastest output group (e.g. the
+    //    2 x 8 leading block of outputs x directions x points): each run is
+    //    read once and scattered through a table of output offsets, so the
+    //    input is streamed exactly once;
+    //  - otherwise a tiled 2-D transpose between fastIn and fastOut.
+    enum class Kind { copy, scatter, tile };
+    const Kind kind = iFastIn == 0 ? Kind::copy : (fastOut.inStride <= scatterRun ? Kind::scatter : Kind::tile);
+    std::vector<std::size_t> scatter;
+    std::vector<Group> outer;
+    std::size_t blockSize = 0;
+    if (kind == Kind::scatter) {
+        // Every group below fastOut in the input is part of the run.
+        scatter.assign(fastOut.inStride, 0);
+        for (const auto& group : groups) {
+            if (group.inStride < fastOut.inStride) {
+                for (std::size_t e = 0; e < fastOut.inStride; ++e) {
+                    scatter[e] += (e / group.inStride) % group.extent * group.outStride;
+                }
+            } else {
+                outer.push_back(group);
+            }
+        }
+        blockSize = fastOut.inStride;
+    } else {
+        for (std::size_t g = 1; g < groups.size(); ++g) {
+            if (g != iFastIn) {
+                outer.push_back(groups[g]);
+            }
+        }
+        blockSize = kind == Kind::copy ? fastIn.extent : fastIn.extent * fastOut.extent;
+    }
+    std::size_t nOuter = 1;
+    for (const auto& group : outer) {
+        nOuter *= group.extent;
+    }
+
+    auto block = [&](const T* src, T* dst) {
+        switch (kind) {
+            case Kind::copy:
+                std::copy_n(src, fastIn.extent, dst);
+                break;
+            case Kind::scatter:
+                for (std::size_t e = 0; e < blockSize; ++e) {
+                    dst[scatter[e]] = src[e];
+                }
+                break;
+            case Kind::tile:
+                // dst(j + i * outStride) = src(i + j * inStride) for i along
+                // the fastest input group and j along the fastest output group.
+                transpose_detail::columns(src, fastOut.inStride, dst, fastIn.outStride, fastIn.extent, 0, fastOut.extent);
+                break;
+        }
+    };
+    if (nOuter == 1 && kind == Kind::tile) {
+        transpose_detail::parallelColumns(in, fastOut.inStride, out, fastIn.outStride, fastIn.extent, fastOut.extent);
+        return;
+    }
+
+    const std::size_t grain = std::max<std::size_t>((std::size_t{1} << 16) / std::max<std::size_t>(blockSize, 1), 1);
+    parallel_for(0, nOuter, [&](std::size_t first, std::size_t last) {
+        // Odometer over the outer groups, started at index first.
+        std::vector<std::size_t> index(outer.size());
+        std::size_t inOffset = 0;
+        std::size_t outOffset = 0;
+        std::size_t remainder = first;
+        for (std::size_t g = 0; g < outer.size(); ++g) {
+            index[g] = remainder % outer[g].extent;
+            remainder /= outer[g].extent;
+            inOffset += index[g] * outer[g].inStride;
+            outOffset += index[g] * outer[g].outStride;
+        }
+        for (std::size_t iOuter = first; iOuter < last; ++iOuter) {
+            block(in + inOffset, out + outOffset);
+            for (std::size_t g = 0; g < outer.size(); ++g) {
+                inOffset += outer[g].inStride;
+                outOffset += outer[g].outStride;
+                if (++index[g] < outer[g].extent) {
+                    break;
+                }
+                inOffset -= outer[g].extent * outer[g].inStride;
+                outOffset -= outer[g].extent * outer[g].outStride;
+                index[g] = 0;
+            }
+        }
+    }, grain);
+}
+
+} // namespace utilities::details
+#endif // TRANSPOSE_HPP
@@ -4,30 +4,347 @@
 #include "utilities.hpp"
 #endif // defined(MATLAB_MEX_FILE)
 #include <algorithm>
+#include <cmath>
 #include <vector>
 #include <type_traits>
 #include <concepts>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <numeric>
 #include <span>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include "details/blockdata.hpp"
+#include "details/threadpool.hpp"
 
 namespace utilities {
 
-template<std::floating_point Number>
+// Compressed sparse column matrix: colBnd[j] .. colBnd[j+1] are the positions
+// of the non-zeros of column j in iRows and values, rows ascending within a
+// column.  Row indices are stored as Index, 32 bit by default.  Index is not
+// widened automatically: a matrix with more rows or columns than it holds is
+// refused with out_of_range, and needs a wider Index chosen by the caller.
+// A compressed sparse row mirror is built on first use by getCsr or a product
+// and kept until the pattern, or for its values the values, change.  Building
+// it is serialised, so const members may be called from several threads at
+// once.
+template<std::floating_point Number, std::unsigned_integral Index = std::uint32_t>
+class SparseSumPlan;
+template<std::floating_point Number, std::unsigned_integral Index = std::uint32_t>
+class SparseProductPlan;
+
+template<std::floating_point Number, std::unsigned_integral Index = std::uint32_t>
 class Sparse {
 private:
+    friend class SparseSumPlan<Number, Index>;
+    friend class SparseProductPlan<Number, Index>;
+
     std::size_t m{}, n{};
-    std::vector<std::size_t> iOffset;
+    std::vector<std::size_t> colBnd = std::vector<std::size_t>(1, 0);
+    std::vector<Index> iRows;
     std::vector<Number> values;
 
-    inline std::size_t linearIndex(std::size_t i, std::size_t j) const {
-        return i + j * m;
+    // A mutex that copies as a new one, leaving Sparse movable.
+    struct CsrMutex : std::mutex {
+        CsrMutex() = default;
+        CsrMutex(const CsrMutex&) noexcept {}
+    };
+
+    // CSR pattern, with csrPosition[k] the position in values of the k-th
+    // non-zero in row major order.  Built, and its flags tested, only under
+    // csrMutex.
+    mutable CsrMutex csrMutex;
+    mutable bool csrValid{false};
+    mutable std::vector<std::size_t> rowBnd;
+    mutable std::vector<Index> jCols;
+    mutable std::vector<std::size_t> csrPosition;
+    mutable bool csrValuesValid{false};
+    mutable std::vector<Number> csrValues;
+
+    // Scatter map of the last pattern given to updateValues, as linear
+    // indices: its scatterFrom[k]-th value goes to values[scatterTo[k]].
+    bool scatterValid{false};
+    std::vector<std::size_t> scatterPattern;
+    std::vector<std::size_t> scatterFrom;
+    std::vector<std::size_t> scatterTo;
+
+    void patternChanged() {
+        csrValid = false;
+        csrValuesValid = false;
+        scatterValid = false;
+    }
+
+    void valuesChanged() {
+        csrValuesValid = false;
+    }
+
+    void refreshCsr() const {
+        std::lock_guard<std::mutex> lock(csrMutex);
+        if (!csrValid) {
+            buildCsr();
+        }
+        if (!csrValuesValid) {
+            csrValues.resize(csrPosition.size());
+            for (std::size_t k = 0; k < csrPosition.size(); k++) {
+                csrValues[k] = values[csrPosition[k]];
+            }
+            csrValuesValid = true;
+        }
+    }
+
+    // Merges the strictly increasing linearIndices with the pattern of this.
+    void buildScatter(std::span<const std::size_t> linearIndices) {
+        scatterValid = false;
+        scatterFrom.clear();
+        scatterTo.clear();
+        const std::size_t nnz = values.size();
+        std::size_t kA = 0;
+        std::size_t jA = 0;
+        // Linear index of the kA-th non-zero, with jA kept in step.
+        auto linear = [&]() {
+            while (colBnd[jA + 1] <= kA) {
+                jA++;
+            }
+            return iRows[kA] + jA * m;
+        };
+        for (std::size_t k = 0; k < linearIndices.size(); k++) {
+            if (k > 0 && linearIndices[k] <= linearIndices[k - 1]) {
+                throw std::invalid_argument("Linear indices must be strictly increasing");
+            }
+            while (kA < nnz && linear() < linearIndices[k]) {
+                kA++;
+            }
+            if (kA < nnz && linear() == linearIndices[k]) {
+                scatterFrom.push_back(k);
+                scatterTo.push_back(kA++);
+            }
+        }
+        scatterPattern.assign(linearIndices.begin(), linearIndices.end());
+        scatterValid = true;
+    }
+
+    // Rows, and the columns of the CSR mirror, are stored as Index.
+    void checkDimensions() const {
+        if (m > static_cast<std::size_t>(std::numeric_limits<Index>::max()) || n > static_cast<std::size_t>(std::numeric_limits<Index>::max())) {
+            throw std::out_of_range("Sparse dimensions exceed the sparse index type");
+        }
+    }
+
+    bool hasPattern(std::size_t nRows, std::size_t nCols, std::span<const std::size_t> bounds, std::span<const Index> rows) const {
+        return m == nRows && n == nCols && std::ranges::equal(colBnd, bounds) && std::ranges::equal(iRows, rows);
+    }
+
+    // Takes the given pattern, with all values zero.
+    void assignPattern(std::size_t nRows, std::size_t nCols, std::span<const std::size_t> bounds, std::span<const Index> rows) {
+        m = nRows;
+        n = nCols;
+        checkDimensions();
+        colBnd.assign(bounds.begin(), bounds.end());
+        iRows.assign(rows.begin(), rows.end());
+        values.assign(iRows.size(), Number{0});
+        patternChanged();
+    }
+
+    // Runs fn(first, last) on the thread pool over ranges of the slices, rows
+    // or columns, delimited by bounds, cut to hold about equal numbers of
+    // non-zeros.
+    template <typename Fn>
+    static void forEachSliceRange(std::span<const std::size_t> bounds, Fn&& fn) {
+        const std::size_t nSlices = bounds.size() - 1;
+        const std::size_t nnz = bounds.back();
+        const std::size_t nParts = std::clamp<std::size_t>(nnz / multiplyGrain, 1, details::ThreadPool::instance().size());
+        details::parallel_for(0, nParts, [&](std::size_t first, std::size_t last) {
+            for (std::size_t p = first; p < last; p++) {
+                auto sliceAt = [&](std::size_t q) {
+                    return q == nParts ? nSlices : static_cast<std::size_t>(std::ranges::lower_bound(bounds, q * nnz / nParts) - bounds.begin());
+                };
+                fn(sliceAt(p), sliceAt(p + 1));
+            }
+        }, 1);
+    }
+
+    // Stable counting sort of nnz items by key(k) < nBuckets on the thread
+    // pool: contiguous pieces of the items are counted into their own
+    // histograms, which a prefix sum turns into each piece's first position
+    // per bucket, and then every piece scatters its items with
+    // move(k, position).  Returns the bucket bounds.
+    template <typename Key, typename Move>
+    static std::vector<std::size_t> countingSort(std::size_t nnz, std::size_t nBuckets, Key&& key, Move&& move) {
+        // Fewer pieces than threads if their histograms would outgrow the items.
+        const std::size_t maxPieces = std::min(details::ThreadPool::instance().size(), std::max<std::size_t>(nnz / std::max<std::size_t>(nBuckets, 1), 1));
+        const std::size_t nPieces = std::clamp<std::size_t>(nnz / assembleGrain, 1, maxPieces);
+        auto pieceBegin = [&](std::size_t p) { return p * nnz / nPieces; };
+        std::vector<std::size_t> next(nPieces * nBuckets, 0);
+        details::parallel_for(0, nPieces, [&](std::size_t first, std::size_t last) {
+            for (std::size_t p = first; p < last; p++) {
+                std::size_t* count = next.data() + p * nBuckets;
+                for (std::size_t k = pieceBegin(p); k < pieceBegin(p + 1); k++) {
+                    count[key(k)] += 1;
+                }
+            }
+        }, 1);
+        std::vector<std::size_t> bounds(nBuckets + 1);
+        std::size_t total = 0;
+        for (std::size_t b = 0; b < nBuckets; b++) {
+            bounds[b] = total;
+            for (std::size_t p = 0; p < nPieces; p++) {
+                total += std::exchange(next[p * nBuckets + b], total);
+            }
+        }
+        bounds[nBuckets] = total;
+        details::parallel_for(0, nPieces, [&](std::size_t first, std::size_t last) {
+            for (std::size_t p = first; p < last; p++) {
+                std::size_t* position = next.data() + p * nBuckets;
+                for (std::size_t k = pieceBegin(p); k < pieceBegin(p + 1); k++) {
+                    move(k, position[key(k)]++);
+                }
+            }
+        }, 1);
+        return bounds;
+    }
+
+    // Replaces the pattern by nnz triplets, row(k), col(k), value(k), sorted
+    // by column with a counting sort.  Within a column the triplets keep
+    // their order, so rows must come strictly ascending; otherwise this is
+    // left empty and invalid_argument is thrown, see assemble for triplets in
+    // any order.
+    template <typename RowAt, typename ColAt, typename ValueAt>
+    void assign(std::size_t nnz, RowAt&& row, ColAt&& col, ValueAt&& value) {
+        checkDimensions();
+        colBnd.assign(n + 1, 0);
+        for (std::size_t k = 0; k < nnz; k++) {
+            const std::size_t j = static_cast<std::size_t>(col(k));
+            if (j >= n || static_cast<std::size_t>(row(k)) >= m) {
+                throw std::out_of_range("Sparse index out of range");
+            }
+            colBnd[j + 1] += 1;
+        }
+        std::partial_sum(colBnd.begin(), colBnd.end(), colBnd.begin());
+        iRows.resize(nnz);
+        values.resize(nnz);
+        std::vector<std::size_t> next(colBnd.begin(), colBnd.end() - 1);
+        for (std::size_t k = 0; k < nnz; k++) {
+            const std::size_t position = next[static_cast<std::size_t>(col(k))]++;
+            iRows[position] = static_cast<Index>(row(k));
+            values[position] = value(k);
+        }
+        patternChanged();
+        for (std::size_t j = 0; j < n; j++) {
+            for (std::size_t k = colBnd[j] + 1; k < colBnd[j + 1]; k++) {
+                if (iRows[k] <= iRows[k - 1]) {
+                    colBnd.assign(n + 1, 0);
+                    iRows.clear();
+                    values.clear();
+                    throw std::invalid_argument("Rows must be strictly increasing within a column, use assemble for unsorted triplets");
+                }
+            }
+        }
+    }
+
+    void buildCsr() const {
+        const std::size_t nnz = values.size();
+        rowBnd.assign(m + 1, 0);
+        for (Index i : iRows) {
+            rowBnd[static_cast<std::size_t>(i) + 1] += 1;
+        }
+        std::partial_sum(rowBnd.begin(), rowBnd.end(), rowBnd.begin());
+        jCols.resize(nnz);
+        csrPosition.resize(nnz);
+        std::vector<std::size_t> next(rowBnd.begin(), rowBnd.end() - 1);
+        for (std::size_t j = 0; j < n; j++) {
+            for (std::size_t k = colBnd[j]; k < colBnd[j + 1]; k++) {
+                const std::size_t position = next[iRows[k]]++;
+                jCols[position] = static_cast<Index>(j);
+                csrPosition[position] = k;
+            }
+        }
+        csrValid = true;
+    }
+
+    // Writes the rows and values of the elements of a dense column with
+    // magnitude above dropTolerance.  Branch free: every element is written
+    // and the position only advances for the kept ones, so a block goes
+    // through a local buffer that may be overwritten past the end.
+    static void compressColumn(const Number* column, std::size_t nRows, Number dropTolerance, Index* rows, Number* nonZeros) {
+        constexpr std::size_t block = 256;
+        Index blockRows[block];
+        Number blockValues[block];
+        for (std::size_t first = 0; first < nRows; first += block) {
+            const std::size_t count = std::min(block, nRows - first);
+            std::size_t k = 0;
+            for (std::size_t i = 0; i < count; i++) {
+                const Number x = column[first + i];
+                blockRows[k] = static_cast<Index>(first + i);
+                blockValues[k] = x;
+                k += std::abs(x) > dropTolerance;
+            }
+            rows = std::copy_n(blockRows, k, rows);
+            nonZeros = std::copy_n(blockValues, k, nonZeros);
+        }
+    }
+
+    // Calls fn(j) for every non-zero in order, with j its column.
+    template <typename Fn>
+    void forEachColumn(Fn&& fn) const {
+        for (std::size_t j = 0; j < n; j++) {
+            for (std::size_t k = colBnd[j]; k < colBnd[j + 1]; k++) {
+                fn(j);
+            }
+        }
     }
 
 public:
+    using index_type = Index;
+
     Sparse() = default;
     ~Sparse() = default;
-    Sparse(std::size_t m, std::size_t n) : m(m), n(n) {}
-    Sparse(const Sparse<Number>& A) = default;
-    Sparse(Sparse<Number>&& A) = default;
+    Sparse(std::size_t m, std::size_t n) : m(m), n(n), colBnd(n + 1, 0) {
+        checkDimensions();
+    }
+    // From strictly ascending column major linear indices of the non-zeros and
+    // their values.
+    Sparse(std::size_t m, std::size_t n, const std::vector<std::size_t>& linearIndices, const std::vector<Number>& nonZeros)
+        : m(m), n(n) {
+        if (linearIndices.size() != nonZeros.size()) {
+            throw std::invalid_argument("Number of indices and values must agree");
+        }
+        if (m == 0 && !linearIndices.empty()) {
+            throw std::out_of_range("Sparse index out of range");
+        }
+        assign(nonZeros.size(),
+               [&](std::size_t k) { return linearIndices[k] % m; },
+               [&](std::size_t k) { return linearIndices[k] / m; },
+               [&](std::size_t k) { return nonZeros[k]; });
+    }
+    // From compressed columns, as given by columnBounds and rowIndices.
+    Sparse(std::size_t m, std::size_t n, std::vector<std::size_t> columnBounds, std::vector<Index> rows, std::vector<Number> nonZeros)
+        : m(m), n(n), colBnd(std::move(columnBounds)), iRows(std::move(rows)), values(std::move(nonZeros)) {
+        checkDimensions();
+        if (colBnd.size() != n + 1 || colBnd.front() != 0 || colBnd.back() != iRows.size() || values.size() != iRows.size()) {
+            throw std::invalid_argument("Compressed columns do not match the dimensions");
+        }
+        if (!std::ranges::is_sorted(colBnd)) {
+            throw std::invalid_argument("Column bounds must not decrease");
+        }
+        for (std::size_t j = 0; j < n; j++) {
+            for (std::size_t k = colBnd[j]; k < colBnd[j + 1]; k++) {
+                if (iRows[k] >= m) {
+                    throw std::out_of_range("Sparse index out of range");
+                }
+                if (k > colBnd[j] && iRows[k] <= iRows[k - 1]) {
+                    throw std::invalid_argument("Rows must be strictly increasing within a column");
+                }
+            }
+        }
+    }
+    // The CSR mirror is not copied, so that A may be in use by other threads;
+    // the copy builds its own on first use.
+    Sparse(const Sparse& A)
+        : m(A.m), n(A.n), colBnd(A.colBnd), iRows(A.iRows), values(A.values), scatterValid(A.scatterValid),
+          scatterPattern(A.scatterPattern), scatterFrom(A.scatterFrom), scatterTo(A.scatterTo) {}
+    Sparse(Sparse&& A) = default;
     Sparse operator=(const Sparse&) = delete;
 
 
@@ -35,129 +352,353 @@ public:
     std::size_t getNumberOfColumns() const { return n; }
     std::size_t getNumberOfNonZeroElements() const { return values.size(); }
 
+    // The compressed column arrays.
+    std::span<const std::size_t> columnBounds() const { return colBnd; }
+    std::span<const Index> rowIndices() const { return iRows; }
+    std::span<const Number> nonZeroValues() const { return values; }
+    // Values may be written in place, before the next product or getCsr; the
+    // pattern stays as it is.
+    std::span<Number> nonZeroValues() {
+        valuesChanged();
+        return values;
+    }
 
-    template<std::integral Index>
-    void iRow(Index* rowPtr) const {
-        std::transform(iOffset.cbegin(), iOffset.cend(), rowPtr, [&](std::size_t elem) { return elem % m; });
+    // Column major linear indices i + j*m of the non-zeros.
+    std::vector<std::size_t> linearIndices() const {
+        std::vector<std::size_t> retval;
+        retval.reserve(values.size());
+        std::size_t k = 0;
+        forEachColumn([&](std::size_t j) { retval.push_back(iRows[k++] + j * m); });
+        return retval;
+    }
+
+    // A', from the CSR mirror.
+    Sparse transposed() const {
+        refreshCsr();
+        Sparse At(n, m);
+        At.colBnd = rowBnd;
+        At.iRows = jCols;
+        At.values = csrValues;
+        return At;
+    }
+
+
+    template<std::integral OutIndex>
+    void iRow(OutIndex* rowPtr) const {
+        std::transform(iRows.cbegin(), iRows.cend(), rowPtr, [](Index i) { return static_cast<OutIndex>(i); });
     }
 
-    template<std::integral Index>
-    void iRow(std::span<Index> rowSpan) const {
-        std::transform(iOffset.cbegin(), iOffset.cend(), rowSpan.begin(), [&](std::size_t elem) { return elem % m; });
+    template<std::integral OutIndex>
+    void iRow(std::span<OutIndex> rowSpan) const {
+        iRow(rowSpan.data());
     }
 
-    template<std::integral Index>
-    void jCol(Index* colPtr) const {
-        std::transform(iOffset.cbegin(), iOffset.cend(), colPtr, [&](std::size_t elem) { return elem / m; });
+    template<std::integral OutIndex>
+    void jCol(OutIndex* colPtr) const {
+        forEachColumn([&](std::size_t j) { *(colPtr++) = static_cast<OutIndex>(j); });
     }
 
-    template<std::integral Index>
-    void jCol(std::span<Index> colSpan) const {
-        std::transform(iOffset.cbegin(), iOffset.cend(), colSpan.begin(), [&](std::size_t elem) { return elem / m; });
+    template<std::integral OutIndex>
+    void jCol(std::span<OutIndex> colSpan) const {
+        jCol(colSpan.data());
     }
 
     void val(Number* valPtr) const {
-        std::transform(values.cbegin(), values.cend(), valPtr, [](Number elem) { return elem; });
+        std::copy(values.cbegin(), values.cend(), valPtr);
     }
 
     void val(std::span<Number> valSpan) const {
-        std::transform(values.cbegin(), values.cend(), valSpan.begin(), [](Number elem) { return elem; });
+        val(valSpan.data());
+    }
+
+    template<std::integral OutIndex>
+    void getCsc(std::span<OutIndex> columnBounds, std::span<OutIndex> iRow, std::span<Number> val) const {
+        std::transform(colBnd.cbegin(), colBnd.cend(), columnBounds.begin(), [](std::size_t k) { return static_cast<OutIndex>(k); });
+        this->iRow(iRow);
+        this->val(val);
+    }
+
+    // The row major arrays come from the cached CSR pattern; only the values
+    // are gathered on every call.
+    template<std::integral OutIndex>
+    void getCsr(std::span<OutIndex> rowBounds, std::span<OutIndex> jCol, std::span<Number> val) const {
+        refreshCsr();
+        std::transform(rowBnd.cbegin(), rowBnd.cend(), rowBounds.begin(), [](std::size_t k) { return static_cast<OutIndex>(k); });
+        std::transform(jCols.cbegin(), jCols.cend(), jCol.begin(), [](Index j) { return static_cast<OutIndex>(j); });
+        std::copy(csrValues.cbegin(), csrValues.cend(), val.begin());
+    }
+
+    // Column major triplets; rows must be strictly ascending within each
+    // column, see assemble otherwise.
+    template<std::integral InIndex>
+    void set(std::span<InIndex> const iRow, std::span<InIndex> const jCol, std::span<Number> const val) {
+        assign(val.size(),
+               [&](std::size_t k) { return iRow[k]; },
+               [&](std::size_t k) { return jCol[k]; },
+               [&](std::size_t k) { return val[k]; });
     }
 
-    template<std::integral Index>
-    void getCsc(std::span<Index> columnBounds, std::span<Index> iRow, std::span<Number> val) const {
-        std::vector<Index> columnProxy(n, 0);
-        
-        for (std::size_t i = 0; i < iOffset.size(); i++) {
-            Index idx = iOffset.at(i);
-            columnProxy.at(idx/m) += 1;
-            iRow[i] = idx % m;
-            val[i] = values.at(i);
+    // Dense columns are converted on the thread pool in pieces of about this
+    // many elements.
+    static constexpr std::size_t denseGrain = std::size_t{1} << 16;
+
+    // From a column major nRows x nCols dense matrix, keeping the elements
+    // with magnitude above dropTolerance (NaN is dropped).  A counting pass
+    // sizes the columns, then they are filled in parallel.
+    void setDense(const Number* data, std::size_t nRows, std::size_t nCols, Number dropTolerance = std::numeric_limits<Number>::epsilon()) {
+        m = nRows;
+        n = nCols;
+        checkDimensions();
+        colBnd.assign(n + 1, 0);
+        const std::size_t grain = std::max<std::size_t>(1, denseGrain / std::max<std::size_t>(m, 1));
+        details::parallel_for(0, n, [&](std::size_t first, std::size_t last) {
+            for (std::size_t j = first; j < last; j++) {
+                const Number* column = data + j * m;
+                std::size_t count = 0;
+                for (std::size_t i = 0; i < m; i++) {
+                    count += std::abs(column[i]) > dropTolerance;
+                }
+                colBnd[j + 1] = count;
+            }
+        }, grain);
+        std::partial_sum(colBnd.begin(), colBnd.end(), colBnd.begin());
+        iRows.resize(colBnd[n]);
+        values.resize(colBnd[n]);
+        details::parallel_for(0, n, [&](std::size_t first, std::size_t last) {
+            for (std::size_t j = first; j < last; j++) {
+                compressColumn(data + j * m, m, dropTolerance, iRows.data() + colBnd[j], values.data() + colBnd[j]);
+            }
+        }, grain);
+        patternChanged();
+    }
+
+    // Triplets are sorted on the thread pool in pieces of at least this many.
+    static constexpr std::size_t assembleGrain = std::size_t{1} << 16;
+
+    // Assembles triplets like MATLAB's sparse(i, j, v, m, n), zero based: in
+    // any order, duplicates summed in the order given, and zeros, given or
+    // summed to, dropped.  A counting sort over pieces of the triplets on the
+    // thread pool orders them by column, then the columns are sorted by row
+    // and reduced in parallel; the scratch memory is O(nnz + n), whatever m.
+    template<std::integral InIndex>
+    void assemble(std::span<const InIndex> iRow, std::span<const InIndex> jCol, std::span<const Number> val) {
+        if (iRow.size() != val.size() || jCol.size() != val.size()) {
+            throw std::invalid_argument("Number of indices and values must agree");
         }
-        std::fill(columnBounds.begin(), columnBounds.end(), 0);
+        checkDimensions();
+        const std::size_t nnz = val.size();
+        details::parallel_for(0, nnz, [&](std::size_t first, std::size_t last) {
+            for (std::size_t k = first; k < last; k++) {
+                if (std::cmp_less(iRow[k], 0) || std::cmp_greater_equal(iRow[k], m) || std::cmp_less(jCol[k], 0) || std::cmp_greater_equal(jCol[k], n)) {
+                    throw std::out_of_range("Sparse index out of range");
+                }
+            }
+        }, assembleGrain);
+
+        iRows.resize(nnz);
+        values.resize(nnz);
+        colBnd = countingSort(nnz, n, [&](std::size_t k) { return static_cast<std::size_t>(jCol[k]); },
+                              [&](std::size_t k, std::size_t position) {
+                                  iRows[position] = static_cast<Index>(iRow[k]);
+                                  values[position] = val[k];
+                              });
+        // Stably, so that duplicates stay in the order given.
+        forEachSliceRange(colBnd, [&](std::size_t first, std::size_t last) {
+            std::vector<std::pair<Index, Number>> column;
+            for (std::size_t j = first; j < last; j++) {
+                const auto begin = iRows.begin() + static_cast<std::ptrdiff_t>(colBnd[j]);
+                const auto end = iRows.begin() + static_cast<std::ptrdiff_t>(colBnd[j + 1]);
+                if (std::is_sorted(begin, end)) {
+                    continue;
+                }
+                column.clear();
+                for (std::size_t k = colBnd[j]; k < colBnd[j + 1]; k++) {
+                    column.emplace_back(iRows[k], values[k]);
+                }
+                std::ranges::stable_sort(column, {}, &std::pair<Index, Number>::first);
+                for (std::size_t k = colBnd[j]; k < colBnd[j + 1]; k++) {
+                    std::tie(iRows[k], values[k]) = column[k - colBnd[j]];
+                }
+            }
+        });
+
+        // Sum the runs of equal rows to the front of every column.
+        std::vector<std::size_t> kept(n);
+        details::parallel_for(0, n, [&](std::size_t first, std::size_t last) {
+            for (std::size_t j = first; j < last; j++) {
+                const std::size_t begin = colBnd[j];
+                std::size_t out = begin;
+                for (std::size_t k = begin; k < colBnd[j + 1]; k++) {
+                    if (out > begin && iRows[out - 1] == iRows[k]) {
+                        values[out - 1] += values[k];
+                        continue;
+                    }
+                    if (out > begin && values[out - 1] == Number{0}) {
+                        out--;
+                    }
+                    iRows[out] = iRows[k];
+                    values[out] = values[k];
+                    out++;
+                }
+                if (out > begin && values[out - 1] == Number{0}) {
+                    out--;
+                }
+                kept[j] = out - begin;
+            }
+        }, std::max<std::size_t>(1, n * assembleGrain / std::max<std::size_t>(nnz, 1)));
 
-        for (Index i = 0; i < static_cast<Index>(n); i++) {
-            columnBounds[i+1] = columnBounds[i] + columnProxy.at(i);
+        // Close the gaps; every column moves towards the front.
+        std::size_t out = 0;
+        for (std::size_t j = 0; j < n; j++) {
+            const std::size_t begin = colBnd[j];
+            if (out != begin) {
+                std::copy_n(iRows.begin() + begin, kept[j], iRows.begin() + out);
+                std::copy_n(values.begin() + begin, kept[j], values.begin() + out);
+            }
+            colBnd[j] = out;
+            out += kept[j];
         }
+        colBnd[n] = out;
+        iRows.resize(out);
+        values.resize(out);
+        patternChanged();
     }
-    
-    // We implicitly assume that the values in the linear index array are monotonically increasing
-    template<std::integral Index>
-    void getCsr(std::span<Index> rowBounds, std::span<Index> jCol, std::span<Number> val) const {
-        std::vector<Index> rowCount(m, 0);
-        for (std::size_t i = 0; i < iOffset.size(); i++) {
-            Index idx = iOffset.at(i);
-            rowCount.at(idx % m) += 1;
-        }
 
-        std::fill(rowBounds.begin(), rowBounds.end(), 0);
-        for (std::size_t iRow = 0; iRow < m; iRow++) {
-            rowBounds[iRow+1] = rowBounds[iRow] + rowCount.at(iRow);
+    // Takes the values of the non-zeros at the strictly increasing linear
+    // indices on the pattern of this, and zeros elsewhere; indices off the
+    // pattern are ignored.  The pattern, and so the CSR mirror, stays as it
+    // is.  The merge of the two patterns is kept and reused for as long as
+    // both stay the same, as in a Newton iteration; with equal patterns the
+    // values are copied straight.
+    void updateValues(std::span<const std::size_t> linearIndices, std::span<const Number> nonZeros) {
+        if (linearIndices.size() != nonZeros.size()) {
+            throw std::invalid_argument("Number of indices and values must agree");
+        }
+        if (!scatterValid || !std::ranges::equal(linearIndices, scatterPattern)) {
+            buildScatter(linearIndices);
+        }
+        valuesChanged();
+        const std::size_t nnz = values.size();
+        if (scatterTo.size() == nnz && nonZeros.size() == nnz) {
+            std::copy(nonZeros.begin(), nonZeros.end(), values.begin());
+            return;
+        }
+        if (scatterTo.size() != nnz) {
+            std::fill(values.begin(), values.end(), Number{0});
         }
+        for (std::size_t k = 0; k < scatterTo.size(); k++) {
+            values[scatterTo[k]] = nonZeros[scatterFrom[k]];
+        }
+    }
+
+    // Products run on the thread pool in pieces of at least this many
+    // non-zeros, each row or column summed in storage order by one thread, so
+    // the results do not depend on the number of threads.
+    static constexpr std::size_t multiplyGrain = std::size_t{1} << 15;
 
-        std::fill(rowCount.begin(), rowCount.end(), 0);
-        for (std::size_t i = 0; i < iOffset.size(); i++) {
-            Index idx = iOffset.at(i);
-            Index iRow = idx % m;
-            jCol[rowBounds[iRow] + rowCount[iRow]] = idx / m;
-            val[rowBounds[iRow] + rowCount[iRow]] = values.at(i);
-            rowCount[iRow] += 1;
+    // y = A*x, row by row over the CSR mirror.
+    void multiply(std::span<const Number> x, std::span<Number> y) const {
+        if (x.size() != n || y.size() != m) {
+            throw std::invalid_argument("Vector sizes do not match the matrix");
         }
+        refreshCsr();
+        forEachSliceRange(rowBnd, [&](std::size_t first, std::size_t last) {
+            for (std::size_t i = first; i < last; i++) {
+                Number sum{0};
+                for (std::size_t k = rowBnd[i]; k < rowBnd[i + 1]; k++) {
+                    sum += csrValues[k] * x[jCols[k]];
+                }
+                y[i] = sum;
+            }
+        });
     }
 
-    template<std::integral Index>
-    void set(std::span<Index> const iRow, std::span<Index> const jCol, std::span<Number> const val) {
-        if (!iOffset.empty())
-            iOffset.clear();
-        if (!values.empty())
-            values.clear();
-        
-        iOffset.resize(val.size());
-        values.resize(val.size());
+    // y = A'*x, column by column.
+    void multiplyTransposed(std::span<const Number> x, std::span<Number> y) const {
+        if (x.size() != m || y.size() != n) {
+            throw std::invalid_argument("Vector sizes do not match the matrix");
+        }
+        forEachSliceRange(colBnd, [&](std::size_t first, std::size_t last) {
+            for (std::size_t j = first; j < last; j++) {
+                Number sum{0};
+                for (std::size_t k = colBnd[j]; k < colBnd[j + 1]; k++) {
+                    sum += values[k] * x[iRows[k]];
+                }
+                y[j] = sum;
+            }
+        });
+    }
 
-        for (std::size_t k = 0; k < val.size(); k++) {
-            iOffset.at(k) = linearIndex(iRow[k], jCol[k]);
-            values.at(k) = val[k];
+    // Y = A*X, row by row over the CSR mirror and for up to eight columns of
+    // X at once, so that each non-zero is read once per eight columns.  Every
+    // column of Y is what multiply gives for the column of X.
+    template <typename AllocatorX, typename AllocatorY>
+    void multiply(const details::BlockData<2, Number, AllocatorX>& X, details::BlockData<2, Number, AllocatorY>& Y) const {
+        if (X.nRows() != n) {
+            throw std::invalid_argument("Inner matrix dimensions must agree");
         }
+        const std::size_t nRhs = X.nCols();
+        if (Y.nRows() != m || Y.nCols() != nRhs) {
+            Y.resize(m, nRhs);
+        }
+        refreshCsr();
+        constexpr std::size_t block = 8;
+        const Number* x = X.data();
+        Number* y = Y.data();
+        forEachSliceRange(rowBnd, [&](std::size_t first, std::size_t last) {
+            for (std::size_t c0 = 0; c0 < nRhs; c0 += block) {
+                const std::size_t nBlock = std::min(block, nRhs - c0);
+                for (std::size_t i = first; i < last; i++) {
+                    Number sum[block]{};
+                    for (std::size_t k = rowBnd[i]; k < rowBnd[i + 1]; k++) {
+                        const Number a = csrValues[k];
+                        const Number* xRow = x + jCols[k] + c0 * n;
+                        for (std::size_t c = 0; c < nBlock; c++) {
+                            sum[c] += a * xRow[c * n];
+                        }
+                    }
+                    for (std::size_t c = 0; c < nBlock; c++) {
+                        y[i + (c0 + c) * m] = sum[c];
+                    }
+                }
+            }
+        });
+    }
+
+    template <typename Allocator>
+    details::BlockData<2, Number> multiply(const details::BlockData<2, Number, Allocator>& X) const {
+        details::BlockData<2, Number> Y(m, X.nCols());
+        multiply(X, Y);
+        return Y;
     }
 
 #if defined(MATLAB_MEX_FILE)
     void set(const matlab::data::SparseArray<Number>& A) {
-        if (!iOffset.empty())
-            iOffset.clear();
-        if (!values.empty())
-            values.clear();
         m = A.getDimensions()[0];
         n = A.getDimensions()[1];
-        iOffset.resize(A.getNumberOfNonZeroElements());
-        values.resize(A.getNumberOfNonZeroElements());
+        checkDimensions();
+        colBnd.assign(n + 1, 0);
+        iRows.clear();
+        values.clear();
+        iRows.reserve(A.getNumberOfNonZeroElements());
+        values.reserve(A.getNumberOfNonZeroElements());
 
-        std::size_t k = 0;
+        // The elements come column major.
         matlab::data::SparseIndex idx;
         for (auto it = A.cbegin(); it != A.cend(); it++) {
             idx = A.getIndex(it);
-            iOffset.at(k) = linearIndex(idx.first, idx.second);
-            values.at(k) = *it;
-            k++;
+            colBnd[idx.second + 1] += 1;
+            iRows.push_back(static_cast<Index>(idx.first));
+            values.push_back(*it);
         }
+        std::partial_sum(colBnd.begin(), colBnd.end(), colBnd.begin());
+        patternChanged();
     }
 
-    void set(const matlab::data::TypedArray<Number>& A) {
-        if (!iOffset.empty())
-            iOffset.clear();
-        if (!values.empty())
-            values.clear();
-        m = A.getDimensions()[0];
-        n = A.getDimensions()[1];
-        
-        for (std::size_t jCol = 0; jCol < n; jCol++) {
-            for (std::size_t iRow = 0; iRow < m; iRow++) {
-                if (std::abs(A[iRow][jCol]) > std::numeric_limits<Number>::epsilon()) {
-                    iOffset.push_back(linearIndex(iRow,jCol));
-                    values.push_back(A[iRow][jCol]);
-                }
-            }
-        }
+    // Reads the buffer of A in place, see setDense.
+    void set(const matlab::data::TypedArray<Number>& A, Number dropTolerance = std::numeric_limits<Number>::epsilon()) {
+        const auto dims = A.getDimensions();
+        setDense(A.getNumberOfElements() > 0 ? &*A.cbegin() : nullptr, dims[0], dims[1], dropTolerance);
     }
 
     void set(const matlab::data::Array& A) {
@@ -170,23 +711,45 @@ public:
         }
     }
 
+    // Takes the values of B on the pattern of this and zeros elsewhere, see
+    // updateValues above.  While B keeps the last pattern its values are
+    // gathered straight into values, without building the linear indices.
     void updateValues(const matlab::data::SparseArray<Number>& B) {
-        std::size_t kA = 0;
-        matlab::data::SparseIndex idx;
-        std::size_t lidxB;
-        for (auto it = B.cbegin(); it != B.cend(); it++) {
-            idx = B.getIndex(it);
-            lidxB = linearIndex(idx.first, idx.second);
-            while (kA < iOffset.size() && lidxB > iOffset.at(kA)) {
-                values.at(kA++) = 0.;
+        if (scatterValid && scatterPattern.size() == B.getNumberOfNonZeroElements()) {
+            valuesChanged();
+            if (scatterTo.size() != values.size()) {
+                std::fill(values.begin(), values.end(), Number{0});
             }
-            if (kA < iOffset.size() && lidxB == iOffset.at(kA)) {
-                values.at(kA++) = *it;
+            // The elements come column major, so the indices increase.  On a
+            // difference the full update below writes every value again.
+            std::size_t k = 0;
+            std::size_t iScatter = 0;
+            auto it = B.cbegin();
+            for (; it != B.cend(); it++, k++) {
+                const matlab::data::SparseIndex idx = B.getIndex(it);
+                if (idx.first + idx.second * m != scatterPattern[k]) {
+                    break;
+                }
+                if (iScatter < scatterFrom.size() && scatterFrom[iScatter] == k) {
+                    values[scatterTo[iScatter++]] = *it;
+                }
+            }
+            if (it == B.cend()) {
+                return;
             }
         }
-        while (kA < iOffset.size()) {
-            values.at(kA++) = 0.;
+        std::vector<std::size_t> linear;
+        std::vector<Number> nonZeros;
+        linear.reserve(B.getNumberOfNonZeroElements());
+        nonZeros.reserve(B.getNumberOfNonZeroElements());
+        // The elements come column major, so the indices increase.
+        matlab::data::SparseIndex idx;
+        for (auto it = B.cbegin(); it != B.cend(); it++) {
+            idx = B.getIndex(it);
+            linear.push_back(idx.first + idx.second * m);
+            nonZeros.push_back(*it);
         }
+        updateValues(std::span<const std::size_t>(linear), std::span<const Number>(nonZeros));
     }
 
     matlab::data::SparseArray<Number> get() const
@@ -199,18 +762,247 @@ public:
         auto rows_p = factory.createBuffer<size_t>(nnz);
         auto cols_p = factory.createBuffer<size_t>(nnz);
 
-        Number *dataPtr = data_p.get();
         iRow(rows_p.get());
         jCol(cols_p.get());
-        std::for_each(values.cbegin(), values.cend(), [&](const Number &e)
-                      { *(dataPtr++) = e; });
-        
+        val(data_p.get());
+
         matlab::data::SparseArray<Number> A = factory.createSparseArray<Number>({m, n}, nnz, std::move(data_p),
                                                                       std::move(rows_p), std::move(cols_p));
         return A;
     }
-#endif // defined(MATLAB_MEX_FILE)    
+#endif // defined(MATLAB_MEX_FILE)
+};
+
+// C = alpha*A + beta*B in two phases.  The constructor is the symbolic phase:
+// it merges the patterns of A and B into that of C, and notes where in C each
+// non-zero of A and B goes.  compute is the numeric phase, to be repeated for
+// new values on the same patterns, which it checks; it runs on the thread pool
+// over the columns of C.  The pattern of C is structural, values that cancel
+// stay as zeros.
+template<std::floating_point Number, std::unsigned_integral Index>
+class SparseSumPlan {
+private:
+    using Matrix = Sparse<Number, Index>;
+
+    std::size_t m{}, n{};
+    // The patterns of A and B.
+    std::vector<std::size_t> aBnd, bBnd;
+    std::vector<Index> aRows, bRows;
+    std::vector<std::size_t> colBnd;
+    std::vector<Index> iRows;
+    // Positions in C of the non-zeros of A and of B.
+    std::vector<std::size_t> aTo, bTo;
+
+    void checkOperands(const Matrix& A, const Matrix& B) const {
+        if (!A.hasPattern(m, n, aBnd, aRows) || !B.hasPattern(m, n, bBnd, bRows)) {
+            throw std::invalid_argument("Operand pattern differs from the plan");
+        }
+    }
+
+public:
+    SparseSumPlan(const Matrix& A, const Matrix& B)
+        : m(A.m), n(A.n), aBnd(A.colBnd), bBnd(B.colBnd), aRows(A.iRows), bRows(B.iRows), colBnd(A.n + 1, 0) {
+        if (B.m != m || B.n != n) {
+            throw std::invalid_argument("Matrix dimensions must agree");
+        }
+        // Merges column j of A and B, calling emit(row, ka, kb) for every row
+        // of C with the positions in A and B, or npos.
+        constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+        auto merge = [&](std::size_t j, auto&& emit) {
+            std::size_t ka = A.colBnd[j];
+            std::size_t kb = B.colBnd[j];
+            while (ka < A.colBnd[j + 1] || kb < B.colBnd[j + 1]) {
+                const bool inA = ka < A.colBnd[j + 1];
+                const bool inB = kb < B.colBnd[j + 1];
+                if (inA && (!inB || A.iRows[ka] < B.iRows[kb])) {
+                    emit(A.iRows[ka], ka, npos);
+                    ka++;
+                } else if (inB && (!inA || B.iRows[kb] < A.iRows[ka])) {
+                    emit(B.iRows[kb], npos, kb);
+                    kb++;
+                } else {
+                    emit(A.iRows[ka], ka, kb);
+                    ka++;
+                    kb++;
+                }
+            }
+        };
+        std::vector<std::size_t> work(n + 1);
+        for (std::size_t j = 0; j < n; j++) {
+            work[j + 1] = A.colBnd[j + 1] - A.colBnd[j] + B.colBnd[j + 1] - B.colBnd[j];
+        }
+        std::partial_sum(work.begin(), work.end(), work.begin());
+        Matrix::forEachSliceRange(work, [&](std::size_t first, std::size_t last) {
+            for (std::size_t j = first; j < last; j++) {
+                merge(j, [&](Index, std::size_t, std::size_t) { colBnd[j + 1] += 1; });
+            }
+        });
+        std::partial_sum(colBnd.begin(), colBnd.end(), colBnd.begin());
+        iRows.resize(colBnd[n]);
+        aTo.resize(A.values.size());
+        bTo.resize(B.values.size());
+        Matrix::forEachSliceRange(work, [&](std::size_t first, std::size_t last) {
+            for (std::size_t j = first; j < last; j++) {
+                std::size_t position = colBnd[j];
+                merge(j, [&](Index row, std::size_t ka, std::size_t kb) {
+                    iRows[position] = row;
+                    if (ka != npos) {
+                        aTo[ka] = position;
+                    }
+                    if (kb != npos) {
+                        bTo[kb] = position;
+                    }
+                    position++;
+                });
+            }
+        });
+    }
+
+    std::size_t getNumberOfNonZeroElements() const { return iRows.size(); }
+
+    // C is given the pattern of the sum unless it has it already.
+    void compute(const Matrix& A, const Matrix& B, Matrix& C, Number alpha = Number{1}, Number beta = Number{1}) const {
+        checkOperands(A, B);
+        if (!C.hasPattern(m, n, colBnd, iRows)) {
+            C.assignPattern(m, n, colBnd, iRows);
+        }
+        Number* c = C.values.data();
+        Matrix::forEachSliceRange(colBnd, [&](std::size_t first, std::size_t last) {
+            std::fill(c + colBnd[first], c + colBnd[last], Number{0});
+            for (std::size_t k = aBnd[first]; k < aBnd[last]; k++) {
+                c[aTo[k]] += alpha * A.values[k];
+            }
+            for (std::size_t k = bBnd[first]; k < bBnd[last]; k++) {
+                c[bTo[k]] += beta * B.values[k];
+            }
+        });
+        C.valuesChanged();
+    }
+
+    Matrix compute(const Matrix& A, const Matrix& B, Number alpha = Number{1}, Number beta = Number{1}) const {
+        Matrix C;
+        compute(A, B, C, alpha, beta);
+        return C;
+    }
+};
+
+// C = A*B in two phases, as SparseSumPlan.  The symbolic phase finds the
+// pattern of every column of C, Gustavson's way, and notes for every product
+// A(i, l)*B(l, j) the position it adds to within column j of C.  The numeric
+// phase walks the same products in the same order.
+template<std::floating_point Number, std::unsigned_integral Index>
+class SparseProductPlan {
+private:
+    using Matrix = Sparse<Number, Index>;
+
+    std::size_t m{}, l{}, n{};
+    // The patterns of A and B.
+    std::vector<std::size_t> aBnd, bBnd;
+    std::vector<Index> aRows, bRows;
+    std::vector<std::size_t> colBnd;
+    std::vector<Index> iRows;
+    // The products of column j are termBnd[j] .. termBnd[j+1]; termTo is the
+    // offset of each in column j of C.
+    std::vector<std::size_t> termBnd;
+    std::vector<Index> termTo;
+
+    void checkOperands(const Matrix& A, const Matrix& B) const {
+        if (!A.hasPattern(m, l, aBnd, aRows) || !B.hasPattern(l, n, bBnd, bRows)) {
+            throw std::invalid_argument("Operand pattern differs from the plan");
+        }
+    }
+
+public:
+    SparseProductPlan(const Matrix& A, const Matrix& B)
+        : m(A.m), l(A.n), n(B.n), aBnd(A.colBnd), bBnd(B.colBnd), aRows(A.iRows), bRows(B.iRows), colBnd(B.n + 1, 0), termBnd(B.n + 1, 0) {
+        if (A.n != B.m) {
+            throw std::invalid_argument("Inner matrix dimensions must agree");
+        }
+        for (std::size_t j = 0; j < n; j++) {
+            for (std::size_t k = B.colBnd[j]; k < B.colBnd[j + 1]; k++) {
+                termBnd[j + 1] += A.colBnd[B.iRows[k] + 1] - A.colBnd[B.iRows[k]];
+            }
+        }
+        std::partial_sum(termBnd.begin(), termBnd.end(), termBnd.begin());
+        // Calls fn(row) for the products of column j in order.
+        auto forEachTerm = [&](std::size_t j, auto&& fn) {
+            for (std::size_t k = B.colBnd[j]; k < B.colBnd[j + 1]; k++) {
+                const std::size_t l = B.iRows[k];
+                for (std::size_t p = A.colBnd[l]; p < A.colBnd[l + 1]; p++) {
+                    fn(A.iRows[p]);
+                }
+            }
+        };
+        constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+        Matrix::forEachSliceRange(termBnd, [&](std::size_t first, std::size_t last) {
+            std::vector<std::size_t> seen(m, npos);
+            for (std::size_t j = first; j < last; j++) {
+                forEachTerm(j, [&](Index i) {
+                    if (seen[i] != j) {
+                        seen[i] = j;
+                        colBnd[j + 1] += 1;
+                    }
+                });
+            }
+        });
+        std::partial_sum(colBnd.begin(), colBnd.end(), colBnd.begin());
+        iRows.resize(colBnd[n]);
+        termTo.resize(termBnd[n]);
+        Matrix::forEachSliceRange(termBnd, [&](std::size_t first, std::size_t last) {
+            // offset[i] is the offset of row i in the current column of C.
+            std::vector<std::size_t> seen(m, npos);
+            std::vector<Index> offset(m);
+            for (std::size_t j = first; j < last; j++) {
+                Index* rows = iRows.data() + colBnd[j];
+                std::size_t count = 0;
+                forEachTerm(j, [&](Index i) {
+                    if (seen[i] != j) {
+                        seen[i] = j;
+                        rows[count++] = i;
+                    }
+                });
+                std::sort(rows, rows + count);
+                for (std::size_t r = 0; r < count; r++) {
+                    offset[rows[r]] = static_cast<Index>(r);
+                }
+                std::size_t t = termBnd[j];
+                forEachTerm(j, [&](Index i) { termTo[t++] = offset[i]; });
+            }
+        });
+    }
+
+    std::size_t getNumberOfNonZeroElements() const { return iRows.size(); }
+
+    // C is given the pattern of the product unless it has it already.
+    void compute(const Matrix& A, const Matrix& B, Matrix& C) const {
+        checkOperands(A, B);
+        if (!C.hasPattern(m, n, colBnd, iRows)) {
+            C.assignPattern(m, n, colBnd, iRows);
+        }
+        Number* c = C.values.data();
+        Matrix::forEachSliceRange(termBnd, [&](std::size_t first, std::size_t last) {
+            for (std::size_t j = first; j < last; j++) {
+                Number* column = c + colBnd[j];
+                std::fill(column, c + colBnd[j + 1], Number{0});
+                std::size_t t = termBnd[j];
+                for (std::size_t k = B.colBnd[j]; k < B.colBnd[j + 1]; k++) {
+                    const Number b = B.values[k];
+                    const std::size_t l = B.iRows[k];
+                    for (std::size_t p = A.colBnd[l]; p < A.colBnd[l + 1]; p++) {
+                        column[termTo[t++]] += A.values[p] * b;
+                    }
+                }
+            }
+        });
+        C.valuesChanged();
+    }
+
+    Matrix compute(const Matrix& A, const Matrix& B) const {
+        Matrix C;
+        compute(A, B, C);
+        return C;
+    }
 };
 
 } // namespace utilities
-#endif // UTILITIES_SPARSE_HPP
\ No newline at end of file
+#endif // UTILITIES_SPARSE_HPP